@@ -23,11 +23,16 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
 typedef void (*cmd_action)(CHEAX *c, const char *cmd);
 typedef void (*stdin_action)(CHEAX *c);
 typedef void (*path_action)(CHEAX *c, const char *path);
 
 #define MAX_INPUT_FILES 16
+#define MAX_MODULES     16
 #define TERM_WIDTH      80
 #define HELP_MARGIN     24
 
@@ -39,10 +44,22 @@ static struct chx_config_help *cfg_help;
 static size_t num_input_files = 0;
 static const char *input_files[MAX_INPUT_FILES];
 
+/* -l MODULE */
+static size_t num_modules = 0;
+static const char *modules[MAX_MODULES];
+
 /* -c CMD */
 static const char *cmd = NULL;
 
-static bool read_stdin = false, use_prelude = true, preproc_only = false;
+/* -o FILE */
+static const char *output_path = NULL;
+
+static bool read_stdin = false, use_prelude = true, preproc_only = false, emit_c = false;
+
+/* --profile MODE, --profile-stacks FILE */
+static int profile_mode = -1;
+static const char *profile_stacks = NULL;
+static bool profiling = false;
 
 static CHEAX *c;
 static const char *progname;
@@ -122,7 +139,19 @@ print_usage(void)
 		{ "c",       "CMD", "Read and evaluate command CMD."                },
 		{ "E",       NULL,  "Preprocess only, don't evaluate expressions. "
 		                    "Output written to stdout."                     },
+		{ "l",    "MODULE", "Load module MODULE, compiled from the output "
+		                    "of --emit-c, before running any input."        },
+		{ "o",      "FILE", "Write output of --emit-c to FILE instead of "
+		                    "stdout."                                       },
 		{ "p",       NULL,  "Don't load prelude."                           },
+		{ "emit-c",  NULL,  "Translate the input file to a C module that "
+		                    "registers its definitions when loaded."        },
+		{ "profile", "MODE", "Profile the program, and write a report to "
+		                    "stderr upon exit. MODE is `calls' to time "
+		                    "every call, or `sample' to sample the call "
+		                    "stack."                                        },
+		{ "profile-stacks", "FILE", "Write collapsed call stacks of "
+		                    "--profile to FILE, for flame graph tools."     },
 		{ "help",    NULL,  "Show this message"                             },
 		{ "version", NULL,  "Show cheax version information."               },
 	};
@@ -208,6 +237,32 @@ set_config(struct chx_config_help *ch, const char *value)
 	return 0;
 }
 
+/*
+ * Match `--NAME VALUE' or `--NAME=VALUE'. Returns 1 and sets *value if
+ * arg matches, 0 if it doesn't, or -1 if the value is missing.
+ */
+static int
+match_valued_option(const char *arg, const char *name, const char **value,
+                    int *arg_idx, int argc, char **argv)
+{
+	size_t len = strlen(name);
+	if (0 != strncmp(arg + 2, name, len) || (arg[2 + len] != '\0' && arg[2 + len] != '='))
+		return 0;
+
+	if (arg[2 + len] == '=') {
+		*value = arg + 3 + len;
+		return 1;
+	}
+
+	if (*arg_idx + 1 >= argc) {
+		fprintf(stderr, "expected value after `%s'\n", arg);
+		return -1;
+	}
+
+	*value = argv[++*arg_idx];
+	return 1;
+}
+
 static int
 handle_string_option(const char *arg, int *arg_idx, int argc, char **argv)
 {
@@ -221,6 +276,32 @@ handle_string_option(const char *arg, int *arg_idx, int argc, char **argv)
 		exit(0);
 	}
 
+	if (0 == strcmp(arg, "--emit-c")) {
+		emit_c = true;
+		return 0;
+	}
+
+	const char *opt_value;
+	int match = match_valued_option(arg, "profile", &opt_value, arg_idx, argc, argv);
+	if (match != 0) {
+		if (match < 0)
+			return -1;
+
+		if (0 == strcmp(opt_value, "calls")) {
+			profile_mode = CHEAX_PROFILE_CALLS;
+		} else if (0 == strcmp(opt_value, "sample")) {
+			profile_mode = CHEAX_PROFILE_SAMPLE;
+		} else {
+			fprintf(stderr, "unknown profiling mode `%s'\n", opt_value);
+			return -1;
+		}
+		return 0;
+	}
+
+	match = match_valued_option(arg, "profile-stacks", &profile_stacks, arg_idx, argc, argv);
+	if (match != 0)
+		return (match < 0) ? -1 : 0;
+
 	/* try to read cheax_config() option */
 	size_t opt_len;
 	const char *config_opt, *eq, *value;
@@ -268,6 +349,26 @@ handle_option(char opt, int *arg_idx, int argc, char **argv)
 	case 'E':
 		preproc_only = true;
 		break;
+	case 'l':
+		if (*arg_idx + 1 >= argc) {
+			fprintf(stderr, "expected module after `-l'\n");
+			return -1;
+		}
+		if (num_modules >= MAX_MODULES) {
+			fprintf(stderr, "maximum number of modules is %d\n", MAX_MODULES);
+			return -1;
+		}
+
+		modules[num_modules++] = argv[++*arg_idx];
+		break;
+	case 'o':
+		if (*arg_idx + 1 >= argc) {
+			fprintf(stderr, "expected file after `-o'\n");
+			return -1;
+		}
+
+		output_path = argv[++*arg_idx];
+		break;
 	case 'p':
 		use_prelude = false;
 		break;
@@ -320,6 +421,16 @@ handle_args(int argc, char **argv)
 		return -1;
 	}
 
+	if (emit_c && (cmd != NULL || read_stdin || num_input_files != 1)) {
+		fputs("--emit-c requires exactly one input file\n", stderr);
+		return -1;
+	}
+
+	if (output_path != NULL && !emit_c) {
+		fputs("-o can only be used with --emit-c\n", stderr);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -417,9 +528,75 @@ pad:
 	return;
 }
 
+static int
+emit_path(CHEAX *c, const char *path)
+{
+	FILE *out = stdout;
+	if (output_path != NULL && (out = fopen(output_path, "w")) == NULL) {
+		perror(output_path);
+		return -1;
+	}
+
+	int res = cheax_emit_c(c, path, out);
+
+	if (out != stdout && fclose(out) != 0) {
+		perror(output_path);
+		return -1;
+	}
+
+	if (res < 0 && output_path != NULL)
+		remove(output_path);
+	return res;
+}
+
+static int
+load_module(CHEAX *c, const char *path)
+{
+#ifdef HAVE_DLFCN_H
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		fprintf(stderr, "%s\n", dlerror());
+		return -1;
+	}
+
+	/* ISO C doesn't allow casting void * to a function pointer */
+	int (*init)(CHEAX *);
+	void *sym = dlsym(handle, "cheax_module_init");
+	if (sym == NULL) {
+		fprintf(stderr, "%s: not a cheax module\n", path);
+		dlclose(handle);
+		return -1;
+	}
+	memcpy(&init, &sym, sizeof(init));
+
+	return init(c);
+#else
+	fprintf(stderr, "%s: loading modules is not supported on this platform\n", path);
+	return -1;
+#endif
+}
+
+static void
+stop_profiling(void)
+{
+	FILE *stacks = NULL;
+	if (profile_stacks != NULL && (stacks = fopen(profile_stacks, "w")) == NULL)
+		fprintf(stderr, "%s: failed to open `%s'\n", progname, profile_stacks);
+
+	/* the program may have stopped the profiler itself */
+	if (cheax_profile_stop(c, stderr, stacks) < 0)
+		cheax_clear_errno(c);
+
+	if (stacks != NULL)
+		fclose(stacks);
+}
+
 static void
 cleanup(void)
 {
+	if (profiling)
+		stop_profiling();
+
 	cheax_destroy(c);
 	free(cfg_help);
 }
@@ -443,6 +620,31 @@ main(int argc, char **argv)
 	if (use_prelude && cheax_load_prelude(c) < 0)
 		goto pad;
 
+	for (size_t i = 0; i < num_modules; ++i) {
+		errstr = modules[i];
+		if (load_module(c, modules[i]) < 0) {
+			if (cheax_errno(c) != 0)
+				goto pad;
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (emit_c) {
+		errstr = input_files[0];
+		if (emit_path(c, input_files[0]) < 0) {
+			if (cheax_errno(c) != 0)
+				goto pad;
+			return EXIT_FAILURE;
+		}
+		return 0;
+	}
+
+	if (profile_mode >= 0 && !preproc_only) {
+		if (cheax_profile_start(c, profile_mode) < 0)
+			goto pad;
+		profiling = true;
+	}
+
 	cmd_action cmd_act = exec_cmd;
 	stdin_action stdin_act = exec_stdin;
 	path_action path_act = exec_path;
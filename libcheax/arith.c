@@ -17,6 +17,7 @@
 
 #include "core.h"
 #include "err.h"
+#include "sym.h"
 #include "unpack.h"
 
 typedef uint_least64_t chx_uint;
@@ -108,22 +109,20 @@ fop_sub(CHEAX *c, chx_double a, chx_double b)
 static chx_int
 iop_mul(CHEAX *c, chx_int a, chx_int b)
 {
-	if (((a == -1) && (b == CHX_INT_MIN))
-	 || ((b == -1) && (a == CHX_INT_MIN)))
-	{
+	/* checked before multiplying, since signed overflow is undefined */
+	bool overflow;
+	if (a > 0)
+		overflow = (b > 0) ? a > CHX_INT_MAX / b : b < CHX_INT_MIN / a;
+	else if (a < 0)
+		overflow = (b > 0) ? a < CHX_INT_MIN / b : b != 0 && b < CHX_INT_MAX / a;
+	else
+		overflow = false;
+
+	if (overflow) {
 		cheax_throwf(c, CHEAX_EOVERFLOW, "multiplication overflow");
 		return 0;
 	}
 
-	if (a != 0 && b != 0) {
-		/* TODO this relies on non-standard behaviour! */
-		chx_int x = a * b;
-		if (a != x / b) {
-			cheax_throwf(c, CHEAX_EOVERFLOW, "multiplication overflow");
-			return 0;
-		}
-	}
-
 	return a * b;
 }
 static chx_double
@@ -382,27 +381,27 @@ bltn_ge(CHEAX *c, struct chx_list *args, void *info)
 void
 cheax_export_arith_bltns_(CHEAX *c)
 {
-	cheax_defun(c, "+", bltn_add, NULL);
-	cheax_defun(c, "-", bltn_sub, NULL);
-	cheax_defun(c, "*", bltn_mul, NULL);
-	cheax_defun(c, "/", bltn_div, NULL);
-	cheax_defun(c, "%", bltn_mod, NULL);
-
-	cheax_defun(c, "bit-and", bltn_bit_and, NULL);
-	cheax_defun(c, "bit-or",  bltn_bit_or,  NULL);
-	cheax_defun(c, "bit-xor", bltn_bit_xor, NULL);
-	cheax_defun(c, "bit-not", bltn_bit_not, NULL);
-	cheax_defun(c, "bit-shl", bltn_bit_shl, NULL);
-	cheax_defun(c, "bit-shr", bltn_bit_shr, NULL);
-	cheax_defun(c, "bit-sal", bltn_bit_sal, NULL);
-	cheax_defun(c, "bit-sar", bltn_bit_sar, NULL);
-	cheax_defun(c, "bit-rol", bltn_bit_rol, NULL);
-	cheax_defun(c, "bit-ror", bltn_bit_ror, NULL);
-
-	cheax_defun(c, "<",  bltn_lt, NULL);
-	cheax_defun(c, "<=", bltn_le, NULL);
-	cheax_defun(c, ">",  bltn_gt, NULL);
-	cheax_defun(c, ">=", bltn_ge, NULL);
+	cheax_defun_pure_(c, "+", bltn_add, NULL);
+	cheax_defun_pure_(c, "-", bltn_sub, NULL);
+	cheax_defun_pure_(c, "*", bltn_mul, NULL);
+	cheax_defun_pure_(c, "/", bltn_div, NULL);
+	cheax_defun_pure_(c, "%", bltn_mod, NULL);
+
+	cheax_defun_pure_(c, "bit-and", bltn_bit_and, NULL);
+	cheax_defun_pure_(c, "bit-or",  bltn_bit_or,  NULL);
+	cheax_defun_pure_(c, "bit-xor", bltn_bit_xor, NULL);
+	cheax_defun_pure_(c, "bit-not", bltn_bit_not, NULL);
+	cheax_defun_pure_(c, "bit-shl", bltn_bit_shl, NULL);
+	cheax_defun_pure_(c, "bit-shr", bltn_bit_shr, NULL);
+	cheax_defun_pure_(c, "bit-sal", bltn_bit_sal, NULL);
+	cheax_defun_pure_(c, "bit-sar", bltn_bit_sar, NULL);
+	cheax_defun_pure_(c, "bit-rol", bltn_bit_rol, NULL);
+	cheax_defun_pure_(c, "bit-ror", bltn_bit_ror, NULL);
+
+	cheax_defun_pure_(c, "<",  bltn_lt, NULL);
+	cheax_defun_pure_(c, "<=", bltn_le, NULL);
+	cheax_defun_pure_(c, ">",  bltn_gt, NULL);
+	cheax_defun_pure_(c, ">=", bltn_ge, NULL);
 
 	cheax_def(c, "int-max", cheax_int(CHX_INT_MAX), CHEAX_READONLY);
 	cheax_def(c, "int-min", cheax_int(CHX_INT_MIN), CHEAX_READONLY);
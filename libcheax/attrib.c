@@ -17,6 +17,9 @@
 #include <string.h>
 
 #include "attrib.h"
+#include "bkquote.h"
+#include "case.h"
+#include "closure.h"
 #include "core.h"
 #include "htab.h"
 #include "types.h"
@@ -48,13 +51,60 @@ cheax_attrib_init_(CHEAX *c)
 	}
 
 	c->attribs[ATTRIB_LOC].size = sizeof(struct attrib);
+	c->attribs[ATTRIB_TYPE_CHECK].size = sizeof(struct attrib);
+}
+
+static void
+attrib_free(CHEAX *c, struct attrib *attr, enum attrib_kind kind)
+{
+	switch (kind) {
+	case ATTRIB_CASE_TREE:
+		cheax_case_free_(c, attr->case_tree);
+		break;
+	case ATTRIB_BKQUOTE_PLAN:
+		cheax_bkquote_plan_free_(c, attr->bkquote_plan);
+		break;
+	case ATTRIB_CLOSURE_INFO:
+		cheax_closure_info_free_(c, attr->closure_info);
+		break;
+	default:
+		break;
+	}
+
+	cheax_free(c, attr);
+}
+
+static void
+attrib_free_case_tree(struct htab_entry *entry, void *data)
+{
+	attrib_free(data, container_of(entry, struct attrib, entry), ATTRIB_CASE_TREE);
+}
+
+static void
+attrib_free_bkquote_plan(struct htab_entry *entry, void *data)
+{
+	attrib_free(data, container_of(entry, struct attrib, entry), ATTRIB_BKQUOTE_PLAN);
+}
+
+static void
+attrib_free_closure_info(struct htab_entry *entry, void *data)
+{
+	attrib_free(data, container_of(entry, struct attrib, entry), ATTRIB_CLOSURE_INFO);
 }
 
 void
 cheax_attrib_cleanup_(CHEAX *c)
 {
-	for (int i = ATTRIB_FIRST; i <= ATTRIB_LAST; ++i)
-		cheax_htab_cleanup_(&c->attribs[i].table, NULL, NULL);
+	for (int i = ATTRIB_FIRST; i <= ATTRIB_LAST; ++i) {
+		htab_item_func del = NULL;
+		if (i == ATTRIB_CASE_TREE)
+			del = attrib_free_case_tree;
+		else if (i == ATTRIB_BKQUOTE_PLAN)
+			del = attrib_free_bkquote_plan;
+		else if (i == ATTRIB_CLOSURE_INFO)
+			del = attrib_free_closure_info;
+		cheax_htab_cleanup_(&c->attribs[i].table, del, c);
+	}
 }
 
 struct attrib *
@@ -97,6 +147,9 @@ cheax_attrib_remove_(CHEAX *c, void *key, enum attrib_kind kind)
 	cheax_htab_remove_(&c->attribs[kind].table, search);
 
 	*(unsigned *)key = rtflags & ~ATTRIB_BIT(kind);
+
+	if (search.item != NULL)
+		attrib_free(c, container_of(search.item, struct attrib, entry), kind);
 }
 
 void
@@ -129,3 +182,27 @@ cheax_attrib_copy_(CHEAX *c, void *dst_key, void *src_key, enum attrib_kind kind
 	memcpy(&dst_attr->doc, &src_attr->doc, content_size);
 	return dst_attr;
 }
+
+void
+cheax_set_loc(CHEAX *c, struct chx_list *lst, const char *path, int line, int pos)
+{
+	ASSERT_NOT_NULL_VOID("set_loc", lst);
+
+	struct attrib *attr = cheax_attrib_get_(c, lst, ATTRIB_LOC);
+	if (attr == NULL)
+		attr = cheax_attrib_add_(c, lst, ATTRIB_LOC);
+	if (attr != NULL)
+		attr->loc = (struct attrib_loc){ path, pos, line };
+}
+
+void
+cheax_set_doc(CHEAX *c, struct chx_list *lst, struct chx_string *doc)
+{
+	ASSERT_NOT_NULL_VOID("set_doc", lst);
+
+	struct attrib *attr = cheax_attrib_get_(c, lst, ATTRIB_DOC);
+	if (attr == NULL)
+		attr = cheax_attrib_add_(c, lst, ATTRIB_DOC);
+	if (attr != NULL)
+		attr->doc = doc;
+}
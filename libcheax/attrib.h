@@ -17,6 +17,7 @@
 #define ATTRIB_H
 
 #include <cheax.h>
+#include <stdint.h>
 
 #include "htab.h"
 
@@ -24,9 +25,13 @@ enum attrib_kind {
 	ATTRIB_ORIG_FORM,
 	ATTRIB_LOC,
 	ATTRIB_DOC,
+	ATTRIB_CASE_TREE,
+	ATTRIB_BKQUOTE_PLAN,
+	ATTRIB_TYPE_CHECK,
+	ATTRIB_CLOSURE_INFO,
 
 	ATTRIB_FIRST = ATTRIB_ORIG_FORM,
-	ATTRIB_LAST  = ATTRIB_DOC,
+	ATTRIB_LAST  = ATTRIB_CLOSURE_INFO,
 };
 
 struct attrib_loc {
@@ -34,6 +39,16 @@ struct attrib_loc {
 	int pos, line;
 };
 
+#define TYPE_CHECK_MAX_USER 3
+
+/* Types accepted by (check-type), resolved on first use */
+struct attrib_type_check {
+	uint32_t basic;   /* bit (1 << t) set for accepted basic type t */
+	bool dynamic;     /* some types are only known after evaluation */
+	uint8_t num_user;
+	int user[TYPE_CHECK_MAX_USER];
+};
+
 struct attrib {
 	struct htab_entry entry;
 	void *key;
@@ -41,6 +56,10 @@ struct attrib {
 		struct chx_string *doc;
 		struct chx_list *orig_form;
 		struct attrib_loc loc;
+		struct case_tree *case_tree;
+		struct bkquote_plan *bkquote_plan;
+		struct attrib_type_check type_check;
+		struct closure_info *closure_info;
 	};
 };
 
@@ -0,0 +1,430 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "attrib.h"
+#include "bkquote.h"
+#include "core.h"
+#include "err.h"
+#include "types.h"
+
+/*
+ * A construction plan mirrors the template, except that any subtree
+ * without commas collapses into a single PLAN_CONST node, whose value
+ * is shared between all expansions instead of being rebuilt.
+ *
+ * Plans only point into the template, which is kept alive by the
+ * backquote the plan is attached to (see ATTRIB_BKQUOTE_PLAN).
+ */
+
+enum {
+	PLAN_CONST,  /* value: shared part of template */
+	PLAN_COMMA,  /* value: expression to evaluate */
+	PLAN_SPLICE, /* value: expression to evaluate and splice */
+	PLAN_LIST,   /* value: template list; elems: one per element */
+	PLAN_WRAP,   /* wrap_type: kind of quote; elems: one for quoted value */
+};
+
+struct bkquote_plan {
+	int kind, wrap_type;
+	struct chx_value value;
+	struct bkquote_plan *elems;
+	size_t num_elems;
+};
+
+enum {
+	BKQ_ERROR = -1,
+	BKQ_VALUE,
+	BKQ_SPLICED,
+};
+
+static void
+plan_cleanup(CHEAX *c, struct bkquote_plan *plan)
+{
+	for (size_t i = 0; i < plan->num_elems; ++i)
+		plan_cleanup(c, &plan->elems[i]);
+	cheax_free(c, plan->elems);
+	plan->elems = NULL;
+	plan->num_elems = 0;
+}
+
+void
+cheax_bkquote_plan_free_(CHEAX *c, struct bkquote_plan *plan)
+{
+	if (plan != NULL) {
+		plan_cleanup(c, plan);
+		cheax_free(c, plan);
+	}
+}
+
+static void compile(CHEAX *c, struct bkquote_plan *plan, struct chx_value tmpl, int nest);
+
+static void
+compile_wrap(CHEAX *c, struct bkquote_plan *plan, struct chx_value tmpl, int nest)
+{
+	plan->elems = cheax_calloc(c, 1, sizeof(struct bkquote_plan));
+	cheax_ft(c, pad);
+	plan->num_elems = 1;
+
+	compile(c, &plan->elems[0], tmpl.data.as_quote->value, nest);
+	cheax_ft(c, pad);
+
+	if (plan->elems[0].kind != PLAN_CONST) {
+		plan->kind = PLAN_WRAP;
+		plan->wrap_type = tmpl.type;
+		return;
+	}
+pad:
+	plan_cleanup(c, plan);
+}
+
+static void
+compile_list(CHEAX *c, struct bkquote_plan *plan, struct chx_list *tmpl, int nest)
+{
+	size_t len = 0;
+	for (struct chx_list *lst = tmpl; lst != NULL; lst = lst->next)
+		++len;
+
+	plan->elems = cheax_calloc(c, len, sizeof(struct bkquote_plan));
+	cheax_ft(c, pad);
+	plan->num_elems = len;
+
+	bool all_const = true;
+	size_t i = 0;
+	for (struct chx_list *lst = tmpl; lst != NULL; lst = lst->next, ++i) {
+		compile(c, &plan->elems[i], lst->value, nest);
+		cheax_ft(c, pad);
+		all_const = all_const && plan->elems[i].kind == PLAN_CONST;
+	}
+
+	if (!all_const) {
+		plan->kind = PLAN_LIST;
+		return;
+	}
+pad:
+	plan_cleanup(c, plan);
+}
+
+static void
+compile(CHEAX *c, struct bkquote_plan *plan, struct chx_value tmpl, int nest)
+{
+	plan->kind = PLAN_CONST;
+	plan->value = tmpl;
+	plan->elems = NULL;
+	plan->num_elems = 0;
+
+	switch (tmpl.type) {
+	case CHEAX_LIST:
+		if (tmpl.data.as_list != NULL)
+			compile_list(c, plan, tmpl.data.as_list, nest);
+		break;
+
+	case CHEAX_BACKQUOTE:
+		compile_wrap(c, plan, tmpl, nest + 1);
+		break;
+	case CHEAX_QUOTE:
+		compile_wrap(c, plan, tmpl, nest);
+		break;
+
+	case CHEAX_COMMA:
+	case CHEAX_SPLICE:
+		if (nest > 0) {
+			compile_wrap(c, plan, tmpl, nest - 1);
+		} else {
+			plan->kind = (tmpl.type == CHEAX_COMMA) ? PLAN_COMMA : PLAN_SPLICE;
+			plan->value = tmpl.data.as_quote->value;
+		}
+		break;
+	}
+}
+
+static struct bkquote_plan *
+get_plan(CHEAX *c, struct chx_quote *bkquote)
+{
+	struct attrib *attr = cheax_attrib_get_(c, bkquote, ATTRIB_BKQUOTE_PLAN);
+	if (attr != NULL)
+		return attr->bkquote_plan;
+
+	struct bkquote_plan *plan = cheax_malloc(c, sizeof(struct bkquote_plan));
+	cheax_ft(c, pad);
+
+	compile(c, plan, bkquote->value, 0);
+	cheax_ft(c, pad2);
+
+	attr = cheax_attrib_add_(c, bkquote, ATTRIB_BKQUOTE_PLAN);
+	cheax_ft(c, pad2);
+
+	attr->bkquote_plan = plan;
+	return plan;
+pad2:
+	cheax_bkquote_plan_free_(c, plan);
+pad:
+	return NULL;
+}
+
+/*
+ * Preprocessing
+ */
+
+static struct chx_value pp_tmpl(CHEAX *c, struct chx_value tmpl, int nest);
+
+static struct chx_list *
+pp_tmpl_list(CHEAX *c, struct chx_list *tmpl, int nest)
+{
+	if (tmpl == NULL)
+		return NULL;
+
+	struct chx_value value = pp_tmpl(c, tmpl->value, nest);
+	cheax_ft(c, pad);
+	struct chx_list *next = pp_tmpl_list(c, tmpl->next, nest);
+	cheax_ft(c, pad);
+
+	if (cheax_equiv(value, tmpl->value) && next == tmpl->next)
+		return tmpl;
+
+	struct chx_list *res = cheax_list(c, value, next).data.as_list;
+	cheax_ft(c, pad);
+	if (c->gen_debug_info)
+		cheax_set_orig_form_(c, res, tmpl);
+	return res;
+pad:
+	return tmpl;
+}
+
+static struct chx_value
+pp_tmpl(CHEAX *c, struct chx_value tmpl, int nest)
+{
+	struct chx_value inner;
+
+	switch (tmpl.type) {
+	case CHEAX_LIST:
+		return cheax_list_value(pp_tmpl_list(c, tmpl.data.as_list, nest));
+
+	case CHEAX_BACKQUOTE:
+		inner = pp_tmpl(c, tmpl.data.as_quote->value, nest + 1);
+		break;
+	case CHEAX_QUOTE:
+		inner = pp_tmpl(c, tmpl.data.as_quote->value, nest);
+		break;
+	case CHEAX_COMMA:
+	case CHEAX_SPLICE:
+		inner = (nest > 0)
+		      ? pp_tmpl(c, tmpl.data.as_quote->value, nest - 1)
+		      : cheax_preproc(c, tmpl.data.as_quote->value);
+		break;
+
+	default:
+		return tmpl;
+	}
+
+	cheax_ft(c, pad);
+	if (cheax_equiv(inner, tmpl.data.as_quote->value))
+		return tmpl;
+
+	switch (tmpl.type) {
+	case CHEAX_BACKQUOTE: return cheax_backquote(c, inner);
+	case CHEAX_QUOTE:     return cheax_quote(c, inner);
+	case CHEAX_COMMA:     return cheax_comma(c, inner);
+	default:              return cheax_splice(c, inner);
+	}
+pad:
+	return tmpl;
+}
+
+struct chx_value
+cheax_preproc_bkquote_(CHEAX *c, struct chx_value bkquote)
+{
+	if (bkquote.type != CHEAX_BACKQUOTE || has_flag(bkquote.data.as_quote->rtflags, PREPROC_BIT))
+		return bkquote;
+
+	struct chx_value tmpl = pp_tmpl(c, bkquote.data.as_quote->value, 0);
+	cheax_ft(c, pad);
+
+	struct chx_value res = cheax_equiv(tmpl, bkquote.data.as_quote->value)
+	                     ? bkquote
+	                     : cheax_backquote(c, tmpl);
+	cheax_ft(c, pad);
+
+	/* compile plan ahead of time */
+	get_plan(c, res.data.as_quote);
+	cheax_ft(c, pad);
+
+	res.data.as_quote->rtflags |= PREPROC_BIT;
+	return res;
+pad:
+	return CHEAX_NIL;
+}
+
+/*
+ * Expansion
+ */
+
+static struct chx_value
+wrap(CHEAX *c, int type, struct chx_value value)
+{
+	switch (type) {
+	case CHEAX_BACKQUOTE: return cheax_backquote(c, value);
+	case CHEAX_QUOTE:     return cheax_quote(c, value);
+	case CHEAX_COMMA:     return cheax_comma(c, value);
+	default:              return cheax_splice(c, value);
+	}
+}
+
+static int run(CHEAX *c, struct bkquote_plan *plan, struct chx_value *value, struct chx_list **spliced);
+
+static int
+run_list(CHEAX *c, struct bkquote_plan *plan, struct chx_value *value)
+{
+	struct chx_list *res = NULL, **tail = &res;
+	chx_ref res_ref = 0;
+	bool fresh_head = false, reffed = false;
+
+	for (size_t i = 0; i < plan->num_elems; ++i) {
+		struct chx_value elem;
+		struct chx_list *spl;
+		int code = run(c, &plan->elems[i], &elem, &spl);
+
+		switch (code) {
+		case BKQ_VALUE:
+			*tail = cheax_list(c, elem, NULL).data.as_list;
+			cheax_ft(c, pad);
+			fresh_head = fresh_head || tail == &res;
+			tail = &(*tail)->next;
+			break;
+
+		case BKQ_SPLICED:
+			if (i + 1 == plan->num_elems) {
+				/* no need to copy last splice */
+				*tail = spl;
+				break;
+			}
+
+			for (; spl != NULL; spl = spl->next) {
+				*tail = cheax_list(c, spl->value, NULL).data.as_list;
+				cheax_ft(c, pad);
+				fresh_head = fresh_head || tail == &res;
+				tail = &(*tail)->next;
+			}
+			break;
+
+		default:
+			goto pad;
+		}
+
+		/* keep partial result alive while evaluating further
+		 * elements */
+		if (!reffed && res != NULL) {
+			res_ref = cheax_ref_ptr(c, res);
+			reffed = true;
+		}
+	}
+
+	if (fresh_head && c->gen_debug_info)
+		cheax_set_orig_form_(c, res, plan->value.data.as_list);
+
+	*value = cheax_list_value(res);
+pad:
+	if (reffed)
+		cheax_unref_ptr(c, res, res_ref);
+	return (cheax_errno(c) == 0) ? BKQ_VALUE : BKQ_ERROR;
+}
+
+static int
+run_wrap(CHEAX *c, struct bkquote_plan *plan, struct chx_value *value, struct chx_list **spliced)
+{
+	struct chx_value inner;
+	struct chx_list *spl;
+
+	switch (run(c, &plan->elems[0], &inner, &spl)) {
+	case BKQ_VALUE:
+		*value = wrap(c, plan->wrap_type, inner);
+		cheax_ft(c, pad);
+		return BKQ_VALUE;
+
+	case BKQ_SPLICED:
+		if (plan->wrap_type == CHEAX_QUOTE || plan->wrap_type == CHEAX_BACKQUOTE) {
+			cheax_throwf(c,
+			             CHEAX_EEVAL,
+			             "%s expects one argument",
+			             (plan->wrap_type == CHEAX_BACKQUOTE) ? "backquote" : "quote");
+			return BKQ_ERROR;
+		}
+
+		struct chx_list *res = NULL, **tail = &res;
+		for (; spl != NULL; spl = spl->next) {
+			struct chx_value w = wrap(c, plan->wrap_type, spl->value);
+			cheax_ft(c, pad);
+			*tail = cheax_list(c, w, NULL).data.as_list;
+			cheax_ft(c, pad);
+			tail = &(*tail)->next;
+		}
+
+		*spliced = res;
+		return BKQ_SPLICED;
+	}
+pad:
+	return BKQ_ERROR;
+}
+
+static int
+run(CHEAX *c, struct bkquote_plan *plan, struct chx_value *value, struct chx_list **spliced)
+{
+	struct chx_value evald;
+
+	switch (plan->kind) {
+	case PLAN_CONST:
+		*value = plan->value;
+		return BKQ_VALUE;
+
+	case PLAN_COMMA:
+		*value = cheax_eval(c, plan->value);
+		cheax_ft(c, pad);
+		return BKQ_VALUE;
+
+	case PLAN_SPLICE:
+		evald = cheax_eval(c, plan->value);
+		cheax_ft(c, pad);
+
+		if (!cheax_is_nil(evald) && evald.type != CHEAX_LIST) {
+			cheax_throwf(c, CHEAX_EEVAL, "expected list after ,@");
+			return BKQ_ERROR;
+		}
+
+		*spliced = evald.data.as_list;
+		return BKQ_SPLICED;
+
+	case PLAN_LIST:
+		return run_list(c, plan, value);
+
+	case PLAN_WRAP:
+		return run_wrap(c, plan, value, spliced);
+	}
+pad:
+	return BKQ_ERROR;
+}
+
+struct chx_value
+cheax_eval_bkquote_(CHEAX *c, struct chx_quote *bkquote)
+{
+	struct chx_value res = CHEAX_NIL;
+	struct chx_list *spliced;
+
+	struct bkquote_plan *plan = get_plan(c, bkquote);
+	cheax_ft(c, pad);
+
+	if (run(c, plan, &res, &spliced) == BKQ_SPLICED)
+		cheax_throwf(c, CHEAX_EEVAL, "internal splice error");
+pad:
+	return res;
+}
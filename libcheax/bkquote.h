@@ -0,0 +1,35 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BKQUOTE_H
+#define BKQUOTE_H
+
+#include <cheax.h>
+
+/* Construction plan for backquoted template */
+struct bkquote_plan;
+
+/*
+ * Preprocess expressions in unquoted parts of backquoted template, and
+ * compile its construction plan.
+ */
+struct chx_value cheax_preproc_bkquote_(CHEAX *c, struct chx_value bkquote);
+
+/* Expand backquote, compiling its plan if this hasn't happened yet */
+struct chx_value cheax_eval_bkquote_(CHEAX *c, struct chx_quote *bkquote);
+
+void cheax_bkquote_plan_free_(CHEAX *c, struct bkquote_plan *plan);
+
+#endif
@@ -0,0 +1,868 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Ordered maps and sorting
+ *
+ * An OrderedMap is a mutable B-tree, ordered either by a comparison
+ * function, or by default numerically, the way (compare) orders
+ * numbers. Nodes keep their entries in sorted arrays, are searched by
+ * bisection, and are split on the way down on insertion and topped up
+ * on the way down on removal, so that both take a single pass from the
+ * root. The nodes are not GC objects; the map owns them, and its
+ * finalizer frees them.
+ *
+ * A comparison function may run the garbage collector, throw, or look
+ * at the map it orders. Each step leaves a valid tree behind before the
+ * next comparison, and a map cannot be changed while one of its own
+ * comparisons is in progress.
+ *
+ * stable-sort is a bottom-up merge sort. Neighbouring runs that are
+ * already in order are not merged, so sorted input takes n - 1
+ * comparisons.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+#include "core.h"
+#include "err.h"
+#include "gc.h"
+#include "types.h"
+#include "unpack.h"
+
+/* minimum degree: nodes other than the root have at least
+ * BT_MIN_LEN and at most BT_MAX_LEN entries */
+#define BT_ORDER 8
+#define BT_MIN_LEN (BT_ORDER - 1)
+#define BT_MAX_LEN (2 * BT_ORDER - 1)
+
+/* enough for any map that fits in memory */
+#define BT_MAX_DEPTH 32
+
+struct bt_node {
+	int len;
+	bool leaf;
+	struct map_slot ents[BT_MAX_LEN];
+	struct bt_node *kids[BT_MAX_LEN + 1]; /* not allocated for leaves */
+};
+
+static struct bt_node *
+alloc_node(CHEAX *c, bool leaf)
+{
+	size_t size = leaf ? offsetof(struct bt_node, kids) : sizeof(struct bt_node);
+	struct bt_node *node = cheax_malloc(c, size);
+	if (node != NULL) {
+		node->len = 0;
+		node->leaf = leaf;
+	}
+	return node;
+}
+
+static void
+free_node(CHEAX *c, struct bt_node *node)
+{
+	if (node == NULL)
+		return;
+
+	if (!node->leaf)
+		for (int i = 0; i <= node->len; ++i)
+			free_node(c, node->kids[i]);
+	cheax_free(c, node);
+}
+
+void
+cheax_omap_fin_(CHEAX *c, void *obj)
+{
+	struct chx_ordered_map *map = obj;
+	free_node(c, map->root);
+}
+
+static void
+mark_node(CHEAX *c, struct bt_node *node)
+{
+	for (int i = 0; i < node->len; ++i) {
+		cheax_gc_mark_(c, node->ents[i].key);
+		cheax_gc_mark_(c, node->ents[i].value);
+	}
+
+	if (!node->leaf)
+		for (int i = 0; i <= node->len; ++i)
+			mark_node(c, node->kids[i]);
+}
+
+void
+cheax_omap_mark_(CHEAX *c, struct chx_ordered_map *map)
+{
+	cheax_gc_mark_(c, map->cmp);
+	if (map->root != NULL)
+		mark_node(c, map->root);
+}
+
+/*
+ * In-order iteration without recursion, for walking two maps side by
+ * side. The stack holds the path from the root to the next entry.
+ */
+struct bt_iter {
+	int depth;
+	struct bt_node *nodes[BT_MAX_DEPTH];
+	int idx[BT_MAX_DEPTH];
+};
+
+static void
+iter_descend(struct bt_iter *it, struct bt_node *node)
+{
+	for (;;) {
+		it->nodes[it->depth] = node;
+		it->idx[it->depth] = 0;
+		++it->depth;
+		if (node->leaf)
+			break;
+		node = node->kids[0];
+	}
+}
+
+static void
+iter_init(struct bt_iter *it, struct chx_ordered_map *map)
+{
+	it->depth = 0;
+	if (map->root != NULL)
+		iter_descend(it, map->root);
+}
+
+static struct map_slot *
+iter_next(struct bt_iter *it)
+{
+	while (it->depth > 0) {
+		int top = it->depth - 1;
+		struct bt_node *node = it->nodes[top];
+		int i = it->idx[top];
+
+		if (i < node->len) {
+			it->idx[top] = i + 1;
+			if (!node->leaf)
+				iter_descend(it, node->kids[i + 1]);
+			return &node->ents[i];
+		}
+
+		--it->depth;
+	}
+
+	return NULL;
+}
+
+void
+cheax_omap_foreach_(struct chx_ordered_map *map, map_entry_func f, void *data)
+{
+	struct bt_iter it;
+	iter_init(&it, map);
+	for (struct map_slot *ent; (ent = iter_next(&it)) != NULL; )
+		f(ent->key, ent->value, data);
+}
+
+bool
+cheax_omap_eq_(CHEAX *c, struct chx_ordered_map *a, struct chx_ordered_map *b)
+{
+	if (a == b)
+		return true;
+	if (a->count != b->count)
+		return false;
+
+	struct bt_iter ia, ib;
+	iter_init(&ia, a);
+	iter_init(&ib, b);
+
+	struct map_slot *ea, *eb;
+	while ((ea = iter_next(&ia)) != NULL && (eb = iter_next(&ib)) != NULL) {
+		if (!cheax_eq(c, ea->key, eb->key) || !cheax_eq(c, ea->value, eb->value))
+			return false;
+	}
+
+	return true;
+}
+
+/* numeric order, as with (compare) */
+static int
+default_order(CHEAX *c, struct chx_value a, struct chx_value b, int *res)
+{
+	if (a.type == CHEAX_INT && b.type == CHEAX_INT) {
+		*res = (a.data.as_int > b.data.as_int) - (a.data.as_int < b.data.as_int);
+		return 0;
+	}
+
+	chx_double da, db;
+	if (!cheax_try_vtod_(a, &da) || !cheax_try_vtod_(b, &db)) {
+		cheax_throwf(c, CHEAX_ETYPE, "expected numbers to compare");
+		return -1;
+	}
+
+	*res = (da > db) - (da < db);
+	return 0;
+}
+
+/* sign of (cmp a b), or of (compare a b) if cmp is nil */
+static int
+compare(CHEAX *c, struct chx_value cmp, struct chx_value a, struct chx_value b, int *res)
+{
+	if (cheax_is_nil(cmp))
+		return default_order(c, a, b, res);
+
+	struct chx_value args = cheax_list(c, b, NULL);
+	cheax_ft(c, pad);
+	args = cheax_list(c, a, args.data.as_list);
+	cheax_ft(c, pad);
+
+	struct chx_value r = cheax_apply(c, cmp, args.data.as_list);
+	cheax_ft(c, pad);
+
+	if (r.type != CHEAX_INT) {
+		cheax_throwf(c, CHEAX_ETYPE, "comparison function must return an integer");
+		return -1;
+	}
+
+	*res = (r.data.as_int > 0) - (r.data.as_int < 0);
+	return 0;
+pad:
+	return -1;
+}
+
+static int
+map_compare(CHEAX *c, struct chx_ordered_map *map, struct chx_value a, struct chx_value b, int *res)
+{
+	++map->busy;
+	int r = compare(c, map->cmp, a, b, res);
+	--map->busy;
+	return r;
+}
+
+/* index of the first entry in node not ordered before key */
+static int
+bisect(CHEAX *c, struct chx_ordered_map *map, struct bt_node *node, struct chx_value key, int *idx, bool *found)
+{
+	int lo = 0, hi = node->len;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2, r;
+		if (map_compare(c, map, key, node->ents[mid].key, &r) < 0)
+			return -1;
+
+		if (r < 0) {
+			hi = mid;
+		} else if (r > 0) {
+			lo = mid + 1;
+		} else {
+			*idx = mid;
+			*found = true;
+			return 0;
+		}
+	}
+
+	*idx = lo;
+	*found = false;
+	return 0;
+}
+
+static struct map_slot *
+find(CHEAX *c, struct chx_ordered_map *map, struct chx_value key)
+{
+	for (struct bt_node *node = map->root; node != NULL; ) {
+		int i;
+		bool found;
+		if (bisect(c, map, node, key, &i, &found) < 0)
+			return NULL;
+		if (found)
+			return &node->ents[i];
+		node = node->leaf ? NULL : node->kids[i];
+	}
+
+	return NULL;
+}
+
+static bool
+check_unlocked(CHEAX *c, struct chx_ordered_map *map)
+{
+	if (map->busy > 0) {
+		cheax_throwf(c, CHEAX_EEVAL, "ordered map changed during comparison");
+		return false;
+	}
+	return true;
+}
+
+/* split full child i of parent, moving its middle entry up */
+static int
+split_child(CHEAX *c, struct bt_node *parent, int i)
+{
+	struct bt_node *left = parent->kids[i];
+	struct bt_node *right = alloc_node(c, left->leaf);
+	if (right == NULL)
+		return -1;
+
+	right->len = BT_MIN_LEN;
+	memcpy(right->ents, left->ents + BT_ORDER, BT_MIN_LEN * sizeof(struct map_slot));
+	if (!left->leaf)
+		memcpy(right->kids, left->kids + BT_ORDER, BT_ORDER * sizeof(struct bt_node *));
+	left->len = BT_MIN_LEN;
+
+	memmove(parent->ents + i + 1, parent->ents + i, (parent->len - i) * sizeof(struct map_slot));
+	memmove(parent->kids + i + 2, parent->kids + i + 1, (parent->len - i) * sizeof(struct bt_node *));
+	parent->ents[i] = left->ents[BT_MIN_LEN];
+	parent->kids[i + 1] = right;
+	++parent->len;
+	return 0;
+}
+
+static int
+insert(CHEAX *c, struct chx_ordered_map *map, struct chx_value key, struct chx_value value)
+{
+	if (map->root == NULL) {
+		map->root = alloc_node(c, true);
+		if (map->root == NULL)
+			return -1;
+	}
+
+	if (map->root->len == BT_MAX_LEN) {
+		struct bt_node *root = alloc_node(c, false);
+		if (root == NULL)
+			return -1;
+		root->kids[0] = map->root;
+		if (split_child(c, root, 0) < 0) {
+			cheax_free(c, root);
+			return -1;
+		}
+		map->root = root;
+	}
+
+	struct bt_node *node = map->root;
+	for (;;) {
+		int i, r;
+		bool found;
+		if (bisect(c, map, node, key, &i, &found) < 0)
+			return -1;
+
+		if (found) {
+			node->ents[i].value = value;
+			return 0;
+		}
+
+		if (node->leaf) {
+			memmove(node->ents + i + 1, node->ents + i, (node->len - i) * sizeof(struct map_slot));
+			node->ents[i] = (struct map_slot){ key, value };
+			++node->len;
+			++map->count;
+			return 0;
+		}
+
+		if (node->kids[i]->len == BT_MAX_LEN) {
+			if (split_child(c, node, i) < 0)
+				return -1;
+
+			/* the entry moved up may be the one we look for */
+			if (map_compare(c, map, key, node->ents[i].key, &r) < 0)
+				return -1;
+			if (r == 0) {
+				node->ents[i].value = value;
+				return 0;
+			}
+			if (r > 0)
+				++i;
+		}
+
+		node = node->kids[i];
+	}
+}
+
+/* join child i + 1 of node onto child i, with the entry in between */
+static void
+merge_kids(CHEAX *c, struct bt_node *node, int i)
+{
+	struct bt_node *left = node->kids[i], *right = node->kids[i + 1];
+
+	left->ents[left->len] = node->ents[i];
+	memcpy(left->ents + left->len + 1, right->ents, right->len * sizeof(struct map_slot));
+	if (!left->leaf)
+		memcpy(left->kids + left->len + 1, right->kids, (right->len + 1) * sizeof(struct bt_node *));
+	left->len += 1 + right->len;
+
+	memmove(node->ents + i, node->ents + i + 1, (node->len - i - 1) * sizeof(struct map_slot));
+	memmove(node->kids + i + 1, node->kids + i + 2, (node->len - i - 1) * sizeof(struct bt_node *));
+	--node->len;
+	cheax_free(c, right);
+}
+
+/*
+ * Make sure child i of node has more than the minimum number of
+ * entries, so one can be removed from below it. Borrows an entry from
+ * a sibling, or merges with one. Returns the index of the child that
+ * now covers what child i did.
+ */
+static int
+fill_child(CHEAX *c, struct bt_node *node, int i)
+{
+	struct bt_node *kid = node->kids[i];
+	if (kid->len > BT_MIN_LEN)
+		return i;
+
+	if (i > 0 && node->kids[i - 1]->len > BT_MIN_LEN) {
+		struct bt_node *left = node->kids[i - 1];
+		memmove(kid->ents + 1, kid->ents, kid->len * sizeof(struct map_slot));
+		kid->ents[0] = node->ents[i - 1];
+		node->ents[i - 1] = left->ents[left->len - 1];
+		if (!kid->leaf) {
+			memmove(kid->kids + 1, kid->kids, (kid->len + 1) * sizeof(struct bt_node *));
+			kid->kids[0] = left->kids[left->len];
+		}
+		--left->len;
+		++kid->len;
+		return i;
+	}
+
+	if (i < node->len && node->kids[i + 1]->len > BT_MIN_LEN) {
+		struct bt_node *right = node->kids[i + 1];
+		kid->ents[kid->len] = node->ents[i];
+		node->ents[i] = right->ents[0];
+		memmove(right->ents, right->ents + 1, (right->len - 1) * sizeof(struct map_slot));
+		if (!kid->leaf) {
+			kid->kids[kid->len + 1] = right->kids[0];
+			memmove(right->kids, right->kids + 1, right->len * sizeof(struct bt_node *));
+		}
+		--right->len;
+		++kid->len;
+		return i;
+	}
+
+	if (i == node->len)
+		--i;
+	merge_kids(c, node, i);
+	return i;
+}
+
+/* remove greatest entry below node, which must have spare entries */
+static struct map_slot
+remove_max(CHEAX *c, struct bt_node *node)
+{
+	while (!node->leaf)
+		node = node->kids[fill_child(c, node, node->len)];
+	return node->ents[--node->len];
+}
+
+/* remove least entry below node, which must have spare entries */
+static struct map_slot
+remove_min(CHEAX *c, struct bt_node *node)
+{
+	while (!node->leaf)
+		node = node->kids[fill_child(c, node, 0)];
+
+	struct map_slot res = node->ents[0];
+	memmove(node->ents, node->ents + 1, (node->len - 1) * sizeof(struct map_slot));
+	--node->len;
+	return res;
+}
+
+static int
+delete(CHEAX *c, struct chx_ordered_map *map, struct chx_value key, bool *removed)
+{
+	*removed = false;
+
+	int res = 0;
+	struct bt_node *node = map->root;
+	while (node != NULL) {
+		int i;
+		bool found;
+		if (bisect(c, map, node, key, &i, &found) < 0) {
+			res = -1;
+			break;
+		}
+
+		if (!found) {
+			node = node->leaf ? NULL : node->kids[fill_child(c, node, i)];
+			continue;
+		}
+
+		if (node->leaf) {
+			memmove(node->ents + i, node->ents + i + 1, (node->len - i - 1) * sizeof(struct map_slot));
+			--node->len;
+		} else if (node->kids[i]->len > BT_MIN_LEN) {
+			node->ents[i] = remove_max(c, node->kids[i]);
+		} else if (node->kids[i + 1]->len > BT_MIN_LEN) {
+			node->ents[i] = remove_min(c, node->kids[i + 1]);
+		} else {
+			/* the key moves down into the merged child */
+			merge_kids(c, node, i);
+			node = node->kids[i];
+			continue;
+		}
+
+		*removed = true;
+		--map->count;
+		break;
+	}
+
+	/* merging children of the root may have emptied it */
+	struct bt_node *root = map->root;
+	if (root != NULL && root->len == 0) {
+		map->root = root->leaf ? NULL : root->kids[0];
+		cheax_free(c, root);
+	}
+
+	return res;
+}
+
+struct range {
+	struct chx_value lo, hi; /* nil if unbounded */
+	struct map_slot *ents;
+	size_t len, cap;
+};
+
+static int
+range_push(CHEAX *c, struct range *rng, struct map_slot ent)
+{
+	if (rng->len == rng->cap) {
+		size_t new_cap = (rng->cap == 0) ? 16 : rng->cap * 2;
+		struct map_slot *ents = cheax_realloc(c, rng->ents, new_cap * sizeof(struct map_slot));
+		if (ents == NULL)
+			return -1;
+		rng->ents = ents;
+		rng->cap = new_cap;
+	}
+
+	rng->ents[rng->len++] = ent;
+	return 0;
+}
+
+/*
+ * Collect entries below node from lo up to hi, in order. Returns 1 once
+ * an entry at or past hi is seen, -1 on error, 0 otherwise. Past the
+ * first child visited, all keys are at or past lo.
+ */
+static int
+collect_range(CHEAX *c, struct chx_ordered_map *map, struct bt_node *node, bool check_lo, struct range *rng)
+{
+	int i = 0, r;
+	bool found = false;
+	if (check_lo && !cheax_is_nil(rng->lo) && bisect(c, map, node, rng->lo, &i, &found) < 0)
+		return -1;
+
+	/* on an exact match, child i holds only keys before lo */
+	bool skip_kid = found;
+
+	for (; i <= node->len; ++i) {
+		if (!node->leaf && !skip_kid) {
+			r = collect_range(c, map, node->kids[i], check_lo, rng);
+			if (r != 0)
+				return r;
+		}
+		check_lo = skip_kid = false;
+
+		if (i == node->len)
+			break;
+
+		if (!cheax_is_nil(rng->hi)) {
+			if (map_compare(c, map, node->ents[i].key, rng->hi, &r) < 0)
+				return -1;
+			if (r >= 0)
+				return 1;
+		}
+
+		if (range_push(c, rng, node->ents[i]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* (key value) */
+static struct chx_value
+pair_value(CHEAX *c, struct map_slot ent)
+{
+	struct chx_value res = cheax_list(c, ent.value, NULL);
+	return (cheax_errno(c) == 0) ? cheax_list(c, ent.key, res.data.as_list) : CHEAX_NIL;
+}
+
+static struct chx_value
+pair_list(CHEAX *c, struct map_slot *ents, size_t len)
+{
+	struct chx_value res = CHEAX_NIL;
+	while (len-- > 0) {
+		struct chx_value pair = pair_value(c, ents[len]);
+		cheax_ft(c, pad);
+		res = cheax_list(c, pair, res.data.as_list);
+		cheax_ft(c, pad);
+	}
+	return res;
+pad:
+	return CHEAX_NIL;
+}
+
+
+static int
+sort_values(CHEAX *c, struct chx_value cmp, struct chx_value *vals, size_t n)
+{
+	if (n < 2)
+		return 0;
+
+	struct chx_value *tmp = cheax_malloc(c, n * sizeof(struct chx_value));
+	if (tmp == NULL)
+		return -1;
+
+	for (size_t w = 1; w < n; w *= 2) {
+		for (size_t lo = 0; lo + w < n; lo += 2 * w) {
+			size_t mid = lo + w, hi = (n - mid > w) ? mid + w : n;
+			int r;
+
+			if (compare(c, cmp, vals[mid - 1], vals[mid], &r) < 0)
+				goto pad;
+			if (r <= 0)
+				continue;
+
+			memcpy(tmp, vals + lo, w * sizeof(struct chx_value));
+			size_t i = 0, j = mid, k = lo;
+			while (i < w && j < hi) {
+				/* take from the left unless strictly greater */
+				if (compare(c, cmp, vals[j], tmp[i], &r) < 0)
+					goto pad;
+				vals[k++] = (r < 0) ? vals[j++] : tmp[i++];
+			}
+			memcpy(vals + k, tmp + i, (w - i) * sizeof(struct chx_value));
+		}
+	}
+
+	cheax_free(c, tmp);
+	return 0;
+pad:
+	cheax_free(c, tmp);
+	return -1;
+}
+
+/*
+ *  _           _ _ _   _
+ * | |__  _   _(_) | |_(_)_ __  ___
+ * | '_ \| | | | | | __| | '_ \/ __|
+ * | |_) | |_| | | | |_| | | | \__ \
+ * |_.__/ \__,_|_|_|\__|_|_| |_|___/
+ *
+ */
+
+static struct chx_value
+new_omap(CHEAX *c, struct chx_value cmp, struct chx_list *pairs)
+{
+	struct chx_ordered_map *map = cheax_gc_alloc_(c, sizeof(struct chx_ordered_map), CHEAX_ORDERED_MAP);
+	if (map == NULL)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+
+	map->root = NULL;
+	map->count = 0;
+	map->cmp = cmp;
+	map->busy = 0;
+
+	chx_ref map_ref = cheax_ref_ptr(c, map);
+
+	for (; pairs != NULL; pairs = pairs->next->next) {
+		if (pairs->next == NULL) {
+			cheax_throwf(c, CHEAX_EMATCH, "expected value for every key");
+			goto pad;
+		}
+
+		if (insert(c, map, pairs->value, pairs->next->value) < 0)
+			goto pad;
+	}
+
+	cheax_unref_ptr(c, map, map_ref);
+	return (struct chx_value){ .type = CHEAX_ORDERED_MAP, .data.as_ordered_map = map };
+pad:
+	cheax_unref_ptr(c, map, map_ref);
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_ordered_map(CHEAX *c, struct chx_list *args, void *info)
+{
+	return new_omap(c, CHEAX_NIL, args);
+}
+
+static struct chx_value
+bltn_ordered_map_with(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_value cmp;
+	struct chx_list *pairs;
+	return (0 == cheax_unpack_(c, args, "[LP]_*", &cmp, &pairs))
+	     ? new_omap(c, cmp, pairs)
+	     : CHEAX_NIL;
+}
+
+static struct chx_value
+bltn_omap_get(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ordered_map *map;
+	struct chx_value key, def;
+	if (cheax_unpack_(c, args, "O__?", &map, &key, &def) < 0)
+		return CHEAX_NIL;
+
+	struct map_slot *ent = find(c, map, key);
+	cheax_ft(c, pad);
+	return (ent != NULL) ? ent->value : def;
+pad:
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_omap_set(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ordered_map *map;
+	struct chx_value key, value;
+	if (cheax_unpack_(c, args, "O__", &map, &key, &value) < 0)
+		return CHEAX_NIL;
+
+	if (!check_unlocked(c, map) || insert(c, map, key, value) < 0)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	return CHEAX_NIL;
+}
+
+static struct chx_value
+bltn_omap_remove(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ordered_map *map;
+	struct chx_value key;
+	if (cheax_unpack_(c, args, "O_", &map, &key) < 0)
+		return CHEAX_NIL;
+
+	bool removed;
+	if (!check_unlocked(c, map) || delete(c, map, key, &removed) < 0)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	return cheax_bool(removed);
+}
+
+static struct chx_value
+bltn_omap_count(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ordered_map *map;
+	return (0 == cheax_unpack_(c, args, "O", &map))
+	     ? cheax_int((chx_int)map->count)
+	     : CHEAX_NIL;
+}
+
+static struct chx_value
+bltn_omap_min(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ordered_map *map;
+	if (cheax_unpack_(c, args, "O", &map) < 0)
+		return CHEAX_NIL;
+
+	struct bt_node *node = map->root;
+	if (node == NULL)
+		return CHEAX_NIL;
+	while (!node->leaf)
+		node = node->kids[0];
+	return cheax_bt_wrap_(c, pair_value(c, node->ents[0]));
+}
+
+static struct chx_value
+bltn_omap_max(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ordered_map *map;
+	if (cheax_unpack_(c, args, "O", &map) < 0)
+		return CHEAX_NIL;
+
+	struct bt_node *node = map->root;
+	if (node == NULL)
+		return CHEAX_NIL;
+	while (!node->leaf)
+		node = node->kids[node->len];
+	return cheax_bt_wrap_(c, pair_value(c, node->ents[node->len - 1]));
+}
+
+static struct chx_value
+bltn_omap_range(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ordered_map *map;
+	struct range rng = { CHEAX_NIL, CHEAX_NIL, NULL, 0, 0 };
+	if (cheax_unpack_(c, args, "O__", &map, &rng.lo, &rng.hi) < 0)
+		return CHEAX_NIL;
+
+	struct chx_value res = CHEAX_NIL;
+	if (map->root != NULL && collect_range(c, map, map->root, true, &rng) >= 0)
+		res = pair_list(c, rng.ents, rng.len);
+
+	cheax_free(c, rng.ents);
+	return cheax_bt_wrap_(c, res);
+}
+
+static struct chx_value
+bltn_omap_to_list(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ordered_map *map;
+	struct range rng = { CHEAX_NIL, CHEAX_NIL, NULL, 0, 0 };
+	if (cheax_unpack_(c, args, "O", &map) < 0)
+		return CHEAX_NIL;
+
+	struct chx_value res = CHEAX_NIL;
+	if (map->root != NULL && collect_range(c, map, map->root, false, &rng) >= 0)
+		res = pair_list(c, rng.ents, rng.len);
+
+	cheax_free(c, rng.ents);
+	return cheax_bt_wrap_(c, res);
+}
+
+static struct chx_value
+bltn_stable_sort(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_list *xs;
+	struct chx_value cmp = CHEAX_NIL;
+	if (cheax_unpack_(c, args, "C[LP]?", &xs, &cmp) < 0)
+		return CHEAX_NIL;
+
+	size_t n = 0;
+	for (struct chx_list *x = xs; x != NULL; x = x->next)
+		++n;
+	if (n < 2)
+		return cheax_list_value(xs);
+
+	/* the values stay reachable through xs while comparing */
+	struct chx_value *vals = cheax_malloc(c, n * sizeof(struct chx_value));
+	cheax_ft(c, pad);
+	for (size_t i = 0; xs != NULL; xs = xs->next, ++i)
+		vals[i] = xs->value;
+
+	struct chx_value res = CHEAX_NIL;
+	if (sort_values(c, cmp, vals, n) == 0) {
+		for (size_t i = n; i-- > 0; ) {
+			res = cheax_list(c, vals[i], res.data.as_list);
+			if (cheax_errno(c) != 0) {
+				res = CHEAX_NIL;
+				break;
+			}
+		}
+	}
+
+	cheax_free(c, vals);
+	return cheax_bt_wrap_(c, res);
+pad:
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+void
+cheax_export_btree_bltns_(CHEAX *c)
+{
+	cheax_defun(c, "ordered-map",      bltn_ordered_map,      NULL);
+	cheax_defun(c, "ordered-map-with", bltn_ordered_map_with, NULL);
+	cheax_defun(c, "omap-get",         bltn_omap_get,         NULL);
+	cheax_defun(c, "omap-set!",        bltn_omap_set,         NULL);
+	cheax_defun(c, "omap-remove!",     bltn_omap_remove,      NULL);
+	cheax_defun(c, "omap-count",       bltn_omap_count,       NULL);
+	cheax_defun(c, "omap-min",         bltn_omap_min,         NULL);
+	cheax_defun(c, "omap-max",         bltn_omap_max,         NULL);
+	cheax_defun(c, "omap-range",       bltn_omap_range,       NULL);
+	cheax_defun(c, "omap->list",       bltn_omap_to_list,     NULL);
+	cheax_defun(c, "stable-sort",      bltn_stable_sort,      NULL);
+}
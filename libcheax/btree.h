@@ -0,0 +1,34 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <cheax.h>
+
+#include "hamt.h"
+
+void cheax_omap_fin_(CHEAX *c, void *obj);
+void cheax_omap_mark_(CHEAX *c, struct chx_ordered_map *map);
+
+/* perform an action for each entry of an ordered map, in order */
+void cheax_omap_foreach_(struct chx_ordered_map *map, map_entry_func f, void *data);
+
+/* same keys in the same order, mapping to equal values */
+bool cheax_omap_eq_(CHEAX *c, struct chx_ordered_map *a, struct chx_ordered_map *b);
+
+void cheax_export_btree_bltns_(CHEAX *c);
+
+#endif
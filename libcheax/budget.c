@@ -0,0 +1,154 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "setup.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include "budget.h"
+#include "core.h"
+#include "err.h"
+
+/* maximum number of eval steps between budget checks */
+#define CHECK_INTERVAL 1024
+
+void
+cheax_budget_init_(CHEAX *c)
+{
+	struct budget_info *b = &c->budget;
+	b->countdown = b->interval = CHECK_INTERVAL;
+	b->steps = 0;
+	b->step_end = b->alloc_end = SIZE_MAX;
+	b->deadline = 0;
+	b->exhausted = 0;
+	b->exhausted_msg = NULL;
+}
+
+uint64_t
+cheax_now_ns_(void)
+{
+	struct timespec ts;
+#ifdef HAVE_CLOCK_GETTIME
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC);
+#endif
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* account for steps taken since the countdown was last reset */
+static void
+sync_steps(struct budget_info *b)
+{
+	b->steps += b->interval - b->countdown;
+	b->countdown = b->interval;
+}
+
+static void
+reset_countdown(CHEAX *c)
+{
+	struct budget_info *b = &c->budget;
+	if (b->exhausted != 0 || c->gen.cancelling) {
+		b->interval = 1;
+	} else {
+		/* make sure we're called on the first step over the limit */
+		size_t left = b->step_end - b->steps;
+		b->interval = (left < CHECK_INTERVAL) ? (int)left + 1 : CHECK_INTERVAL;
+	}
+
+	b->countdown = b->interval;
+}
+
+int
+cheax_check_budget_(CHEAX *c)
+{
+	struct budget_info *b = &c->budget;
+	sync_steps(b);
+
+	if (c->gen.cancelling) {
+		/* an abandoned generator must unwind without running any
+		 * more code, so (catch) and (finally) can't keep it going;
+		 * see cheax_gen_cancel_abandoned_() */
+		reset_countdown(c);
+		cheax_throwf(c, CHEAX_EAPI, "generator abandoned");
+		return -1;
+	}
+
+	if (b->exhausted != 0) {
+		/* keep cheax code from catching its way out */
+	} else if (b->steps > b->step_end) {
+		b->exhausted = CHEAX_EBUDGET;
+		b->exhausted_msg = "step budget exhausted";
+	} else if (c->gc.alloc_total > b->alloc_end) {
+		b->exhausted = CHEAX_EBUDGET;
+		b->exhausted_msg = "allocation budget exhausted";
+	} else if (b->deadline != 0 && cheax_now_ns_() >= b->deadline) {
+		b->exhausted = CHEAX_ETIMEOUT;
+		b->exhausted_msg = "deadline passed";
+	}
+
+	reset_countdown(c);
+
+	if (b->exhausted != 0) {
+		cheax_throwf(c, b->exhausted, "%s", b->exhausted_msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+cheax_budget_interrupt_(CHEAX *c)
+{
+	struct budget_info *b = &c->budget;
+	sync_steps(b);
+	b->countdown = b->interval = 1;
+}
+
+struct chx_value
+cheax_eval_with_budget(CHEAX *c, struct chx_value expr, const struct chx_budget *budget)
+{
+	ASSERT_NOT_NULL("eval_with_budget", budget, CHEAX_NIL);
+
+	struct budget_info *b = &c->budget;
+	sync_steps(b);
+	struct budget_info prev = *b;
+
+	if (budget->steps > 0 && budget->steps < b->step_end - b->steps)
+		b->step_end = b->steps + budget->steps;
+
+	size_t alloc_total = c->gc.alloc_total;
+	size_t alloc_left = (alloc_total < b->alloc_end) ? b->alloc_end - alloc_total : 0;
+	if (budget->bytes > 0 && budget->bytes < alloc_left)
+		b->alloc_end = alloc_total + budget->bytes;
+
+	if (budget->time_ms > 0) {
+		uint64_t deadline = cheax_now_ns_() + (uint64_t)budget->time_ms * 1000000u;
+		if (b->deadline == 0 || deadline < b->deadline)
+			b->deadline = deadline;
+	}
+
+	reset_countdown(c);
+
+	struct chx_value res = cheax_eval(c, expr);
+
+	sync_steps(b);
+	prev.steps = b->steps;
+	*b = prev;
+	reset_countdown(c);
+
+	return res;
+}
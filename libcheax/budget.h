@@ -0,0 +1,55 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <cheax.h>
+
+#include <stdint.h>
+
+/* Resource limits of cheax_eval_with_budget(), checked every so many
+ * eval steps. Limits are absolute, in terms of `steps', the
+ * c->gc.alloc_total counter and cheax_now_ns_(), so that nested
+ * budgets can never exceed the enclosing one. */
+struct budget_info {
+	/* steps left until cheax_check_budget_(), counted down from
+	 * `interval' */
+	int countdown, interval;
+	size_t steps, step_end;
+	size_t alloc_end;
+	uint64_t deadline;  /* 0 if none */
+
+	/* once a budget runs out, every step throws this error until
+	 * the cheax_eval_with_budget() call that set it returns */
+	int exhausted;
+	const char *exhausted_msg;
+};
+
+void cheax_budget_init_(CHEAX *c);
+
+/* Called from the evaluator when `countdown' reaches 0. Returns -1 and
+ * throws ETIMEOUT or EBUDGET if the budget ran out, or EAPI while
+ * abandoned generators are being cancelled. */
+int cheax_check_budget_(CHEAX *c);
+
+/* Have the next eval step call cheax_check_budget_(), which also
+ * throws while c->gen.cancelling is set. */
+void cheax_budget_interrupt_(CHEAX *c);
+
+/* monotonic time in nanoseconds */
+uint64_t cheax_now_ns_(void);
+
+#endif
@@ -0,0 +1,431 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "case.h"
+#include "core.h"
+#include "err.h"
+#include "htab.h"
+
+/*
+ * Pattern-value pairs are split into blocks of consecutive pairs whose
+ * patterns are of the same kind:
+ *
+ *  - BLOCK_LIT: literal patterns. At most one of these can match, so
+ *    we look it up in a hash table.
+ *  - BLOCK_CONS: list patterns. The type check and list length are
+ *    computed once for the whole block, and only patterns of the right
+ *    length are tried.
+ *  - BLOCK_ANY: a single identifier pattern, which always matches.
+ *
+ * Patterns that can never match (e.g. quotes or NaN) are dropped.
+ * Matching collects bindings instead of defining symbols, so that an
+ * environment is only needed once a pattern matches.
+ */
+
+enum {
+	BLOCK_LIT,
+	BLOCK_CONS,
+	BLOCK_ANY,
+};
+
+struct case_clause {
+	struct chx_list *pair;
+	struct chx_value pan;
+	int min_len; /* for list patterns */
+	bool exact_len;
+};
+
+struct case_lit {
+	struct htab_entry entry;
+	struct chx_value value;
+	int clause;
+};
+
+struct case_block {
+	int kind;
+	int first, last; /* clause indices */
+	struct htab lits;
+	int max_len;
+};
+
+struct case_tree {
+	struct case_clause *clauses;
+	struct case_block *blocks;
+	int num_clauses, num_blocks;
+	int max_ids;
+};
+
+static bool
+is_colon(CHEAX *c, struct chx_value v)
+{
+	return v.type == CHEAX_ID && v.data.as_id == c->std_ids[COLON_ID];
+}
+
+static uint32_t
+lit_hash(const struct htab_entry *item)
+{
+	struct chx_value v = ((const struct case_lit *)item)->value;
+	uint32_t h;
+	chx_double d;
+	chx_int b;
+
+	switch (v.type) {
+	case CHEAX_STRING:
+		h = cheax_good_hash_(v.data.as_string->value, v.data.as_string->len);
+		break;
+	case CHEAX_DOUBLE:
+		/* 0.0 == -0.0 */
+		d = (v.data.as_double == 0.0) ? 0.0 : v.data.as_double;
+		h = cheax_good_hash_(&d, sizeof(d));
+		break;
+	case CHEAX_BOOL:
+		b = v.data.as_int != 0;
+		h = cheax_good_hash_(&b, sizeof(b));
+		break;
+	default:
+		h = cheax_good_hash_(&v.data.as_int, sizeof(v.data.as_int));
+		break;
+	}
+
+	return h ^ (uint32_t)v.type;
+}
+
+static bool
+lit_eq(const struct htab_entry *ent_a, const struct htab_entry *ent_b)
+{
+	struct chx_value a = ((const struct case_lit *)ent_a)->value;
+	struct chx_value b = ((const struct case_lit *)ent_b)->value;
+
+	if (a.type != b.type)
+		return false;
+
+	switch (a.type) {
+	case CHEAX_STRING:
+		return a.data.as_string->len == b.data.as_string->len
+		    && 0 == memcmp(a.data.as_string->value, b.data.as_string->value, a.data.as_string->len);
+	case CHEAX_DOUBLE:
+		return a.data.as_double == b.data.as_double;
+	case CHEAX_BOOL:
+		return (a.data.as_int != 0) == (b.data.as_int != 0);
+	default:
+		return a.data.as_int == b.data.as_int;
+	}
+}
+
+static bool
+is_lit_type(int type)
+{
+	switch (type) {
+	case CHEAX_INT:
+	case CHEAX_DOUBLE:
+	case CHEAX_BOOL:
+	case CHEAX_STRING:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int
+block_kind(struct chx_value pan)
+{
+	switch (pan.type) {
+	case CHEAX_ID:
+		return BLOCK_ANY;
+	case CHEAX_LIST:
+		return BLOCK_CONS;
+	case CHEAX_DOUBLE:
+		return isnan(pan.data.as_double) ? -1 : BLOCK_LIT;
+	default:
+		return is_lit_type(pan.type) ? BLOCK_LIT : -1;
+	}
+}
+
+/* Number of identifiers bound by pattern */
+static int
+count_ids(CHEAX *c, struct chx_value pan)
+{
+	if (pan.type == CHEAX_ID)
+		return 1;
+	if (pan.type != CHEAX_LIST)
+		return 0;
+
+	struct chx_list *lst = pan.data.as_list;
+	if (lst != NULL && is_colon(c, lst->value))
+		lst = lst->next;
+
+	int n = 0;
+	for (; lst != NULL; lst = lst->next)
+		n += count_ids(c, lst->value);
+	return n;
+}
+
+static void
+free_lit(struct htab_entry *item, void *data)
+{
+	cheax_free(data, item);
+}
+
+void
+cheax_case_free_(CHEAX *c, struct case_tree *tree)
+{
+	if (tree == NULL)
+		return;
+
+	for (int i = 0; i < tree->num_blocks; ++i)
+		if (tree->blocks[i].kind == BLOCK_LIT)
+			cheax_htab_cleanup_(&tree->blocks[i].lits, free_lit, c);
+
+	cheax_free(c, tree->blocks);
+	cheax_free(c, tree->clauses);
+	cheax_free(c, tree);
+}
+
+static void
+add_lit(CHEAX *c, struct case_block *blk, struct chx_value value, int clause)
+{
+	struct case_lit *lit = cheax_malloc(c, sizeof(struct case_lit));
+	cheax_ft(c, pad);
+	lit->value = value;
+	lit->clause = clause;
+
+	struct htab_search search = cheax_htab_get_(&blk->lits, &lit->entry);
+	if (search.item != NULL) {
+		/* Earlier pattern takes precedence */
+		cheax_free(c, lit);
+		return;
+	}
+
+	cheax_htab_set_(&blk->lits, search, &lit->entry);
+	if (cheax_errno(c) != 0)
+		cheax_free(c, lit);
+pad:
+	return;
+}
+
+struct case_tree *
+cheax_case_compile_(CHEAX *c, struct chx_list *pairs)
+{
+	int num_pairs = 0;
+	for (struct chx_list *p = pairs; p != NULL; p = p->next) {
+		if (p->value.type != CHEAX_LIST || p->value.data.as_list == NULL) {
+			cheax_throwf(c, CHEAX_EMATCH, "pattern-value pair expected");
+			return NULL;
+		}
+		++num_pairs;
+	}
+
+	struct case_tree *tree = cheax_calloc(c, 1, sizeof(struct case_tree));
+	cheax_ft(c, pad);
+
+	/* one block per pair at most */
+	tree->clauses = cheax_calloc(c, num_pairs + 1, sizeof(struct case_clause));
+	cheax_ft(c, pad);
+	tree->blocks = cheax_calloc(c, num_pairs + 1, sizeof(struct case_block));
+	cheax_ft(c, pad);
+
+	struct case_block *blk = NULL;
+	for (struct chx_list *p = pairs; p != NULL; p = p->next) {
+		struct chx_list *pair = p->value.data.as_list;
+		struct chx_value pan = pair->value;
+
+		int kind = block_kind(pan);
+		if (kind < 0)
+			continue; /* never matches */
+
+		struct case_clause *cl = &tree->clauses[tree->num_clauses];
+		cl->pair = pair;
+		cl->pan = pan;
+
+		int num_ids = count_ids(c, pan);
+		if (num_ids > tree->max_ids)
+			tree->max_ids = num_ids;
+
+		if (kind == BLOCK_CONS) {
+			struct chx_list *lst = pan.data.as_list;
+			cl->exact_len = true;
+			if (lst != NULL && is_colon(c, lst->value)) {
+				cl->exact_len = false;
+				lst = lst->next;
+				if (lst == NULL)
+					continue; /* (:) never matches */
+			}
+
+			for (; lst != NULL; lst = lst->next)
+				++cl->min_len;
+
+			/* (: ... rest) requires one fewer element */
+			if (!cl->exact_len)
+				--cl->min_len;
+		}
+
+		if (blk == NULL || blk->kind != kind || kind == BLOCK_ANY) {
+			blk = &tree->blocks[tree->num_blocks++];
+			blk->kind = kind;
+			blk->first = tree->num_clauses;
+			if (kind == BLOCK_LIT)
+				cheax_htab_init_(c, &blk->lits, lit_hash, lit_eq);
+		}
+
+		if (kind == BLOCK_LIT) {
+			add_lit(c, blk, pan, tree->num_clauses);
+			cheax_ft(c, pad);
+		} else if (kind == BLOCK_CONS && cl->min_len > blk->max_len) {
+			blk->max_len = cl->min_len;
+		}
+
+		blk->last = ++tree->num_clauses;
+	}
+
+	return tree;
+pad:
+	cheax_case_free_(c, tree);
+	return NULL;
+}
+
+static bool match_node(CHEAX *c, struct chx_value pan, struct chx_value value,
+                       struct case_binding *binds, int *num_binds);
+
+static bool
+match_list(CHEAX *c, struct chx_list *pan, struct chx_list *value,
+           struct case_binding *binds, int *num_binds)
+{
+	bool colon = pan != NULL && is_colon(c, pan->value);
+	if (colon)
+		pan = pan->next;
+
+	for (; pan != NULL; pan = pan->next, value = value->next) {
+		if (colon && pan->next == NULL)
+			return match_node(c, pan->value, cheax_list_value(value), binds, num_binds);
+
+		if (value == NULL || !match_node(c, pan->value, value->value, binds, num_binds))
+			return false;
+	}
+
+	return value == NULL;
+}
+
+static bool
+match_node(CHEAX *c, struct chx_value pan, struct chx_value value,
+           struct case_binding *binds, int *num_binds)
+{
+	if (pan.type == CHEAX_ID) {
+		binds[*num_binds].id = pan.data.as_id;
+		binds[*num_binds].value = value;
+		++*num_binds;
+		return true;
+	}
+
+	if (pan.type != value.type)
+		return false;
+
+	switch (pan.type) {
+	case CHEAX_LIST:
+		return match_list(c, pan.data.as_list, value.data.as_list, binds, num_binds);
+	case CHEAX_INT:
+	case CHEAX_DOUBLE:
+	case CHEAX_BOOL:
+	case CHEAX_STRING:
+		return cheax_eq(c, pan, value);
+	default:
+		return false;
+	}
+}
+
+static int
+match_cons_block(CHEAX *c, struct case_tree *tree, struct case_block *blk,
+                 struct chx_value value, struct case_binding *binds, int *num_binds)
+{
+	if (value.type != CHEAX_LIST)
+		return -1;
+
+	/* Count up to one past the longest pattern, which is enough to
+	 * tell all patterns apart */
+	int len = 0;
+	for (struct chx_list *lst = value.data.as_list; lst != NULL && len <= blk->max_len; lst = lst->next)
+		++len;
+
+	for (int i = blk->first; i < blk->last; ++i) {
+		struct case_clause *cl = &tree->clauses[i];
+		if (cl->exact_len ? (len != cl->min_len) : (len < cl->min_len))
+			continue;
+
+		*num_binds = 0;
+		if (match_list(c, cl->pan.data.as_list, value.data.as_list, binds, num_binds))
+			return i;
+	}
+
+	return -1;
+}
+
+static int
+match_lit_block(struct case_block *blk, struct chx_value value)
+{
+	if (!is_lit_type(value.type))
+		return -1;
+
+	struct case_lit dummy = { .value = value };
+	struct htab_search search = cheax_htab_get_(&blk->lits, &dummy.entry);
+	return (search.item == NULL)
+	     ? -1
+	     : ((struct case_lit *)search.item)->clause;
+}
+
+struct chx_list *
+cheax_case_match_(CHEAX *c,
+                  struct case_tree *tree,
+                  struct chx_value value,
+                  struct case_binding *buf,
+                  int buf_len,
+                  struct case_binding **binds,
+                  int *num_binds)
+{
+	*binds = buf;
+	*num_binds = 0;
+
+	if (tree->max_ids > buf_len) {
+		*binds = cheax_malloc(c, tree->max_ids * sizeof(struct case_binding));
+		cheax_ft(c, pad);
+	}
+
+	for (int i = 0; i < tree->num_blocks; ++i) {
+		struct case_block *blk = &tree->blocks[i];
+		int match = -1;
+
+		switch (blk->kind) {
+		case BLOCK_LIT:
+			match = match_lit_block(blk, value);
+			break;
+		case BLOCK_CONS:
+			match = match_cons_block(c, tree, blk, value, *binds, num_binds);
+			break;
+		case BLOCK_ANY:
+			match = blk->first;
+			*num_binds = 0;
+			match_node(c, tree->clauses[match].pan, value, *binds, num_binds);
+			break;
+		}
+
+		if (match >= 0)
+			return tree->clauses[match].pair;
+	}
+
+	*num_binds = 0;
+pad:
+	return NULL;
+}
@@ -0,0 +1,51 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CASE_H
+#define CASE_H
+
+#include <cheax.h>
+
+/* Compiled pattern-value pairs of a (case) form */
+struct case_tree;
+
+struct case_binding {
+	struct chx_id *id;
+	struct chx_value value;
+};
+
+/*
+ * Compile pattern-value pairs of preprocessed (case) form, i.e. the
+ * list of pairs following the matched expression. Pointers into the
+ * pairs are retained, so the tree must not outlive them.
+ */
+struct case_tree *cheax_case_compile_(CHEAX *c, struct chx_list *pairs);
+void cheax_case_free_(CHEAX *c, struct case_tree *tree);
+
+/*
+ * Find first pattern-value pair matching `value', without touching the
+ * environment. Returns the pair, or NULL if none match. Bindings are
+ * written to `*binds', which is either `buf' (of length `buf_len') or
+ * a cheax_malloc()'d buffer, and their number to `*num_binds'.
+ */
+struct chx_list *cheax_case_match_(CHEAX *c,
+                                   struct case_tree *tree,
+                                   struct chx_value value,
+                                   struct case_binding *buf,
+                                   int buf_len,
+                                   struct case_binding **binds,
+                                   int *num_binds);
+
+#endif
@@ -0,0 +1,337 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "attrib.h"
+#include "closure.h"
+#include "core.h"
+#include "sym.h"
+
+/*
+ * A (fn) body looks up identifiers in the environment the function was
+ * created in. Rather than capturing that environment as a whole, we
+ * only capture the chain from the innermost frame that binds something
+ * the body may look up. Frames above it do not escape, so they can
+ * still be freed eagerly by cheax_pop_env(), and they aren't kept alive
+ * by the function.
+ *
+ * The analysis collects the identifiers the body refers to outside the
+ * scope of any binding within the body itself: parameters, patterns of
+ * (let), (loop), (dotimes) and (case), and definitions in a body, from
+ * the next statement on. The rest happens when the function is created,
+ * see cheax_capture_env_().
+ *
+ * A function that calls a parameter, a local or a computed value might
+ * be handed (eval) or (env), which look up identifiers only known at
+ * run time. Such a function captures the whole chain.
+ */
+
+struct closure_info {
+	bool dyn_calls;
+	int num_ids;
+	struct chx_id *ids[];
+};
+
+struct id_set {
+	struct chx_id **ids;
+	int len, cap;
+};
+
+struct analysis {
+	struct id_set refs;
+	/* identifiers bound at the current point; a stack, in that
+	 * leaving a scope cuts it back to its length on entry */
+	struct id_set scope;
+	bool dyn_calls;
+};
+
+static bool
+id_set_has(struct id_set *set, struct chx_id *id)
+{
+	for (int i = 0; i < set->len; ++i)
+		if (set->ids[i] == id)
+			return true;
+	return false;
+}
+
+static void
+id_set_add(CHEAX *c, struct id_set *set, struct chx_id *id)
+{
+	if (id_set_has(set, id))
+		return;
+
+	if (set->len == set->cap) {
+		int new_cap = (set->cap == 0) ? 8 : set->cap * 2;
+		struct chx_id **new_ids = cheax_realloc(c, set->ids, new_cap * sizeof(*new_ids));
+		cheax_ft(c, pad);
+		set->ids = new_ids;
+		set->cap = new_cap;
+	}
+
+	set->ids[set->len++] = id;
+pad:
+	return;
+}
+
+/* Bring identifiers bound by pattern into scope */
+static void
+bind_pattern(CHEAX *c, struct analysis *an, struct chx_value pan)
+{
+	switch (pan.type) {
+	case CHEAX_ID:
+		if (pan.data.as_id != c->std_ids[COLON_ID])
+			id_set_add(c, &an->scope, pan.data.as_id);
+		break;
+	case CHEAX_LIST:
+		for (struct chx_list *lst = pan.data.as_list; lst != NULL; lst = lst->next)
+			bind_pattern(c, an, lst->value);
+		break;
+	default:
+		break;
+	}
+}
+
+static void collect_refs(CHEAX *c, struct analysis *an, struct chx_value v);
+
+static void
+collect_refs_seq(CHEAX *c, struct analysis *an, struct chx_list *lst)
+{
+	for (; lst != NULL; lst = lst->next)
+		collect_refs(c, an, lst->value);
+}
+
+/* Like collect_refs_seq(), but skip the first element of every list */
+static void
+collect_refs_clauses(CHEAX *c, struct analysis *an, struct chx_list *lst)
+{
+	for (; lst != NULL; lst = lst->next)
+		if (lst->value.type == CHEAX_LIST && lst->value.data.as_list != NULL)
+			collect_refs_seq(c, an, lst->value.data.as_list->next);
+}
+
+/*
+ * Statements evaluated in a frame of their own. What they define is in
+ * scope for the statements after it, up to the end of the body.
+ */
+static void
+collect_refs_body(CHEAX *c, struct analysis *an, struct chx_list *body)
+{
+	int mark = an->scope.len;
+
+	for (; body != NULL; body = body->next) {
+		collect_refs(c, an, body->value);
+
+		struct chx_list *def = body->value.data.as_list;
+		if (cheax_is_definition_(c, body->value) && def->next != NULL)
+			bind_pattern(c, an, def->next->value);
+	}
+
+	an->scope.len = mark;
+}
+
+/* (let), (let*) and (loop) */
+static void
+collect_refs_let(CHEAX *c, struct analysis *an, struct chx_list *args, bool star)
+{
+	int mark = an->scope.len;
+
+	if (args->value.type == CHEAX_LIST) {
+		for (struct chx_list *p = args->value.data.as_list; p != NULL; p = p->next) {
+			if (p->value.type != CHEAX_LIST || p->value.data.as_list == NULL)
+				continue;
+			collect_refs_seq(c, an, p->value.data.as_list->next);
+			if (star)
+				bind_pattern(c, an, p->value.data.as_list->value);
+		}
+
+		for (struct chx_list *p = args->value.data.as_list; !star && p != NULL; p = p->next)
+			if (p->value.type == CHEAX_LIST && p->value.data.as_list != NULL)
+				bind_pattern(c, an, p->value.data.as_list->value);
+	}
+
+	collect_refs_body(c, an, args->next);
+	an->scope.len = mark;
+}
+
+static void
+collect_refs_form(CHEAX *c, struct analysis *an, const char *name, struct chx_list *args)
+{
+	if (args == NULL)
+		return;
+
+	int mark = an->scope.len;
+
+	if (0 == strcmp(name, "fn")) {
+		bind_pattern(c, an, args->value);
+		collect_refs_body(c, an, args->next);
+	} else if (0 == strcmp(name, "def") || 0 == strcmp(name, "var")) {
+		collect_refs_seq(c, an, args->next);
+	} else if (0 == strcmp(name, "let") || 0 == strcmp(name, "loop")) {
+		collect_refs_let(c, an, args, false);
+	} else if (0 == strcmp(name, "let*")) {
+		collect_refs_let(c, an, args, true);
+	} else if (0 == strcmp(name, "dotimes")) {
+		if (args->value.type == CHEAX_LIST && args->value.data.as_list != NULL) {
+			struct chx_list *spec = args->value.data.as_list;
+			collect_refs_seq(c, an, spec->next);
+			bind_pattern(c, an, spec->value);
+		}
+		collect_refs_body(c, an, args->next);
+	} else if (0 == strcmp(name, "case")) {
+		collect_refs(c, an, args->value);
+		for (struct chx_list *cl = args->next; cl != NULL; cl = cl->next) {
+			if (cl->value.type != CHEAX_LIST || cl->value.data.as_list == NULL)
+				continue;
+			bind_pattern(c, an, cl->value.data.as_list->value);
+			collect_refs_body(c, an, cl->value.data.as_list->next);
+			an->scope.len = mark;
+		}
+	} else if (0 == strcmp(name, "do")) {
+		collect_refs_body(c, an, args);
+	} else if (0 == strcmp(name, "defsym")) {
+		/* (get ...) and (set ...) are keywords */
+		collect_refs_clauses(c, an, args->next);
+	} else if (0 == strcmp(name, "try")) {
+		/* (catch ...) and (finally ...) are keywords */
+		collect_refs(c, an, args->value);
+		collect_refs_clauses(c, an, args->next);
+	} else {
+		collect_refs_seq(c, an, args);
+	}
+
+	an->scope.len = mark;
+}
+
+/* Whether the function called is known before the body runs: a free
+ * identifier, checked by cheax_capture_env_(), or a (fn) literal */
+static bool
+static_head(struct analysis *an, struct chx_value head)
+{
+	if (head.type == CHEAX_ID)
+		return !id_set_has(&an->scope, head.data.as_id);
+
+	if (head.type != CHEAX_LIST || head.data.as_list == NULL)
+		return false;
+
+	struct chx_value fn_head = head.data.as_list->value;
+	return fn_head.type == CHEAX_SPECIAL_OP
+	    && fn_head.data.as_special_op->name != NULL
+	    && 0 == strcmp(fn_head.data.as_special_op->name, "fn");
+}
+
+static void
+collect_refs(CHEAX *c, struct analysis *an, struct chx_value v)
+{
+	switch (v.type) {
+	case CHEAX_ID:
+		if (!id_set_has(&an->scope, v.data.as_id))
+			id_set_add(c, &an->refs, v.data.as_id);
+		break;
+
+	case CHEAX_LIST:
+		if (v.data.as_list == NULL)
+			break;
+
+		struct chx_value head = v.data.as_list->value;
+		if (head.type == CHEAX_SPECIAL_OP && head.data.as_special_op->name != NULL) {
+			collect_refs_form(c, an, head.data.as_special_op->name, v.data.as_list->next);
+			break;
+		}
+
+		if (!static_head(an, head))
+			an->dyn_calls = true;
+		collect_refs_seq(c, an, v.data.as_list);
+		break;
+
+	case CHEAX_BACKQUOTE:
+	case CHEAX_COMMA:
+	case CHEAX_SPLICE:
+		collect_refs(c, an, v.data.as_quote->value);
+		break;
+
+	default:
+		/* (quote) contains data, not code */
+		break;
+	}
+}
+
+static struct closure_info *
+analyse(CHEAX *c, struct chx_list *fn_args)
+{
+	struct closure_info *ci = NULL;
+	struct analysis an = { 0 };
+
+	if (fn_args == NULL)
+		goto pad;
+
+	collect_refs_form(c, &an, "fn", fn_args);
+	cheax_ft(c, pad);
+
+	ci = cheax_malloc(c, offsetof(struct closure_info, ids) + an.refs.len * sizeof(struct chx_id *));
+	cheax_ft(c, pad);
+
+	ci->dyn_calls = an.dyn_calls;
+	ci->num_ids = an.refs.len;
+	if (an.refs.len > 0)
+		memcpy(ci->ids, an.refs.ids, an.refs.len * sizeof(struct chx_id *));
+pad:
+	cheax_free(c, an.refs.ids);
+	cheax_free(c, an.scope.ids);
+	return ci;
+}
+
+void
+cheax_closure_info_free_(CHEAX *c, struct closure_info *ci)
+{
+	cheax_free(c, ci);
+}
+
+struct closure_info *
+cheax_closure_info_(CHEAX *c, struct chx_list *fn_args)
+{
+	struct attrib *attr = cheax_attrib_get_(c, fn_args, ATTRIB_CLOSURE_INFO);
+	if (attr != NULL)
+		return attr->closure_info;
+
+	struct closure_info *ci = analyse(c, fn_args);
+	cheax_ft(c, pad);
+
+	attr = cheax_attrib_add_(c, fn_args, ATTRIB_CLOSURE_INFO);
+	if (attr == NULL) {
+		cheax_closure_info_free_(c, ci);
+		return NULL;
+	}
+
+	attr->closure_info = ci;
+	return ci;
+pad:
+	return NULL;
+}
+
+struct chx_env *
+cheax_closure_env_(CHEAX *c, struct chx_list *fn_args)
+{
+	/* Nothing to leave out */
+	if (c->env == NULL)
+		return NULL;
+
+	struct closure_info *ci = cheax_closure_info_(c, fn_args);
+	cheax_ft(c, pad);
+
+	return cheax_capture_env_(c, ci->ids, ci->num_ids, ci->dyn_calls);
+pad:
+	return NULL;
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include <cheax.h>
+
+/* Identifiers a (fn) body may look up in its enclosing environment */
+struct closure_info;
+
+/*
+ * Analyse preprocessed (fn) form, i.e. the argument list followed by
+ * the body, unless this has happened already. The result is kept as an
+ * attribute of the form.
+ */
+struct closure_info *cheax_closure_info_(CHEAX *c, struct chx_list *fn_args);
+void cheax_closure_info_free_(CHEAX *c, struct closure_info *ci);
+
+/*
+ * Environment to be captured by a function created from the given
+ * (fn) form in the current environment. Frames binding none of the
+ * identifiers the body may look up are left out, so that they don't
+ * escape.
+ */
+struct chx_env *cheax_closure_env_(CHEAX *c, struct chx_list *fn_args);
+
+#endif
@@ -79,6 +79,17 @@ set_gen_debug_info(CHEAX *c, bool value)
 	c->gen_debug_info = value;
 }
 
+static bool
+get_heap_stack(CHEAX *c)
+{
+	return c->heap_stack;
+}
+static void
+set_heap_stack(CHEAX *c, bool value)
+{
+	c->heap_stack = value;
+}
+
 static bool
 get_hyper_gc(CHEAX *c)
 {
@@ -120,6 +131,17 @@ set_mem_limit(CHEAX *c, int value)
 		c->mem_limit = value;
 }
 
+static bool
+get_optimize(CHEAX *c)
+{
+	return c->optimize;
+}
+static void
+set_optimize(CHEAX *c, bool value)
+{
+	c->optimize = value;
+}
+
 static bool
 get_tail_call_elimination(CHEAX *c)
 {
@@ -152,6 +174,15 @@ static struct config_info opts[] = {
 		"Generate debug info when reading S-expressions to "
 		"improve backtrace readability."
 	},
+	{
+		"heap-stack", CHEAX_BOOL, "<true|false>",
+		{ .get_bool = get_heap_stack },
+		{ .set_bool = set_heap_stack },
+		"Keep the continuation frames of non-tail calls on the "
+		"heap instead of the C stack, so that recursion depth is "
+		"bounded by the memory limit. Requires tail call "
+		"elimination."
+	},
 	{
 		"hyperactive-gc", CHEAX_BOOL, "<true|false>",
 		{ .get_bool = get_hyper_gc },
@@ -167,6 +198,14 @@ static struct config_info opts[] = {
 		"given as a number of bytes. Set to 0 to disable "
 		"memory limiting."
 	},
+	{
+		"optimize", CHEAX_BOOL, "<true|false>",
+		{ .get_bool = get_optimize },
+		{ .set_bool = set_optimize },
+		"Fold constants, prune constant branches and inline small "
+		"functions while preprocessing. Only read-only globals "
+		"that cannot be redefined are taken into account."
+	},
 	{
 		"stack-limit", CHEAX_INT, "N",
 		{ .get_int = get_stack_limit },
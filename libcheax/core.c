@@ -19,15 +19,28 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "attrib.h"
+#include "btree.h"
+#include "closure.h"
 #include "config.h"
 #include "core.h"
 #include "err.h"
+#include "eval.h"
 #include "feat.h"
 #include "gc.h"
+#include "gen.h"
+#include "generic.h"
+#include "hashmap.h"
 #include "htab.h"
+#include "print.h"
+#include "prof.h"
+#include "record.h"
 #include "setup.h"
+#include "strm.h"
+#include "sym.h"
 #include "types.h"
 #include "unpack.h"
+#include "vector.h"
 
 static uint32_t
 id_hash_for_htab(const struct htab_entry *item)
@@ -253,6 +266,22 @@ cheax_ext_func(CHEAX *c, const char *name, chx_func_ptr perform, void *info)
 	return res;
 }
 struct chx_value
+cheax_tail_ext_func(CHEAX *c, const char *name, chx_tail_func_ptr perform, void *info)
+{
+	if (perform == NULL || name == NULL)
+		return CHEAX_NIL;
+
+	struct tail_ext_func *tf = cheax_gc_alloc_(c, sizeof(struct tail_ext_func), CHEAX_EXT_FUNC);
+	if (tf == NULL)
+		return CHEAX_NIL;
+	tf->base.name = name;
+	tf->base.perform = cheax_tail_ext_func_perform_;
+	tf->base.info = tf;
+	tf->perform = perform;
+	tf->info = info;
+	return cheax_ext_func_value(&tf->base);
+}
+struct chx_value
 cheax_ext_func_value_proc(struct chx_ext_func *extf)
 {
 	return cheax_ext_func_value(extf);
@@ -360,6 +389,11 @@ cheax_init(void)
 	res->gen_debug_info = true;
 	res->tail_call_elimination = true;
 	res->hyper_gc = false;
+	res->optimize = false;
+	res->heap_stack = false;
+	res->tmc.first = res->tmc.last = NULL;
+	res->loop = NULL;
+	res->preproc_depth = 0;
 	res->mem_limit = 0;
 	res->stack_limit = 0;
 	res->error.code = 0;
@@ -369,6 +403,12 @@ cheax_init(void)
 	cheax_gc_register_finalizer_(res, CHEAX_ID,   id_fin);
 	cheax_gc_register_finalizer_(res, CHEAX_ENV, cheax_env_fin_);
 	cheax_gc_register_finalizer_(res, CHEAX_LIST, (chx_fin)cheax_attrib_remove_all_);
+	cheax_gc_register_finalizer_(res, CHEAX_BACKQUOTE, (chx_fin)cheax_attrib_remove_all_);
+	cheax_gc_register_finalizer_(res, CHEAX_EXT_FUNC, cheax_generic_fin_);
+	cheax_gc_register_finalizer_(res, CHEAX_GENERATOR, cheax_gen_fin_);
+	cheax_gc_register_finalizer_(res, CHEAX_VECTOR, cheax_vector_fin_);
+	cheax_gc_register_finalizer_(res, CHEAX_HASHMAP, cheax_hashmap_fin_);
+	cheax_gc_register_finalizer_(res, CHEAX_ORDERED_MAP, cheax_omap_fin_);
 
 	res->global_ns.rtflags = 0;
 	cheax_norm_env_init_(res, &res->global_ns, NULL);
@@ -389,6 +429,21 @@ cheax_init(void)
 	res->user_error_names.array = NULL;
 	res->user_error_names.len = res->user_error_names.cap = 0;
 
+	res->hstack.array = NULL;
+	res->hstack.len = res->hstack.cap = 0;
+	res->hstack.free_args = NULL;
+
+	memset(&res->env_pool, 0, sizeof(res->env_pool));
+	memset(&res->gen, 0, sizeof(res->gen));
+
+	res->prof = NULL;
+	res->prof_runs = 0;
+
+	cheax_budget_init_(res);
+
+	memset(&res->hooks, 0, sizeof(res->hooks));
+	res->trace_calls = false;
+
 	/* This is a bit hacky; we declare the these types as aliases
 	 * in the typestore, while at the same time we have the
 	 * CHEAX_... constants. Bacause CHEAX_TYPECODE is the same
@@ -406,6 +461,10 @@ cheax_init(void)
 	res->std_ids[DEFSET_ID]  = cheax_id(res, "defset").data.as_id;
 	res->std_ids[CATCH_ID]   = cheax_id(res, "catch").data.as_id;
 	res->std_ids[FINALLY_ID] = cheax_id(res, "finally").data.as_id;
+	res->std_ids[DEF_ID]     = cheax_id(res, "def").data.as_id;
+	res->std_ids[VAR_ID]     = cheax_id(res, "var").data.as_id;
+	res->std_ids[DEFSYM_ID]  = cheax_id(res, "defsym").data.as_id;
+	res->std_ids[RECUR_ID]   = cheax_id(res, "recur").data.as_id;
 
 	return res;
 }
@@ -420,16 +479,21 @@ cheax_destroy(CHEAX *c)
 		}
 	}
 
+	cheax_prof_cleanup_(c);
 	cheax_gc_cleanup_(c);
 	cheax_norm_env_cleanup_(c, &c->global_ns);
 	cheax_norm_env_cleanup_(c, &c->specop_ns);
 	cheax_norm_env_cleanup_(c, &c->macro_ns);
+	cheax_env_pool_cleanup_(c);
 	cheax_attrib_cleanup_(c);
 
 	cheax_free(c, c->bt.array);
+	cheax_free(c, c->hstack.array);
 
-	for (size_t i = 0; i < c->typestore.len; ++i)
+	for (size_t i = 0; i < c->typestore.len; ++i) {
 		cheax_free(c, c->typestore.array[i].name);
+		cheax_record_info_free_(c, c->typestore.array[i].record);
+	}
 	cheax_free(c, c->typestore.array);
 
 	for (size_t i = 0; i < c->user_error_names.len; ++i)
@@ -442,6 +506,26 @@ cheax_destroy(CHEAX *c)
 
 	free(c);
 }
+
+void
+cheax_set_hooks(CHEAX *c, const struct chx_hooks *hooks)
+{
+	if (hooks == NULL)
+		memset(&c->hooks, 0, sizeof(c->hooks));
+	else
+		c->hooks = *hooks;
+
+	cheax_update_trace_calls_(c);
+}
+
+void
+cheax_update_trace_calls_(CHEAX *c)
+{
+	c->trace_calls = c->prof != NULL
+	              || c->hooks.enter != NULL
+	              || c->hooks.exit != NULL;
+}
+
 const char *
 cheax_version(void)
 {
@@ -563,8 +647,10 @@ cheax_new_type(CHEAX *c, const char *name, int base_type)
 	struct type_alias alias = { 0 };
 	alias.name = store_name;
 	alias.base_type = base_type;
+	alias.resolved_type = cheax_resolve_type(c, base_type);
 	alias.print = NULL;
 	alias.casts = NULL;
+	alias.record = NULL;
 	c->typestore.array[ts_idx] = alias;
 	++c->typestore.len;
 
@@ -614,21 +700,17 @@ cheax_get_base_type(CHEAX *c, int type)
 int
 cheax_resolve_type(CHEAX *c, int type)
 {
-	while (type > CHEAX_LAST_BASIC_TYPE) {
-		int base_type = cheax_get_base_type(c, type);
-
-		if (base_type == -1)
-			return -1;
-
-		if (base_type == type) {
-			cheax_throwf(c, CHEAX_EEVAL, "resolve_type(): unable to resolve type");
-			return -1;
-		}
+	if (type <= CHEAX_LAST_BASIC_TYPE)
+		return type;
 
-		type = base_type;
+	if (!cheax_is_user_type(c, type)) {
+		cheax_throwf(c, CHEAX_EEVAL, "resolve_type(): unable to resolve type");
+		return -1;
 	}
 
-	return type;
+	/* Base types never change, so cheax_new_type() resolves ahead
+	 * of time */
+	return c->typestore.array[type - CHEAX_TYPESTORE_BIAS].resolved_type;
 }
 
 bool
@@ -700,6 +782,9 @@ create_func(CHEAX *c, struct chx_list *args)
 		return CHEAX_NIL;
 	}
 
+	struct chx_env *lexenv = cheax_closure_env_(c, args);
+	cheax_ft(c, pad);
+
 	struct chx_value res;
 	res.type = CHEAX_FUNC;
 	res.data.as_func = cheax_gc_alloc_(c, sizeof(struct chx_func), CHEAX_FUNC);
@@ -708,8 +793,11 @@ create_func(CHEAX *c, struct chx_list *args)
 
 	res.data.as_func->args = arg_list;
 	res.data.as_func->body = body;
-	res.data.as_func->lexenv = cheax_env(c).data.as_env;
+	res.data.as_func->lexenv = lexenv;
+	cheax_init_params_(c, res.data.as_func);
 	return res;
+pad:
+	return CHEAX_NIL;
 }
 
 static struct chx_value
@@ -720,7 +808,10 @@ bltn_defmacro(CHEAX *c, struct chx_list *args, void *info)
 		return CHEAX_NIL;
 
 	static const uint8_t ops[] = { PP_SEQ, PP_EXPR, };
+	int pp_loop_depth = c->pp_loop_depth;
+	c->pp_loop_depth = 0;
 	struct chx_value args_pp = cheax_preproc_pattern_(c, cheax_list_value(args), ops, NULL);
+	c->pp_loop_depth = pp_loop_depth;
 	cheax_ft(c, pad);
 
 	struct chx_value macro = cheax_bt_wrap_(c, create_func(c, args_pp.data.as_list));
@@ -754,7 +845,18 @@ pp_sf_fn(CHEAX *c, struct chx_list *args, void *info)
 		"expected body",
 	};
 
-	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+	/* (recur) can't reach a (loop) around the function */
+	int pp_loop_depth = c->pp_loop_depth;
+	c->pp_loop_depth = 0;
+	struct chx_value res = cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+	c->pp_loop_depth = pp_loop_depth;
+	cheax_ft(c, pad);
+
+	/* find out what to capture ahead of time */
+	if (res.type == CHEAX_LIST && res.data.as_list != NULL)
+		cheax_closure_info_(c, res.data.as_list);
+pad:
+	return res;
 }
 
 static struct chx_list *
@@ -777,8 +879,8 @@ pad:
 	return NULL;
 }
 
-static struct chx_value
-bltn_prepend(CHEAX *c, struct chx_list *args, void *info)
+struct chx_value
+cheax_bltn_prepend_(CHEAX *c, struct chx_list *args, void *info)
 {
 	if (args == NULL) {
 		cheax_throwf(c, CHEAX_EMATCH, "expected at least one argument");
@@ -797,6 +899,136 @@ bltn_type_of(CHEAX *c, struct chx_list *args, void *info)
 	     : CHEAX_NIL;
 }
 
+/*
+ * Resolve types that refer to read-only global type codes, leaving the
+ * rest for runtime. This happens on first use rather than during
+ * preprocessing, since only then do we know whether type names are
+ * shadowed.
+ */
+static void
+compile_type_check(CHEAX *c, struct chx_list *types, struct attrib_type_check *tc)
+{
+	*tc = (struct attrib_type_check){ 0 };
+
+	for (; types != NULL; types = types->next) {
+		struct chx_value ty;
+		if (types->value.type != CHEAX_ID
+		 || !cheax_try_get_const_global_(c, types->value.data.as_id, &ty)
+		 || ty.type != CHEAX_TYPECODE
+		 || !cheax_is_valid_type(c, ty.data.as_int))
+		{
+			tc->dynamic = true;
+		} else if (cheax_is_basic_type(c, ty.data.as_int)) {
+			tc->basic |= 1u << ty.data.as_int;
+		} else if (tc->num_user < TYPE_CHECK_MAX_USER) {
+			tc->user[tc->num_user++] = ty.data.as_int;
+		} else {
+			tc->dynamic = true;
+		}
+	}
+}
+
+static struct attrib_type_check *
+get_type_check(CHEAX *c, struct chx_list *args)
+{
+	struct attrib *attr = cheax_attrib_get_(c, args, ATTRIB_TYPE_CHECK);
+	if (attr == NULL) {
+		attr = cheax_attrib_add_(c, args, ATTRIB_TYPE_CHECK);
+		if (attr == NULL)
+			return NULL;
+		compile_type_check(c, args->next, &attr->type_check);
+	}
+	return &attr->type_check;
+}
+
+static bool
+type_check_matches(CHEAX *c, struct attrib_type_check *tc, int type, struct chx_list *types)
+{
+	if (type >= 0 && type <= CHEAX_LAST_BASIC_TYPE) {
+		if (has_flag(tc->basic, 1u << type))
+			return true;
+	} else {
+		for (int i = 0; i < tc->num_user; ++i)
+			if (tc->user[i] == type)
+				return true;
+	}
+
+	if (!tc->dynamic)
+		return false;
+
+	for (; types != NULL; types = types->next) {
+		struct chx_value ty = cheax_eval(c, types->value);
+		cheax_ft(c, pad);
+		if (cheax_eq(c, typecode(type), ty))
+			return true;
+	}
+pad:
+	return false;
+}
+
+static void
+throw_type_error(CHEAX *c, struct chx_value what, struct chx_list *types)
+{
+	struct sostrm ss;
+	cheax_sostrm_init_(&ss, c);
+
+	cheax_ostrm_putc_(&ss.strm, '`');
+	cheax_ostrm_show_(c, &ss.strm, what);
+	cheax_ostrm_printf_(&ss.strm, "' must have type ");
+	for (; types != NULL; types = types->next) {
+		cheax_ostrm_show_(c, &ss.strm, types->value);
+		if (types->next != NULL)
+			cheax_ostrm_printf_(&ss.strm, " or ");
+	}
+
+	struct chx_value msg = cheax_nstring(c, ss.buf, ss.idx);
+	cheax_free(c, ss.buf);
+	cheax_ft(c, pad);
+
+	cheax_throw(c, CHEAX_ETYPE, msg.data.as_string);
+	cheax_add_bt(c);
+pad:
+	return;
+}
+
+static int
+sf_check_type(CHEAX *c, struct chx_list *args, void *info, struct chx_env *ps, union chx_eval_out *out)
+{
+	out->value = CHEAX_NIL;
+
+	struct chx_value what;
+	struct chx_list *types;
+	if (cheax_unpack_(c, args, "__+", &what, &types) < 0)
+		return CHEAX_VALUE_OUT;
+
+	struct attrib_type_check *tc = get_type_check(c, args);
+	cheax_ft(c, pad);
+
+	struct chx_value val = cheax_eval(c, what);
+	cheax_ft(c, pad);
+
+	if (!type_check_matches(c, tc, val.type, types) && cheax_errno(c) == 0)
+		throw_type_error(c, what, types);
+pad:
+	return CHEAX_VALUE_OUT;
+}
+
+static struct chx_value
+pp_sf_check_type(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* (node EXPR (node EXPR (seq EXPR))) */
+	static const uint8_t ops[] = {
+		PP_NODE | PP_ERR(0), PP_EXPR, PP_NODE | PP_ERR(1), PP_EXPR, PP_SEQ, PP_EXPR,
+	};
+
+	static const char *errors[] = {
+		"expected value",
+		"expected type",
+	};
+
+	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+}
+
 static struct chx_value
 bltn_string_bytes(CHEAX *c, struct chx_list *args, void *info)
 {
@@ -849,9 +1081,10 @@ cheax_export_core_bltns_(CHEAX *c)
 	cheax_def(c, "defmacro", cheax_ext_func(c, "defmacro", bltn_defmacro, NULL), CHEAX_READONLY);
 	c->env = prev_env;
 
-	cheax_defsyntax(c, "fn", sf_fn, pp_sf_fn, NULL);
+	cheax_defsyntax(c, "fn",         sf_fn,         pp_sf_fn,         NULL);
+	cheax_defsyntax(c, "check-type", sf_check_type, pp_sf_check_type, NULL);
 
-	cheax_defun(c, ":",             bltn_prepend,       NULL);
+	cheax_defun(c, ":",             cheax_bltn_prepend_, NULL);
 	cheax_defun(c, "type-of",       bltn_type_of,       NULL);
 	cheax_defun(c, "string-bytes",  bltn_string_bytes,  NULL);
 	cheax_defun(c, "string-length", bltn_string_length, NULL);
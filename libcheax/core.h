@@ -17,6 +17,7 @@
 #define CORE_H
 
 #include "attrib.h"
+#include "budget.h"
 #include "gc.h"
 #include "types.h"
 #include "sym.h"
@@ -39,16 +40,23 @@
 enum {
 	GC_BIT           = 0x0001, /* allocated by gc */
 	GC_MARKED        = 0x0002, /* marked in use by gc (temporary) */
-	REF_BIT          = 0x0004, /* carries cheax_ref() */
+	SEALED_BIT       = 0x0004, /* chx_env gains no more bindings */
 	NO_ESC_BIT       = 0x0008, /* chx_env presumed not to have escaped */
 	PREPROC_BIT      = 0x0010, /* This form has been preprocessed */
-	FIRST_ATTRIB_BIT = 0x0020,
+	PURE_BIT         = 0x0020, /* chx_ext_func has no side effects */
+	FIRST_ATTRIB_BIT = 0x0040,
 	LAST_ATTRIB_BIT  = FIRST_ATTRIB_BIT << ATTRIB_LAST,
 	ATTRIB_BITS      = ((LAST_ATTRIB_BIT << 1) - 1) & ~(FIRST_ATTRIB_BIT - 1),
 };
 
 #define ATTRIB_BIT(attr) (FIRST_ATTRIB_BIT << (attr))
 
+/* cheax_ref() count, kept in the upper bits of rtflags. A count rather
+ * than a single bit, since generators interleave the refs taken on
+ * their own C stacks with those of their callers. */
+#define REF_ONE  0x10000u
+#define REF_BITS (~(REF_ONE - 1u))
+
 static inline bool
 has_flag(int i, int f)
 {
@@ -59,6 +67,9 @@ void cheax_set_orig_form_(CHEAX *c, void *key, struct chx_list *orig_form);
 
 struct chx_id *cheax_find_id_(CHEAX *c, const char *name);
 
+/* the `:' builtin, which the evaluator recognizes for tail modulo cons */
+struct chx_value cheax_bltn_prepend_(CHEAX *c, struct chx_list *args, void *info);
+
 struct type_cast {
 	int to;
 	chx_func_ptr cast;
@@ -66,9 +77,15 @@ struct type_cast {
 	struct type_cast *next;
 };
 
+struct record_info;
+
 struct type_alias {
 	char *name;
 	int base_type;
+	/* basic type that base_type resolves to, see cheax_resolve_type() */
+	int resolved_type;
+	/* slot names and accessors, for types made by (defrecord) */
+	struct record_info *record;
 
 	chx_func_ptr print;
 
@@ -81,8 +98,23 @@ enum {
 	DEFSET_ID,
 	CATCH_ID,
 	FINALLY_ID,
+	DEF_ID,
+	VAR_ID,
+	DEFSYM_ID,
+	RECUR_ID,
+
+	NUM_STD_IDS = RECUR_ID + 1,
+};
 
-	NUM_STD_IDS = FINALLY_ID + 1,
+struct heap_frame;
+struct loop_frame;
+struct prof_info;
+
+struct heap_stack {
+	struct heap_frame *array;
+	size_t len, cap;
+	/* argument list cells up for reuse */
+	struct chx_list *free_args;
 };
 
 struct cheax {
@@ -106,9 +138,23 @@ struct cheax {
 
 	/* see config.c for explanation of these fields */
 	int features;
-	bool allow_redef, gen_debug_info, tail_call_elimination, hyper_gc;
+	bool allow_redef, gen_debug_info, tail_call_elimination, hyper_gc, optimize;
+	bool heap_stack;
 	int mem_limit, stack_limit;
 
+	/* cons cells handed from eval_sexpr() to wrap_tail_eval() for
+	 * tail modulo cons, see eval.c */
+	struct {
+		struct chx_list *first, *last;
+	} tmc;
+
+	/* nesting depth of cheax_preproc(), to optimize top-level forms only */
+	int preproc_depth;
+
+	/* number of (loop) bodies lexically around the form being
+	 * preprocessed, see pp_sf_loop() */
+	int pp_loop_depth;
+
 	/* file handle type code */
 	int fhandle_type;
 
@@ -119,6 +165,34 @@ struct cheax {
 
 	struct htab interned_ids;
 
+	/* continuation frames of heap-stack evaluator */
+	struct heap_stack hstack;
+
+	/* innermost (loop) being evaluated, see eval.c */
+	struct loop_frame *loop;
+
+	/* see gen.c */
+	struct {
+		/* innermost running generator, or NULL */
+		struct chx_generator *running;
+		/* generators with a coroutine in progress */
+		struct chx_generator *live;
+		/* unreachable generators, yet to be cancelled */
+		struct chx_generator *abandoned;
+		bool cancelling;
+		/* lowest C stack address evaluation may use within the
+		 * running generator, or 0 outside of generators */
+		uintptr_t stack_floor;
+	} gen;
+
+	/* recycled environment frames and symbols, see sym.c */
+	struct {
+		struct chx_env *frames; /* linked through value.norm.below */
+		struct full_sym *syms;  /* linked through entry.next */
+		int num_frames, num_syms;
+		size_t frame_hits, frame_misses, sym_hits, sym_misses;
+	} env_pool;
+
 	struct {
 		struct bt_entry {
 			struct attrib_loc info;
@@ -142,6 +216,19 @@ struct cheax {
 
 	struct gc_info gc;
 
+	/* running profiler, or NULL, see prof.c */
+	struct prof_info *prof;
+	unsigned prof_runs;
+
+	/* see cheax_eval_with_budget() */
+	struct budget_info budget;
+
+	/* see cheax_set_hooks() */
+	struct chx_hooks hooks;
+
+	/* whether hooks or profiler need to know about calls */
+	bool trace_calls;
+
 	attrib_info attribs;
 
 	struct chx_id *std_ids[NUM_STD_IDS];
@@ -149,6 +236,8 @@ struct cheax {
 	struct chx_sym **config_syms;
 };
 
+void cheax_update_trace_calls_(CHEAX *c);
+
 /* v-to-i: value to int */
 bool cheax_try_vtoi_(struct chx_value value, chx_int *res);
 /* v-to-d: value to double */
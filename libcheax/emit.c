@@ -0,0 +1,1247 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "attrib.h"
+#include "core.h"
+#include "err.h"
+#include "eval.h"
+#include "print.h"
+#include "sym.h"
+
+/*
+ * Translation of cheax source to C. Each top-level form is read,
+ * preprocessed and then written out as a C expression that rebuilds
+ * the preprocessed form through the public API. The generated module
+ * feeds these forms back through cheax_preproc() and cheax_eval(), but
+ * without the reader or any macro expansion.
+ *
+ * Top-level function definitions, (def NAME (fn (PARAMS...) BODY...)),
+ * are moreover compiled to C if the parameters are distinct
+ * identifiers and the body only consists of the special forms handled
+ * by compile_form() and of function calls. NAME is then bound to an
+ * external function made with cheax_tail_ext_func() instead, in which
+ * parameters and (let) bindings are C variables, and integer
+ * arithmetic and comparisons are done in place. Other calls are handed
+ * to the evaluator as forms of their already evaluated arguments; in
+ * tail position, they are returned to the evaluator's trampoline
+ * rather than made from C, so that tail call elimination carries over.
+ *
+ * Identifiers a compiled function doesn't bind itself are looked up in
+ * the global scope. If the module is loaded in any other scope, the
+ * rebuilt definition is evaluated as is.
+ */
+
+/* ISO C only guarantees string literals of up to 4095 characters */
+#define MAX_LITERAL 4095
+
+static const char emit_prologue[] =
+	"#include <cheax.h>\n"
+	"#include <math.h>\n"
+	"\n"
+	"#define N        CHEAX_NIL\n"
+	"#define I(X)     cheax_int(X)\n"
+	"#define D(X)     cheax_double(X)\n"
+	"#define T        cheax_true()\n"
+	"#define F        cheax_false()\n"
+	"#define Y(X)     cheax_id(c, X)\n"
+	"#define S(X, L)  cheax_nstring(c, X, L)\n"
+	"#define Q(X)     cheax_quote(c, X)\n"
+	"#define BQ(X)    cheax_backquote(c, X)\n"
+	"#define CM(X)    cheax_comma(c, X)\n"
+	"#define SP(X)    cheax_splice(c, X)\n"
+	"#define L(A, B)  cheax_list(c, A, (B).data.as_list)\n"
+	"#define CAST(X, T) cheax_cast(c, X, T)\n"
+	"#define LOC(X, LN, POS) loc(c, X, LN, POS)\n"
+	"#define DOC(X, S) doc(c, X, S)\n"
+	"\n"
+	"int cheax_module_init(CHEAX *c);\n"
+	"\n"
+	"static struct chx_value\n"
+	"loc(CHEAX *c, struct chx_value v, int line, int pos)\n"
+	"{\n"
+	"\tif (v.type == CHEAX_LIST && v.data.as_list != NULL)\n"
+	"\t\tcheax_set_loc(c, v.data.as_list, source_path, line, pos);\n"
+	"\treturn v;\n"
+	"}\n"
+	"\n"
+	"static struct chx_value\n"
+	"doc(CHEAX *c, struct chx_value v, struct chx_value doc)\n"
+	"{\n"
+	"\tif (v.type == CHEAX_LIST && v.data.as_list != NULL)\n"
+	"\t\tcheax_set_doc(c, v.data.as_list, doc.data.as_string);\n"
+	"\treturn v;\n"
+	"}\n"
+	"\n"
+	"static struct chx_value\n"
+	"compiled(CHEAX *c, struct chx_value def, const char *name, chx_tail_func_ptr perform)\n"
+	"{\n"
+	"\tif (cheax_errno(c) == 0 && cheax_is_nil(cheax_env(c)))\n"
+	"\t\tdef.data.as_list->next->next->value = cheax_tail_ext_func(c, name, perform, NULL);\n"
+	"\treturn def;\n"
+	"}\n";
+
+static const char emit_epilogue[] =
+	"int\n"
+	"cheax_module_init(CHEAX *c)\n"
+	"{\n"
+	"\tfor (size_t i = 0; forms[i] != NULL; ++i) {\n"
+	"\t\tstruct chx_value v = forms[i](c);\n"
+	"\t\tif (cheax_errno(c) != 0)\n"
+	"\t\t\treturn -1;\n"
+	"\n"
+	"\t\tv = cheax_preproc(c, v);\n"
+	"\t\tif (cheax_errno(c) != 0)\n"
+	"\t\t\treturn -1;\n"
+	"\n"
+	"\t\tcheax_eval(c, v);\n"
+	"\t\tif (cheax_errno(c) != 0)\n"
+	"\t\t\treturn -1;\n"
+	"\t}\n"
+	"\n"
+	"\treturn 0;\n"
+	"}\n";
+
+/*
+ * Run-time support of compiled functions, emitted after the epilogue
+ * as far as it is used.
+ */
+
+enum {
+	HELPER_CALL_FORM = 1 << 0,
+	HELPER_CALL      = 1 << 1,
+	HELPER_TAIL_CALL = 1 << 2,
+	HELPER_TEST      = 1 << 3,
+	HELPER_BUILTIN   = 1 << 4,
+	HELPER_TYPE_ERR  = 1 << 5,
+	HELPER_FIRST_OP  = 6, /* bit of arith_ops[0] */
+};
+
+static const char helper_call_form[] =
+	"\n"
+	"static struct chx_value\n"
+	"call_form(CHEAX *c, struct chx_value f, int argc, struct chx_value *argv)\n"
+	"{\n"
+	"\t/* Arguments have been evaluated in the wrong scope for this */\n"
+	"\tif (f.type == CHEAX_ENV) {\n"
+	"\t\tcheax_throwf(c, CHEAX_ETYPE, \"cannot call environment from compiled function\");\n"
+	"\t\tcheax_add_bt(c);\n"
+	"\t\treturn N;\n"
+	"\t}\n"
+	"\n"
+	"\tstruct chx_value form = N;\n"
+	"\tfor (int i = argc - 1; i >= 0; --i) {\n"
+	"\t\tstruct chx_value v = argv[i];\n"
+	"\t\tswitch (v.type) {\n"
+	"\t\tcase CHEAX_LIST:\n"
+	"\t\t\tif (v.data.as_list == NULL)\n"
+	"\t\t\t\tbreak;\n"
+	"\t\t\t/* fall through */\n"
+	"\t\tcase CHEAX_ID:\n"
+	"\t\tcase CHEAX_QUOTE:\n"
+	"\t\tcase CHEAX_BACKQUOTE:\n"
+	"\t\tcase CHEAX_COMMA:\n"
+	"\t\tcase CHEAX_SPLICE:\n"
+	"\t\t\tv = Q(v);\n"
+	"\t\t\tbreak;\n"
+	"\t\t}\n"
+	"\t\tform = L(v, form);\n"
+	"\t}\n"
+	"\treturn L(f, form);\n"
+	"}\n";
+
+static const char helper_call[] =
+	"\n"
+	"static struct chx_value\n"
+	"call(CHEAX *c, struct chx_value f, int argc, struct chx_value *argv)\n"
+	"{\n"
+	"\tstruct chx_value form = call_form(c, f, argc, argv);\n"
+	"\treturn (cheax_errno(c) == 0) ? cheax_eval(c, form) : N;\n"
+	"}\n";
+
+static const char helper_tail_call[] =
+	"\n"
+	"static int\n"
+	"tail_call(CHEAX *c, struct chx_value f, int argc, struct chx_value *argv,\n"
+	"          struct chx_env *pop_stop, union chx_eval_out *out)\n"
+	"{\n"
+	"\tstruct chx_value form = call_form(c, f, argc, argv);\n"
+	"\tif (cheax_errno(c) != 0) {\n"
+	"\t\tout->value = N;\n"
+	"\t\treturn CHEAX_VALUE_OUT;\n"
+	"\t}\n"
+	"\n"
+	"\tout->ts.tail = form;\n"
+	"\tout->ts.pop_stop = pop_stop;\n"
+	"\treturn CHEAX_TAIL_OUT;\n"
+	"}\n";
+
+static const char helper_test[] =
+	"\n"
+	"static int\n"
+	"test(CHEAX *c, struct chx_value v)\n"
+	"{\n"
+	"\tif (v.type == CHEAX_BOOL)\n"
+	"\t\treturn v.data.as_int != 0;\n"
+	"\n"
+	"\tcheax_throwf(c, CHEAX_ETYPE, \"test must have boolean value\");\n"
+	"\tcheax_add_bt(c);\n"
+	"\treturn -1;\n"
+	"}\n";
+
+static const char helper_builtin[] =
+	"\n"
+	"static struct chx_value\n"
+	"builtin(CHEAX *c, const char *name, struct chx_value l, struct chx_value r)\n"
+	"{\n"
+	"\tstruct chx_value f = cheax_get_from(c, NULL, name);\n"
+	"\treturn (cheax_errno(c) == 0) ? call(c, f, 2, (struct chx_value[]){ l, r }) : N;\n"
+	"}\n";
+
+static const char helper_type_err[] =
+	"\n"
+	"static void\n"
+	"type_err(CHEAX *c, const char *msg, size_t len)\n"
+	"{\n"
+	"\tstruct chx_value str = S(msg, len);\n"
+	"\tif (cheax_errno(c) == 0) {\n"
+	"\t\tcheax_throw(c, CHEAX_ETYPE, str.data.as_string);\n"
+	"\t\tcheax_add_bt(c);\n"
+	"\t}\n"
+	"}\n";
+
+static const char helper_params[] =
+	"\n"
+	"static int\n"
+	"params(CHEAX *c, struct chx_list *args, int n, struct chx_value *argv)\n"
+	"{\n"
+	"\tint i;\n"
+	"\tfor (i = 0; i < n && args != NULL; ++i, args = args->next)\n"
+	"\t\targv[i] = args->value;\n"
+	"\n"
+	"\tif (i == n && args == NULL)\n"
+	"\t\treturn 0;\n"
+	"\n"
+	"\tcheax_throwf(c, CHEAX_EMATCH, \"invalid (number of) arguments\");\n"
+	"\tcheax_add_bt(c);\n"
+	"\treturn -1;\n"
+	"}\n"
+	"\n"
+	"static void\n"
+	"unref_all(CHEAX *c, struct chx_value *t, chx_ref *r, int n)\n"
+	"{\n"
+	"\tfor (int i = 0; i < n; ++i)\n"
+	"\t\tcheax_unref(c, t[i], r[i]);\n"
+	"}\n";
+
+/*
+ * Binary built-in functions applied in place to integers a and b if
+ * cond holds, falling back to calling the built-in otherwise.
+ */
+static const struct arith_op {
+	const char *name, *helper, *cond, *result;
+} arith_ops[] = {
+	{ "+",  "op_add", "(b >= 0) ? a <= CHX_INT_MAX - b : a >= CHX_INT_MIN - b", "I(a + b)" },
+	{ "-",  "op_sub", "(b >= 0) ? a >= CHX_INT_MIN + b : a <= CHX_INT_MAX + b", "I(a - b)" },
+	{ "*",  "op_mul", "a >= -INT32_MAX && a <= INT32_MAX && b >= -INT32_MAX && b <= INT32_MAX",
+	                  "I(a * b)" },
+	{ "<",  "op_lt",  NULL, "cheax_bool(a < b)"  },
+	{ "<=", "op_le",  NULL, "cheax_bool(a <= b)" },
+	{ ">",  "op_gt",  NULL, "cheax_bool(a > b)"  },
+	{ ">=", "op_ge",  NULL, "cheax_bool(a >= b)" },
+	{ "=",  "op_eq",  NULL, "cheax_bool(a == b)" },
+	{ "!=", "op_ne",  NULL, "cheax_bool(a != b)" },
+};
+
+static void
+emit_arith_op(FILE *out, const struct arith_op *op)
+{
+	fprintf(out, "\nstatic struct chx_value\n"
+	             "%s(CHEAX *c, struct chx_value l, struct chx_value r)\n"
+	             "{\n"
+	             "\tif (l.type == CHEAX_INT && r.type == CHEAX_INT) {\n"
+	             "\t\tchx_int a = l.data.as_int, b = r.data.as_int;\n",
+	        op->helper);
+	if (op->cond != NULL)
+		fprintf(out, "\t\tif (%s)\n\t\t\treturn %s;\n", op->cond, op->result);
+	else
+		fprintf(out, "\t\treturn %s;\n", op->result);
+	fprintf(out, "\t}\n"
+	             "\treturn builtin(c, \"%s\", l, r);\n"
+	             "}\n",
+	        op->name);
+}
+
+static void
+emit_helpers(FILE *out, unsigned helpers)
+{
+	if (helpers & HELPER_CALL_FORM)
+		fputs(helper_call_form, out);
+	if (helpers & HELPER_CALL)
+		fputs(helper_call, out);
+	if (helpers & HELPER_TAIL_CALL)
+		fputs(helper_tail_call, out);
+	if (helpers & HELPER_TEST)
+		fputs(helper_test, out);
+	if (helpers & HELPER_BUILTIN)
+		fputs(helper_builtin, out);
+	if (helpers & HELPER_TYPE_ERR)
+		fputs(helper_type_err, out);
+
+	for (size_t i = 0; i < sizeof(arith_ops) / sizeof(arith_ops[0]); ++i)
+		if (helpers & (1u << (HELPER_FIRST_OP + i)))
+			emit_arith_op(out, &arith_ops[i]);
+
+	fputs(helper_params, out);
+}
+
+static void
+emit_indent(FILE *out, int depth)
+{
+	fputc('\n', out);
+	for (int i = 0; i < depth; ++i)
+		fputc('\t', out);
+}
+
+static void
+emit_cstr(FILE *out, const char *str, size_t len)
+{
+	if (len > MAX_LITERAL) {
+		/* Too long for a string literal; use a compound literal */
+		fputs("(const char *)(const unsigned char[]){ ", out);
+		for (size_t i = 0; i < len; ++i)
+			fprintf(out, "%s%u", (i == 0) ? "" : ",", (unsigned)str[i] & 0xFFu);
+		fputs(" }", out);
+		return;
+	}
+
+	fputc('"', out);
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char ch = str[i];
+		if (ch == '"' || ch == '\\' || ch == '?')
+			fprintf(out, "\\%c", ch);
+		else if (ch >= 0x20 && ch < 0x7F)
+			fputc(ch, out);
+		else
+			fprintf(out, "\\%03o", ch);
+	}
+	fputc('"', out);
+}
+
+static void
+emit_string(FILE *out, struct chx_string *str)
+{
+	fputs("S(", out);
+	emit_cstr(out, str->value, str->len);
+	fprintf(out, ", %zu)", str->len);
+}
+
+static void
+emit_double(FILE *out, chx_double d)
+{
+	if (isnan(d))
+		fputs("D(NAN)", out);
+	else if (isinf(d))
+		fputs((d < 0) ? "D(-INFINITY)" : "D(INFINITY)", out);
+	else
+		fprintf(out, "D(%a)", d);
+}
+
+static void
+emit_int(FILE *out, chx_int i)
+{
+	if (i == CHX_INT_MIN)
+		fputs("I(CHX_INT_MIN)", out);
+	else
+		fprintf(out, "I(INT64_C(%" PRIdCHX "))", i);
+}
+
+static int emit_value(CHEAX *c, FILE *out, struct chx_value v, int depth);
+
+static struct attrib *
+find_attrib(CHEAX *c, struct chx_list *lst, enum attrib_kind kind)
+{
+	struct attrib *attr = cheax_attrib_get_(c, lst, kind);
+	if (attr != NULL)
+		return attr;
+
+	struct attrib *orig = cheax_attrib_get_(c, lst, ATTRIB_ORIG_FORM);
+	return (orig != NULL) ? cheax_attrib_get_(c, orig->orig_form, kind) : NULL;
+}
+
+static int
+emit_list(CHEAX *c, FILE *out, struct chx_list *lst, int depth)
+{
+	struct attrib *doc = find_attrib(c, lst, ATTRIB_DOC);
+	struct attrib *loc = find_attrib(c, lst, ATTRIB_LOC);
+
+	if (doc != NULL)
+		fputs("DOC(", out);
+	if (loc != NULL)
+		fputs("LOC(", out);
+
+	int count = 0;
+	for (; lst != NULL; lst = lst->next, ++count) {
+		fputs("L(", out);
+		if (emit_value(c, out, lst->value, depth + 1) < 0)
+			return -1;
+		fputs(", ", out);
+	}
+
+	fputc('N', out);
+	for (; count > 0; --count)
+		fputc(')', out);
+
+	if (loc != NULL)
+		fprintf(out, ", %d, %d)", loc->loc.line, loc->loc.pos);
+	if (doc != NULL) {
+		fputs(", ", out);
+		emit_string(out, doc->doc);
+		fputc(')', out);
+	}
+
+	return 0;
+}
+
+static int
+emit_quote(CHEAX *c, FILE *out, const char *macro, struct chx_quote *quote, int depth)
+{
+	fprintf(out, "%s(", macro);
+	if (emit_value(c, out, quote->value, depth) < 0)
+		return -1;
+	fputc(')', out);
+	return 0;
+}
+
+static int
+emit_value(CHEAX *c, FILE *out, struct chx_value v, int depth)
+{
+	int ty = cheax_resolve_type(c, v.type);
+	bool cast = (v.type != ty);
+
+	if (cast) {
+		/* Only the built-in type aliases have stable type codes */
+		if (v.type != CHEAX_TYPECODE && v.type != CHEAX_ERRORCODE)
+			goto cannot_emit;
+		fputs("CAST(", out);
+	}
+
+	switch (ty) {
+	case CHEAX_LIST:
+		if (v.data.as_list == NULL) {
+			fputc('N', out);
+			break;
+		}
+
+		emit_indent(out, depth);
+		if (emit_list(c, out, v.data.as_list, depth) < 0)
+			return -1;
+		break;
+	case CHEAX_INT:
+		emit_int(out, v.data.as_int);
+		break;
+	case CHEAX_BOOL:
+		fputc(v.data.as_int ? 'T' : 'F', out);
+		break;
+	case CHEAX_DOUBLE:
+		emit_double(out, v.data.as_double);
+		break;
+	case CHEAX_ID:
+		fputs("Y(", out);
+		emit_cstr(out, v.data.as_id->value, strlen(v.data.as_id->value));
+		fputc(')', out);
+		break;
+	case CHEAX_STRING:
+		emit_string(out, v.data.as_string);
+		break;
+	case CHEAX_QUOTE:
+		return emit_quote(c, out, "Q", v.data.as_quote, depth);
+	case CHEAX_BACKQUOTE:
+		return emit_quote(c, out, "BQ", v.data.as_quote, depth);
+	case CHEAX_COMMA:
+		return emit_quote(c, out, "CM", v.data.as_quote, depth);
+	case CHEAX_SPLICE:
+		return emit_quote(c, out, "SP", v.data.as_quote, depth);
+	case CHEAX_SPECIAL_OP:
+		/* Heads of preprocessed special forms; preprocessing the
+		 * rebuilt form will resolve the name again. */
+		if (v.data.as_special_op->name == NULL)
+			goto cannot_emit;
+		fputs("Y(", out);
+		emit_cstr(out, v.data.as_special_op->name, strlen(v.data.as_special_op->name));
+		fputc(')', out);
+		break;
+	case CHEAX_EXT_FUNC:
+		if (v.data.as_ext_func->name == NULL)
+			goto cannot_emit;
+		fputs("Y(", out);
+		emit_cstr(out, v.data.as_ext_func->name, strlen(v.data.as_ext_func->name));
+		fputc(')', out);
+		break;
+	default:
+		goto cannot_emit;
+	}
+
+	if (cast)
+		fprintf(out, ", %d)", v.type);
+	return 0;
+
+cannot_emit:
+	cheax_throwf(c, CHEAX_ETYPE, "emit_c(): cannot emit value of type %d", v.type);
+	return -1;
+}
+
+static bool
+has_c_macro_head(CHEAX *c, struct chx_value v)
+{
+	struct chx_value macro;
+	return v.type == CHEAX_LIST
+	    && v.data.as_list != NULL
+	    && v.data.as_list->value.type == CHEAX_ID
+	    && cheax_try_get_from(c, &c->macro_ns, v.data.as_list->value.data.as_id->value, &macro)
+	    && macro.type == CHEAX_EXT_FUNC;
+}
+
+/*
+ *                            _ _ _
+ *   ___ ___  _ __ ___  _ __ (_) | ___
+ *  / __/ _ \| '_ ` _ \| '_ \| | |/ _ \
+ * | (_| (_) | | | | | | |_) | | |  __/
+ *  \___\___/|_| |_| |_| .__/|_|_|\___|
+ *                     |_|
+ */
+
+struct bind {
+	struct chx_id *id; /* NULL while not yet in scope */
+	int var;
+};
+
+/* state of compilation of a single function, see compile_fn() */
+struct cc {
+	CHEAX *c;
+	FILE *out;
+	int depth;
+	bool ok;        /* false once something unsupported turns up */
+	bool uses_test;
+	unsigned helpers;
+	int num_temps, num_labels;
+
+	/* C variables identifiers are bound to, innermost last */
+	struct bind *binds;
+	int num_binds, cap_binds;
+};
+
+/* Variables are parameters a[i] if negative, and temporaries t[k]
+ * otherwise. Every temporary is assigned at most once per call. */
+struct var_name {
+	char s[32];
+};
+
+static struct var_name
+var_name(int var)
+{
+	struct var_name res;
+	if (var < 0)
+		snprintf(res.s, sizeof(res.s), "a[%d]", -var - 1);
+	else
+		snprintf(res.s, sizeof(res.s), "t[%d]", var);
+	return res;
+}
+
+static void
+cc_indent(struct cc *cc)
+{
+	for (int i = 0; i < cc->depth; ++i)
+		fputc('\t', cc->out);
+}
+
+static void
+cc_line(struct cc *cc, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	cc_indent(cc);
+	vfprintf(cc->out, fmt, ap);
+	fputc('\n', cc->out);
+	va_end(ap);
+}
+
+/* Keep temporary k, which might be collectable, until the function
+ * returns */
+static void
+cc_keep(struct cc *cc, int k)
+{
+	cc_line(cc, "cheax_ft(c, pad);");
+	cc_line(cc, "r[%d] = cheax_ref(c, t[%d]);", k, k);
+}
+
+static void
+cc_store(struct cc *cc, int k, int var)
+{
+	cc_line(cc, "t[%d] = %s;", k, var_name(var).s);
+	cc_line(cc, "r[%d] = cheax_ref(c, t[%d]);", k, k);
+}
+
+static void
+push_bind(struct cc *cc, struct chx_id *id, int var)
+{
+	if (cc->num_binds == cc->cap_binds) {
+		int new_cap = (cc->cap_binds == 0) ? 16 : cc->cap_binds * 2;
+		struct bind *new_binds = cheax_realloc(cc->c, cc->binds, new_cap * sizeof(*new_binds));
+		if (new_binds == NULL) {
+			cc->ok = false;
+			return;
+		}
+		cc->binds = new_binds;
+		cc->cap_binds = new_cap;
+	}
+
+	cc->binds[cc->num_binds++] = (struct bind){ id, var };
+}
+
+static bool
+find_bind(struct cc *cc, struct chx_id *id, int *var)
+{
+	for (int i = cc->num_binds - 1; i >= 0; --i) {
+		if (cc->binds[i].id == id) {
+			*var = cc->binds[i].var;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Built-in arithmetic applied to two arguments */
+static int
+find_arith_op(struct cc *cc, struct chx_list *call)
+{
+	struct chx_value head = call->value, f;
+	int var;
+
+	if (head.type != CHEAX_ID
+	 || call->next == NULL || call->next->next == NULL || call->next->next->next != NULL
+	 || find_bind(cc, head.data.as_id, &var)
+	 || !cheax_try_get_const_global_(cc->c, head.data.as_id, &f)
+	 || f.type != CHEAX_EXT_FUNC
+	 || f.data.as_ext_func->name == NULL)
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; i < sizeof(arith_ops) / sizeof(arith_ops[0]); ++i)
+		if (0 == strcmp(head.data.as_id->value, arith_ops[i].name)
+		 && 0 == strcmp(f.data.as_ext_func->name, arith_ops[i].name))
+			return i;
+
+	return -1;
+}
+
+static int compile_expr(struct cc *cc, struct chx_value v);
+static void compile_tail(struct cc *cc, struct chx_value v);
+
+/* Value rebuilt on every evaluation, like the forms of the module */
+static int
+compile_value(struct cc *cc, struct chx_value v)
+{
+	int k = cc->num_temps++;
+	cc_indent(cc);
+	fprintf(cc->out, "t[%d] = ", k);
+	emit_value(cc->c, cc->out, v, cc->depth + 1);
+	fputs(";\n", cc->out);
+
+	bool immediate = v.type == CHEAX_INT
+	              || v.type == CHEAX_BOOL
+	              || v.type == CHEAX_DOUBLE
+	              || cheax_is_nil(v);
+	if (!immediate)
+		cc_keep(cc, k);
+	return k;
+}
+
+static int
+compile_id(struct cc *cc, struct chx_id *id)
+{
+	int var;
+	if (find_bind(cc, id, &var))
+		return var;
+
+	int k = cc->num_temps++;
+	cc_indent(cc);
+	fprintf(cc->out, "t[%d] = cheax_get_from(c, NULL, ", k);
+	emit_cstr(cc->out, id->value, strlen(id->value));
+	fputs(");\n", cc->out);
+	cc_keep(cc, k);
+	return k;
+}
+
+/* Evaluate test into b */
+static void
+compile_test(struct cc *cc, struct chx_value test)
+{
+	int var = compile_expr(cc, test);
+	cc->uses_test = true;
+	cc->helpers |= HELPER_TEST;
+	cc_line(cc, "if ((b = test(c, %s)) < 0)", var_name(var).s);
+	cc_line(cc, "\tgoto pad;");
+}
+
+/* Evaluate v into temporary k, or as the function's result if k < 0 */
+static void
+compile_branch(struct cc *cc, struct chx_value v, int k)
+{
+	if (k < 0)
+		compile_tail(cc, v);
+	else
+		cc_store(cc, k, compile_expr(cc, v));
+}
+
+static void
+compile_seq(struct cc *cc, struct chx_list *seq, int k)
+{
+	for (; seq->next != NULL; seq = seq->next)
+		compile_expr(cc, seq->value);
+	compile_branch(cc, seq->value, k);
+}
+
+/* (if), (when), (unless), (and) and (or), which takes branch x if b
+ * is as expected, and results in y (or value other) otherwise */
+static void
+compile_if(struct cc *cc,
+           struct chx_list *args,
+           bool expect,
+           struct chx_value *y,
+           const char *other,
+           int k)
+{
+	compile_test(cc, args->value);
+	cc_line(cc, expect ? "if (b) {" : "if (!b) {");
+	++cc->depth;
+	compile_branch(cc, args->next->value, k);
+	--cc->depth;
+
+	if (k < 0) {
+		cc_line(cc, "}");
+		if (y != NULL) {
+			compile_tail(cc, *y);
+		} else {
+			cc_line(cc, "out->value = %s;", other);
+			cc_line(cc, "goto pad;");
+		}
+		return;
+	}
+
+	if (y == NULL && 0 == strcmp(other, "N")) {
+		/* temporaries are nil to begin with */
+		cc_line(cc, "}");
+		return;
+	}
+
+	cc_line(cc, "} else {");
+	++cc->depth;
+	if (y != NULL)
+		compile_branch(cc, *y, k);
+	else
+		cc_line(cc, "t[%d] = %s;", k, other);
+	--cc->depth;
+	cc_line(cc, "}");
+}
+
+static void
+compile_cond(struct cc *cc, struct chx_list *clauses, int k)
+{
+	int label = cc->num_labels++;
+	bool any = (clauses != NULL);
+
+	for (; clauses != NULL; clauses = clauses->next) {
+		struct chx_list *clause = clauses->value.data.as_list;
+		compile_test(cc, clause->value);
+		cc_line(cc, "if (b) {");
+		++cc->depth;
+		if (clause->next != NULL)
+			compile_seq(cc, clause->next, k);
+		else if (k < 0)
+			cc_line(cc, "goto pad;");
+		if (k >= 0)
+			cc_line(cc, "goto done%d;", label);
+		--cc->depth;
+		cc_line(cc, "}");
+	}
+
+	if (k < 0)
+		cc_line(cc, "goto pad;");
+	else if (any)
+		cc_line(cc, "done%d:;", label);
+}
+
+/* (let) or, if star is set, (let*), binding identifiers only */
+static void
+compile_let(struct cc *cc, struct chx_list *args, bool star, int k)
+{
+	struct chx_list *pairs = args->value.data.as_list;
+	int first = cc->num_binds;
+
+	for (struct chx_list *p = pairs; p != NULL; p = p->next) {
+		struct chx_list *pair = p->value.data.as_list;
+		if (pair->value.type != CHEAX_ID) {
+			cc->ok = false;
+			return;
+		}
+
+		/* Binding the same identifier twice fails at run time */
+		for (struct chx_list *q = pairs; q != p; q = q->next) {
+			if (q->value.data.as_list->value.data.as_id == pair->value.data.as_id) {
+				cc->ok = false;
+				return;
+			}
+		}
+
+		int var = compile_expr(cc, pair->next->value);
+		push_bind(cc, star ? pair->value.data.as_id : NULL, var);
+	}
+
+	if (!star) {
+		struct chx_list *p = pairs;
+		for (int i = first; i < cc->num_binds; ++i, p = p->next)
+			cc->binds[i].id = p->value.data.as_list->value.data.as_id;
+	}
+
+	compile_seq(cc, args->next, k);
+	cc->num_binds = first;
+}
+
+static void
+compile_call(struct cc *cc, struct chx_list *call, int k)
+{
+	int op = find_arith_op(cc, call);
+	if (op >= 0) {
+		int x = compile_expr(cc, call->next->value);
+		int y = compile_expr(cc, call->next->next->value);
+		cc->helpers |= HELPER_CALL_FORM | HELPER_CALL | HELPER_BUILTIN | (1u << (HELPER_FIRST_OP + op));
+
+		int res = (k < 0) ? cc->num_temps++ : k;
+		cc_line(cc, "t[%d] = %s(c, %s, %s);",
+		        res, arith_ops[op].helper, var_name(x).s, var_name(y).s);
+		cc_keep(cc, res);
+		if (k < 0) {
+			cc_line(cc, "out->value = t[%d];", res);
+			cc_line(cc, "goto pad;");
+		}
+		return;
+	}
+
+	int head = compile_expr(cc, call->value);
+
+	int argc = 0;
+	for (struct chx_list *a = call->next; a != NULL; a = a->next)
+		++argc;
+
+	int *argv = NULL;
+	if (argc > 0) {
+		argv = cheax_malloc(cc->c, argc * sizeof(*argv));
+		if (argv == NULL) {
+			cc->ok = false;
+			return;
+		}
+	}
+
+	int i = 0;
+	for (struct chx_list *a = call->next; a != NULL; a = a->next)
+		argv[i++] = compile_expr(cc, a->value);
+
+	cc_indent(cc);
+	if (k < 0)
+		fprintf(cc->out, "res = tail_call(c, %s, %d, ", var_name(head).s, argc);
+	else
+		fprintf(cc->out, "t[%d] = call(c, %s, %d, ", k, var_name(head).s, argc);
+
+	if (argc == 0) {
+		fputs("NULL", cc->out);
+	} else {
+		fputs("(struct chx_value[]){ ", cc->out);
+		for (i = 0; i < argc; ++i)
+			fprintf(cc->out, "%s%s", (i == 0) ? "" : ", ", var_name(argv[i]).s);
+		fputs(" }", cc->out);
+	}
+	cheax_free(cc->c, argv);
+
+	cc->helpers |= HELPER_CALL_FORM;
+	if (k < 0) {
+		cc->helpers |= HELPER_TAIL_CALL;
+		fputs(", pop_stop, out);\n", cc->out);
+		cc_line(cc, "goto pad;");
+	} else {
+		cc->helpers |= HELPER_CALL;
+		fputs(");\n", cc->out);
+		cc_keep(cc, k);
+	}
+}
+
+/*
+ * (check-type) against read-only global basic types, whose type codes
+ * are the same in every instance. The error message is that of the
+ * special form, worked out here.
+ */
+static void
+compile_check_type(struct cc *cc, struct chx_list *args, int k)
+{
+	CHEAX *c = cc->c;
+	struct chx_value what = args->value, ty;
+	struct chx_list *types = args->next;
+	int var;
+
+	for (struct chx_list *t = types; t != NULL; t = t->next) {
+		if (t->value.type != CHEAX_ID
+		 || find_bind(cc, t->value.data.as_id, &var)
+		 || !cheax_try_get_const_global_(c, t->value.data.as_id, &ty)
+		 || ty.type != CHEAX_TYPECODE
+		 || !cheax_is_basic_type(c, ty.data.as_int))
+		{
+			cc->ok = false;
+			return;
+		}
+	}
+
+	var = compile_expr(cc, what);
+
+	cc_indent(cc);
+	fputs("if (", cc->out);
+	for (struct chx_list *t = types; t != NULL; t = t->next) {
+		cheax_try_get_const_global_(c, t->value.data.as_id, &ty);
+		fprintf(cc->out, "%s%s.type != %d",
+		        (t == types) ? "" : " && ", var_name(var).s, (int)ty.data.as_int);
+	}
+	fputs(") {\n", cc->out);
+
+	struct sostrm ss;
+	cheax_sostrm_init_(&ss, c);
+	cheax_ostrm_putc_(&ss.strm, '`');
+	cheax_ostrm_show_(c, &ss.strm, what);
+	cheax_ostrm_printf_(&ss.strm, "' must have type ");
+	for (struct chx_list *t = types; t != NULL; t = t->next) {
+		cheax_ostrm_show_(c, &ss.strm, t->value);
+		if (t->next != NULL)
+			cheax_ostrm_printf_(&ss.strm, " or ");
+	}
+
+	cc_indent(cc);
+	fputs("\ttype_err(c, ", cc->out);
+	emit_cstr(cc->out, ss.buf, ss.idx);
+	fprintf(cc->out, ", %zu);\n", ss.idx);
+	cheax_free(c, ss.buf);
+	cc->helpers |= HELPER_TYPE_ERR;
+
+	cc_line(cc, "\tgoto pad;");
+	cc_line(cc, "}");
+
+	/* the result is nil, which is where out->value and t[k] start */
+	if (k < 0)
+		cc_line(cc, "goto pad;");
+}
+
+/*
+ * Compile (non-empty) list into temporary k, or as the function's
+ * result if k < 0.
+ */
+static void
+compile_form(struct cc *cc, struct chx_list *form, int k)
+{
+	if (form->value.type != CHEAX_SPECIAL_OP) {
+		compile_call(cc, form, k);
+		return;
+	}
+
+	const char *name = form->value.data.as_special_op->name;
+	struct chx_list *args = form->next;
+
+	if (name == NULL)
+		cc->ok = false;
+	else if (0 == strcmp(name, "if"))
+		compile_if(cc, args, true, &args->next->next->value, NULL, k);
+	else if (0 == strcmp(name, "when"))
+		compile_if(cc, args, true, NULL, "N", k);
+	else if (0 == strcmp(name, "unless"))
+		compile_if(cc, args, false, NULL, "N", k);
+	else if (0 == strcmp(name, "and"))
+		compile_if(cc, args, true, NULL, "F", k);
+	else if (0 == strcmp(name, "or"))
+		compile_if(cc, args, false, NULL, "T", k);
+	else if (0 == strcmp(name, "do"))
+		compile_seq(cc, args, k);
+	else if (0 == strcmp(name, "cond"))
+		compile_cond(cc, args, k);
+	else if (0 == strcmp(name, "let"))
+		compile_let(cc, args, false, k);
+	else if (0 == strcmp(name, "let*"))
+		compile_let(cc, args, true, k);
+	else if (0 == strcmp(name, "check-type"))
+		compile_check_type(cc, args, k);
+	else
+		cc->ok = false;
+}
+
+static int
+compile_expr(struct cc *cc, struct chx_value v)
+{
+	int k;
+
+	switch (v.type) {
+	case CHEAX_INT:
+	case CHEAX_BOOL:
+	case CHEAX_DOUBLE:
+	case CHEAX_STRING:
+		return compile_value(cc, v);
+	case CHEAX_QUOTE:
+		return compile_value(cc, v.data.as_quote->value);
+	case CHEAX_ID:
+		return compile_id(cc, v.data.as_id);
+	case CHEAX_LIST:
+		if (v.data.as_list == NULL)
+			return compile_value(cc, v);
+
+		k = cc->num_temps++;
+		compile_form(cc, v.data.as_list, k);
+		return k;
+	default:
+		cc->ok = false;
+		return 0;
+	}
+}
+
+static void
+compile_tail(struct cc *cc, struct chx_value v)
+{
+	if (v.type == CHEAX_LIST && v.data.as_list != NULL) {
+		compile_form(cc, v.data.as_list, -1);
+		return;
+	}
+
+	cc_line(cc, "out->value = %s;", var_name(compile_expr(cc, v)).s);
+	cc_line(cc, "goto pad;");
+}
+
+static struct chx_list *
+special_form(struct chx_value v, const char *name)
+{
+	if (v.type != CHEAX_LIST || v.data.as_list == NULL)
+		return NULL;
+
+	struct chx_value head = v.data.as_list->value;
+	return (head.type == CHEAX_SPECIAL_OP
+	     && head.data.as_special_op->name != NULL
+	     && 0 == strcmp(head.data.as_special_op->name, name))
+	     ? v.data.as_list
+	     : NULL;
+}
+
+/* If v is (def NAME (fn (PARAMS...) BODY...)), with distinct
+ * identifiers for parameters, return the (fn) form */
+static struct chx_list *
+fn_definition(struct chx_value v)
+{
+	struct chx_list *def = special_form(v, "def");
+	if (def == NULL
+	 || def->next == NULL || def->next->value.type != CHEAX_ID
+	 || def->next->next == NULL || def->next->next->next != NULL)
+	{
+		return NULL;
+	}
+
+	struct chx_list *fn = special_form(def->next->next->value, "fn");
+	if (fn == NULL || fn->next == NULL || fn->next->value.type != CHEAX_LIST || fn->next->next == NULL)
+		return NULL;
+
+	struct chx_list *params = fn->next->value.data.as_list;
+	for (struct chx_list *p = params; p != NULL; p = p->next) {
+		/* (: x xs) is a variadic argument list */
+		if (p->value.type != CHEAX_ID || 0 == strcmp(p->value.data.as_id->value, ":"))
+			return NULL;
+
+		for (struct chx_list *q = params; q != p; q = q->next)
+			if (q->value.data.as_id == p->value.data.as_id)
+				return NULL;
+	}
+
+	return fn;
+}
+
+static void
+copy_stream(FILE *dst, FILE *src, long len)
+{
+	char buf[4096];
+	size_t n;
+
+	rewind(src);
+	for (; len > 0; len -= n) {
+		n = fread(buf, 1, (len < (long)sizeof(buf)) ? (size_t)len : sizeof(buf), src);
+		if (n == 0)
+			break;
+		fwrite(buf, 1, n, dst);
+	}
+}
+
+/*
+ * Compile (fn (PARAMS...) BODY...) form fn to C function fnN, with N
+ * the index of the form, and write it to defs. The body is written to
+ * scratch first, as the declarations depend on it. Returns false if fn
+ * could not be compiled.
+ */
+static bool
+compile_fn(CHEAX *c, FILE *defs, FILE *scratch, int index, struct chx_list *fn, unsigned *helpers)
+{
+	struct cc cc = { .c = c, .out = scratch, .depth = 1, .ok = true };
+
+	int num_params = 0;
+	for (struct chx_list *p = fn->next->value.data.as_list; p != NULL; p = p->next)
+		push_bind(&cc, p->value.data.as_id, -(++num_params));
+
+	rewind(scratch);
+	compile_seq(&cc, fn->next->next, -1);
+	long len = ftell(scratch);
+	cheax_free(c, cc.binds);
+
+	if (!cc.ok || cheax_errno(c) != 0)
+		return false;
+
+	int num_temps = (cc.num_temps > 0) ? cc.num_temps : 1;
+	fprintf(defs, "\nstatic int\n"
+	              "fn%d(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)\n"
+	              "{\n"
+	              "\tstruct chx_value a[%d], t[%d] = { { 0 } };\n"
+	              "\tchx_ref r[%d] = { 0 };\n"
+	              "\tint res = CHEAX_VALUE_OUT%s;\n"
+	              "\tout->value = N;\n"
+	              "\n"
+	              "\tif (params(c, args, %d, a) < 0)\n"
+	              "\t\tgoto pad;\n"
+	              "\n",
+	        index, (num_params > 0) ? num_params : 1, num_temps, num_temps,
+	        cc.uses_test ? ", b" : "", num_params);
+	copy_stream(defs, scratch, len);
+	fprintf(defs, "pad:\n"
+	              "\tunref_all(c, t, r, %d);\n"
+	              "\treturn res;\n"
+	              "}\n",
+	        num_temps);
+
+	*helpers |= cc.helpers;
+	return true;
+}
+
+int
+cheax_emit_c(CHEAX *c, const char *path, FILE *out)
+{
+	ASSERT_NOT_NULL("emit_c", path, -1);
+	ASSERT_NOT_NULL("emit_c", out, -1);
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		cheax_throwf(c, CHEAX_EIO, "emit_c(): failed to open file \"%s\"", path);
+		return -1;
+	}
+
+	cheax_rmshebang_(f);
+
+	fputs("/* Generated by cheax_emit_c() from ", out);
+	for (const char *p = path; *p != '\0'; ++p)
+		if (p[0] != '*' || p[1] != '/')
+			fputc(*p, out);
+	fputs(". Do not edit. */\n\n", out);
+
+	fputs("static const char source_path[] = ", out);
+	emit_cstr(out, path, strlen(path));
+	fputs(";\n\n", out);
+	fputs(emit_prologue, out);
+
+	/* Compiled functions go after everything else, preceded by the
+	 * helpers they turn out to need */
+	FILE *defs = tmpfile(), *scratch = tmpfile();
+	if (defs == NULL || scratch == NULL) {
+		cheax_throwf(c, CHEAX_EIO, "emit_c(): failed to create temporary file");
+		goto pad;
+	}
+
+	unsigned helpers = 0;
+	int line = 1, pos = 0, num_forms = 0, num_compiled = 0;
+	for (;; ++num_forms) {
+		struct chx_value v = cheax_read_at(c, f, path, &line, &pos);
+		cheax_ft(c, pad);
+		if (cheax_is_nil(v) && feof(f))
+			break;
+
+		/* Macros implemented in C, like defmacro itself, may do their
+		 * work at expansion time. Such forms are emitted as read, and
+		 * expanded when the module is loaded. */
+		bool expand_late = has_c_macro_head(c, v);
+
+		struct chx_value pp = cheax_preproc(c, v);
+		cheax_ft(c, pad);
+
+		struct chx_list *fn = expand_late ? NULL : fn_definition(pp);
+		bool compiled = fn != NULL && compile_fn(c, defs, scratch, num_forms, fn, &helpers);
+		cheax_ft(c, pad);
+
+		if (compiled) {
+			++num_compiled;
+			fprintf(out, "\nstatic int fn%d(CHEAX *, struct chx_list *, void *, "
+			             "struct chx_env *, union chx_eval_out *);\n", num_forms);
+		}
+
+		fprintf(out, "\nstatic struct chx_value\nform%d(CHEAX *c)\n{\n\treturn ", num_forms);
+		if (compiled)
+			fputs("compiled(c, ", out);
+		if (emit_value(c, out, expand_late ? v : pp, 1) < 0)
+			goto pad;
+		if (compiled) {
+			const char *name = pp.data.as_list->next->value.data.as_id->value;
+			fputs(", ", out);
+			emit_cstr(out, name, strlen(name));
+			fprintf(out, ", fn%d)", num_forms);
+		}
+		fputs(";\n}\n", out);
+
+		v = pp;
+
+		/* Later forms may depend on macros defined here */
+		cheax_eval(c, v);
+		cheax_ft(c, pad);
+	}
+
+	fputs("\nstatic struct chx_value (*const forms[])(CHEAX *c) = {", out);
+	for (int i = 0; i < num_forms; ++i)
+		fprintf(out, "%sform%d,", (i % 8 == 0) ? "\n\t" : " ", i);
+	fputs("\n\tNULL,\n};\n\n", out);
+	fputs(emit_epilogue, out);
+
+	if (num_compiled > 0) {
+		emit_helpers(out, helpers);
+		copy_stream(out, defs, ftell(defs));
+	}
+
+	fclose(scratch);
+	fclose(defs);
+	fclose(f);
+	return 0;
+pad:
+	if (scratch != NULL)
+		fclose(scratch);
+	if (defs != NULL)
+		fclose(defs);
+	fclose(f);
+	return -1;
+}
@@ -20,6 +20,7 @@
 #include "core.h"
 #include "err.h"
 #include "print.h"
+#include "probes.h"
 #include "unpack.h"
 
 /* declare associative array of builtin error codes and their names */
@@ -102,6 +103,11 @@ cheax_throw(CHEAX *c, int code, struct chx_string *msg)
 	c->error.msg = msg;
 	c->bt.len = 0;
 	c->bt.truncated = false;
+
+	PROBE1(c, error__throw, code);
+
+	if (c->hooks.error != NULL)
+		c->hooks.error(c, code, msg, c->hooks.data);
 }
 
 void
@@ -272,8 +278,14 @@ cheax_add_bt(CHEAX *c)
 	ent->info = (loc_attr != NULL) ? loc_attr->loc : no_loc;
 
 	truncate_list_msg(c, ent->line1, sizeof(ent->line1), list_line1);
-	if (list_line2 != NULL)
+	if (list_line2 != NULL) {
 		truncate_list_msg(c, ent->line2, sizeof(ent->line2), list_line2);
+
+		/* preprocessing may have changed the form without changing
+		 * how it prints, e.g. by resolving type names to constants */
+		if (0 == strcmp(ent->line1, ent->line2))
+			ent->line2[0] = '\0';
+	}
 }
 
 void
@@ -13,32 +13,27 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdint.h>
 #include <string.h>
 
+#include "attrib.h"
+#include "bkquote.h"
+#include "btree.h"
+#include "case.h"
 #include "core.h"
 #include "err.h"
 #include "eval.h"
 #include "gc.h"
+#include "hamt.h"
+#include "hashmap.h"
+#include "opt.h"
+#include "probes.h"
+#include "prof.h"
+#include "sym.h"
 #include "unpack.h"
 
-typedef struct chx_value (*value_op)(CHEAX *c, struct chx_value in);
-static struct chx_list *list_map(CHEAX *c, value_op fn, struct chx_list *lst);
-static struct chx_list *list_concat(CHEAX *c, struct chx_list *a, struct chx_list *b);
-
-enum {
-	BKQ_ERROR = -1,
-	BKQ_VALUE,
-	BKQ_SPLICED,
-};
-
-static int eval_bkquoted(CHEAX *c,
-                         struct chx_value *value,
-                         struct chx_list **spliced,
-                         struct chx_value quoted,
-                         int nest);
-
-static void
-rmshebang(FILE *f)
+void
+cheax_rmshebang_(FILE *f)
 {
 	char shebang[2] = { 0 };
 	size_t bytes = fread(shebang, 1, 2, f);
@@ -62,7 +57,8 @@ cheax_exec(CHEAX *c, const char *path)
 		return;
 	}
 
-	rmshebang(f);
+	cheax_rmshebang_(f);
+	PROBE1(c, exec__start, path);
 
 	int line = 1, pos = 0;
 	for (;;) {
@@ -78,17 +74,40 @@ cheax_exec(CHEAX *c, const char *path)
 	}
 
 pad:
+	PROBE2(c, exec__done, path, line);
 	fclose(f);
 }
 
-static struct chx_value
-eval_ext_func(CHEAX *c, struct chx_ext_func *form, struct chx_list *args, bool eval_args)
+static int
+perform_ext_func(CHEAX *c,
+                 struct chx_ext_func *form,
+                 struct chx_list *args,
+                 struct chx_env *pop_stop,
+                 union chx_eval_out *out)
+{
+	if (form->perform == cheax_tail_ext_func_perform_) {
+		struct tail_ext_func *tf = form->info;
+		return tf->perform(c, args, tf->info, pop_stop, out);
+	}
+
+	out->value = form->perform(c, args, form->info);
+	return CHEAX_VALUE_OUT;
+}
+
+static int
+eval_ext_func(CHEAX *c,
+              struct chx_ext_func *form,
+              struct chx_list *args,
+              bool eval_args,
+              struct chx_env *pop_stop,
+              union chx_eval_out *out)
 {
 	struct chx_list *true_args;
 	struct chx_list arg_buf[16], *other_args = NULL;
 	chx_ref ref_buf[16];
 	size_t i = 0;
-	struct chx_value res = CHEAX_NIL;
+	int res = CHEAX_VALUE_OUT;
+	out->value = CHEAX_NIL;
 
 	if (eval_args) {
 		struct chx_list **next_argp = &true_args;
@@ -116,7 +135,7 @@ eval_ext_func(CHEAX *c, struct chx_ext_func *form, struct chx_list *args, bool e
 	}
 
 	chx_ref other_arg_ref = cheax_ref_ptr(c, other_args);
-	res = form->perform(c, true_args, form->info);
+	res = perform_ext_func(c, form, true_args, pop_stop, out);
 	cheax_unref_ptr(c, other_args, other_arg_ref);
 pad:
 	for (size_t j = 0; j < i; ++j)
@@ -125,6 +144,115 @@ pad:
 	return res;
 }
 
+/* maximum number of parameters bound through bind_flat_args() */
+#define MAX_FLAT_PARAMS 16
+
+void
+cheax_init_params_(CHEAX *c, struct chx_func *fn)
+{
+	fn->num_params = -1;
+	fn->variadic = false;
+	fn->sealed = !cheax_body_defines_(c, fn->body);
+
+	if (fn->args.type == CHEAX_ID) {
+		fn->num_params = 0;
+		fn->variadic = true;
+		return;
+	}
+
+	if (fn->args.type != CHEAX_LIST)
+		return;
+
+	struct chx_list *pan = fn->args.data.as_list;
+	bool variadic = false;
+	if (pan != NULL && pan->value.type == CHEAX_ID && pan->value.data.as_id == c->std_ids[COLON_ID]) {
+		variadic = true;
+		pan = pan->next;
+		if (pan == NULL)
+			return;
+	}
+
+	int n = 0;
+	for (struct chx_list *p = pan; p != NULL; p = p->next, ++n) {
+		if (p->value.type != CHEAX_ID || n >= MAX_FLAT_PARAMS)
+			return;
+
+		for (struct chx_list *q = pan; q != p; q = q->next)
+			if (q->value.data.as_id == p->value.data.as_id)
+				return;
+	}
+
+	fn->num_params = variadic ? n - 1 : n;
+	fn->variadic = variadic;
+}
+
+/*
+ * Fast path for functions whose argument list consists of distinct
+ * identifiers only: evaluate all arguments into a buffer, and define
+ * them in one go.
+ */
+static int
+bind_flat_args(CHEAX *c,
+               struct chx_func *fn,
+               struct chx_list *args,
+               struct chx_env *caller_env,
+               bool argeval_override)
+{
+	struct chx_id *ids[MAX_FLAT_PARAMS];
+	struct chx_value values[MAX_FLAT_PARAMS];
+	chx_ref refs[MAX_FLAT_PARAMS];
+	int n = fn->num_params, num_values = 0;
+
+	/* check arity before evaluating anything */
+	int num_args = 0;
+	for (struct chx_list *a = args; a != NULL && num_args <= n; a = a->next)
+		++num_args;
+	if (num_args < n || (!fn->variadic && num_args > n)) {
+		cheax_throwf(c, CHEAX_EMATCH, "invalid (number of) arguments");
+		return -1;
+	}
+
+	struct chx_list *pan = NULL;
+	if (fn->args.type == CHEAX_LIST) {
+		pan = fn->args.data.as_list;
+		if (fn->variadic)
+			pan = pan->next; /* skip colon */
+	}
+
+	struct chx_env *func_env = c->env;
+	chx_ref func_env_ref = cheax_ref_ptr(c, func_env);
+	c->env = caller_env;
+
+	for (; num_values < n; ++num_values, pan = pan->next, args = args->next) {
+		ids[num_values] = pan->value.data.as_id;
+		values[num_values] = argeval_override ? args->value : cheax_eval(c, args->value);
+		cheax_ft(c, pad);
+		refs[num_values] = cheax_ref(c, values[num_values]);
+	}
+
+	if (fn->variadic) {
+		ids[n] = (pan == NULL) ? fn->args.data.as_id : pan->value.data.as_id;
+
+		struct chx_list *rest = args;
+		if (!argeval_override && cheax_unpack_(c, args, ".*", &rest) < 0)
+			goto pad;
+
+		values[n] = cheax_list_value(rest);
+		refs[n] = cheax_ref(c, values[n]);
+		++num_values;
+	}
+
+	c->env = func_env;
+	cheax_def_params_(c, ids, values, num_values);
+pad:
+	c->env = func_env;
+	cheax_unref_ptr(c, func_env, func_env_ref);
+	for (int i = 0; i < num_values; ++i)
+		cheax_unref(c, values[i], refs[i]);
+
+	return (cheax_errno(c) == 0) ? 0 : -1;
+}
+
 static int
 eval_args(CHEAX *c,
           struct chx_func *fn,
@@ -132,6 +260,14 @@ eval_args(CHEAX *c,
           struct chx_env *caller_env,
           bool argeval_override)
 {
+	if (fn->num_params >= 0) {
+		if (bind_flat_args(c, fn, args, caller_env, argeval_override) < 0) {
+			cheax_add_bt(c);
+			return -1;
+		}
+		return 0;
+	}
+
 	int mflags = CHEAX_READONLY;
 	if (!argeval_override)
 		mflags |= CHEAX_EVAL_NODES;
@@ -175,6 +311,9 @@ eval_func_call(CHEAX *c,
 
 	cheax_unref_ptr(c, caller_env, caller_env_ref);
 
+	if (fn->sealed)
+		cheax_seal_env_(c);
+
 	struct chx_env *func_env = c->env;
 	c->env = caller_env;
 
@@ -249,23 +388,33 @@ eval_cast(CHEAX *c,
 	return CHEAX_VALUE_OUT;
 }
 
-static int
-eval_sexpr(CHEAX *c, struct chx_list *input, struct chx_env *pop_stop, union chx_eval_out *out)
+/* Only called when c->trace_calls is set, keeping the untraced path
+ * down to a single branch. */
+static unsigned
+enter_call(CHEAX *c, struct chx_value head, struct chx_list *input)
 {
-	if (c->stack_limit > 0 && c->stack_depth >= c->stack_limit) {
-		cheax_throwf(c, CHEAX_ESTACK, "stack overflow! (stack limit %d)", c->stack_limit);
-		out->value = CHEAX_NIL;
-		return CHEAX_VALUE_OUT;
-	}
-
-	int res = CHEAX_VALUE_OUT;
-	int prev_stack_depth = c->stack_depth++;
-
-	chx_ref input_ref = cheax_ref_ptr(c, input);
+	if (c->hooks.enter != NULL)
+		c->hooks.enter(c, input, c->hooks.data);
+	return cheax_prof_enter_(c, head, input);
+}
 
-	struct chx_value head = cheax_eval(c, input->value);
-	cheax_ft(c, pad);
+static void
+exit_call(CHEAX *c, struct chx_list *input, unsigned prof_token)
+{
+	if (prof_token != 0)
+		cheax_prof_exit_(c, prof_token);
+	if (c->hooks.exit != NULL)
+		c->hooks.exit(c, input, c->hooks.data);
+}
 
+static int
+dispatch_sexpr(CHEAX *c,
+               struct chx_list *input,
+               struct chx_value head,
+               struct chx_env *pop_stop,
+               union chx_eval_out *out)
+{
+	int res;
 	chx_ref head_ref = cheax_ref(c, head);
 
 	/* should already be cheax_ref()'d further up the
@@ -274,11 +423,13 @@ eval_sexpr(CHEAX *c, struct chx_list *input, struct chx_env *pop_stop, union chx
 	c->bt.last_call = input;
 
 	struct chx_list *args = input->next;
+	bool traced = c->trace_calls;
+	unsigned prof_token = traced ? enter_call(c, head, input) : 0;
+	PROBE_CALL(c, function__entry, head, input);
 
 	switch (head.type) {
 	case CHEAX_EXT_FUNC:
-		out->value = eval_ext_func(c, head.data.as_ext_func, args, true);
-		res = CHEAX_VALUE_OUT;
+		res = eval_ext_func(c, head.data.as_ext_func, args, true, pop_stop, out);
 		break;
 
 	case CHEAX_SPECIAL_OP:
@@ -308,6 +459,10 @@ eval_sexpr(CHEAX *c, struct chx_list *input, struct chx_env *pop_stop, union chx
 		break;
 	}
 
+	PROBE_CALL(c, function__return, head, input);
+	if (traced)
+		exit_call(c, input, prof_token);
+
 	cheax_unref(c, head, head_ref);
 
 	if (res == CHEAX_VALUE_OUT) {
@@ -316,183 +471,133 @@ eval_sexpr(CHEAX *c, struct chx_list *input, struct chx_env *pop_stop, union chx
 		cheax_gc(c);
 		cheax_unref(c, out->value, res_ref);
 	}
-pad:
-	cheax_unref_ptr(c, input, input_ref);
-	c->stack_depth = prev_stack_depth;
-	return res;
-}
 
-static struct chx_list *
-list_map(CHEAX *c, value_op fn, struct chx_list *lst)
-{
-	struct chx_list *res = NULL, **nxt = &res;
-	for (; lst !=  NULL; lst = lst->next) {
-		*nxt = cheax_list(c, fn(c, lst->value), NULL).data.as_list;
-		cheax_ft(c, pad);
-		nxt = &(*nxt)->next;
-	}
 	return res;
-pad:
-	return NULL;
 }
 
-static struct chx_list *
-list_concat(CHEAX *c, struct chx_list *a, struct chx_list *b)
+/* approximate current C stack address */
+static uintptr_t
+stack_pointer(void)
 {
-	if (a == NULL)
-		return b;
-
-	struct chx_list *cdr = list_concat(c, a->next, b);
-	cheax_ft(c, pad);
-	return cheax_list(c, a->value, cdr).data.as_list;
-pad:
-	return NULL;
+#ifdef __GNUC__
+	/* unlike the address of a local, not moved off the stack by
+	 * AddressSanitizer */
+	return (uintptr_t)__builtin_frame_address(0);
+#else
+	char here;
+	return (uintptr_t)(void *)&here;
+#endif
 }
 
-static struct chx_list *
-eval_bkquoted_list(CHEAX *c, struct chx_list *quoted, int nest)
+static bool
+check_stack_limit(CHEAX *c)
 {
-	if (quoted == NULL)
-		return NULL;
+	if (c->stack_limit > 0 && c->stack_depth >= c->stack_limit) {
+		cheax_throwf(c, CHEAX_ESTACK, "stack overflow! (stack limit %d)", c->stack_limit);
+		return false;
+	}
 
-	struct chx_value car;
-	struct chx_list *spl_list, *cdr;
-	struct chx_value spl_list_value;
-	chx_ref car_ref, spl_list_ref;
-	switch (eval_bkquoted(c, &car, &spl_list, quoted->value, nest)) {
-	case BKQ_VALUE:
-		car_ref = cheax_ref(c, car);
-		cdr = eval_bkquoted_list(c, quoted->next, nest);
-		cheax_unref(c, car, car_ref);
-		cheax_ft(c, pad);
+	if (c->gen.stack_floor != 0 && stack_pointer() < c->gen.stack_floor) {
+		cheax_throwf(c, CHEAX_ESTACK, "stack overflow! (generator stack exhausted)");
+		return false;
+	}
+	return true;
+}
 
-		struct chx_list *res = cheax_list(c, car, cdr).data.as_list;
-		cheax_ft(c, pad);
-		cheax_set_orig_form_(c, res, quoted);
-		cheax_ft(c, pad);
+/*
+ * Returned by eval_sexpr() for (: x ... (f ...)) forms in tail modulo
+ * cons mode, in which case it leaves a chain of cons cells in c->tmc.
+ * The value of out->ts.tail must then be written into the `next'
+ * field of the last cell, so that f can be tail called.
+ */
+#define TMC_OUT (CHEAX_TAIL_OUT + 1)
 
-		return res;
+static bool
+is_tail_cons(CHEAX *c, struct chx_value head, struct chx_list *args)
+{
+	if (!c->tail_call_elimination
+	 || head.type != CHEAX_EXT_FUNC
+	 || head.data.as_ext_func->perform != cheax_bltn_prepend_
+	 || args == NULL
+	 || args->next == NULL)
+	{
+		return false;
+	}
 
-	case BKQ_SPLICED:
-		spl_list_value = cheax_list_value(spl_list);
-		spl_list_ref = cheax_ref(c, spl_list_value);
-		cdr = eval_bkquoted_list(c, quoted->next, nest);
-		cheax_unref(c, spl_list_value, spl_list_ref);
-		cheax_ft(c, pad);
+	while (args->next != NULL)
+		args = args->next;
 
-		return (cdr == NULL) ? spl_list : list_concat(c, spl_list, cdr);
-	}
-pad:
-	return NULL;
+	/* only worth it if the last argument is a call */
+	return args->value.type == CHEAX_LIST && args->value.data.as_list != NULL;
 }
 
 static int
-expand_comma(CHEAX *c,
-             struct chx_value *value,
-             struct chx_list **spliced,
-             struct chx_value quoted)
+eval_tail_cons(CHEAX *c, struct chx_list *input, struct chx_env *pop_stop, union chx_eval_out *out)
 {
-	struct chx_value evald = cheax_eval(c, quoted.data.as_quote->value);
+	struct chx_list *was_last_call = c->bt.last_call;
+	c->bt.last_call = input;
+
+	struct chx_list *arg = input->next;
+	struct chx_value val = cheax_eval(c, arg->value);
 	cheax_ft(c, pad);
 
-	switch (quoted.type) {
-	case CHEAX_COMMA:
-		*value = evald;
-		return BKQ_VALUE;
+	struct chx_list *first, *last;
+	first = last = cheax_list(c, val, NULL).data.as_list;
+	cheax_ft(c, pad);
 
-	case CHEAX_SPLICE:
-		if (!cheax_is_nil(evald) && evald.type != CHEAX_LIST) {
-			cheax_throwf(c, CHEAX_EEVAL, "expected list after ,@");
-			return BKQ_ERROR;
-		}
+	chx_ref first_ref = cheax_ref_ptr(c, first);
+	for (arg = arg->next; arg->next != NULL; arg = arg->next) {
+		val = cheax_eval(c, arg->value);
+		cheax_ft(c, pad2);
 
-		if (spliced != NULL)
-			*spliced = evald.data.as_list;
-		return BKQ_SPLICED;
+		last = last->next = cheax_list(c, val, NULL).data.as_list;
+		cheax_ft(c, pad2);
 	}
+	cheax_unref_ptr(c, first, first_ref);
+
+	c->tmc.first = first;
+	c->tmc.last = last;
+	out->ts.tail = arg->value;
+	out->ts.pop_stop = pop_stop;
+	return TMC_OUT;
+pad2:
+	cheax_unref_ptr(c, first, first_ref);
 pad:
-	return BKQ_ERROR;
+	c->bt.last_call = was_last_call;
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
 }
 
-static int
-eval_bkquoted_comma(CHEAX *c,
-                    struct chx_value *value,
-                    struct chx_list **spliced,
-                    struct chx_value quoted,
-                    int nest)
-{
-	if (nest <= 0)
-		return expand_comma(c, value, spliced, quoted);
-
-	struct chx_value to_comma;
-	struct chx_list *splice_to_comma;
-	value_op comma = (value_op)((quoted.type == CHEAX_COMMA) ? cheax_comma : cheax_splice);
-	switch (eval_bkquoted(c, &to_comma, &splice_to_comma, quoted.data.as_quote->value, nest - 1)) {
-	case BKQ_VALUE:
-		*value = comma(c, to_comma);
-		cheax_ft(c, pad);
-		return BKQ_VALUE;
-
-	case BKQ_SPLICED:
-		if (spliced != NULL) {
-			*spliced = list_map(c, comma, splice_to_comma);
-			cheax_ft(c, pad);
-		}
-
-		return BKQ_SPLICED;
-	}
-pad:
-	return BKQ_ERROR;
+/* count an eval step against the budget, see cheax_eval_with_budget() */
+static bool
+count_step(CHEAX *c)
+{
+	return --c->budget.countdown > 0 || cheax_check_budget_(c) == 0;
 }
 
 static int
-eval_bkquoted(CHEAX *c,
-              struct chx_value *value,
-              struct chx_list **spliced,
-              struct chx_value quoted,
-              int nest)
+eval_sexpr(CHEAX *c, struct chx_list *input, struct chx_env *pop_stop, union chx_eval_out *out)
 {
-	struct chx_quote *qt_quoted = NULL;
-	int code;
-	bool bkquote = false;
-
-	switch (quoted.type) {
-	case CHEAX_LIST:
-		*value = cheax_list_value(eval_bkquoted_list(c, quoted.data.as_list, nest));
-		return BKQ_VALUE;
+	if (!check_stack_limit(c) || !count_step(c)) {
+		out->value = CHEAX_NIL;
+		return CHEAX_VALUE_OUT;
+	}
 
-	case CHEAX_BACKQUOTE:
-		bkquote = true;
-		/* fall through */
-	case CHEAX_QUOTE:
-		qt_quoted = (struct chx_quote *)quoted.data.as_quote;
-		struct chx_value to_quote;
-
-		code = eval_bkquoted(c, &to_quote, NULL, qt_quoted->value, nest + bkquote);
-		if (code != BKQ_VALUE) {
-			if (code == BKQ_SPLICED) {
-				cheax_throwf(c,
-				             CHEAX_EEVAL,
-				             "%s expects one argument",
-				             bkquote ? "backquote" : "quote");
-			}
-			return BKQ_ERROR;
-		}
+	int res = CHEAX_VALUE_OUT;
+	int prev_stack_depth = c->stack_depth++;
 
-		*value = (bkquote ? cheax_backquote : cheax_quote)(c, to_quote);
-		cheax_ft(c, pad);
-		return BKQ_VALUE;
+	chx_ref input_ref = cheax_ref_ptr(c, input);
 
-	case CHEAX_COMMA:
-	case CHEAX_SPLICE:
-		return eval_bkquoted_comma(c, value, spliced, quoted, nest);
+	struct chx_value head = cheax_eval(c, input->value);
+	cheax_ft(c, pad);
 
-	default:
-		*value = quoted;
-		return BKQ_VALUE;
-	}
+	res = is_tail_cons(c, head, input->next)
+	    ? eval_tail_cons(c, input, pop_stop, out)
+	    : dispatch_sexpr(c, input, head, pop_stop, out);
 pad:
-	return BKQ_ERROR;
+	cheax_unref_ptr(c, input, input_ref);
+	c->stack_depth = prev_stack_depth;
+	return res;
 }
 
 static int
@@ -500,7 +605,6 @@ eval(CHEAX *c, struct chx_value input, struct chx_env *pop_stop, union chx_eval_
 {
 	struct chx_value res = CHEAX_NIL;
 	chx_ref input_ref;
-	int code;
 
 	switch (input.type) {
 	case CHEAX_ID:
@@ -518,9 +622,7 @@ eval(CHEAX *c, struct chx_value input, struct chx_env *pop_stop, union chx_eval_
 		break;
 	case CHEAX_BACKQUOTE:
 		input_ref = cheax_ref(c, input);
-		code = eval_bkquoted(c, &res, NULL, input.data.as_quote->value, 0);
-		if (code == BKQ_SPLICED)
-			cheax_throwf(c, CHEAX_EEVAL, "internal splice error");
+		res = cheax_eval_bkquote_(c, input.data.as_quote);
 		cheax_unref(c, input, input_ref);
 
 		chx_ref res_ref = cheax_ref(c, res);
@@ -560,28 +662,7 @@ static int
 apply_func_evaluator(CHEAX *c, void *input_info, struct chx_env *pop_stop, union chx_eval_out *out)
 {
 	struct chx_list afi = *(struct chx_list *)input_info;
-	struct chx_value func = afi.value;
-	struct chx_list *args = afi.next;
-
-	int res;
-	switch (func.type) {
-	case CHEAX_EXT_FUNC:
-		out->value = eval_ext_func(c, func.data.as_ext_func, args, false);
-		res = CHEAX_VALUE_OUT;
-		break;
-
-	case CHEAX_FUNC:
-		res = eval_func_call(c, func.data.as_func, args, pop_stop, out, true);
-		break;
-
-	default:
-		cheax_throwf(c, CHEAX_EEVAL, "apply_func_evaluator(): internal error");
-		out->value = CHEAX_NIL;
-		res = CHEAX_VALUE_OUT;
-		break;
-	}
-
-	return res;
+	return cheax_apply_tail(c, afi.value, afi.next, pop_stop, out);
 }
 
 static struct chx_value
@@ -591,7 +672,8 @@ wrap_tail_eval(CHEAX *c, tail_evaluator initial_eval, void *input_info)
 	struct chx_env *ret_env = c->env;
 	struct chx_list *ret_last_call = c->bt.last_call;
 
-	if (initial_eval(c, input_info, c->env, &out) == CHEAX_VALUE_OUT)
+	int ek = initial_eval(c, input_info, c->env, &out);
+	if (ek == CHEAX_VALUE_OUT)
 		return out.value;
 
 	struct chx_list *was_last_call = c->bt.last_call;
@@ -606,23 +688,48 @@ wrap_tail_eval(CHEAX *c, tail_evaluator initial_eval, void *input_info)
 
 	struct chx_env *pop_stop;
 
+	/* list under construction through tail modulo cons, and the
+	 * cell whose `next' field is yet to be filled in */
+	struct chx_list *tmc_first = NULL, *tmc_hole = NULL;
+	chx_ref tmc_ref = 0;
+
 	if (c->tail_call_elimination) {
-		int ek;
 		do {
+			if (ek == TMC_OUT) {
+				if (tmc_first == NULL) {
+					tmc_first = c->tmc.first;
+					tmc_ref = cheax_ref_ptr(c, tmc_first);
+				} else {
+					tmc_hole->next = c->tmc.first;
+				}
+				tmc_hole = c->tmc.last;
+			}
+
 			++tail_lvls;
 			pop_stop = out.ts.pop_stop;
 			ek = eval(c, out.ts.tail, pop_stop, &out);
 			cheax_ft(c, pad2);
-		} while (ek == CHEAX_TAIL_OUT);
+		} while (ek != CHEAX_VALUE_OUT);
 	} else {
 		pop_stop = out.ts.pop_stop;
 		out.value = cheax_eval(c, out.ts.tail);
 	}
 
+	if (tmc_first != NULL) {
+		if (out.value.type != CHEAX_LIST) {
+			cheax_throwf(c, CHEAX_ETYPE, "improper list not allowed");
+			goto pad2;
+		}
+		tmc_hole->next = out.value.data.as_list;
+		out.value = cheax_list_value(tmc_first);
+	}
+
 	while (c->env != pop_stop)
 		cheax_pop_env(c);
 
 pad2:
+	if (tmc_first != NULL)
+		cheax_unref_ptr(c, tmc_first, tmc_ref);
 	cheax_unref_ptr(c, ret_env, ret_env_ref);
 	cheax_unref_ptr(c, was_last_call, last_call_ref);
 	cheax_unref_ptr(c, ret_last_call, ret_last_call_ref);
@@ -641,45 +748,333 @@ pad:
 	return res;
 }
 
-struct chx_value
-cheax_eval(CHEAX *c, struct chx_value input)
+/*
+ * Heap-stack evaluator
+ *
+ * Performs the same work as wrap_tail_eval(c, value_evaluator, ...),
+ * but rather than recursing on the C stack to evaluate the arguments
+ * of function calls, it keeps its continuation in c->hstack. An
+ * HF_EVAL frame corresponds to one wrap_tail_eval() invocation, and an
+ * HF_CALL frame to an eval_sexpr() invocation evaluating the arguments
+ * of an (ext) function. Special operators, and the non-tail statements
+ * of function bodies, still recurse through cheax_eval().
+ */
+
+/* tail_lvls value of HF_EVAL frame that hasn't leapt into a tail call */
+#define NOT_TAILED (-2)
+
+static struct heap_frame *
+push_heap_frame(CHEAX *c, int kind)
 {
-	return wrap_tail_eval(c, value_evaluator, &input);
+	if (c->hstack.len == c->hstack.cap) {
+		size_t new_cap = (c->hstack.cap == 0) ? 64 : c->hstack.cap * 2;
+		if (new_cap > SIZE_MAX / sizeof(struct heap_frame)) {
+			cheax_throwf(c, CHEAX_ENOMEM, "push_heap_frame(): stack too large");
+			return NULL;
+		}
+
+		struct heap_frame *new_array;
+		new_array = cheax_realloc(c, c->hstack.array, new_cap * sizeof(struct heap_frame));
+		if (new_array == NULL)
+			return NULL;
+
+		c->hstack.array = new_array;
+		c->hstack.cap = new_cap;
+	}
+
+	struct heap_frame *fr = &c->hstack.array[c->hstack.len++];
+	fr->kind = kind;
+	return fr;
 }
 
-struct chx_value
-cheax_macroexpand(CHEAX *c, struct chx_value expr)
+static int
+push_eval_frame(CHEAX *c)
 {
-	struct chx_value expr_mexp = expr;
-	do {
-		expr = expr_mexp;
-		expr_mexp = cheax_macroexpand_once(c, expr);
-		cheax_ft(c, pad);
-	} while (!cheax_equiv(expr, expr_mexp));
-pad:
-	return expr_mexp;
+	struct heap_frame *fr = push_heap_frame(c, HF_EVAL);
+	if (fr == NULL)
+		return -1;
+
+	fr->u.eval.ret_env = fr->u.eval.pop_stop = c->env;
+	fr->u.eval.ret_last_call = fr->u.eval.was_last_call = c->bt.last_call;
+	fr->u.eval.tail_lvls = NOT_TAILED;
+	fr->u.eval.tmc_first = fr->u.eval.tmc_hole = NULL;
+	return 0;
 }
 
-struct chx_value
-cheax_macroexpand_once(CHEAX *c, struct chx_value expr)
+static struct heap_frame *
+top_frame(CHEAX *c)
 {
-	if (expr.type != CHEAX_LIST || expr.data.as_list == NULL)
-		return expr;
+	return &c->hstack.array[c->hstack.len - 1];
+}
 
-	struct chx_list *lst = expr.data.as_list;
-	struct chx_value head = lst->value, macro;
-	if (head.type != CHEAX_ID
-	 || !cheax_try_get_from(c, &c->macro_ns, head.data.as_id->value, &macro))
-	{
-		return expr;
-	}
+static struct chx_list *
+alloc_arg(CHEAX *c, struct chx_value value)
+{
+	struct chx_list *arg = c->hstack.free_args;
+	if (arg == NULL)
+		return cheax_list(c, value, NULL).data.as_list;
+
+	c->hstack.free_args = arg->next;
+	arg->value = value;
+	arg->next = NULL;
+	return arg;
+}
 
-	if (macro.type != CHEAX_FUNC && macro.type != CHEAX_EXT_FUNC) {
-		cheax_throwf(c, CHEAX_ESTATIC, "invalid macro type");
-		return CHEAX_NIL;
-	}
+/*
+ * Argument lists can be reused after the call unless they may have
+ * been bound as a whole. External functions never hold on to them,
+ * since eval_ext_func() passes them arguments on the C stack.
+ */
+static bool
+args_reusable(struct chx_value head)
+{
+	if (head.type == CHEAX_EXT_FUNC)
+		return true;
 
-	chx_ref lst_ref = cheax_ref_ptr(c, lst);
+	struct chx_func *fn = head.data.as_func;
+	return fn->num_params >= 0 && !fn->variadic;
+}
+
+static void
+free_args(CHEAX *c, struct chx_list *args, struct chx_list *last_arg)
+{
+	if (args == NULL)
+		return;
+
+	for (struct chx_list *arg = args; arg != NULL; arg = arg->next)
+		arg->value = CHEAX_NIL;
+
+	last_arg->next = c->hstack.free_args;
+	c->hstack.free_args = args;
+}
+
+static struct chx_value
+heap_eval(CHEAX *c, struct chx_value input)
+{
+	const size_t base = c->hstack.len;
+	union chx_eval_out out = { 0 };
+	struct heap_frame *fr;
+	struct chx_value head, value;
+	int ek;
+
+	if (push_eval_frame(c) < 0)
+		return CHEAX_NIL;
+
+eval:
+	/* evaluate `input' in the HF_EVAL frame on top */
+	fr = top_frame(c);
+	if (input.type == CHEAX_LIST && input.data.as_list != NULL) {
+		struct chx_list *lst = input.data.as_list;
+		if (!check_stack_limit(c) || !count_step(c))
+			goto unwind;
+
+		chx_ref lst_ref = cheax_ref_ptr(c, lst);
+		head = cheax_eval(c, lst->value);
+		if (cheax_errno(c) != 0) {
+			cheax_unref_ptr(c, lst, lst_ref);
+			goto unwind;
+		}
+
+		bool tail_cons = is_tail_cons(c, head, lst->next);
+		if (!tail_cons && (head.type == CHEAX_EXT_FUNC || head.type == CHEAX_FUNC)) {
+			chx_ref head_ref = cheax_ref(c, head);
+			fr = push_heap_frame(c, HF_CALL);
+			cheax_unref(c, head, head_ref);
+			cheax_unref_ptr(c, lst, lst_ref);
+			if (fr == NULL)
+				goto unwind;
+
+			fr->u.call.input = lst;
+			fr->u.call.next_arg = lst->next;
+			fr->u.call.args = fr->u.call.last_arg = NULL;
+			fr->u.call.head = head;
+			fr->u.call.was_last_call = c->bt.last_call;
+			fr->u.call.prev_stack_depth = c->stack_depth++;
+			c->bt.last_call = lst;
+			goto next_arg;
+		}
+
+		int prev_stack_depth = c->stack_depth++;
+		ek = tail_cons
+		   ? eval_tail_cons(c, lst, fr->u.eval.pop_stop, &out)
+		   : dispatch_sexpr(c, lst, head, fr->u.eval.pop_stop, &out);
+		c->stack_depth = prev_stack_depth;
+		cheax_unref_ptr(c, lst, lst_ref);
+	} else {
+		ek = eval(c, input, fr->u.eval.pop_stop, &out);
+	}
+
+result:
+	/* handle result of evaluation in the HF_EVAL frame on top */
+	fr = top_frame(c);
+	if (ek != CHEAX_VALUE_OUT && fr->u.eval.tail_lvls == NOT_TAILED) {
+		fr->u.eval.was_last_call = c->bt.last_call;
+		fr->u.eval.tail_lvls = -1;
+	}
+
+	if (cheax_errno(c) != 0)
+		goto unwind;
+
+	if (ek == TMC_OUT) {
+		if (fr->u.eval.tmc_first == NULL)
+			fr->u.eval.tmc_first = c->tmc.first;
+		else
+			fr->u.eval.tmc_hole->next = c->tmc.first;
+		fr->u.eval.tmc_hole = c->tmc.last;
+	}
+
+	if (ek != CHEAX_VALUE_OUT) {
+		++fr->u.eval.tail_lvls;
+		fr->u.eval.pop_stop = out.ts.pop_stop;
+		input = out.ts.tail;
+		goto eval;
+	}
+
+	value = out.value;
+	if (fr->u.eval.tmc_first != NULL) {
+		if (value.type != CHEAX_LIST) {
+			cheax_throwf(c, CHEAX_ETYPE, "improper list not allowed");
+			goto unwind;
+		}
+		fr->u.eval.tmc_hole->next = value.data.as_list;
+		value = cheax_list_value(fr->u.eval.tmc_first);
+	}
+	if (fr->u.eval.tail_lvls != NOT_TAILED) {
+		while (c->env != fr->u.eval.pop_stop)
+			cheax_pop_env(c);
+		c->env = fr->u.eval.ret_env;
+		c->bt.last_call = fr->u.eval.ret_last_call;
+	}
+
+	if (--c->hstack.len == base)
+		return value;
+
+	/* append value to argument list of waiting function call */
+	fr = top_frame(c);
+	struct chx_list *arg = alloc_arg(c, value);
+	if (arg == NULL)
+		goto unwind;
+
+	if (fr->u.call.last_arg == NULL)
+		fr->u.call.args = arg;
+	else
+		fr->u.call.last_arg->next = arg;
+	fr->u.call.last_arg = arg;
+
+next_arg:
+	/* continue HF_CALL frame on top */
+	fr = top_frame(c);
+	if (fr->u.call.next_arg != NULL) {
+		input = fr->u.call.next_arg->value;
+		fr->u.call.next_arg = fr->u.call.next_arg->next;
+		if (push_eval_frame(c) < 0)
+			goto unwind;
+		goto eval;
+	}
+
+	/* The frame stays in place during the call, keeping head and
+	 * arguments reachable. Reentrant calls push frames above it, so
+	 * only refer to it by index from here on. */
+	size_t call_idx = c->hstack.len - 1;
+	struct chx_env *pop_stop = c->hstack.array[call_idx - 1].u.eval.pop_stop;
+	head = fr->u.call.head;
+
+	struct chx_list *call = fr->u.call.input;
+	bool traced = c->trace_calls;
+	unsigned prof_token = traced ? enter_call(c, head, call) : 0;
+	PROBE_CALL(c, function__entry, head, call);
+	if (head.type == CHEAX_EXT_FUNC) {
+		ek = perform_ext_func(c, head.data.as_ext_func, fr->u.call.args, pop_stop, &out);
+	} else {
+		ek = eval_func_call(c, head.data.as_func, fr->u.call.args, pop_stop, &out, true);
+	}
+	PROBE_CALL(c, function__return, head, call);
+	if (traced)
+		exit_call(c, call, prof_token);
+
+	fr = &c->hstack.array[call_idx];
+	if (ek == CHEAX_VALUE_OUT) {
+		c->bt.last_call = fr->u.call.was_last_call;
+		chx_ref res_ref = cheax_ref(c, out.value);
+		cheax_gc(c);
+		cheax_unref(c, out.value, res_ref);
+	}
+
+	if (args_reusable(fr->u.call.head))
+		free_args(c, fr->u.call.args, fr->u.call.last_arg);
+
+	c->stack_depth = fr->u.call.prev_stack_depth;
+	--c->hstack.len;
+	goto result;
+
+unwind:
+	/* leave frames like their native counterparts would on error */
+	while (c->hstack.len > base) {
+		fr = top_frame(c);
+		if (fr->kind == HF_EVAL) {
+			if (fr->u.eval.tail_lvls != NOT_TAILED) {
+				cheax_bt_add_tail_msg_(c, fr->u.eval.tail_lvls);
+				c->bt.last_call = fr->u.eval.was_last_call;
+				cheax_add_bt(c);
+				c->env = fr->u.eval.ret_env;
+				c->bt.last_call = fr->u.eval.ret_last_call;
+			}
+		} else {
+			if (fr->u.call.head.type == CHEAX_FUNC) {
+				/* eval_args() failed */
+				c->bt.last_call = fr->u.call.input;
+				cheax_add_bt(c);
+			}
+			c->bt.last_call = fr->u.call.was_last_call;
+			c->stack_depth = fr->u.call.prev_stack_depth;
+		}
+		--c->hstack.len;
+	}
+
+	return CHEAX_NIL;
+}
+
+struct chx_value
+cheax_eval(CHEAX *c, struct chx_value input)
+{
+	return (c->heap_stack && c->tail_call_elimination)
+	     ? heap_eval(c, input)
+	     : wrap_tail_eval(c, value_evaluator, &input);
+}
+
+struct chx_value
+cheax_macroexpand(CHEAX *c, struct chx_value expr)
+{
+	struct chx_value expr_mexp = expr;
+	do {
+		expr = expr_mexp;
+		expr_mexp = cheax_macroexpand_once(c, expr);
+		cheax_ft(c, pad);
+	} while (!cheax_equiv(expr, expr_mexp));
+pad:
+	return expr_mexp;
+}
+
+struct chx_value
+cheax_macroexpand_once(CHEAX *c, struct chx_value expr)
+{
+	if (expr.type != CHEAX_LIST || expr.data.as_list == NULL)
+		return expr;
+
+	struct chx_list *lst = expr.data.as_list;
+	struct chx_value head = lst->value, macro;
+	if (head.type != CHEAX_ID
+	 || !cheax_try_get_from(c, &c->macro_ns, head.data.as_id->value, &macro))
+	{
+		return expr;
+	}
+
+	if (macro.type != CHEAX_FUNC && macro.type != CHEAX_EXT_FUNC) {
+		cheax_throwf(c, CHEAX_ESTATIC, "invalid macro type");
+		return CHEAX_NIL;
+	}
+
+	chx_ref lst_ref = cheax_ref_ptr(c, lst);
 
 	struct chx_value res = cheax_apply(c, macro, lst->next);
 
@@ -694,6 +1089,9 @@ cheax_macroexpand_once(CHEAX *c, struct chx_value expr)
 		cheax_ft(c, pad);
 	}
 
+	if (c->hooks.macroexpand != NULL)
+		c->hooks.macroexpand(c, expr, res, c->hooks.data);
+
 	return res;
 pad:
 	return CHEAX_NIL;
@@ -759,9 +1157,12 @@ pad:
 	return call_out_val;
 }
 
-struct chx_value
-cheax_preproc(CHEAX *c, struct chx_value expr)
+static struct chx_value
+preproc(CHEAX *c, struct chx_value expr)
 {
+	if (expr.type == CHEAX_BACKQUOTE)
+		return cheax_preproc_bkquote_(c, expr);
+
 	if (!should_preprocess(expr))
 		return expr;
 
@@ -797,6 +1198,21 @@ cheax_preproc(CHEAX *c, struct chx_value expr)
 	return out;
 }
 
+struct chx_value
+cheax_preproc(CHEAX *c, struct chx_value expr)
+{
+	++c->preproc_depth;
+	struct chx_value out = preproc(c, expr);
+	--c->preproc_depth;
+
+	/* Optimize whole top-level forms, so that binding forms
+	 * anywhere within can be taken into account */
+	if (c->optimize && c->preproc_depth == 0 && cheax_errno(c) == 0)
+		out = cheax_optimize_(c, out);
+
+	return out;
+}
+
 struct chx_value
 cheax_apply(CHEAX *c, struct chx_value func, struct chx_list *args)
 {
@@ -819,6 +1235,34 @@ cheax_apply(CHEAX *c, struct chx_value func, struct chx_list *args)
 	}
 }
 
+int
+cheax_apply_tail(CHEAX *c,
+                 struct chx_value func,
+                 struct chx_list *args,
+                 struct chx_env *pop_stop,
+                 union chx_eval_out *out)
+{
+	switch (func.type) {
+	case CHEAX_EXT_FUNC:
+		return eval_ext_func(c, func.data.as_ext_func, args, false, pop_stop, out);
+
+	case CHEAX_FUNC:
+		return eval_func_call(c, func.data.as_func, args, pop_stop, out, true);
+
+	default:
+		cheax_throwf(c, CHEAX_ETYPE, "apply(): only ExtFunc and Func allowed (got type %d)", func.type);
+		out->value = CHEAX_NIL;
+		return CHEAX_VALUE_OUT;
+	}
+}
+
+struct chx_value
+cheax_tail_ext_func_perform_(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct tail_ext_func *tf = info;
+	return cheax_apply(c, cheax_ext_func_value(&tf->base), args);
+}
+
 static bool
 match_node(CHEAX *c,
            struct chx_env *env,
@@ -972,12 +1416,30 @@ cheax_eq(CHEAX *c, struct chx_value l, struct chx_value r)
 	case CHEAX_BACKQUOTE:
 	case CHEAX_COMMA:
 	case CHEAX_SPLICE:
-		return cheax_eq(c, l.data.as_quote->value, l.data.as_quote->value);
+		return cheax_eq(c, l.data.as_quote->value, r.data.as_quote->value);
 	case CHEAX_STRING:
 		return (l.data.as_string->len == r.data.as_string->len)
 		    && (0 == memcmp(l.data.as_string->value,
 		                    r.data.as_string->value,
 		                    r.data.as_string->len));
+	case CHEAX_RECORD:
+		for (int i = 0; i < l.data.as_record->num_slots; ++i)
+			if (!cheax_eq(c, l.data.as_record->slots[i], r.data.as_record->slots[i]))
+				return false;
+		return true;
+	case CHEAX_VECTOR:
+		if (l.data.as_vector->len != r.data.as_vector->len)
+			return false;
+		for (size_t i = 0; i < l.data.as_vector->len; ++i)
+			if (!cheax_eq(c, l.data.as_vector->items[i], r.data.as_vector->items[i]))
+				return false;
+		return true;
+	case CHEAX_HASHMAP:
+		return cheax_hashmap_eq_(c, l.data.as_hashmap, r.data.as_hashmap);
+	case CHEAX_MAP:
+		return cheax_map_eq_(c, l.data.as_map, r.data.as_map);
+	case CHEAX_ORDERED_MAP:
+		return cheax_omap_eq_(c, l.data.as_ordered_map, r.data.as_ordered_map);
 	case CHEAX_USER_PTR:
 	default:
 		return l.data.user_ptr == r.data.user_ptr;
@@ -999,26 +1461,47 @@ cheax_equiv(struct chx_value l, struct chx_value r)
  *
  */
 
-static struct chx_value
-bltn_eval(CHEAX *c, struct chx_list *args, void *info)
+static int
+bltn_eval(CHEAX *c,
+          struct chx_list *args,
+          void *info,
+          struct chx_env *pop_stop,
+          union chx_eval_out *out)
 {
-	struct chx_value arg;
-	return (0 == cheax_unpack_(c, args, "_", &arg))
-	     ? cheax_bt_wrap_(c, cheax_eval(c, arg))
-	     : CHEAX_NIL;
+	if (0 != cheax_unpack_(c, args, "_", &out->ts.tail)) {
+		out->value = CHEAX_NIL;
+		return CHEAX_VALUE_OUT;
+	}
+
+	out->ts.pop_stop = pop_stop;
+	return CHEAX_TAIL_OUT;
 }
 
-static struct chx_value
-bltn_apply(CHEAX *c, struct chx_list *args, void *info)
+bool
+cheax_is_eval_(struct chx_ext_func *extf)
 {
-	/* TODO revert back to tailable form */
+	if (extf->perform != cheax_tail_ext_func_perform_)
+		return false;
 
+	struct tail_ext_func *tf = extf->info;
+	return tf->perform == bltn_eval;
+}
+
+static int
+bltn_apply(CHEAX *c,
+           struct chx_list *args,
+           void *info,
+           struct chx_env *pop_stop,
+           union chx_eval_out *out)
+{
 	struct chx_value func;
 	struct chx_list *list;
-	if (cheax_unpack_(c, args, "[LP]C", &func, &list) < 0)
-		return CHEAX_NIL;
+	if (cheax_unpack_(c, args, "[LP]C", &func, &list) < 0) {
+		out->value = CHEAX_NIL;
+		return CHEAX_VALUE_OUT;
+	}
 
-	return cheax_apply(c, func, list);
+	return cheax_apply_tail(c, func, list, pop_stop, out);
 }
 
 static struct chx_value
@@ -1039,6 +1522,30 @@ bltn_ne(CHEAX *c, struct chx_list *args, void *info)
 	     : CHEAX_NIL;
 }
 
+static struct case_tree *
+get_case_tree(CHEAX *c, struct chx_list *args)
+{
+	struct attrib *attr = cheax_attrib_get_(c, args, ATTRIB_CASE_TREE);
+	if (attr != NULL)
+		return attr->case_tree;
+
+	/* Not compiled in pp_sf_case(), e.g. because the optimizer
+	 * rebuilt the form */
+	struct case_tree *tree = cheax_case_compile_(c, args->next);
+	cheax_ft(c, pad);
+
+	attr = cheax_attrib_add_(c, args, ATTRIB_CASE_TREE);
+	if (attr == NULL) {
+		cheax_case_free_(c, tree);
+		return NULL;
+	}
+
+	attr->case_tree = tree;
+	return tree;
+pad:
+	return NULL;
+}
+
 static int
 sf_case(CHEAX *c,
         struct chx_list *args,
@@ -1046,57 +1553,69 @@ sf_case(CHEAX *c,
         struct chx_env *pop_stop,
         union chx_eval_out *out)
 {
+	struct case_binding bind_buf[16], *binds = bind_buf;
+	int num_binds;
+
 	if (args == NULL) {
 		cheax_throwf(c, CHEAX_EMATCH, "invalid case");
 		out->value = cheax_bt_wrap_(c, CHEAX_NIL);
 		return CHEAX_VALUE_OUT;
 	}
 
+	struct case_tree *tree = get_case_tree(c, args);
+	if (tree == NULL) {
+		out->value = cheax_bt_wrap_(c, CHEAX_NIL);
+		return CHEAX_VALUE_OUT;
+	}
+
 	struct chx_value what = cheax_eval(c, args->value);
 	cheax_ft(c, pad);
 
-	/* pattern-value-pair */
-	for (struct chx_list *pvp = args->next; pvp != NULL; pvp = pvp->next) {
-		struct chx_value pair = pvp->value;
-		if (pair.type != CHEAX_LIST || pair.data.as_list == NULL) {
-			cheax_throwf(c, CHEAX_EMATCH, "pattern-value pair expected");
-			out->value = cheax_bt_wrap_(c, CHEAX_NIL);
-			return CHEAX_VALUE_OUT;
-		}
+	int len = sizeof(bind_buf) / sizeof(bind_buf[0]);
+	struct chx_list *cons_pair = cheax_case_match_(c, tree, what, bind_buf, len, &binds, &num_binds);
+	cheax_ft(c, pad);
 
-		struct chx_list *cons_pair = pair.data.as_list;
-		struct chx_value pan = cons_pair->value;
+	if (cons_pair == NULL) {
+		cheax_throwf(c, CHEAX_EMATCH, "non-exhaustive pattern");
+		cheax_add_bt(c);
+		goto pad;
+	}
 
-		cheax_push_env(c);
-		cheax_ft(c, pad);
+	/* pattern matches! */
 
-		if (!cheax_match(c, pan, what, CHEAX_READONLY)) {
-			cheax_pop_env(c);
-			continue;
-		}
+	if (cons_pair->next == NULL)
+		goto pad;
 
-		/* pattern matches! */
+	cheax_push_env(c);
+	cheax_ft(c, pad);
 
-		if (cons_pair->next == NULL)
-			goto pad;
+	for (int i = 0; i < num_binds; ++i) {
+		cheax_def_id_(c, binds[i].id, binds[i].value, CHEAX_READONLY);
+		cheax_ft(c, pad2);
+	}
 
-		struct chx_list *stat;
-		for (stat = cons_pair->next; stat->next != NULL; stat = stat->next) {
-			cheax_bt_wrap_(c, cheax_eval(c, stat->value));
-			cheax_ft(c, pad2);
-		}
+	if (!cheax_body_defines_(c, cons_pair->next))
+		cheax_seal_env_(c);
 
-		out->ts.tail = stat->value;
-		out->ts.pop_stop = pop_stop;
-		return CHEAX_TAIL_OUT;
-pad2:
-		cheax_pop_env(c);
-		goto pad;
+	if (binds != bind_buf) {
+		cheax_free(c, binds);
+		binds = bind_buf;
+	}
+
+	struct chx_list *stat;
+	for (stat = cons_pair->next; stat->next != NULL; stat = stat->next) {
+		cheax_bt_wrap_(c, cheax_eval(c, stat->value));
+		cheax_ft(c, pad2);
 	}
 
-	cheax_throwf(c, CHEAX_EMATCH, "non-exhaustive pattern");
-	cheax_add_bt(c);
+	out->ts.tail = stat->value;
+	out->ts.pop_stop = pop_stop;
+	return CHEAX_TAIL_OUT;
+pad2:
+	cheax_pop_env(c);
 pad:
+	if (binds != bind_buf)
+		cheax_free(c, binds);
 	out->value = CHEAX_NIL;
 	return CHEAX_VALUE_OUT;
 }
@@ -1114,7 +1633,14 @@ pp_sf_case(CHEAX *c, struct chx_list *args, void *info)
 		"pattern-value pair expected",
 	};
 
-	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+	struct chx_value res = cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+	cheax_ft(c, pad);
+
+	/* compile patterns ahead of time */
+	if (res.type == CHEAX_LIST && res.data.as_list != NULL)
+		get_case_tree(c, res.data.as_list);
+pad:
+	return res;
 }
 
 static int
@@ -1150,6 +1676,9 @@ sf_cond(CHEAX *c,
 		cheax_push_env(c);
 		cheax_ft(c, pad);
 
+		if (!cheax_body_defines_(c, cons_pair->next))
+			cheax_seal_env_(c);
+
 		if (cons_pair->next == NULL)
 			goto pad2;
 
@@ -1183,14 +1712,687 @@ pp_sf_cond(CHEAX *c, struct chx_list *args, void *info)
 	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
 }
 
-void
-cheax_export_eval_bltns_(CHEAX *c)
+/* Evaluate boolean test */
+static bool
+eval_test(CHEAX *c, struct chx_value test, bool *res)
+{
+	test = cheax_eval(c, test);
+	cheax_ft(c, pad);
+	if (test.type != CHEAX_BOOL) {
+		cheax_throwf(c, CHEAX_ETYPE, "test must have boolean value");
+		cheax_add_bt(c);
+		goto pad;
+	}
+
+	*res = (test.data.as_int != 0);
+	return true;
+pad:
+	return false;
+}
+
+/*
+ * Evaluate branch in tail position. Only enter a new scope if the
+ * branch binds something, so that it doesn't end up in the enclosing
+ * environment.
+ */
+static int
+tail_branch(CHEAX *c, struct chx_value branch, struct chx_env *pop_stop, union chx_eval_out *out)
+{
+	if (cheax_is_definition_(c, branch)) {
+		cheax_push_env(c);
+		cheax_ft(c, pad);
+	}
+
+	out->ts.tail = branch;
+	out->ts.pop_stop = pop_stop;
+	return CHEAX_TAIL_OUT;
+pad:
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+static int
+sf_if(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)
+{
+	struct chx_value test, then, els;
+	bool b;
+	if (0 == cheax_unpack_(c, args, "___", &test, &then, &els) && eval_test(c, test, &b))
+		return tail_branch(c, b ? then : els, pop_stop, out);
+
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+static struct chx_value
+pp_sf_if(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* (node EXPR (node EXPR (node EXPR NIL))) */
+	static const uint8_t ops[] = {
+		PP_NODE | PP_ERR(0), PP_EXPR,
+		PP_NODE | PP_ERR(1), PP_EXPR,
+		PP_NODE | PP_ERR(2), PP_EXPR, PP_NIL | PP_ERR(3),
+	};
+
+	static const char *errors[] = {
+		"expected test",
+		"expected then-expression",
+		"expected else-expression",
+		"unexpected expression after else-expression",
+	};
+
+	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+}
+
+/*
+ * (when), or (unless) if info is non-NULL: evaluate the second argument
+ * only if the test has the expected value.
+ */
+static int
+sf_when(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)
 {
-	cheax_defun(c, "eval",  bltn_eval,  NULL);
-	cheax_defun(c, "apply", bltn_apply, NULL);
-	cheax_defun(c, "=",     bltn_eq,    NULL);
-	cheax_defun(c, "!=",    bltn_ne,    NULL);
+	bool expect = (info == NULL);
 
-	cheax_defsyntax(c, "case", sf_case, pp_sf_case, NULL);
-	cheax_defsyntax(c, "cond", sf_cond, pp_sf_cond, NULL);
+	struct chx_value test, then;
+	bool b;
+	if (0 == cheax_unpack_(c, args, "__", &test, &then)
+	 && eval_test(c, test, &b)
+	 && b == expect)
+	{
+		return tail_branch(c, then, pop_stop, out);
+	}
+
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+/*
+ * (and), or (or) if info is non-NULL: short-circuit if the first
+ * argument decides the outcome, otherwise the second argument is the
+ * result.
+ */
+static int
+sf_and(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)
+{
+	bool short_circuit = (info != NULL);
+
+	struct chx_value x, y;
+	bool b;
+	if (0 == cheax_unpack_(c, args, "__", &x, &y) && eval_test(c, x, &b)) {
+		if (b != short_circuit)
+			return tail_branch(c, y, pop_stop, out);
+
+		out->value = cheax_bool(short_circuit);
+		return CHEAX_VALUE_OUT;
+	}
+
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+/* (when), (unless), (and) and (or) */
+static struct chx_value
+pp_sf_when(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* (node EXPR (node EXPR NIL)) */
+	static const uint8_t ops[] = {
+		PP_NODE | PP_ERR(0), PP_EXPR, PP_NODE | PP_ERR(1), PP_EXPR, PP_NIL | PP_ERR(2),
+	};
+
+	static const char *errors[] = {
+		"expected test",
+		"expected expression",
+		"unexpected expression after second argument",
+	};
+
+	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+}
+
+static int
+sf_do(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)
+{
+	struct chx_list *body;
+	if (cheax_unpack_(c, args, "_+", &body) < 0)
+		goto pad;
+
+	/* Only enter a new scope if the body binds something */
+	bool new_scope = false;
+	for (struct chx_list *stat = body; stat != NULL && !new_scope; stat = stat->next)
+		new_scope = cheax_is_definition_(c, stat->value);
+
+	if (new_scope) {
+		cheax_push_env(c);
+		cheax_ft(c, pad);
+	}
+
+	for (; body->next != NULL; body = body->next) {
+		cheax_eval(c, body->value);
+		cheax_ft(c, pad2);
+	}
+
+	out->ts.tail = body->value;
+	out->ts.pop_stop = pop_stop;
+	return CHEAX_TAIL_OUT;
+pad2:
+	if (new_scope)
+		cheax_pop_env(c);
+pad:
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+static struct chx_value
+pp_sf_do(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* (node EXPR (seq EXPR)) */
+	static const uint8_t ops[] = {
+		PP_NODE | PP_ERR(0), PP_EXPR, PP_SEQ, PP_EXPR,
+	};
+	static const char *errors[] = { "expected body" };
+	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+}
+
+/*
+ * Loops bind their variables once, in a single frame, and rebind them
+ * in place for every iteration. The body is evaluated directly rather
+ * than trampolined through wrap_tail_eval().
+ *
+ * Don't expect (loop) to beat a self tail call by much, nor (while) to
+ * beat either: tail calls already recycle their frame, and most of the
+ * time goes to evaluating the body. Only (dotimes), which does its own
+ * counting, saves a lot. See tools/bench-loops.sh.
+ */
+
+/* (loop) being evaluated, living on the C stack of sf_loop() */
+struct loop_frame {
+	struct chx_env *env;
+	int num_vars;
+	struct chx_id **ids;
+	/* values passed to (recur), yet to be bound */
+	struct chx_value *values;
+	chx_ref *refs;
+	bool recur;
+	struct loop_frame *outer;
+};
+
+/*
+ * Evaluate body once. If it binds something, do so in a scope of its
+ * own, so that it can be bound anew in the next iteration.
+ */
+static struct chx_value
+eval_body(CHEAX *c, struct chx_list *body, bool new_scope)
+{
+	struct chx_value res = CHEAX_NIL;
+
+	if (new_scope) {
+		cheax_push_env(c);
+		cheax_ft(c, pad);
+	}
+
+	for (; body != NULL; body = body->next) {
+		res = cheax_eval(c, body->value);
+		cheax_ft(c, pad2);
+	}
+
+pad2:
+	if (new_scope)
+		cheax_pop_env(c);
+pad:
+	return res;
+}
+
+static void
+unref_values(CHEAX *c, struct chx_value *values, chx_ref *refs, int n)
+{
+	for (int i = 0; i < n; ++i)
+		cheax_unref(c, values[i], refs[i]);
+}
+
+/* Bind the loop variables to the values in frame->values */
+static void
+bind_loop_vars(CHEAX *c, struct loop_frame *frame)
+{
+	struct chx_env *env = frame->env;
+	if (env != NULL && has_flag(env->rtflags, NO_ESC_BIT)) {
+		/* nobody else can see the frame; rebind in place */
+		struct full_sym *vars = env->value.norm.params;
+		for (int i = 0; i < frame->num_vars; ++i)
+			vars[i].sym.protect = frame->values[i];
+		return;
+	}
+
+	/* A closure holds on to the current bindings, so leave them be
+	 * and bind in a frame of our own */
+	if (env != NULL)
+		cheax_pop_env(c);
+
+	frame->env = NULL;
+	cheax_push_env(c);
+	cheax_ft(c, pad);
+	frame->env = c->env;
+
+	cheax_def_params_(c, frame->ids, frame->values, frame->num_vars);
+	cheax_ft(c, pad);
+
+	/* a body binding something gets a scope of its own */
+	cheax_seal_env_(c);
+pad:
+	return;
+}
+
+static int
+sf_loop(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)
+{
+	struct chx_id *ids[MAX_FLAT_PARAMS];
+	struct chx_value values[MAX_FLAT_PARAMS];
+	chx_ref refs[MAX_FLAT_PARAMS];
+	int n = 0;
+
+	struct loop_frame frame = {
+		.env    = NULL,
+		.ids    = ids,
+		.values = values,
+		.refs   = refs,
+		.recur  = false,
+		.outer  = c->loop,
+	};
+
+	struct chx_value res = CHEAX_NIL;
+	struct chx_list *pairs, *body;
+	if (cheax_unpack_(c, args, "C_+", &pairs, &body) < 0)
+		goto pad;
+
+	for (; pairs != NULL; pairs = pairs->next, ++n) {
+		if (n >= MAX_FLAT_PARAMS) {
+			cheax_throwf(c, CHEAX_EVALUE, "too many loop variables");
+			cheax_add_bt(c);
+			goto pad;
+		}
+
+		struct chx_value pairv = pairs->value;
+		if (pairv.type != CHEAX_LIST
+		 || cheax_unpack_(c, pairv.data.as_list, "N.", &ids[n], &values[n]) < 0)
+		{
+			if (cheax_errno(c) == 0) {
+				cheax_throwf(c, CHEAX_ETYPE, "expected list of lists in first arg");
+				cheax_add_bt(c);
+			}
+			goto pad;
+		}
+
+		refs[n] = cheax_ref(c, values[n]);
+
+		for (int i = 0; i < n; ++i) {
+			if (ids[i] == ids[n]) {
+				cheax_throwf(c, CHEAX_EVALUE, "duplicate loop variable `%s'", ids[n]->value);
+				cheax_add_bt(c);
+				++n;
+				goto pad;
+			}
+		}
+	}
+
+	frame.num_vars = n;
+	bind_loop_vars(c, &frame);
+	unref_values(c, values, refs, n);
+	n = 0;
+	cheax_ft(c, pad2);
+
+	c->loop = &frame;
+
+	bool new_scope = cheax_body_defines_(c, body);
+	for (;;) {
+		res = eval_body(c, body, new_scope);
+		if (!frame.recur)
+			break;
+
+		/* iterations don't pass through eval_sexpr() */
+		if (cheax_errno(c) == 0 && !count_step(c))
+			res = CHEAX_NIL;
+
+		frame.recur = false;
+		bool tail = cheax_errno(c) == 0
+		         && res.type == CHEAX_ID
+		         && res.data.as_id == c->std_ids[RECUR_ID];
+		if (tail)
+			bind_loop_vars(c, &frame);
+
+		unref_values(c, values, refs, frame.num_vars);
+		if (cheax_errno(c) != 0)
+			break;
+
+		if (!tail) {
+			cheax_throwf(c, CHEAX_EEVAL, "recur not in tail position");
+			cheax_add_bt(c);
+			break;
+		}
+	}
+
+	c->loop = frame.outer;
+pad2:
+	if (c->env != NULL && c->env == frame.env)
+		cheax_pop_env(c);
+pad:
+	unref_values(c, values, refs, n);
+	out->value = (cheax_errno(c) == 0) ? res : CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+static void check_recur(CHEAX *c, struct chx_value form, bool tail);
+
+/* Check forms in sequence, of which only the last can be in tail position */
+static void
+check_recur_seq(CHEAX *c, struct chx_list *lst, bool tail)
+{
+	for (; lst != NULL; lst = lst->next) {
+		check_recur(c, lst->value, tail && lst->next == NULL);
+		cheax_ft(c, pad);
+	}
+pad:
+	return;
+}
+
+/*
+ * Throw if preprocessed form contains a (recur) that doesn't hand its
+ * result straight back to the (loop) being preprocessed.
+ */
+static void
+check_recur(CHEAX *c, struct chx_value form, bool tail)
+{
+	if (form.type != CHEAX_LIST || form.data.as_list == NULL)
+		return;
+
+	struct chx_value head = form.data.as_list->value;
+	struct chx_list *args = form.data.as_list->next;
+	if (head.type != CHEAX_SPECIAL_OP || head.data.as_special_op->name == NULL) {
+		check_recur_seq(c, form.data.as_list, false);
+		return;
+	}
+
+	const char *name = head.data.as_special_op->name;
+	if (0 == strcmp(name, "recur")) {
+		if (!tail) {
+			cheax_throwf(c, CHEAX_ESTATIC, "recur not in tail position");
+			return;
+		}
+		check_recur_seq(c, args, false);
+	} else if (0 == strcmp(name, "if")) {
+		for (; args != NULL; args = args->next) {
+			/* both branches, but not the test */
+			check_recur(c, args->value, tail && args != form.data.as_list->next);
+			cheax_ft(c, pad);
+		}
+	} else if (0 == strcmp(name, "when") || 0 == strcmp(name, "unless")) {
+		if (args != NULL) {
+			check_recur(c, args->value, false);
+			cheax_ft(c, pad);
+			check_recur_seq(c, args->next, tail);
+		}
+	} else if (0 == strcmp(name, "do") || 0 == strcmp(name, "and")
+	        || 0 == strcmp(name, "or"))
+	{
+		check_recur_seq(c, args, tail);
+	} else if (0 == strcmp(name, "cond")) {
+		for (; args != NULL; args = args->next) {
+			check_recur_seq(c, args->value.data.as_list, tail);
+			cheax_ft(c, pad);
+		}
+	} else if (0 == strcmp(name, "case")) {
+		if (args != NULL) {
+			check_recur(c, args->value, false);
+			for (args = args->next; args != NULL; args = args->next) {
+				cheax_ft(c, pad);
+				check_recur_seq(c, args->value.data.as_list->next, tail);
+			}
+		}
+	} else if (0 == strcmp(name, "let") || 0 == strcmp(name, "let*")) {
+		if (args != NULL) {
+			for (struct chx_list *p = args->value.data.as_list; p != NULL; p = p->next) {
+				check_recur_seq(c, p->value.data.as_list->next, false);
+				cheax_ft(c, pad);
+			}
+			check_recur_seq(c, args->next, tail);
+		}
+	} else if (0 == strcmp(name, "loop") || 0 == strcmp(name, "fn")) {
+		/* checked when preprocessed themselves */
+	} else {
+		check_recur_seq(c, args, false);
+	}
+pad:
+	return;
+}
+
+static struct chx_value
+pp_sf_loop(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* (node (seq (node LIT (node EXPR NIL))) (node EXPR (seq EXPR))) */
+	static const uint8_t ops[] = {
+		/* sequence of... */
+		PP_NODE | PP_ERR(0), PP_SEQ | PP_ERR(1),
+		/* ...pairs */
+		PP_NODE | PP_ERR(2), PP_LIT, PP_NODE | PP_ERR(2), PP_EXPR, PP_NIL | PP_ERR(2),
+		/* body */
+		PP_NODE | PP_ERR(3), PP_EXPR, PP_SEQ, PP_EXPR,
+	};
+
+	static const char *errors[] = {
+		"expected binding list",
+		"expected list of pairs in first argument",
+		"each loop binding must contain two values",
+		"expected body",
+	};
+
+	++c->pp_loop_depth;
+	struct chx_value res = cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+	--c->pp_loop_depth;
+	cheax_ft(c, pad);
+
+	if (res.type == CHEAX_LIST && res.data.as_list != NULL) {
+		struct chx_list *bindings = res.data.as_list;
+		for (struct chx_list *p = bindings->value.data.as_list; p != NULL; p = p->next) {
+			check_recur(c, p->value.data.as_list->next->value, false);
+			cheax_ft(c, pad);
+		}
+		if (cheax_errno(c) == 0)
+			check_recur_seq(c, bindings->next, true);
+	}
+pad:
+	return res;
+}
+
+/* Whether target is env or one of the environments it looks into */
+static bool
+env_within(struct chx_env *env, struct chx_env *target)
+{
+	for (; env != NULL; env = env->value.norm.below) {
+		if (env == target)
+			return true;
+		if (env->is_bif)
+			return env_within(env->value.bif[0], target)
+			    || env_within(env->value.bif[1], target);
+	}
+	return false;
+}
+
+/*
+ * (recur): have the innermost (loop) rebind its variables and evaluate
+ * its body again once we return to it.
+ */
+static int
+sf_recur(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)
+{
+	struct chx_value values[MAX_FLAT_PARAMS];
+	chx_ref refs[MAX_FLAT_PARAMS];
+	int n = 0;
+	out->value = CHEAX_NIL;
+
+	/* The innermost (loop) being evaluated need not be the one we're
+	 * in lexically, if we got here through a function call */
+	struct loop_frame *frame = c->loop;
+	if (frame == NULL || !env_within(c->env, frame->env)) {
+		cheax_throwf(c, CHEAX_EEVAL, "recur outside of loop");
+		cheax_add_bt(c);
+		return CHEAX_VALUE_OUT;
+	}
+
+	int num_args = 0;
+	for (struct chx_list *a = args; a != NULL; a = a->next)
+		++num_args;
+	if (num_args != frame->num_vars) {
+		cheax_throwf(c, CHEAX_EMATCH, "expected %d value(s) to rebind", frame->num_vars);
+		cheax_add_bt(c);
+		return CHEAX_VALUE_OUT;
+	}
+
+	/* Kept referenced until the loop has bound them */
+	for (; args != NULL; args = args->next, ++n) {
+		values[n] = cheax_eval(c, args->value);
+		cheax_ft(c, pad);
+		refs[n] = cheax_ref(c, values[n]);
+	}
+
+	/* Catches (recur) in the arguments of (recur) as well */
+	if (frame->recur) {
+		cheax_throwf(c, CHEAX_EEVAL, "recur not in tail position");
+		cheax_add_bt(c);
+		goto pad;
+	}
+
+	memcpy(frame->values, values, n * sizeof(values[0]));
+	memcpy(frame->refs, refs, n * sizeof(refs[0]));
+	frame->recur = true;
+	out->value = cheax_id_value(c->std_ids[RECUR_ID]);
+	return CHEAX_VALUE_OUT;
+pad:
+	unref_values(c, values, refs, n);
+	return CHEAX_VALUE_OUT;
+}
+
+static struct chx_value
+pp_sf_recur(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* whether it's in tail position is up to pp_sf_loop() */
+	if (c->pp_loop_depth == 0) {
+		cheax_throwf(c, CHEAX_ESTATIC, "recur outside of loop");
+		return CHEAX_NIL;
+	}
+
+	/* (seq EXPR) */
+	static const uint8_t ops[] = { PP_SEQ, PP_EXPR };
+	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, NULL);
+}
+
+static int
+sf_while(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)
+{
+	struct chx_value test;
+	struct chx_list *body;
+	if (cheax_unpack_(c, args, "__+", &test, &body) < 0)
+		goto pad;
+
+	bool new_scope = cheax_body_defines_(c, body), b;
+	while (eval_test(c, test, &b) && b) {
+		eval_body(c, body, new_scope);
+		cheax_ft(c, pad);
+		if (!count_step(c))
+			break;
+	}
+
+pad:
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+static struct chx_value
+pp_sf_while(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* (node EXPR (node EXPR (seq EXPR))) */
+	static const uint8_t ops[] = {
+		PP_NODE | PP_ERR(0), PP_EXPR, PP_NODE | PP_ERR(1), PP_EXPR, PP_SEQ, PP_EXPR,
+	};
+
+	static const char *errors[] = {
+		"expected test",
+		"expected body",
+	};
+
+	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+}
+
+static int
+sf_dotimes(CHEAX *c, struct chx_list *args, void *info, struct chx_env *pop_stop, union chx_eval_out *out)
+{
+	struct chx_list *spec, *body;
+	struct chx_id *id;
+	chx_int n;
+	if (cheax_unpack_(c, args, "C_+", &spec, &body) < 0
+	 || cheax_unpack_(c, spec, "Ni", &id, &n) < 0)
+	{
+		goto pad2;
+	}
+
+	struct chx_value value;
+	struct loop_frame frame = {
+		.env      = NULL,
+		.num_vars = 1,
+		.ids      = &id,
+		.values   = &value,
+	};
+
+	bool new_scope = cheax_body_defines_(c, body);
+	for (chx_int i = 0; i < n; ++i) {
+		value = cheax_int(i);
+		bind_loop_vars(c, &frame);
+		cheax_ft(c, pad);
+		eval_body(c, body, new_scope);
+		cheax_ft(c, pad);
+		if (!count_step(c))
+			break;
+	}
+
+pad:
+	if (c->env != NULL && c->env == frame.env)
+		cheax_pop_env(c);
+pad2:
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+static struct chx_value
+pp_sf_dotimes(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* (node (node LIT (node EXPR NIL)) (node EXPR (seq EXPR))) */
+	static const uint8_t ops[] = {
+		PP_NODE | PP_ERR(0), PP_NODE | PP_ERR(0), PP_LIT, PP_NODE | PP_ERR(0), PP_EXPR, PP_NIL | PP_ERR(0),
+		PP_NODE | PP_ERR(1), PP_EXPR, PP_SEQ, PP_EXPR,
+	};
+
+	static const char *errors[] = {
+		"expected (var count)",
+		"expected body",
+	};
+
+	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+}
+
+void
+cheax_export_eval_bltns_(CHEAX *c)
+{
+	cheax_defun_tail(c, "eval",  bltn_eval,  NULL);
+	cheax_defun_tail(c, "apply", bltn_apply, NULL);
+	cheax_defun_pure_(c, "=",     bltn_eq,    NULL);
+	cheax_defun_pure_(c, "!=",    bltn_ne,    NULL);
+
+	cheax_defsyntax(c, "case",   sf_case, pp_sf_case, NULL);
+	cheax_defsyntax(c, "cond",   sf_cond, pp_sf_cond, NULL);
+	cheax_defsyntax(c, "if",     sf_if,   pp_sf_if,   NULL);
+	cheax_defsyntax(c, "when",   sf_when, pp_sf_when, NULL);
+	cheax_defsyntax(c, "unless", sf_when, pp_sf_when, (void *)1);
+	cheax_defsyntax(c, "and",    sf_and,  pp_sf_when, NULL);
+	cheax_defsyntax(c, "or",     sf_and,  pp_sf_when, (void *)1);
+	cheax_defsyntax(c, "do",     sf_do,   pp_sf_do,   NULL);
+
+	cheax_defsyntax(c, "loop",    sf_loop,    pp_sf_loop,    NULL);
+	cheax_defsyntax(c, "recur",   sf_recur,   pp_sf_recur,   NULL);
+	cheax_defsyntax(c, "while",   sf_while,   pp_sf_while,   NULL);
+	cheax_defsyntax(c, "dotimes", sf_dotimes, pp_sf_dotimes, NULL);
 }
@@ -29,6 +29,47 @@ bool cheax_ex_match_(CHEAX *c,
                      struct chx_value match,
                      struct match_info info);
 
+void cheax_rmshebang_(FILE *f);
+
+/*
+ * Continuation frame of the heap-stack evaluator (see config option
+ * "heap-stack"). Frames live in c->hstack and are scanned by the GC.
+ */
+struct heap_frame {
+	enum { HF_EVAL, HF_CALL } kind;
+	union {
+		/* one cheax_eval() level, including the tail calls it performs */
+		struct {
+			struct chx_env *ret_env, *pop_stop;
+			struct chx_list *ret_last_call, *was_last_call;
+			int tail_lvls;
+			/* tail modulo cons list, and cell to append to */
+			struct chx_list *tmc_first, *tmc_hole;
+		} eval;
+
+		/* function call waiting for its arguments to be evaluated */
+		struct {
+			struct chx_list *input, *next_arg, *args, *last_arg;
+			struct chx_value head;
+			struct chx_list *was_last_call;
+			int prev_stack_depth;
+		} call;
+	} u;
+};
+
+/*
+ * perform callback of external functions created through
+ * cheax_tail_ext_func(), for when they are called outside of tail
+ * position
+ */
+struct chx_value cheax_tail_ext_func_perform_(CHEAX *c, struct chx_list *args, void *info);
+
+/* compute parameter descriptor of newly created function */
+void cheax_init_params_(CHEAX *c, struct chx_func *fn);
+
+/* whether extf is the (eval) builtin */
+bool cheax_is_eval_(struct chx_ext_func *extf);
+
 void cheax_export_eval_bltns_(CHEAX *c);
 
 #endif
@@ -17,6 +17,7 @@
 #include <string.h>
 
 #include "arith.h"
+#include "btree.h"
 #include "config.h"
 #include "core.h"
 #include "err.h"
@@ -24,21 +25,29 @@
 #include "feat.h"
 #include "format.h"
 #include "gc.h"
+#include "gen.h"
+#include "generic.h"
+#include "hamt.h"
+#include "hashmap.h"
 #include "maths.h"
 #include "io.h"
+#include "prof.h"
+#include "record.h"
 #include "sym.h"
 #include "unpack.h"
+#include "vector.h"
 
 /* sorted asciibetically for use in bsearch() */
 static const struct nfeat { const char *name; int feat; } named_feats[] = {
-	{"all",     ALL_FEATURES  },
-	{"exit",    EXIT_BUILTIN  },
-	{"file-io", FILE_IO       },
-	{"gc",      GC_BUILTIN    },
-	{"stderr",  EXPOSE_STDERR },
-	{"stdin",   EXPOSE_STDIN  },
-	{"stdio",   STDIO         },
-	{"stdout",  EXPOSE_STDOUT },
+	{"all",     ALL_FEATURES    },
+	{"exit",    EXIT_BUILTIN    },
+	{"file-io", FILE_IO         },
+	{"gc",      GC_BUILTIN      },
+	{"profile", PROFILE_BUILTIN },
+	{"stderr",  EXPOSE_STDERR   },
+	{"stdin",   EXPOSE_STDIN    },
+	{"stdio",   STDIO           },
+	{"stdout",  EXPOSE_STDOUT   },
 };
 
 /* used in bsearch() */
@@ -101,6 +110,7 @@ cheax_load_feature(CHEAX *c, const char *feat)
 	cheax_load_config_feature_(c, nf);
 	cheax_load_gc_feature_(c, nf);
 	cheax_load_io_feature_(c, nf);
+	cheax_load_prof_feature_(c, nf);
 
 	c->features |= nf;
 	return 0;
@@ -110,13 +120,20 @@ void
 cheax_export_bltns_(CHEAX *c)
 {
 	cheax_export_arith_bltns_(c);
+	cheax_export_btree_bltns_(c);
 	cheax_export_core_bltns_(c);
 	cheax_export_err_bltns_(c);
 	cheax_export_eval_bltns_(c);
 	cheax_export_format_bltns_(c);
+	cheax_export_gen_bltns_(c);
+	cheax_export_generic_bltns_(c);
+	cheax_export_hamt_bltns_(c);
+	cheax_export_hashmap_bltns_(c);
 	cheax_export_io_bltns_(c);
 	cheax_export_math_bltns_(c);
+	cheax_export_record_bltns_(c);
 	cheax_export_sym_bltns_(c);
+	cheax_export_vector_bltns_(c);
 
 	cheax_defsym(c, "features", get_features, NULL, NULL, NULL);
 }
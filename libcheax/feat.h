@@ -27,7 +27,8 @@ enum {
 	EXPOSE_STDOUT   = 0x0020,
 	EXPOSE_STDERR   = 0x0040,
 	STDIO           = EXPOSE_STDIN | EXPOSE_STDOUT | EXPOSE_STDERR,
-	CONFIG_FEAT_BIT = 0x0080,
+	PROFILE_BUILTIN = 0x0080,
+	CONFIG_FEAT_BIT = 0x0100,
 	/* bits above CONFIG_FEAT_BIT reserved */
 
 	ALL_FEATURES    = ~0,
@@ -36,10 +36,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "btree.h"
 #include "core.h"
 #include "err.h"
+#include "eval.h"
 #include "feat.h"
 #include "gc.h"
+#include "gen.h"
+#include "generic.h"
+#include "probes.h"
 #include "unpack.h"
 
 struct gc_header {
@@ -94,6 +99,8 @@ claim_mem(CHEAX *c, alloc_ptr ptr, size_t total_size, size_t unclaim)
 {
 	ptr->size = total_size;
 	c->gc.all_mem = c->gc.all_mem - unclaim + total_size;
+	if (total_size > unclaim)
+		c->gc.alloc_total += total_size - unclaim;
 
 	size_t mem = c->gc.all_mem, prev_mem = c->gc.prev_run;
 	c->gc.triggered = c->gc.triggered
@@ -123,6 +130,8 @@ static void *
 claim_mem(CHEAX *c, alloc_ptr ptr, size_t total_size, size_t unclaim)
 {
 	c->gc.all_mem = c->gc.all_mem - unclaim + MSIZE(ptr);
+	if (MSIZE(ptr) > unclaim)
+		c->gc.alloc_total += MSIZE(ptr) - unclaim;
 
 	size_t mem = c->gc.all_mem, prev_mem = c->gc.prev_run;
 	c->gc.triggered = c->gc.triggered
@@ -235,7 +244,7 @@ cheax_gc_init_(CHEAX *c)
 {
 	c->gc.objects.prev = c->gc.objects.next = &c->gc.objects;
 
-	c->gc.all_mem = c->gc.prev_run = c->gc.num_objects = 0;
+	c->gc.all_mem = c->gc.prev_run = c->gc.num_objects = c->gc.alloc_total = 0;
 	c->gc.lock = c->gc.triggered = false;
 
 	memset(c->gc.finalizers, 0, sizeof(c->gc.finalizers));
@@ -299,6 +308,7 @@ cheax_gc_alloc_(CHEAX *c, size_t size, int type)
 	next->prev = new;
 	prev->next = new;
 
+	PROBE2(c, gc__alloc, rsvd_type, size);
 	return &hdr->obj;
 }
 
@@ -324,6 +334,39 @@ cheax_gc_free_(CHEAX *c, void *obj)
 	cheax_free(c, hdr);
 }
 
+void
+cheax_gc_detach_(CHEAX *c, void *obj)
+{
+	struct gc_header *hdr = container_of(obj, struct gc_header, obj);
+
+	struct gc_header_node *prev, *next;
+	prev = hdr->node.prev;
+	next = hdr->node.next;
+	prev->next = next;
+	next->prev = prev;
+	hdr->node.prev = hdr->node.next = NULL;
+	--c->gc.num_objects;
+}
+
+void
+cheax_gc_attach_(CHEAX *c, void *obj)
+{
+	struct gc_header *hdr = container_of(obj, struct gc_header, obj);
+	hdr->obj.rtflags = GC_BIT;
+
+	++c->gc.num_objects;
+
+	struct gc_header_node *new, *prev, *next;
+	new = &hdr->node;
+	prev = &c->gc.objects;
+	next = c->gc.objects.next;
+
+	new->prev = prev;
+	new->next = next;
+	next->prev = new;
+	prev->next = new;
+}
+
 void
 cheax_gc_register_finalizer_(CHEAX *c, int type, chx_fin fin)
 {
@@ -376,9 +419,9 @@ mark_env_member(struct htab_entry *item, void *data)
 	mark_string(c, sym->sym.doc);
 }
 static void
-mark_env_members(CHEAX *c, struct htab *htab)
+mark_env_members(CHEAX *c, struct chx_env *env)
 {
-	cheax_htab_foreach_(htab, mark_env_member, c);
+	cheax_env_foreach_(env, mark_env_member, c);
 }
 static void
 mark_env(CHEAX *c, struct chx_env *env)
@@ -388,12 +431,21 @@ mark_env(CHEAX *c, struct chx_env *env)
 			mark_env(c, env->value.bif[0]);
 			env = env->value.bif[1];
 		} else {
-			mark_env_members(c, &env->value.norm.syms);
+			mark_env_members(c, env);
 			env = env->value.norm.below;
 		}
 	}
 }
 
+static void
+mark_hash_entry(struct htab_entry *item, void *data)
+{
+	CHEAX *c = data;
+	struct hash_entry *ent = container_of(item, struct hash_entry, entry);
+	mark_obj(c, ent->key);
+	mark_obj(c, ent->value);
+}
+
 static void
 mark_obj(CHEAX *c, struct chx_value used)
 {
@@ -429,9 +481,48 @@ mark_obj(CHEAX *c, struct chx_value used)
 	case CHEAX_SPLICE:
 		mark_obj(c, used.data.as_quote->value);
 		break;
+
+	case CHEAX_EXT_FUNC:
+		cheax_generic_mark_(c, used.data.as_ext_func);
+		break;
+
+	case CHEAX_GENERATOR:
+		cheax_gen_mark_(c, used.data.as_generator);
+		break;
+
+	case CHEAX_RECORD:
+		for (int i = 0; i < used.data.as_record->num_slots; ++i)
+			mark_obj(c, used.data.as_record->slots[i]);
+		break;
+
+	case CHEAX_VECTOR:
+		for (size_t i = 0; i < used.data.as_vector->len; ++i)
+			mark_obj(c, used.data.as_vector->items[i]);
+		break;
+
+	case CHEAX_HASHMAP:
+		cheax_htab_foreach_(&used.data.as_hashmap->table, mark_hash_entry, c);
+		break;
+
+	case CHEAX_MAP:
+		for (int i = 0; i < used.data.as_map->len; ++i) {
+			mark_obj(c, used.data.as_map->slots[i].key);
+			mark_obj(c, used.data.as_map->slots[i].value);
+		}
+		break;
+
+	case CHEAX_ORDERED_MAP:
+		cheax_omap_mark_(c, used.data.as_ordered_map);
+		break;
 	}
 }
 
+void
+cheax_gc_mark_(CHEAX *c, struct chx_value value)
+{
+	mark_obj(c, value);
+}
+
 void
 cheax_gc(CHEAX *c)
 {
@@ -439,28 +530,54 @@ cheax_gc(CHEAX *c)
 		cheax_force_gc(c);
 }
 
+void
+cheax_gc_mark_hstack_(CHEAX *c, struct heap_stack *hs)
+{
+	for (size_t i = 0; i < hs->len; ++i) {
+		struct heap_frame *fr = &hs->array[i];
+		if (fr->kind == HF_EVAL) {
+			mark_env(c, fr->u.eval.ret_env);
+			mark_env(c, fr->u.eval.pop_stop);
+			mark_list(c, fr->u.eval.ret_last_call);
+			mark_list(c, fr->u.eval.was_last_call);
+			mark_list(c, fr->u.eval.tmc_first);
+		} else {
+			mark_list(c, fr->u.call.input);
+			mark_list(c, fr->u.call.args);
+			mark_obj(c, fr->u.call.head);
+			mark_list(c, fr->u.call.was_last_call);
+		}
+	}
+
+	mark_list(c, hs->free_args);
+}
+
 static void
 mark(CHEAX *c)
 {
 	struct gc_header_node *n;
 	for (n = c->gc.objects.next; n != &c->gc.objects; n = n->next) {
 		struct gc_header *hdr = (struct gc_header *)n;
-		if (has_flag(hdr->obj.rtflags, REF_BIT)) {
+		if ((hdr->obj.rtflags & REF_BITS) != 0) {
 			mark_obj(c, ((struct chx_value){ .type          = hdr->rsvd_type,
 			                                 .data.user_ptr = &hdr->obj }));
 		}
 	}
 
 	mark_env(c, c->env);
-	mark_env_members(c, &c->global_ns.value.norm.syms);
-	mark_env_members(c, &c->specop_ns.value.norm.syms);
-	mark_env_members(c, &c->macro_ns.value.norm.syms);
+	mark_env_members(c, &c->global_ns);
+	mark_env_members(c, &c->specop_ns);
+	mark_env_members(c, &c->macro_ns);
 	mark_string(c, c->error.msg);
+	cheax_gc_mark_hstack_(c, &c->hstack);
 
 	for (int i = 0; i < NUM_STD_IDS; ++i)
 		mark_obj(c, cheax_id_value(c->std_ids[i]));
 
 	cheax_htab_foreach_(&c->attribs[ATTRIB_DOC].table, mark_doc, c);
+
+	/* last, since it depends on what has been marked so far */
+	cheax_gen_mark_roots_(c);
 }
 
 static void
@@ -490,11 +607,22 @@ cheax_force_gc(CHEAX *c)
 
 	c->gc.lock = true;
 
+	if (c->hooks.gc_start != NULL)
+		c->hooks.gc_start(c, c->hooks.data);
+	PROBE1(c, gc__start, c->gc.num_objects);
+
 	mark(c);
+	PROBE(c, gc__mark__done);
 	sweep(c);
+	PROBE1(c, gc__sweep__done, c->gc.num_objects);
+
+	if (c->hooks.gc_end != NULL)
+		c->hooks.gc_end(c, c->hooks.data);
 
 	c->gc.prev_run = c->gc.all_mem;
 	c->gc.lock = c->gc.triggered = false;
+
+	cheax_gen_cancel_abandoned_(c);
 }
 
 chx_ref
@@ -506,8 +634,13 @@ cheax_ref(CHEAX *c, struct chx_value value)
 chx_ref
 cheax_ref_ptr(CHEAX *c, void *restrict value)
 {
-	if (value != NULL && (*(unsigned *)value & (GC_BIT | REF_BIT)) == GC_BIT) {
-		*(unsigned *)value |= REF_BIT;
+	/* A saturated count is never decremented, leaving the object
+	 * referenced for good rather than freeing it early */
+	if (value != NULL
+	 && has_flag(*(unsigned *)value, GC_BIT)
+	 && (*(unsigned *)value & REF_BITS) != REF_BITS)
+	{
+		*(unsigned *)value += REF_ONE;
 		return PLEASE_UNREF;
 	}
 
@@ -524,7 +657,7 @@ void
 cheax_unref_ptr(CHEAX *c, void *restrict value, chx_ref ref)
 {
 	if (ref == PLEASE_UNREF)
-		*(unsigned *)value &= ~REF_BIT;
+		*(unsigned *)value -= REF_ONE;
 }
 
 /*
@@ -561,11 +694,27 @@ bltn_get_used_memory(CHEAX *c, struct chx_list *args, void *info)
 	     : CHEAX_NIL;
 }
 
+static struct chx_value
+bltn_get_env_pool_stats(CHEAX *c, struct chx_list *args, void *info)
+{
+	if (cheax_unpack_(c, args, "") < 0)
+		return CHEAX_NIL;
+
+	struct chx_value res[] = {
+		cheax_id(c, "frames"),
+		cheax_int(c->env_pool.frame_hits), cheax_int(c->env_pool.frame_misses),
+		cheax_id(c, "syms"),
+		cheax_int(c->env_pool.sym_hits), cheax_int(c->env_pool.sym_misses),
+	};
+	return cheax_bt_wrap_(c, cheax_array_to_list(c, res, sizeof(res) / sizeof(res[0])));
+}
+
 void
 cheax_load_gc_feature_(CHEAX *c, int bits)
 {
 	if (has_flag(bits, GC_BUILTIN)) {
 		cheax_defun(c, "gc", bltn_gc, NULL);
 		cheax_defun(c, "get-used-memory", bltn_get_used_memory, NULL);
+		cheax_defun(c, "get-env-pool-stats", bltn_get_env_pool_stats, NULL);
 	}
 }
@@ -34,6 +34,8 @@ struct gc_info {
 	struct gc_header_node objects;
 	chx_fin finalizers[CHEAX_LAST_BASIC_TYPE + 1];
 	size_t all_mem, prev_run, num_objects;
+	/* bytes ever allocated, see cheax_eval_with_budget() */
+	size_t alloc_total;
 	bool lock, triggered;
 };
 
@@ -41,8 +43,22 @@ void cheax_gc_init_(CHEAX *c);
 void cheax_gc_cleanup_(CHEAX *c);
 void *cheax_gc_alloc_(CHEAX *c, size_t size, int type);
 void cheax_gc_free_(CHEAX *c, void *obj);
+
+/*
+ * Take object out of, or put it back into, the set of objects managed
+ * by the garbage collector. Used for recycling objects without going
+ * through malloc() and free(); detached objects keep counting towards
+ * used memory.
+ */
+void cheax_gc_detach_(CHEAX *c, void *obj);
+void cheax_gc_attach_(CHEAX *c, void *obj);
 void cheax_gc_register_finalizer_(CHEAX *c, int type, chx_fin fin);
 
+/* mark objects from outside of gc.c, during cheax_gen_mark_roots_() */
+struct heap_stack;
+void cheax_gc_mark_(CHEAX *c, struct chx_value value);
+void cheax_gc_mark_hstack_(CHEAX *c, struct heap_stack *hs);
+
 void cheax_gc(CHEAX *c);
 void cheax_force_gc(CHEAX *c);
 
@@ -0,0 +1,501 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Generators
+ *
+ * A generator runs its function as a coroutine on a C stack of its
+ * own, so that (yield) can suspend it from any depth. Switching
+ * between coroutines swaps the evaluator state that differs between
+ * them (see struct coro_state), but everything else, including
+ * c->error, is shared.
+ *
+ * Values held on the C stack of a suspended generator are protected
+ * by cheax_ref(), just like on the main stack. Once a suspended
+ * generator becomes unreachable, its coroutine is cancelled after
+ * garbage collection: (yield) throws EAPI to make it unwind, releasing
+ * its refs. Like an exhausted budget, every eval step throws the error
+ * again while cancelling, so that the generator can neither catch its
+ * way out nor run any code of its own.
+ */
+
+#include "setup.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UCONTEXT
+#  include <ucontext.h>
+#endif
+#ifdef HAVE_MMAP
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include "budget.h"
+#include "core.h"
+#include "err.h"
+#include "gc.h"
+#include "gen.h"
+#include "prof.h"
+#include "unpack.h"
+
+/* C stack size of a generator; only pages in use take memory */
+#define GEN_STACK_SIZE (8u << 20)
+/* C stack left for code between checks of the stack floor, see
+ * check_stack_limit() in eval.c */
+#define GEN_STACK_RESERVE (256u << 10)
+
+enum gen_state {
+	GEN_FRESH,
+	GEN_SUSPENDED,
+	GEN_RUNNING,
+	GEN_DONE,
+};
+
+/* evaluator state that differs between coroutines */
+struct coro_state {
+	struct chx_env *env;
+	struct chx_list *last_call;
+	struct loop_frame *loop;
+	struct heap_stack hstack;
+	int stack_depth;
+};
+
+struct chx_generator {
+	unsigned rtflags;
+	enum gen_state state;
+	bool cancel;
+	struct chx_value fn, value;
+
+	/* While suspended, the generator's own evaluator state. While
+	 * running, that of the code that resumed it. */
+	struct coro_state saved;
+	/* profiler frames of the generator while suspended */
+	struct prof_stack prof;
+
+	/* generator running when this one was resumed */
+	struct chx_generator *resumer;
+	/* links in c->gen.live, or in c->gen.abandoned through `next' */
+	struct chx_generator *prev, *next;
+
+	CHEAX *c;
+#ifdef HAVE_UCONTEXT
+	void *stack;
+	ucontext_t ctx, caller;
+#endif
+};
+
+static void
+link_live(CHEAX *c, struct chx_generator *g)
+{
+	g->prev = NULL;
+	g->next = c->gen.live;
+	if (g->next != NULL)
+		g->next->prev = g;
+	c->gen.live = g;
+}
+
+static void
+unlink_live(CHEAX *c, struct chx_generator *g)
+{
+	if (g->prev != NULL)
+		g->prev->next = g->next;
+	else
+		c->gen.live = g->next;
+
+	if (g->next != NULL)
+		g->next->prev = g->prev;
+
+	g->prev = g->next = NULL;
+}
+
+#ifdef HAVE_UCONTEXT
+
+static void
+swap_state(CHEAX *c, struct coro_state *st)
+{
+	struct coro_state cur = {
+		.env         = c->env,
+		.last_call   = c->bt.last_call,
+		.loop        = c->loop,
+		.hstack      = c->hstack,
+		.stack_depth = c->stack_depth,
+	};
+
+	c->env          = st->env;
+	c->bt.last_call = st->last_call;
+	c->loop         = st->loop;
+	c->hstack       = st->hstack;
+	c->stack_depth  = st->stack_depth;
+
+	*st = cur;
+}
+
+#ifdef HAVE_MMAP
+static size_t
+guard_size(void)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	return (page > 0) ? (size_t)page : 4096;
+}
+
+static void *
+alloc_stack(void)
+{
+	/* guard page at the bottom turns overflow into a crash rather
+	 * than heap corruption */
+	void *mem = mmap(NULL, GEN_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	mprotect(mem, guard_size(), PROT_NONE);
+	return mem;
+}
+
+static void
+free_stack(void *stack)
+{
+	munmap(stack, GEN_STACK_SIZE);
+}
+
+#define STACK_BOTTOM_GAP guard_size()
+#else
+#define alloc_stack()    malloc(GEN_STACK_SIZE)
+#define free_stack(s)    free(s)
+#define STACK_BOTTOM_GAP 0
+#endif
+
+/* makecontext() passes int arguments only */
+static void
+gen_entry(unsigned hi, unsigned lo)
+{
+	struct chx_generator *g = (void *)(((uintptr_t)hi << 16 << 16) | (uintptr_t)lo);
+	CHEAX *c = g->c;
+
+	if (!g->cancel)
+		cheax_apply(c, g->fn, NULL);
+
+	g->state = GEN_DONE;
+	/* returns to g->caller through uc_link */
+}
+
+static int
+start(CHEAX *c, struct chx_generator *g)
+{
+	g->stack = alloc_stack();
+	if (g->stack == NULL || getcontext(&g->ctx) < 0) {
+		if (g->stack != NULL)
+			free_stack(g->stack);
+		g->stack = NULL;
+		cheax_throwf(c, CHEAX_ENOMEM, "failed to create generator stack");
+		return -1;
+	}
+
+	size_t gap = STACK_BOTTOM_GAP;
+	g->ctx.uc_stack.ss_sp = (char *)g->stack + gap;
+	g->ctx.uc_stack.ss_size = GEN_STACK_SIZE - gap;
+	g->ctx.uc_link = &g->caller;
+
+	uintptr_t p = (uintptr_t)g;
+	makecontext(&g->ctx, (void (*)(void))gen_entry, 2, (unsigned)(p >> 16 >> 16), (unsigned)p);
+
+	memset(&g->saved, 0, sizeof(g->saved));
+	g->state = GEN_SUSPENDED;
+	link_live(c, g);
+	return 0;
+}
+
+static void
+finish(CHEAX *c, struct chx_generator *g)
+{
+	unlink_live(c, g);
+	free_stack(g->stack);
+	g->stack = NULL;
+	cheax_free(c, g->saved.hstack.array);
+	memset(&g->saved, 0, sizeof(g->saved));
+	cheax_prof_stack_cleanup_(c, &g->prof);
+}
+
+static void
+switch_to(CHEAX *c, struct chx_generator *g)
+{
+	/* Evaluation depth is limited by the generator's C stack rather
+	 * than by a fixed count, since frames of --heap-stack don't
+	 * take any. The stack is assumed to grow down. */
+	uintptr_t prev_floor = c->gen.stack_floor;
+	c->gen.stack_floor = (uintptr_t)g->stack + STACK_BOTTOM_GAP + GEN_STACK_RESERVE;
+
+	/* keep the generator's calls from being taken for the resumer's
+	 * on the profiler's shadow stack, and the other way around */
+	size_t prof_base = cheax_prof_depth_(c);
+	cheax_prof_resume_(c, &g->prof);
+
+	swap_state(c, &g->saved);
+	g->resumer = c->gen.running;
+	c->gen.running = g;
+	g->state = GEN_RUNNING;
+
+	swapcontext(&g->caller, &g->ctx);
+
+	c->gen.running = g->resumer;
+	g->resumer = NULL;
+	swap_state(c, &g->saved);
+	c->gen.stack_floor = prev_floor;
+
+	cheax_prof_suspend_(c, prof_base, &g->prof);
+}
+
+static void
+switch_back(struct chx_generator *g)
+{
+	g->state = GEN_SUSPENDED;
+	swapcontext(&g->ctx, &g->caller);
+}
+
+#endif /* HAVE_UCONTEXT */
+
+/* Returns 1 if g yielded a value, 0 if it finished, -1 on error */
+static int
+resume(CHEAX *c, struct chx_generator *g)
+{
+	switch (g->state) {
+	case GEN_DONE:
+		return 0;
+	case GEN_RUNNING:
+		cheax_throwf(c, CHEAX_EEVAL, "generator is already running");
+		return -1;
+	default:
+		break;
+	}
+
+#ifdef HAVE_UCONTEXT
+	if (g->state == GEN_FRESH && start(c, g) < 0)
+		return -1;
+
+	switch_to(c, g);
+
+	if (g->state == GEN_DONE)
+		finish(c, g);
+
+	if (cheax_errno(c) != 0)
+		return -1;
+
+	return (g->state == GEN_DONE) ? 0 : 1;
+#else
+	cheax_throwf(c, CHEAX_EEVAL, "generators are not supported on this platform");
+	return -1;
+#endif
+}
+
+void
+cheax_gen_fin_(CHEAX *c, void *obj)
+{
+#ifdef HAVE_UCONTEXT
+	struct chx_generator *g = obj;
+	/* only when destroying the cheax instance, since suspended
+	 * generators are cancelled before they are collected */
+	if (g->stack != NULL)
+		finish(c, g);
+#endif
+}
+
+void
+cheax_gen_mark_(CHEAX *c, struct chx_generator *g)
+{
+	cheax_gc_mark_(c, g->fn);
+	cheax_gc_mark_(c, g->value);
+
+	if (g->state == GEN_SUSPENDED || g->state == GEN_RUNNING) {
+		cheax_gc_mark_(c, cheax_env_value(g->saved.env));
+		cheax_gc_mark_(c, cheax_list_value(g->saved.last_call));
+		cheax_gc_mark_hstack_(c, &g->saved.hstack);
+	}
+}
+
+static struct chx_value
+gen_value(struct chx_generator *g)
+{
+	return (struct chx_value){ .type = CHEAX_GENERATOR, .data.as_generator = g };
+}
+
+void
+cheax_gen_mark_roots_(CHEAX *c)
+{
+	for (struct chx_generator *g = c->gen.running; g != NULL; g = g->resumer)
+		cheax_gc_mark_(c, gen_value(g));
+	for (struct chx_generator *g = c->gen.abandoned; g != NULL; g = g->next)
+		cheax_gc_mark_(c, gen_value(g));
+
+	/* Abandon all unreachable generators first, since marking one
+	 * may mark others that are only reachable through it. */
+	struct chx_generator *g, *nxt, *first = NULL;
+	for (g = c->gen.live; g != NULL; g = nxt) {
+		nxt = g->next;
+		if (!has_flag(g->rtflags, GC_MARKED) && g->state == GEN_SUSPENDED) {
+			unlink_live(c, g);
+			g->next = first;
+			first = g;
+		}
+	}
+
+	for (g = first; g != NULL; g = nxt) {
+		nxt = g->next;
+		cheax_gc_mark_(c, gen_value(g));
+		g->next = c->gen.abandoned;
+		c->gen.abandoned = g;
+	}
+}
+
+void
+cheax_gen_cancel_abandoned_(CHEAX *c)
+{
+	/* Wait for a moment without pending errors, so as not to
+	 * clobber the backtrace */
+	if (c->gen.cancelling || cheax_errno(c) != 0)
+		return;
+
+	c->gen.cancelling = true;
+	cheax_budget_interrupt_(c);
+
+	struct chx_generator *g;
+	while ((g = c->gen.abandoned) != NULL) {
+		c->gen.abandoned = g->next;
+		link_live(c, g);
+
+		chx_ref g_ref = cheax_ref_ptr(c, g);
+		g->cancel = true;
+		resume(c, g);
+		cheax_unref_ptr(c, g, g_ref);
+		cheax_clear_errno(c);
+	}
+
+	c->gen.cancelling = false;
+	cheax_budget_interrupt_(c);
+}
+
+struct chx_value
+cheax_generator(CHEAX *c, struct chx_value fn)
+{
+	if (fn.type != CHEAX_FUNC && fn.type != CHEAX_EXT_FUNC) {
+		cheax_throwf(c, CHEAX_EAPI, "generator(): `fn' must be a function");
+		return CHEAX_NIL;
+	}
+
+	struct chx_generator *g = cheax_gc_alloc_(c, sizeof(struct chx_generator), CHEAX_GENERATOR);
+	if (g == NULL)
+		return CHEAX_NIL;
+
+	g->state = GEN_FRESH;
+	g->cancel = false;
+	g->fn = fn;
+	g->value = CHEAX_NIL;
+	memset(&g->saved, 0, sizeof(g->saved));
+	memset(&g->prof, 0, sizeof(g->prof));
+	g->resumer = g->prev = g->next = NULL;
+	g->c = c;
+#ifdef HAVE_UCONTEXT
+	g->stack = NULL;
+#endif
+	return gen_value(g);
+}
+
+int
+cheax_generator_next(CHEAX *c, struct chx_value gen, struct chx_value *out)
+{
+	ASSERT_NOT_NULL("generator_next", out, -1);
+
+	if (gen.type != CHEAX_GENERATOR) {
+		cheax_throwf(c, CHEAX_EAPI, "generator_next(): `gen' must be a generator");
+		return -1;
+	}
+
+	struct chx_generator *g = gen.data.as_generator;
+	int res = resume(c, g);
+	*out = (res == 1) ? g->value : CHEAX_NIL;
+	g->value = CHEAX_NIL;
+	return res;
+}
+
+/*
+ *  _           _ _ _   _
+ * | |__  _   _(_) | |_(_)_ __  ___
+ * | '_ \| | | | | | __| | '_ \/ __|
+ * | |_) | |_| | | | |_| | | | \__ \
+ * |_.__/ \__,_|_|_|\__|_|_| |_|___/
+ *
+ */
+
+static struct chx_value
+bltn_generator(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_value fn;
+	return (0 == cheax_unpack_(c, args, "[LP]", &fn))
+	     ? cheax_bt_wrap_(c, cheax_generator(c, fn))
+	     : CHEAX_NIL;
+}
+
+static struct chx_value
+bltn_yield(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_value value;
+	if (cheax_unpack_(c, args, "_", &value) < 0)
+		return CHEAX_NIL;
+
+	struct chx_generator *g = c->gen.running;
+	if (g == NULL) {
+		cheax_throwf(c, CHEAX_EEVAL, "yield outside of generator");
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+#ifdef HAVE_UCONTEXT
+	if (!g->cancel) {
+		g->value = value;
+		switch_back(g);
+	}
+#endif
+
+	if (g->cancel)
+		cheax_throwf(c, CHEAX_EAPI, "generator abandoned");
+
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_next(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_generator *g;
+	struct chx_value value;
+	if (cheax_unpack_(c, args, "G", &g) < 0)
+		return CHEAX_NIL;
+
+	chx_ref g_ref = cheax_ref_ptr(c, g);
+	int res = cheax_generator_next(c, gen_value(g), &value);
+	cheax_unref_ptr(c, g, g_ref);
+
+	if (res <= 0)
+		return CHEAX_NIL;
+
+	return cheax_bt_wrap_(c, cheax_list(c, value, NULL));
+}
+
+void
+cheax_export_gen_bltns_(CHEAX *c)
+{
+	cheax_defun(c, "generator", bltn_generator, NULL);
+	cheax_defun(c, "yield",     bltn_yield,     NULL);
+	cheax_defun(c, "next",      bltn_next,      NULL);
+}
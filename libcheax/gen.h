@@ -0,0 +1,37 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef GEN_H
+#define GEN_H
+
+#include <cheax.h>
+
+void cheax_gen_fin_(CHEAX *c, void *obj);
+
+/* mark what a generator refers to; called from mark_obj() */
+void cheax_gen_mark_(CHEAX *c, struct chx_generator *gen);
+
+/* Mark generators that are running, and abandon those that are no
+ * longer reachable with their coroutine still in progress. To be
+ * called once all other roots have been marked. */
+void cheax_gen_mark_roots_(CHEAX *c);
+
+/* Cancel abandoned generators, letting their coroutines unwind. To be
+ * called after garbage collection. */
+void cheax_gen_cancel_abandoned_(CHEAX *c);
+
+void cheax_export_gen_bltns_(CHEAX *c);
+
+#endif
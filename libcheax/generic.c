@@ -0,0 +1,380 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Generic functions
+ *
+ * A generic function is an external function that dispatches on the
+ * types of its first one or two arguments. Methods are added for
+ * specific types, or for any type. A call with an argument of a type
+ * that has no method of its own falls back to the method for its base
+ * type, then to that of its base type, and so on, and finally to the
+ * method for any type. For two dispatched arguments, the first takes
+ * precedence.
+ *
+ * Resolving a method walks all methods, but only happens once per
+ * (pair of) type code(s): the result is cached in an array indexed by
+ * type code. Adding a method empties the cache.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "err.h"
+#include "eval.h"
+#include "gc.h"
+#include "generic.h"
+#include "types.h"
+#include "unpack.h"
+
+/* type in a method signature matching any type */
+#define ANY_TYPE (-1)
+
+struct method {
+	int types[2];
+	struct chx_value func;
+	struct method *next;
+};
+
+struct generic {
+	char *name;
+	int num_dispatch;
+	struct method *methods;
+
+	/* Dispatch cache, indexed by type code. For one dispatched
+	 * argument, the method to call for that type; for two, a row
+	 * of these, indexed by the type code of the second argument,
+	 * allocated on first use. NULL where not yet resolved. */
+	union {
+		struct method **methods;
+		struct method ***rows;
+	} cache;
+	size_t cache_len;
+};
+
+/* cached in place of a method where no method applies */
+static struct method no_method;
+
+static int call_generic(CHEAX *c,
+                        struct chx_list *args,
+                        void *info,
+                        struct chx_env *pop_stop,
+                        union chx_eval_out *out);
+
+static struct generic *
+get_generic(struct chx_ext_func *extf)
+{
+	if (extf == NULL || extf->perform != cheax_tail_ext_func_perform_)
+		return NULL;
+
+	struct tail_ext_func *tf = extf->info;
+	return (tf->perform == call_generic) ? tf->info : NULL;
+}
+
+static void
+clear_cache(CHEAX *c, struct generic *g)
+{
+	if (g->num_dispatch == 2 && g->cache.rows != NULL) {
+		for (size_t i = 0; i < g->cache_len; ++i)
+			cheax_free(c, g->cache.rows[i]);
+	}
+
+	cheax_free(c, g->cache.methods);
+	g->cache.methods = NULL;
+	g->cache_len = 0;
+}
+
+void
+cheax_generic_fin_(CHEAX *c, void *obj)
+{
+	struct generic *g = get_generic(obj);
+	if (g == NULL)
+		return;
+
+	struct method *m, *next;
+	for (m = g->methods; m != NULL; m = next) {
+		next = m->next;
+		cheax_free(c, m);
+	}
+
+	clear_cache(c, g);
+	cheax_free(c, g->name);
+	cheax_free(c, g);
+}
+
+void
+cheax_generic_mark_(CHEAX *c, struct chx_ext_func *extf)
+{
+	struct generic *g = get_generic(extf);
+	if (g == NULL)
+		return;
+
+	for (struct method *m = g->methods; m != NULL; m = m->next)
+		cheax_gc_mark_(c, m->func);
+}
+
+/* Next type to look for a method for, after `type', or -2 when done */
+static int
+fallback_type(CHEAX *c, int type)
+{
+	if (type == ANY_TYPE)
+		return -2;
+	if (cheax_is_basic_type(c, type))
+		return ANY_TYPE;
+	return cheax_get_base_type(c, type);
+}
+
+static struct method *
+find_method(struct generic *g, int t0, int t1)
+{
+	for (struct method *m = g->methods; m != NULL; m = m->next)
+		if (m->types[0] == t0 && m->types[1] == t1)
+			return m;
+	return NULL;
+}
+
+static struct method *
+resolve(CHEAX *c, struct generic *g, const int *types)
+{
+	for (int t0 = types[0]; t0 != -2; t0 = fallback_type(c, t0)) {
+		if (g->num_dispatch == 1) {
+			struct method *m = find_method(g, t0, ANY_TYPE);
+			if (m != NULL)
+				return m;
+			continue;
+		}
+
+		for (int t1 = types[1]; t1 != -2; t1 = fallback_type(c, t1)) {
+			struct method *m = find_method(g, t0, t1);
+			if (m != NULL)
+				return m;
+		}
+	}
+
+	return &no_method;
+}
+
+/* Make room in the cache for all type codes in existence */
+static bool
+grow_cache(CHEAX *c, struct generic *g)
+{
+	size_t num_types = CHEAX_TYPESTORE_BIAS + c->typestore.len;
+
+	/* rows are as wide as the cache is long; easier to start over */
+	clear_cache(c, g);
+
+	void *cache = cheax_calloc(c, num_types, sizeof(void *));
+	cheax_ft(c, pad);
+
+	g->cache.methods = cache;
+	g->cache_len = num_types;
+	return true;
+pad:
+	return false;
+}
+
+static struct method *
+dispatch(CHEAX *c, struct generic *g, const int *types)
+{
+	for (int i = 0; i < g->num_dispatch; ++i) {
+		if (types[i] < 0 || !cheax_is_valid_type(c, types[i])) {
+			cheax_throwf(c, CHEAX_EEVAL, "dispatch(): invalid type code");
+			return NULL;
+		}
+
+		if ((size_t)types[i] >= g->cache_len && !grow_cache(c, g))
+			return NULL;
+	}
+
+	struct method **slot;
+	if (g->num_dispatch == 1) {
+		slot = &g->cache.methods[types[0]];
+	} else {
+		struct method ***row = &g->cache.rows[types[0]];
+		if (*row == NULL) {
+			*row = cheax_calloc(c, g->cache_len, sizeof(struct method *));
+			cheax_ft(c, pad);
+		}
+		slot = &(*row)[types[1]];
+	}
+
+	if (*slot == NULL)
+		*slot = resolve(c, g, types);
+	return *slot;
+pad:
+	return NULL;
+}
+
+/*
+ * Arguments of external functions live on the C stack, or are reused
+ * by the heap stack evaluator once the call returns. Methods that may
+ * bind them as a whole get a copy.
+ */
+static struct chx_list *
+copy_args(CHEAX *c, struct chx_list *args)
+{
+	struct chx_list *res = NULL, **next = &res;
+	for (; args != NULL; args = args->next) {
+		struct chx_value cell = cheax_list(c, args->value, NULL);
+		cheax_ft(c, pad);
+		*next = cell.data.as_list;
+		next = &(*next)->next;
+	}
+	return res;
+pad:
+	return NULL;
+}
+
+static int
+call_generic(CHEAX *c,
+             struct chx_list *args,
+             void *info,
+             struct chx_env *pop_stop,
+             union chx_eval_out *out)
+{
+	struct generic *g = info;
+	int types[2] = { ANY_TYPE, ANY_TYPE };
+
+	struct chx_list *arg = args;
+	for (int i = 0; i < g->num_dispatch; ++i, arg = arg->next) {
+		if (arg == NULL) {
+			cheax_throwf(c, CHEAX_EMATCH, "expected at least %d argument(s)", g->num_dispatch);
+			goto pad;
+		}
+		types[i] = arg->value.type;
+	}
+
+	struct method *m = dispatch(c, g, types);
+	cheax_ft(c, pad);
+
+	if (m == &no_method) {
+		cheax_throwf(c, CHEAX_ETYPE, "no method of `%s' for given argument type(s)", g->name);
+		goto pad;
+	}
+
+	struct chx_func *fn = m->func.data.as_func;
+	if (m->func.type == CHEAX_FUNC && (fn->num_params < 0 || fn->variadic)) {
+		args = copy_args(c, args);
+		cheax_ft(c, pad);
+	}
+
+	return cheax_apply_tail(c, m->func, args, pop_stop, out);
+pad:
+	cheax_add_bt(c);
+	out->value = CHEAX_NIL;
+	return CHEAX_VALUE_OUT;
+}
+
+static struct chx_value
+bltn_make_generic(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_id *id;
+	chx_int num_dispatch;
+	if (cheax_unpack_(c, args, "NI", &id, &num_dispatch) < 0)
+		return CHEAX_NIL;
+
+	if (num_dispatch < 1 || num_dispatch > 2) {
+		cheax_throwf(c, CHEAX_EVALUE, "can only dispatch on one or two arguments");
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	struct generic *g = cheax_malloc(c, sizeof(struct generic));
+	cheax_ft(c, pad2);
+
+	g->name = cheax_malloc(c, strlen(id->value) + 1);
+	cheax_ft(c, pad);
+	strcpy(g->name, id->value);
+
+	g->num_dispatch = num_dispatch;
+	g->methods = NULL;
+	g->cache.methods = NULL;
+	g->cache_len = 0;
+
+	struct chx_value res = cheax_tail_ext_func(c, g->name, call_generic, g);
+	if (res.type != CHEAX_EXT_FUNC) {
+		cheax_free(c, g->name);
+		goto pad;
+	}
+
+	/* from here on, the finalizer takes care of g */
+	return res;
+pad:
+	cheax_free(c, g);
+pad2:
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_add_method(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_ext_func *extf;
+	struct chx_list *type_list;
+	struct chx_value func;
+	if (cheax_unpack_(c, args, "PC[LP]", &extf, &type_list, &func) < 0)
+		return CHEAX_NIL;
+
+	struct generic *g = get_generic(extf);
+	if (g == NULL) {
+		cheax_throwf(c, CHEAX_ETYPE, "expected generic function");
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	int types[2] = { ANY_TYPE, ANY_TYPE }, n = 0;
+	for (; type_list != NULL; type_list = type_list->next, ++n) {
+		if (n >= g->num_dispatch) {
+			cheax_throwf(c, CHEAX_EMATCH, "expected %d type(s)", g->num_dispatch);
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+		}
+
+		struct chx_value ty = type_list->value;
+		if (cheax_is_nil(ty))
+			continue;
+
+		if (ty.type != CHEAX_TYPECODE || !cheax_is_valid_type(c, ty.data.as_int)) {
+			cheax_throwf(c, CHEAX_ETYPE, "expected type code or nil");
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+		}
+
+		types[n] = ty.data.as_int;
+	}
+
+	if (n != g->num_dispatch) {
+		cheax_throwf(c, CHEAX_EMATCH, "expected %d type(s)", g->num_dispatch);
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	struct method *m = find_method(g, types[0], types[1]);
+	if (m == NULL) {
+		m = cheax_malloc(c, sizeof(struct method));
+		cheax_ft(c, pad);
+		m->types[0] = types[0];
+		m->types[1] = types[1];
+		m->next = g->methods;
+		g->methods = m;
+	}
+
+	m->func = func;
+	clear_cache(c, g);
+pad:
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+void
+cheax_export_generic_bltns_(CHEAX *c)
+{
+	cheax_defun(c, "make-generic", bltn_make_generic, NULL);
+	cheax_defun(c, "add-method",   bltn_add_method,   NULL);
+}
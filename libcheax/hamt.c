@@ -0,0 +1,487 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Immutable maps
+ *
+ * A Map is a hash array mapped trie. Each node has up to 32 slots,
+ * one for every 5-bit fragment of the key's hash at its depth, of
+ * which only those in use are stored: a bitmap tells which fragments
+ * are present, and the index of a slot is the number of bits set
+ * below that of its fragment. A slot holds either an entry or, if its
+ * bit is also set in `subnodes', a subnode for the keys sharing that
+ * fragment. Once all hash bits are used up, the remaining keys go in
+ * a collision node: a plain array of entries.
+ *
+ * Updates copy the path from the root to the affected node, and share
+ * all other nodes with the previous version. Nodes are GC objects of
+ * type CHEAX_MAP in their own right, which is how the GC follows them.
+ * Keys are hashed and compared like those of a HashMap.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "err.h"
+#include "gc.h"
+#include "hamt.h"
+#include "hashmap.h"
+#include "types.h"
+#include "unpack.h"
+
+#define FRAG_BITS 5
+#define FRAG_MASK ((1u << FRAG_BITS) - 1)
+#define HASH_BITS 32
+
+static int
+popcount(uint32_t x)
+{
+#ifdef __GNUC__
+	return __builtin_popcount(x);
+#else
+	x = x - ((x >> 1) & 0x55555555u);
+	x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+	x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+	return (int)((x * 0x01010101u) >> 24);
+#endif
+}
+
+static uint32_t
+frag_bit(uint32_t hash, int shift)
+{
+	return 1u << ((hash >> shift) & FRAG_MASK);
+}
+
+static int
+slot_index(struct chx_map *node, uint32_t bit)
+{
+	return popcount(node->bitmap & (bit - 1));
+}
+
+static struct chx_value
+node_value(struct chx_map *node)
+{
+	return (struct chx_value){ .type = CHEAX_MAP, .data.as_map = node };
+}
+
+static struct chx_map *
+alloc_node(CHEAX *c, int len)
+{
+	size_t size = offsetof(struct chx_map, slots) + len * sizeof(struct map_slot);
+	struct chx_map *node = cheax_gc_alloc_(c, size, CHEAX_MAP);
+	if (node != NULL) {
+		node->bitmap = node->subnodes = 0;
+		node->len = len;
+		node->count = 0;
+	}
+	return node;
+}
+
+/* copy of node with room for `extra' more (or, if negative, fewer) slots */
+static struct chx_map *
+copy_node(CHEAX *c, struct chx_map *node, int extra)
+{
+	struct chx_map *res = alloc_node(c, node->len + extra);
+	if (res != NULL) {
+		res->bitmap = node->bitmap;
+		res->subnodes = node->subnodes;
+		res->count = node->count;
+		if (extra >= 0)
+			memcpy(res->slots, node->slots, node->len * sizeof(struct map_slot));
+	}
+	return res;
+}
+
+static struct chx_map *
+insert_slot(CHEAX *c, struct chx_map *node, int idx, struct map_slot slot)
+{
+	struct chx_map *res = alloc_node(c, node->len + 1);
+	if (res == NULL)
+		return NULL;
+
+	memcpy(res->slots, node->slots, idx * sizeof(struct map_slot));
+	res->slots[idx] = slot;
+	memcpy(res->slots + idx + 1, node->slots + idx, (node->len - idx) * sizeof(struct map_slot));
+	res->bitmap = node->bitmap;
+	res->subnodes = node->subnodes;
+	res->count = node->count;
+	return res;
+}
+
+static struct chx_map *
+remove_slot(CHEAX *c, struct chx_map *node, int idx)
+{
+	struct chx_map *res = copy_node(c, node, -1);
+	if (res == NULL)
+		return NULL;
+
+	memcpy(res->slots, node->slots, idx * sizeof(struct map_slot));
+	memcpy(res->slots + idx, node->slots + idx + 1, (node->len - idx - 1) * sizeof(struct map_slot));
+	return res;
+}
+
+static struct map_slot *
+find(CHEAX *c, struct chx_map *node, struct chx_value key, uint32_t hash)
+{
+	for (int shift = 0; shift < HASH_BITS; shift += FRAG_BITS) {
+		uint32_t bit = frag_bit(hash, shift);
+		if ((node->bitmap & bit) == 0)
+			return NULL;
+
+		struct map_slot *slot = &node->slots[slot_index(node, bit)];
+		if ((node->subnodes & bit) == 0)
+			return cheax_eq(c, slot->key, key) ? slot : NULL;
+
+		node = slot->value.data.as_map;
+	}
+
+	for (int i = 0; i < node->len; ++i)
+		if (cheax_eq(c, node->slots[i].key, key))
+			return &node->slots[i];
+	return NULL;
+}
+
+/* node holding just the two given entries, of different keys */
+static struct chx_map *
+merge(CHEAX *c, struct map_slot a, uint32_t a_hash, struct map_slot b, uint32_t b_hash, int shift)
+{
+	struct chx_map *node;
+
+	if (shift >= HASH_BITS) {
+		node = alloc_node(c, 2);
+		if (node != NULL) {
+			node->slots[0] = a;
+			node->slots[1] = b;
+			node->count = 2;
+		}
+		return node;
+	}
+
+	uint32_t a_bit = frag_bit(a_hash, shift), b_bit = frag_bit(b_hash, shift);
+	if (a_bit == b_bit) {
+		struct chx_map *sub = merge(c, a, a_hash, b, b_hash, shift + FRAG_BITS);
+		if (sub == NULL || (node = alloc_node(c, 1)) == NULL)
+			return NULL;
+		node->bitmap = node->subnodes = a_bit;
+		node->slots[0] = (struct map_slot){ CHEAX_NIL, node_value(sub) };
+	} else {
+		if ((node = alloc_node(c, 2)) == NULL)
+			return NULL;
+		node->bitmap = a_bit | b_bit;
+		node->slots[a_bit < b_bit ? 0 : 1] = a;
+		node->slots[a_bit < b_bit ? 1 : 0] = b;
+	}
+
+	node->count = 2;
+	return node;
+}
+
+static struct chx_map *
+assoc(CHEAX *c, struct chx_map *node, struct map_slot ent, uint32_t hash, int shift)
+{
+	struct chx_map *res;
+
+	if (shift >= HASH_BITS) {
+		/* collision node */
+		for (int i = 0; i < node->len; ++i) {
+			if (cheax_eq(c, node->slots[i].key, ent.key)) {
+				if ((res = copy_node(c, node, 0)) != NULL)
+					res->slots[i] = ent;
+				return res;
+			}
+		}
+
+		if ((res = insert_slot(c, node, node->len, ent)) != NULL)
+			++res->count;
+		return res;
+	}
+
+	uint32_t bit = frag_bit(hash, shift);
+	int idx = slot_index(node, bit);
+
+	if ((node->bitmap & bit) == 0) {
+		if ((res = insert_slot(c, node, idx, ent)) != NULL) {
+			res->bitmap |= bit;
+			++res->count;
+		}
+		return res;
+	}
+
+	struct map_slot *slot = &node->slots[idx];
+	struct chx_map *sub;
+
+	if (node->subnodes & bit) {
+		struct chx_map *old_sub = slot->value.data.as_map;
+		if ((sub = assoc(c, old_sub, ent, hash, shift + FRAG_BITS)) == NULL)
+			return NULL;
+		if (sub == old_sub)
+			return node;
+		if ((res = copy_node(c, node, 0)) == NULL)
+			return NULL;
+		res->count += sub->count - old_sub->count;
+	} else if (cheax_eq(c, slot->key, ent.key)) {
+		if (cheax_equiv(slot->value, ent.value))
+			return node;
+		if ((res = copy_node(c, node, 0)) != NULL)
+			res->slots[idx] = ent;
+		return res;
+	} else {
+		uint32_t slot_hash = cheax_hash_value_(c, slot->key);
+		if ((sub = merge(c, *slot, slot_hash, ent, hash, shift + FRAG_BITS)) == NULL)
+			return NULL;
+		if ((res = copy_node(c, node, 0)) == NULL)
+			return NULL;
+		res->subnodes |= bit;
+		++res->count;
+	}
+
+	res->slots[idx] = (struct map_slot){ CHEAX_NIL, node_value(sub) };
+	return res;
+}
+
+/* node itself if key was not found; NULL on error */
+static struct chx_map *
+dissoc(CHEAX *c, struct chx_map *node, struct chx_value key, uint32_t hash, int shift)
+{
+	struct chx_map *res;
+
+	if (shift >= HASH_BITS) {
+		for (int i = 0; i < node->len; ++i) {
+			if (cheax_eq(c, node->slots[i].key, key)) {
+				if ((res = remove_slot(c, node, i)) != NULL)
+					--res->count;
+				return res;
+			}
+		}
+		return node;
+	}
+
+	uint32_t bit = frag_bit(hash, shift);
+	if ((node->bitmap & bit) == 0)
+		return node;
+
+	int idx = slot_index(node, bit);
+	struct map_slot *slot = &node->slots[idx];
+
+	if ((node->subnodes & bit) == 0) {
+		if (!cheax_eq(c, slot->key, key))
+			return node;
+		if ((res = remove_slot(c, node, idx)) != NULL) {
+			res->bitmap &= ~bit;
+			--res->count;
+		}
+		return res;
+	}
+
+	struct chx_map *sub = dissoc(c, slot->value.data.as_map, key, hash, shift + FRAG_BITS);
+	if (sub == NULL)
+		return NULL;
+	if (sub == slot->value.data.as_map)
+		return node;
+
+	if ((res = copy_node(c, node, 0)) == NULL)
+		return NULL;
+	--res->count;
+
+	if (sub->count == 1 && sub->subnodes == 0) {
+		/* keep the trie canonical: lone entries move up */
+		res->slots[idx] = sub->slots[0];
+		res->subnodes &= ~bit;
+	} else {
+		res->slots[idx].value = node_value(sub);
+	}
+
+	return res;
+}
+
+void
+cheax_map_foreach_(struct chx_map *map, map_entry_func f, void *data)
+{
+	/* collision nodes have no bits set, and only entries */
+	uint32_t bits = map->bitmap;
+	for (int i = 0; i < map->len; ++i) {
+		uint32_t bit = bits & (~bits + 1);
+		bits &= ~bit;
+
+		struct map_slot *slot = &map->slots[i];
+		if (map->subnodes & bit)
+			cheax_map_foreach_(slot->value.data.as_map, f, data);
+		else
+			f(slot->key, slot->value, data);
+	}
+}
+
+struct eq_info {
+	CHEAX *c;
+	struct chx_map *other;
+	bool eq;
+};
+
+static void
+entry_eq(struct chx_value key, struct chx_value value, void *data)
+{
+	struct eq_info *info = data;
+	if (!info->eq)
+		return;
+
+	struct map_slot *other = find(info->c, info->other, key, cheax_hash_value_(info->c, key));
+	info->eq = other != NULL && cheax_eq(info->c, value, other->value);
+}
+
+bool
+cheax_map_eq_(CHEAX *c, struct chx_map *a, struct chx_map *b)
+{
+	if (a == b)
+		return true;
+	if (a->count != b->count)
+		return false;
+
+	struct eq_info info = { c, b, true };
+	cheax_map_foreach_(a, entry_eq, &info);
+	return info.eq;
+}
+
+/*
+ *  _           _ _ _   _
+ * | |__  _   _(_) | |_(_)_ __  ___
+ * | '_ \| | | | | | __| | '_ \/ __|
+ * | |_) | |_| | | | |_| | | | \__ \
+ * |_.__/ \__,_|_|_|\__|_|_| |_|___/
+ *
+ */
+
+/* assoc each key-value pair in args onto map */
+static struct chx_value
+assoc_pairs(CHEAX *c, struct chx_map *map, struct chx_list *args)
+{
+	for (; args != NULL; args = args->next->next) {
+		if (args->next == NULL) {
+			cheax_throwf(c, CHEAX_EMATCH, "expected value for every key");
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+		}
+
+		struct map_slot ent = { args->value, args->next->value };
+		map = assoc(c, map, ent, cheax_hash_value_(c, ent.key), 0);
+		if (map == NULL)
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	return node_value(map);
+}
+
+static struct chx_value
+bltn_map_of(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_map *empty = alloc_node(c, 0);
+	return (empty == NULL)
+	     ? cheax_bt_wrap_(c, CHEAX_NIL)
+	     : assoc_pairs(c, empty, args);
+}
+
+static struct chx_value
+bltn_map_get(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_map *map;
+	struct chx_value key, def;
+	if (cheax_unpack_(c, args, "M__?", &map, &key, &def) < 0)
+		return CHEAX_NIL;
+
+	struct map_slot *slot = find(c, map, key, cheax_hash_value_(c, key));
+	return (slot != NULL) ? slot->value : def;
+}
+
+static struct chx_value
+bltn_map_assoc(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_map *map;
+	struct chx_list *pairs;
+	if (cheax_unpack_(c, args, "M_*", &map, &pairs) < 0)
+		return CHEAX_NIL;
+
+	return assoc_pairs(c, map, pairs);
+}
+
+static struct chx_value
+bltn_map_dissoc(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_map *map;
+	struct chx_list *keys;
+	if (cheax_unpack_(c, args, "M_*", &map, &keys) < 0)
+		return CHEAX_NIL;
+
+	for (; keys != NULL; keys = keys->next) {
+		map = dissoc(c, map, keys->value, cheax_hash_value_(c, keys->value), 0);
+		if (map == NULL)
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	return node_value(map);
+}
+
+static struct chx_value
+bltn_map_count(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_map *map;
+	return (0 == cheax_unpack_(c, args, "M", &map))
+	     ? cheax_int((chx_int)map->count)
+	     : CHEAX_NIL;
+}
+
+struct collect_info {
+	CHEAX *c;
+	struct chx_value res;
+};
+
+static void
+collect_entry(struct chx_value key, struct chx_value value, void *data)
+{
+	struct collect_info *info = data;
+	CHEAX *c = info->c;
+
+	if (cheax_errno(c) != 0)
+		return;
+
+	struct chx_value pair = cheax_list(c, value, NULL);
+	cheax_ft(c, pad);
+	pair = cheax_list(c, key, pair.data.as_list);
+	cheax_ft(c, pad);
+	info->res = cheax_list(c, pair, info->res.data.as_list);
+pad:
+	return;
+}
+
+static struct chx_value
+bltn_map_to_list(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_map *map;
+	if (cheax_unpack_(c, args, "M", &map) < 0)
+		return CHEAX_NIL;
+
+	struct collect_info ci = { c, CHEAX_NIL };
+	cheax_map_foreach_(map, collect_entry, &ci);
+	return cheax_bt_wrap_(c, (cheax_errno(c) == 0) ? ci.res : CHEAX_NIL);
+}
+
+void
+cheax_export_hamt_bltns_(CHEAX *c)
+{
+	cheax_defun(c, "map-of",     bltn_map_of,      NULL);
+	cheax_defun(c, "map-get",    bltn_map_get,     NULL);
+	cheax_defun(c, "map-assoc",  bltn_map_assoc,   NULL);
+	cheax_defun(c, "map-dissoc", bltn_map_dissoc,  NULL);
+	cheax_defun(c, "map-count",  bltn_map_count,   NULL);
+	cheax_defun(c, "map->list",  bltn_map_to_list, NULL);
+}
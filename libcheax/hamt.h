@@ -0,0 +1,31 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HAMT_H
+#define HAMT_H
+
+#include <cheax.h>
+
+typedef void (*map_entry_func)(struct chx_value key, struct chx_value value, void *data);
+
+/* perform an action for each entry of a map */
+void cheax_map_foreach_(struct chx_map *map, map_entry_func f, void *data);
+
+/* same keys, mapping to equal values */
+bool cheax_map_eq_(CHEAX *c, struct chx_map *a, struct chx_map *b);
+
+void cheax_export_hamt_bltns_(CHEAX *c);
+
+#endif
@@ -0,0 +1,372 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Hash maps
+ *
+ * A HashMap is a mutable table built on struct htab. Keys are hashed
+ * structurally, consistently with (=): numbers, booleans and strings
+ * by value, identifiers by pointer, and lists, quotes, records and
+ * vectors by their elements. Each entry keeps the hash of its key, so
+ * that growing the table never hashes a key twice.
+ *
+ * Keys that are mutated after insertion, e.g. vectors, will no longer
+ * be found.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "err.h"
+#include "gc.h"
+#include "hashmap.h"
+#include "htab.h"
+#include "types.h"
+#include "unpack.h"
+
+/* nested values deeper than this do not add to the hash of a key */
+#define MAX_HASH_DEPTH 8
+
+/*
+ * Key to look up. Comparing keys may need to resolve user types, for
+ * which key_eq() needs a CHEAX *; cheax_htab_get_() passes the entry it
+ * looks for as the first argument.
+ */
+struct hash_query {
+	struct hash_entry ent;
+	CHEAX *c;
+};
+
+static uint32_t
+mix(uint32_t h, uint32_t v)
+{
+	return h * 33U ^ v;
+}
+
+static uint32_t
+hash_value(CHEAX *c, struct chx_value v, int depth)
+{
+	uint32_t h = (uint32_t)v.type;
+	chx_double d;
+	chx_int b;
+
+	if (depth >= MAX_HASH_DEPTH)
+		return h;
+
+	switch (cheax_resolve_type(c, v.type)) {
+	case CHEAX_INT:
+		return mix(h, cheax_good_hash_(&v.data.as_int, sizeof(v.data.as_int)));
+	case CHEAX_BOOL:
+		b = v.data.as_int != 0;
+		return mix(h, cheax_good_hash_(&b, sizeof(b)));
+	case CHEAX_DOUBLE:
+		/* 0.0 == -0.0 */
+		d = (v.data.as_double == 0.0) ? 0.0 : v.data.as_double;
+		return mix(h, cheax_good_hash_(&d, sizeof(d)));
+	case CHEAX_STRING:
+		return mix(h, cheax_good_hash_(v.data.as_string->value, v.data.as_string->len));
+	case CHEAX_LIST:
+		for (struct chx_list *l = v.data.as_list; l != NULL; l = l->next)
+			h = mix(h, hash_value(c, l->value, depth + 1));
+		return h;
+	case CHEAX_QUOTE:
+	case CHEAX_BACKQUOTE:
+	case CHEAX_COMMA:
+	case CHEAX_SPLICE:
+		return mix(h, hash_value(c, v.data.as_quote->value, depth + 1));
+	case CHEAX_RECORD:
+		for (int i = 0; i < v.data.as_record->num_slots; ++i)
+			h = mix(h, hash_value(c, v.data.as_record->slots[i], depth + 1));
+		return h;
+	case CHEAX_VECTOR:
+		for (size_t i = 0; i < v.data.as_vector->len; ++i)
+			h = mix(h, hash_value(c, v.data.as_vector->items[i], depth + 1));
+		return h;
+	case CHEAX_HASHMAP:
+		/* entries are in no particular order */
+		return mix(h, (uint32_t)v.data.as_hashmap->table.size);
+	case CHEAX_MAP:
+		return mix(h, (uint32_t)v.data.as_map->count);
+	case CHEAX_ORDERED_MAP:
+		return mix(h, (uint32_t)v.data.as_ordered_map->count);
+	case CHEAX_EXT_FUNC:
+		/* see cheax_eq() */
+		return mix(h, cheax_good_hash_(&v.data.as_ext_func->info, sizeof(void *)));
+	default:
+		return mix(h, cheax_good_hash_(&v.data.user_ptr, sizeof(void *)));
+	}
+}
+
+uint32_t
+cheax_hash_value_(CHEAX *c, struct chx_value v)
+{
+	return hash_value(c, v, 0);
+}
+
+static uint32_t
+key_hash(const struct htab_entry *item)
+{
+	return ((const struct hash_entry *)item)->hash;
+}
+
+static bool
+key_eq(const struct htab_entry *query, const struct htab_entry *item)
+{
+	const struct hash_query *q = (const struct hash_query *)query;
+	return cheax_eq(q->c, q->ent.key, ((const struct hash_entry *)item)->key);
+}
+
+static struct hash_query
+make_query(CHEAX *c, struct chx_value key)
+{
+	struct hash_query q;
+	q.ent.hash = cheax_hash_value_(c, key);
+	q.ent.key = key;
+	q.c = c;
+	return q;
+}
+
+static void
+free_entry(struct htab_entry *item, void *data)
+{
+	cheax_free(data, item);
+}
+
+void
+cheax_hashmap_fin_(CHEAX *c, void *obj)
+{
+	struct chx_hashmap *map = obj;
+	cheax_htab_cleanup_(&map->table, free_entry, c);
+}
+
+static struct hash_entry *
+map_find(CHEAX *c, struct chx_hashmap *map, struct chx_value key)
+{
+	struct hash_query dummy = make_query(c, key);
+	struct htab_search search = cheax_htab_get_(&map->table, &dummy.ent.entry);
+	return (struct hash_entry *)search.item;
+}
+
+static int
+map_set(CHEAX *c, struct chx_hashmap *map, struct chx_value key, struct chx_value value)
+{
+	struct hash_query dummy = make_query(c, key);
+	struct htab_search search = cheax_htab_get_(&map->table, &dummy.ent.entry);
+	if (search.item != NULL) {
+		((struct hash_entry *)search.item)->value = value;
+		return 0;
+	}
+
+	struct hash_entry *ent = cheax_malloc(c, sizeof(struct hash_entry));
+	if (ent == NULL)
+		return -1;
+
+	ent->hash = dummy.ent.hash;
+	ent->key = key;
+	ent->value = value;
+	cheax_htab_set_(&map->table, search, &ent->entry);
+	if (cheax_errno(c) != 0) {
+		cheax_free(c, ent);
+		return -1;
+	}
+
+	return 0;
+}
+
+struct eq_info {
+	CHEAX *c;
+	struct chx_hashmap *other;
+	bool eq;
+};
+
+static void
+entry_eq(struct htab_entry *item, void *data)
+{
+	struct eq_info *info = data;
+	struct hash_entry *ent = (struct hash_entry *)item, *other_ent;
+	if (!info->eq)
+		return;
+
+	other_ent = map_find(info->c, info->other, ent->key);
+	info->eq = other_ent != NULL && cheax_eq(info->c, ent->value, other_ent->value);
+}
+
+bool
+cheax_hashmap_eq_(CHEAX *c, struct chx_hashmap *a, struct chx_hashmap *b)
+{
+	if (a == b)
+		return true;
+	if (a->table.size != b->table.size)
+		return false;
+
+	struct eq_info info = { c, b, true };
+	cheax_htab_foreach_(&a->table, entry_eq, &info);
+	return info.eq;
+}
+
+static struct chx_hashmap *
+new_hashmap(CHEAX *c)
+{
+	struct chx_hashmap *map = cheax_gc_alloc_(c, sizeof(struct chx_hashmap), CHEAX_HASHMAP);
+	if (map != NULL)
+		cheax_htab_init_(c, &map->table, key_hash, key_eq);
+	return map;
+}
+
+/*
+ *  _           _ _ _   _
+ * | |__  _   _(_) | |_(_)_ __  ___
+ * | '_ \| | | | | | __| | '_ \/ __|
+ * | |_) | |_| | | | |_| | | | \__ \
+ * |_.__/ \__,_|_|_|\__|_|_| |_|___/
+ *
+ */
+
+static struct chx_value
+bltn_hash_map(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_hashmap *map = new_hashmap(c);
+	if (map == NULL)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+
+	for (; args != NULL; args = args->next->next) {
+		if (args->next == NULL) {
+			cheax_throwf(c, CHEAX_EMATCH, "expected value for every key");
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+		}
+
+		if (map_set(c, map, args->value, args->next->value) < 0)
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	return (struct chx_value){ .type = CHEAX_HASHMAP, .data.as_hashmap = map };
+}
+
+static struct chx_value
+bltn_hash_get(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_hashmap *map;
+	struct chx_value key, def;
+	if (cheax_unpack_(c, args, "H__?", &map, &key, &def) < 0)
+		return CHEAX_NIL;
+
+	struct hash_entry *ent = map_find(c, map, key);
+	return (ent != NULL) ? ent->value : def;
+}
+
+static struct chx_value
+bltn_hash_set(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_hashmap *map;
+	struct chx_value key, value;
+	if (cheax_unpack_(c, args, "H__", &map, &key, &value) < 0)
+		return CHEAX_NIL;
+
+	map_set(c, map, key, value);
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_hash_remove(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_hashmap *map;
+	struct chx_value key;
+	if (cheax_unpack_(c, args, "H_", &map, &key) < 0)
+		return CHEAX_NIL;
+
+	struct hash_query dummy = make_query(c, key);
+	struct htab_search search = cheax_htab_get_(&map->table, &dummy.ent.entry);
+	if (search.item == NULL)
+		return cheax_bool(false);
+
+	cheax_htab_remove_(&map->table, search);
+	cheax_free(c, search.item);
+	return cheax_bool(true);
+}
+
+static struct chx_value
+bltn_hash_count(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_hashmap *map;
+	return (0 == cheax_unpack_(c, args, "H", &map))
+	     ? cheax_int((chx_int)map->table.size)
+	     : CHEAX_NIL;
+}
+
+enum { COLLECT_KEYS, COLLECT_VALUES, COLLECT_PAIRS };
+
+struct collect_info {
+	CHEAX *c;
+	int what;
+	struct chx_value res;
+};
+
+static void
+collect_entry(struct htab_entry *item, void *data)
+{
+	struct collect_info *info = data;
+	struct hash_entry *ent = (struct hash_entry *)item;
+	CHEAX *c = info->c;
+	struct chx_value v;
+
+	if (cheax_errno(c) != 0)
+		return;
+
+	switch (info->what) {
+	case COLLECT_KEYS:
+		v = ent->key;
+		break;
+	case COLLECT_VALUES:
+		v = ent->value;
+		break;
+	default:
+		v = cheax_list(c, ent->value, NULL);
+		cheax_ft(c, pad);
+		v = cheax_list(c, ent->key, v.data.as_list);
+		cheax_ft(c, pad);
+		break;
+	}
+
+	info->res = cheax_list(c, v, info->res.data.as_list);
+pad:
+	return;
+}
+
+static struct chx_value
+bltn_hash_collect(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_hashmap *map;
+	if (cheax_unpack_(c, args, "H", &map) < 0)
+		return CHEAX_NIL;
+
+	struct collect_info ci = { c, (int)(intptr_t)info, CHEAX_NIL };
+	cheax_htab_foreach_(&map->table, collect_entry, &ci);
+	return cheax_bt_wrap_(c, (cheax_errno(c) == 0) ? ci.res : CHEAX_NIL);
+}
+
+void
+cheax_export_hashmap_bltns_(CHEAX *c)
+{
+	cheax_defun(c, "hash-map",     bltn_hash_map,     NULL);
+	cheax_defun(c, "hash-get",     bltn_hash_get,     NULL);
+	cheax_defun(c, "hash-set!",    bltn_hash_set,     NULL);
+	cheax_defun(c, "hash-remove!", bltn_hash_remove,  NULL);
+	cheax_defun(c, "hash-count",   bltn_hash_count,   NULL);
+	cheax_defun(c, "hash-keys",    bltn_hash_collect, (void *)(intptr_t)COLLECT_KEYS);
+	cheax_defun(c, "hash-values",  bltn_hash_collect, (void *)(intptr_t)COLLECT_VALUES);
+	cheax_defun(c, "hash->list",   bltn_hash_collect, (void *)(intptr_t)COLLECT_PAIRS);
+}
@@ -0,0 +1,31 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <cheax.h>
+
+void cheax_hashmap_fin_(CHEAX *c, void *obj);
+
+/* structural hash, consistent with cheax_eq() */
+uint32_t cheax_hash_value_(CHEAX *c, struct chx_value v);
+
+/* same number of keys, mapping to equal values */
+bool cheax_hashmap_eq_(CHEAX *c, struct chx_hashmap *a, struct chx_hashmap *b);
+
+void cheax_export_hashmap_bltns_(CHEAX *c);
+
+#endif
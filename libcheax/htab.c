@@ -56,6 +56,25 @@ cheax_htab_cleanup_(struct htab *htab, htab_item_func del, void *data)
 	memset(htab, 0, sizeof(*htab));
 }
 
+void
+cheax_htab_clear_(struct htab *htab, htab_item_func del, void *data)
+{
+	if (htab->size == 0)
+		return;
+
+	for (size_t i = 0; i < htab->cap; ++i) {
+		struct htab_entry *bucket, *next;
+		for (bucket = htab->buckets[i]; bucket != NULL; bucket = next) {
+			next = bucket->next;
+			if (del != NULL)
+				del(bucket, data);
+		}
+		htab->buckets[i] = NULL;
+	}
+
+	htab->size = 0;
+}
+
 struct htab_search
 cheax_htab_get_(struct htab *htab, const struct htab_entry *item)
 {
@@ -149,6 +168,7 @@ cheax_htab_remove_(struct htab *htab, struct htab_search search)
 	if (search.item != NULL) {
 		*search.pos = search.item->next;
 		search.item->next = NULL;
+		--htab->size;
 		resize_down(htab);
 	}
 }
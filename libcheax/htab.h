@@ -80,6 +80,13 @@ void cheax_htab_init_(CHEAX *c, struct htab *htab, htab_hash_func hash, htab_eq_
  */
 void cheax_htab_cleanup_(struct htab *htab, htab_item_func del, void *data);
 
+/*
+ * Remove all entries from hash table, performing action `del' for each
+ * entry if `del' is not NULL. Unlike cheax_htab_cleanup_(), this keeps
+ * the bucket array around for reuse.
+ */
+void cheax_htab_clear_(struct htab *htab, htab_item_func del, void *data);
+
 /*
  * Get hash table entry, or the location where a new one might be
  * inserted.
@@ -72,8 +72,21 @@ enum {
 	CHEAX_SPLICE,        /*!< Type for comma splice (i.e. ,@) expressions. */
 	CHEAX_STRING,        /*!< String type. */
 	CHEAX_ENV,           /*!< Environment type. */
+	CHEAX_GENERATOR,     /*!< Generator type. */
 
-	CHEAX_LAST_BASIC_TYPE = CHEAX_ENV,
+	/*! \brief Basic type of records.
+	 *
+	 * \note Objects of this basic type exist only through the type
+	 * aliases that `defrecord' creates.
+	 */
+	CHEAX_RECORD,
+
+	CHEAX_VECTOR,        /*!< Vector type. */
+	CHEAX_HASHMAP,       /*!< Hash map type. */
+	CHEAX_MAP,           /*!< Immutable map type. */
+	CHEAX_ORDERED_MAP,   /*!< Ordered map type. */
+
+	CHEAX_LAST_BASIC_TYPE = CHEAX_ORDERED_MAP,
 	CHEAX_TYPESTORE_BIAS,
 
 	/*! The type of type codes themselves. A type alias of \ref CHEAX_INT. */
@@ -125,6 +138,12 @@ struct chx_func;
 struct chx_ext_func;
 struct chx_special_op;
 struct chx_env;
+struct chx_generator;
+struct chx_record;
+struct chx_vector;
+struct chx_hashmap;
+struct chx_map;
+struct chx_ordered_map;
 
 /*! \brief Represents a value in the cheax environment.
  *
@@ -143,6 +162,12 @@ struct chx_value {
 		struct chx_ext_func *as_ext_func;
 		struct chx_special_op *as_special_op;
 		struct chx_env *as_env;
+		struct chx_generator *as_generator;
+		struct chx_record *as_record;
+		struct chx_vector *as_vector;
+		struct chx_hashmap *as_hashmap;
+		struct chx_map *as_map;
+		struct chx_ordered_map *as_ordered_map;
 		void *user_ptr;
 
 		unsigned *rtflags_ptr;
@@ -171,6 +196,18 @@ struct chx_value {
 		struct chx_special_op *as_special_op;
 		/*! \brief Data when type is \ref CHEAX_ENV. */
 		struct chx_env *as_env;
+		/*! \brief Data when type is \ref CHEAX_GENERATOR. */
+		struct chx_generator *as_generator;
+		/*! \brief Data when type is \ref CHEAX_RECORD. */
+		struct chx_record *as_record;
+		/*! \brief Data when type is \ref CHEAX_VECTOR. */
+		struct chx_vector *as_vector;
+		/*! \brief Data when type is \ref CHEAX_HASHMAP. */
+		struct chx_hashmap *as_hashmap;
+		/*! \brief Data when type is \ref CHEAX_MAP. */
+		struct chx_map *as_map;
+		/*! \brief Data when type is \ref CHEAX_ORDERED_MAP. */
+		struct chx_ordered_map *as_ordered_map;
 		/*! \brief Data when type is \ref CHEAX_USER_PTR. */
 		void *user_ptr;
 
@@ -325,6 +362,9 @@ struct chx_func {
 	struct chx_value args;       /*!< Lambda argument list expression. */
 	struct chx_list *body;       /*!< Lambda body. */
 	struct chx_env *lexenv;      /*!< Lexical environment. \note Internal use only. */
+	int num_params;              /*!< Number of fixed parameters if the argument list consists of identifiers only, -1 otherwise. \note Internal use only. */
+	bool variadic;               /*!< Whether the last identifier binds remaining arguments. \note Internal use only. */
+	bool sealed;                 /*!< Whether the body defines nothing in the function's own frame. \note Internal use only. */
 };
 
 #define cheax_func_value(X) ((struct chx_value){ .type = CHEAX_FUNC, .data.as_func = (X) })
@@ -388,6 +428,26 @@ CHX_API struct chx_value cheax_ext_func(CHEAX *c,
                                         chx_func_ptr perform,
                                         void *info);
 
+/*! \brief Creates a cheax external function expression that can
+ *         return tail calls.
+ *
+ * Like cheax_ext_func(), the arguments are pre-evaluated. However,
+ * rather than returning its value, \a perform writes it to \p out
+ * and returns \ref CHEAX_VALUE_OUT, or hands a tail expression back
+ * to the evaluator through \p out and returns \ref CHEAX_TAIL_OUT,
+ * like special operators do. See also cheax_apply_tail().
+ *
+ * \param perform Function pointer to be invoked.
+ * \param name    Function name as will be used by cheax_print().
+ * \param info    Callback info to be passed upon invocation.
+ *
+ * \sa cheax_defun_tail()
+ */
+CHX_API struct chx_value cheax_tail_ext_func(CHEAX *c,
+                                             const char *name,
+                                             chx_tail_func_ptr perform,
+                                             void *info);
+
 #define cheax_ext_func_value(X) ((struct chx_value){ .type = CHEAX_EXT_FUNC, .data.as_ext_func = (X) })
 CHX_API struct chx_value cheax_ext_func_value_proc(struct chx_ext_func *sf) CHX_CONST;
 
@@ -518,6 +578,94 @@ CHX_API struct chx_value cheax_env(CHEAX *c);
 #define cheax_env_value(X) ((struct chx_value){ .type = CHEAX_ENV, .data.as_env = (X) })
 CHX_API struct chx_value cheax_env_value_proc(struct chx_env *env) CHX_CONST;
 
+/*! \brief Generator, producing values through `yield' from a function
+ *         running as a coroutine.
+ *
+ * \sa cheax_generator(), cheax_generator_next(), CHEAX_GENERATOR
+ */
+struct chx_generator;
+
+/*! \brief Creates a generator.
+ *
+ * The function is not called until the first call to
+ * cheax_generator_next().
+ *
+ * \param fn Function or external function taking no arguments. Every
+ *           call to `yield' it makes produces a value.
+ *
+ * \returns The generator.
+ */
+CHX_API struct chx_value cheax_generator(CHEAX *c, struct chx_value fn);
+
+/*! \brief Resumes a generator until it yields its next value.
+ *
+ * \param gen Generator.
+ * \param out Set to the value produced, if any.
+ *
+ * \returns 1 if a value was produced, 0 if the generator has finished
+ *          and -1 in case of an error.
+ */
+CHX_API int cheax_generator_next(CHEAX *c, struct chx_value gen, struct chx_value *out);
+
+/*! \brief Growable array of values, indexed in constant time.
+ *
+ * \sa cheax_vector(), cheax_vector_len(), cheax_vector_ref(),
+ *     cheax_vector_set(), cheax_vector_push(), CHEAX_VECTOR
+ */
+struct chx_vector;
+
+/*! \brief Creates a vector.
+ *
+ * Sets cheax_errno() to \ref CHEAX_EAPI if \a items is `NULL` while
+ * \a len is not zero.
+ *
+ * \param items Array of values to copy into the vector.
+ * \param len   Length of \a items.
+ *
+ * \sa chx_vector, CHEAX_VECTOR
+ */
+CHX_API struct chx_value cheax_vector(CHEAX *c, struct chx_value *items, size_t len);
+
+#define cheax_vector_value(X) ((struct chx_value){ .type = CHEAX_VECTOR, .data.as_vector = (X) })
+CHX_API struct chx_value cheax_vector_value_proc(struct chx_vector *vec) CHX_CONST;
+
+/*! \brief Number of elements in vector.
+ *
+ * \param vec Vector.
+ *
+ * \returns Length of given vector, or zero if \a vec is `NULL`.
+ */
+CHX_API size_t cheax_vector_len(CHEAX *c, struct chx_vector *vec) CHX_PURE;
+
+/*! \brief Gets element of vector.
+ *
+ * Sets cheax_errno() to \ref CHEAX_EINDEX if \a pos is out of bounds.
+ *
+ * \param vec Vector.
+ * \param pos Index of the element.
+ */
+CHX_API struct chx_value cheax_vector_ref(CHEAX *c, struct chx_vector *vec, size_t pos);
+
+/*! \brief Replaces element of vector.
+ *
+ * Sets cheax_errno() to \ref CHEAX_EINDEX if \a pos is out of bounds.
+ *
+ * \param vec   Vector.
+ * \param pos   Index of the element.
+ * \param value New value of the element.
+ */
+CHX_API void cheax_vector_set(CHEAX *c, struct chx_vector *vec, size_t pos, struct chx_value value);
+
+/*! \brief Appends element to vector, growing it if needed.
+ *
+ * \param vec   Vector.
+ * \param value Value to append.
+ *
+ * \returns 0 if everything succeeded without errors, -1 if there was an
+ *          error (most likely \ref CHEAX_ENOMEM).
+ */
+CHX_API int cheax_vector_push(CHEAX *c, struct chx_vector *vec, struct chx_value value);
+
 #if __STDC_VERSION__ + 0 >= 201112L
 #define cheax_value(v)                                              \
 	(_Generic((0,v),                                            \
@@ -528,7 +676,8 @@ CHX_API struct chx_value cheax_env_value_proc(struct chx_env *env) CHX_CONST;
 		struct chx_env *:    cheax_env_value_proc,          \
 		struct chx_id *:     cheax_id_value_proc,           \
 		struct chx_string *: cheax_string_value_proc,       \
-		struct chx_list *:   cheax_list_value_proc)(v))
+		struct chx_list *:   cheax_list_value_proc,         \
+		struct chx_vector *: cheax_vector_value_proc)(v))
 #endif
 
 struct chx_sym;
@@ -681,6 +830,8 @@ enum {
 	CHEAX_EOVERFLOW  = 0x010C, /*!< Integer overflow error. */
 	CHEAX_EINDEX     = 0x010D, /*!< Invalid index error. */
 	CHEAX_EIO        = 0x010E, /*!< IO error. */
+	CHEAX_ETIMEOUT   = 0x010F, /*!< Deadline passed error. \sa cheax_eval_with_budget() */
+	CHEAX_EBUDGET    = 0x0110, /*!< Resource budget exhausted error. \sa cheax_eval_with_budget() */
 
 	CHEAX_EAPI       = 0x0200, /*!< API error. \note Not to be thrown from within cheax code. */
 	CHEAX_ENOMEM     = 0x0201, /*!< Out-of-memory error. \note Not to be thrown from within cheax code. */
@@ -703,6 +854,7 @@ static const struct { const char *name; int code; } var[] = { \
 	ERR_NAME_PAIR(EWRITEONLY), ERR_NAME_PAIR(EEXIST),     \
 	ERR_NAME_PAIR(EVALUE), ERR_NAME_PAIR(EOVERFLOW),      \
 	ERR_NAME_PAIR(EINDEX), ERR_NAME_PAIR(EIO),            \
+	ERR_NAME_PAIR(ETIMEOUT), ERR_NAME_PAIR(EBUDGET),      \
 	                                                      \
 	ERR_NAME_PAIR(EAPI), ERR_NAME_PAIR(ENOMEM)            \
 }
@@ -805,6 +957,8 @@ CHX_API const char *cheax_version(void);
  * \li `"file-io"` to load `fopen` and `fclose` built-ins;
  * \li `"set-max-stack-depth"` to load the <tt>set-max-stack-depth</tt> built-in;
  * \li `"gc"` to load the `gc` built-in function;
+ * \li `"profile"` to load the `profile-start` and `profile-stop`
+ *     built-ins;
  * \li `"exit"` to load the `exit` function;
  * \li `"stdin"` to expose the `stdin` variable;
  * \li `"stdout"` to expose the `stdout` variable;
@@ -1057,7 +1211,8 @@ CHX_API bool cheax_try_get(CHEAX *c, const char *id, struct chx_value *out);
  * \note This function may call cheax_gc(). Make sure to cheax_ref()
  *       your values properly.
  *
- * \param env Environment to look up identifier in.
+ * \param env Environment to look up identifier in, or `NULL` for the
+ *            global scope.
  * \param id  Identifier to look up.
  *
  * \returns The value of the given symbol. Always `NULL` in case of an
@@ -1076,7 +1231,8 @@ CHX_API struct chx_value cheax_get_from(CHEAX *c, struct chx_env *env, const cha
  * \note This function may call cheax_gc(). Make sure to cheax_ref()
  *       your values properly.
  *
- * \param env Environment to look up identifier in.
+ * \param env Environment to look up identifier in, or `NULL` for the
+ *            global scope.
  * \param id  Identifier to look up.
  * \param out Output value. Not written to if no symbol was found.
  *
@@ -1126,6 +1282,19 @@ cheax_def(c, id, &cheax_ext_func(c, id, perform, info)->base, CHEAX_READONLY);
  * \sa chx_ext_func, cheax_ext_func(), cheax_def(), cheax_defsyntax()
  */
 CHX_API void cheax_defun(CHEAX *c, const char *id, chx_func_ptr perform, void *info);
+
+/*! \brief Shorthand function to declare an external function that can
+ *         return tail calls in the cheax environment.
+ *
+ * Like cheax_defun(), but using cheax_tail_ext_func().
+ *
+ * \param id      Identifier for the external function.
+ * \param perform Callback for the new external function.
+ * \param info    Callback info for the new external function.
+ *
+ * \sa cheax_tail_ext_func(), cheax_defun()
+ */
+CHX_API void cheax_defun_tail(CHEAX *c, const char *id, chx_tail_func_ptr perform, void *info);
 CHX_API void cheax_defsyntax(CHEAX *c,
                              const char *id,
                              chx_tail_func_ptr perform,
@@ -1331,6 +1500,34 @@ CHX_API struct chx_value cheax_readstr_at(CHEAX *c,
                                           int *line,
                                           int *pos);
 
+/*! \brief Attaches source location information to a list, as
+ *         cheax_read_at() does for every list it reads.
+ *
+ * Used for error reporting and diagnostics. Throws \ref CHEAX_EAPI if
+ * \a lst is `NULL`.
+ *
+ * \param lst  List to annotate.
+ * \param path Path of source file. Must outlive \a lst.
+ * \param line Line number.
+ * \param pos  Column number.
+ *
+ * \sa cheax_set_doc(), cheax_emit_c()
+ */
+CHX_API void cheax_set_loc(CHEAX *c, struct chx_list *lst, const char *path, int line, int pos);
+
+/*! \brief Attaches a documentation string to a list, as if it were
+ *         preceded by a doc comment in source.
+ *
+ * When the list is a definition, the documentation string becomes that
+ * of the defined symbol. Throws \ref CHEAX_EAPI if \a lst is `NULL`.
+ *
+ * \param lst List to annotate.
+ * \param doc Documentation string.
+ *
+ * \sa cheax_set_loc(), cheax_emit_c()
+ */
+CHX_API void cheax_set_doc(CHEAX *c, struct chx_list *lst, struct chx_string *doc);
+
 /*! \brief Expand given expression until it is no longer a macro form.
  *
  * Macros are defined using the `(defmacro)` built-in. Throws
@@ -1376,6 +1573,41 @@ CHX_API struct chx_value cheax_preproc(CHEAX *c, struct chx_value expr);
  */
 CHX_API struct chx_value cheax_eval(CHEAX *c, struct chx_value expr);
 
+/*! \brief Resource limits for cheax_eval_with_budget().
+ *
+ * A limit of 0 means no limit.
+ */
+struct chx_budget {
+	size_t steps;          /*!< Maximum number of evaluated expressions. */
+	size_t bytes;          /*!< Maximum number of bytes allocated. */
+	unsigned long time_ms; /*!< Wall-clock time limit in milliseconds. */
+};
+
+/*! \brief Evaluates given cheax expression within resource limits.
+ *
+ * Like cheax_eval(), but throws \ref CHEAX_EBUDGET once \a expr has
+ * taken more than the given number of steps or allocated more than
+ * the given number of bytes, and \ref CHEAX_ETIMEOUT if its time limit
+ * passes. These are checked periodically rather than continuously, so
+ * the allocation limit may be exceeded slightly. Once thrown, the
+ * error is thrown again on every evaluation step, so cheax code cannot
+ * catch its way out of it.
+ *
+ * Calls can be nested, in which case the inner call is also held to
+ * the limits of the outer call.
+ *
+ * \note This function may call cheax_gc(). Make sure to cheax_ref()
+ *       your values properly.
+ *
+ * \param expr Cheax expression to evaluate.
+ * \param budget Resource limits.
+ *
+ * \returns The evaluated expression.
+ *
+ * \sa cheax_eval()
+ */
+CHX_API struct chx_value cheax_eval_with_budget(CHEAX *c, struct chx_value expr, const struct chx_budget *budget);
+
 /*! \brief Invokes function with given argument list.
  *
  * Argument list will be passed to the function as-is. I.e. the
@@ -1391,6 +1623,27 @@ CHX_API struct chx_value cheax_eval(CHEAX *c, struct chx_value expr);
  */
 CHX_API struct chx_value cheax_apply(CHEAX *c, struct chx_value func, struct chx_list *list);
 
+/*! \brief Invokes function with given argument list as a tail call.
+ *
+ * Like cheax_apply(), but for use in the callbacks of special
+ * operators and of external functions created with
+ * cheax_tail_ext_func(). Rather than evaluating the function body,
+ * it may hand it back to the evaluator.
+ *
+ * \param func     Function to invoke.
+ * \param list     Argument list to pass to \a func.
+ * \param pop_stop As passed to the callback.
+ * \param out      As passed to the callback.
+ *
+ * \returns \ref CHEAX_VALUE_OUT or \ref CHEAX_TAIL_OUT, to be
+ *          returned from the callback.
+ */
+CHX_API int cheax_apply_tail(CHEAX *c,
+                             struct chx_value func,
+                             struct chx_list *list,
+                             struct chx_env *pop_stop,
+                             union chx_eval_out *out);
+
 /*! \brief Prints given value to file.
  *
  * Core element of the read, eval, print loop.
@@ -1428,6 +1681,127 @@ CHX_API struct chx_value cheax_format(CHEAX *c, struct chx_string *fmt, struct c
  */
 CHX_API void cheax_exec(CHEAX *c, const char *f);
 
+/*! \brief Translates a cheax source file to C.
+ *
+ * Every top-level form in the file is preprocessed, written out as C
+ * code that rebuilds the preprocessed form through this API, and then
+ * evaluated, so that macros it defines are available to subsequent
+ * forms. Top-level function definitions of the form
+ *
+ *     (def name (fn (params...) body...))
+ *
+ * are also translated to C functions, as long as the body only uses
+ * the special forms `if`, `when`, `unless`, `and`, `or`, `do`, `cond`,
+ * `let` and `let*` (binding identifiers), `check-type` (against
+ * built-in types), and function calls. Integer
+ * arithmetic and comparisons are done directly in C, and tail calls
+ * are returned to the evaluator, so they don't grow the C stack.
+ * When loaded in the global scope, the module binds such a `name` to
+ * an external function instead of a function. The resulting
+ * translation unit defines
+ *
+ *     int cheax_module_init(CHEAX *c);
+ *
+ * which evaluates the forms in order, and returns 0 on success or -1
+ * if an error was thrown. Compiled as a shared object, the module
+ * registers the same definitions as cheax_exec() would for \a path,
+ * without having to read or macro-expand the source.
+ *
+ * Throws \ref CHEAX_EIO if \a path cannot be opened, and
+ * \ref CHEAX_ETYPE if a form expands to a value that has no source
+ * representation (e.g. a function or an environment).
+ *
+ * \param path Input file path.
+ * \param out  Output file handle.
+ *
+ * \returns 0 on success, -1 on error.
+ *
+ * \sa cheax_exec(), cheax_set_loc(), cheax_set_doc()
+ */
+CHX_API int cheax_emit_c(CHEAX *c, const char *path, FILE *out);
+
+/*! \brief Callbacks for evaluation events.
+ *
+ * Any callback may be NULL. Callbacks must not throw errors, and
+ * \a gc_start and \a gc_end must not allocate cheax values.
+ *
+ * \sa cheax_set_hooks()
+ */
+struct chx_hooks {
+	/*! \brief Called before a call to a function, external function
+	 *         or special operator.
+	 *
+	 * Note that a function returns before its tail call is evaluated.
+	 */
+	void (*enter)(CHEAX *c, struct chx_list *call, void *data);
+
+	/*! \brief Called after the call \a enter was called for. */
+	void (*exit)(CHEAX *c, struct chx_list *call, void *data);
+
+	/*! \brief Called before a garbage collection cycle. */
+	void (*gc_start)(CHEAX *c, void *data);
+
+	/*! \brief Called after a garbage collection cycle. */
+	void (*gc_end)(CHEAX *c, void *data);
+
+	/*! \brief Called when an error is thrown. */
+	void (*error)(CHEAX *c, int code, struct chx_string *msg, void *data);
+
+	/*! \brief Called when a macro form \a form expanded to \a expansion. */
+	void (*macroexpand)(CHEAX *c, struct chx_value form, struct chx_value expansion, void *data);
+
+	/*! \brief Passed to every callback. */
+	void *data;
+};
+
+/*! \brief Installs callbacks for evaluation events, replacing any
+ *         installed before.
+ *
+ * \param hooks Callbacks to copy, or NULL to remove all callbacks.
+ */
+CHX_API void cheax_set_hooks(CHEAX *c, const struct chx_hooks *hooks);
+
+/*! \brief Profiling modes for cheax_profile_start(). */
+enum {
+	CHEAX_PROFILE_CALLS,  /*!< Count and time every call. */
+	CHEAX_PROFILE_SAMPLE, /*!< Sample the call stack on a profiling timer. */
+};
+
+/*! \brief Starts profiling calls to functions, external functions and
+ *         special operators.
+ *
+ * In \ref CHEAX_PROFILE_CALLS mode, every call is counted and timed.
+ * In \ref CHEAX_PROFILE_SAMPLE mode, the call stack is sampled every
+ * millisecond of CPU time using \c setitimer(ITIMER_PROF), which only
+ * one cheax instance per process can do at a time.
+ *
+ * Sets cheax_errno() to \ref CHEAX_EAPI if the profiler is already
+ * running, or if \a mode is not supported on this platform.
+ *
+ * \param mode \ref CHEAX_PROFILE_CALLS or \ref CHEAX_PROFILE_SAMPLE.
+ *
+ * \returns 0 on success, -1 on error.
+ *
+ * \sa cheax_profile_stop()
+ */
+CHX_API int cheax_profile_start(CHEAX *c, int mode);
+
+/*! \brief Stops the profiler, and writes out its results.
+ *
+ * Sets cheax_errno() to \ref CHEAX_EAPI if the profiler isn't running.
+ *
+ * \param report File handle to write a text report to, sorted by time
+ *               spent in each function, or NULL.
+ * \param stacks File handle to write collapsed call stacks to, for use
+ *               with flame graph tools, or NULL. Stacks are weighed in
+ *               microseconds or samples, depending on the mode.
+ *
+ * \returns 0 on success, -1 on error.
+ *
+ * \sa cheax_profile_start()
+ */
+CHX_API int cheax_profile_stop(CHEAX *c, FILE *report, FILE *stacks);
+
 CHX_API void *cheax_malloc(CHEAX *c, size_t size);
 CHX_API void *cheax_calloc(CHEAX *c, size_t nmemb, size_t size);
 CHX_API void *cheax_realloc(CHEAX *c, void *ptr, size_t size);
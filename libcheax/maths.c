@@ -18,6 +18,7 @@
 #include "core.h"
 #include "err.h"
 #include "maths.h"
+#include "sym.h"
 #include "unpack.h"
 
 static struct chx_value
@@ -440,37 +441,37 @@ bltn_trunc(CHEAX *c, struct chx_list *args, void *info)
 void
 cheax_export_math_bltns_(CHEAX *c)
 {
-	cheax_defun(c, "acos",      bltn_acos,      NULL);
-	cheax_defun(c, "acosh",     bltn_acosh,     NULL);
-	cheax_defun(c, "asin",      bltn_asin,      NULL);
-	cheax_defun(c, "asinh",     bltn_asinh,     NULL);
-	cheax_defun(c, "atan",      bltn_atan,      NULL);
-	cheax_defun(c, "atan2",     bltn_atan2,     NULL);
-	cheax_defun(c, "atanh",     bltn_atanh,     NULL);
-	cheax_defun(c, "cbrt",      bltn_cbrt,      NULL);
-	cheax_defun(c, "ceil",      bltn_ceil,      NULL);
-	cheax_defun(c, "cos",       bltn_cos,       NULL);
-	cheax_defun(c, "cosh",      bltn_cosh,      NULL);
-	cheax_defun(c, "erf",       bltn_erf,       NULL);
-	cheax_defun(c, "exp",       bltn_exp,       NULL);
-	cheax_defun(c, "expm1",     bltn_expm1,     NULL);
-	cheax_defun(c, "floor",     bltn_floor,     NULL);
-	cheax_defun(c, "ldexp",     bltn_ldexp,     NULL);
-	cheax_defun(c, "lgamma",    bltn_lgamma,    NULL);
-	cheax_defun(c, "log",       bltn_log,       NULL);
-	cheax_defun(c, "log10",     bltn_log10,     NULL);
-	cheax_defun(c, "log1p",     bltn_log1p,     NULL);
-	cheax_defun(c, "log2",      bltn_log2,      NULL);
-	cheax_defun(c, "nextafter", bltn_nextafter, NULL);
-	cheax_defun(c, "pow",       bltn_pow,       NULL);
-	cheax_defun(c, "round",     bltn_round,     NULL);
-	cheax_defun(c, "sin",       bltn_sin,       NULL);
-	cheax_defun(c, "sinh",      bltn_sinh,      NULL);
-	cheax_defun(c, "sqrt",      bltn_sqrt,      NULL);
-	cheax_defun(c, "tan",       bltn_tan,       NULL);
-	cheax_defun(c, "tanh",      bltn_tanh,      NULL);
-	cheax_defun(c, "tgamma",    bltn_tgamma,    NULL);
-	cheax_defun(c, "trunc",     bltn_trunc,     NULL);
+	cheax_defun_pure_(c, "acos",      bltn_acos,      NULL);
+	cheax_defun_pure_(c, "acosh",     bltn_acosh,     NULL);
+	cheax_defun_pure_(c, "asin",      bltn_asin,      NULL);
+	cheax_defun_pure_(c, "asinh",     bltn_asinh,     NULL);
+	cheax_defun_pure_(c, "atan",      bltn_atan,      NULL);
+	cheax_defun_pure_(c, "atan2",     bltn_atan2,     NULL);
+	cheax_defun_pure_(c, "atanh",     bltn_atanh,     NULL);
+	cheax_defun_pure_(c, "cbrt",      bltn_cbrt,      NULL);
+	cheax_defun_pure_(c, "ceil",      bltn_ceil,      NULL);
+	cheax_defun_pure_(c, "cos",       bltn_cos,       NULL);
+	cheax_defun_pure_(c, "cosh",      bltn_cosh,      NULL);
+	cheax_defun_pure_(c, "erf",       bltn_erf,       NULL);
+	cheax_defun_pure_(c, "exp",       bltn_exp,       NULL);
+	cheax_defun_pure_(c, "expm1",     bltn_expm1,     NULL);
+	cheax_defun_pure_(c, "floor",     bltn_floor,     NULL);
+	cheax_defun_pure_(c, "ldexp",     bltn_ldexp,     NULL);
+	cheax_defun_pure_(c, "lgamma",    bltn_lgamma,    NULL);
+	cheax_defun_pure_(c, "log",       bltn_log,       NULL);
+	cheax_defun_pure_(c, "log10",     bltn_log10,     NULL);
+	cheax_defun_pure_(c, "log1p",     bltn_log1p,     NULL);
+	cheax_defun_pure_(c, "log2",      bltn_log2,      NULL);
+	cheax_defun_pure_(c, "nextafter", bltn_nextafter, NULL);
+	cheax_defun_pure_(c, "pow",       bltn_pow,       NULL);
+	cheax_defun_pure_(c, "round",     bltn_round,     NULL);
+	cheax_defun_pure_(c, "sin",       bltn_sin,       NULL);
+	cheax_defun_pure_(c, "sinh",      bltn_sinh,      NULL);
+	cheax_defun_pure_(c, "sqrt",      bltn_sqrt,      NULL);
+	cheax_defun_pure_(c, "tan",       bltn_tan,       NULL);
+	cheax_defun_pure_(c, "tanh",      bltn_tanh,      NULL);
+	cheax_defun_pure_(c, "tgamma",    bltn_tgamma,    NULL);
+	cheax_defun_pure_(c, "trunc",     bltn_trunc,     NULL);
 
 	cheax_def(c, "pi",   cheax_double(M_PI),      CHEAX_READONLY);
 	cheax_def(c, "nan",  cheax_double(+NAN),      CHEAX_READONLY);
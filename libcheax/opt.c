@@ -0,0 +1,770 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "core.h"
+#include "err.h"
+#include "opt.h"
+#include "sym.h"
+#include "types.h"
+
+/*
+ * Optimizing pass over preprocessed top-level forms, enabled through
+ * the `optimize' config option. It performs:
+ *
+ *  - constant propagation of read-only global numbers and booleans;
+ *  - folding of calls to pure built-in functions (see
+ *    cheax_defun_pure_()) with literal arguments;
+ *  - pruning of constant (cond) arms, and of (if), (when), (unless),
+ *    (and) and (or) forms with constant tests; and
+ *  - inlining of small read-only global functions, like (not) and
+ *    (const).
+ *
+ * Global symbols are only considered if they can't be redefined (see
+ * cheax_try_get_const_global_()). Since the preprocessor has no notion
+ * of scope, any identifier bound anywhere within the top-level form is
+ * considered shadowed throughout the whole form. Forms we do not know
+ * the structure of are left alone entirely, as are the arguments of
+ * calls to anything but known global functions, since the callee might
+ * be an environment evaluating its argument in a different scope.
+ */
+
+/* inlined functions may themselves be inlined, up to this depth */
+#define MAX_INLINE_DEPTH 4
+
+/* maximum number of parameters for a function to be inlined */
+#define MAX_INLINE_PARAMS 8
+
+enum {
+	FORM_CALL,   /* (f EXPR...) */
+	FORM_FN,     /* (fn LIT EXPR...) */
+	FORM_DEF,    /* (def LIT EXPR...), (var ...), (set ...) */
+	FORM_LET,    /* (let ((LIT EXPR)...) EXPR...), (let* ...), (loop ...) */
+	FORM_CASE,   /* (case EXPR (LIT EXPR...)...) */
+	FORM_COND,   /* (cond (EXPR EXPR...)...) */
+	FORM_BRANCH, /* (if EXPR...), (when ...), (unless ...), (and ...), (or ...), (do ...) */
+	FORM_OTHER,  /* any other special form */
+};
+
+struct opt_state {
+	/* identifiers bound anywhere within the top-level form */
+	struct chx_id **bound;
+	size_t num_bound, cap_bound;
+
+	int inline_depth;
+};
+
+static int
+form_kind(struct chx_value head)
+{
+	if (head.type != CHEAX_SPECIAL_OP)
+		return FORM_CALL;
+
+	static const struct { const char *name; int kind; } forms[] = {
+		{ "fn",     FORM_FN     },
+		{ "def",    FORM_DEF    },
+		{ "var",    FORM_DEF    },
+		{ "set",    FORM_DEF    },
+		{ "let",    FORM_LET    },
+		{ "let*",   FORM_LET    },
+		{ "loop",   FORM_LET    },
+		{ "case",   FORM_CASE   },
+		{ "cond",   FORM_COND   },
+		{ "if",     FORM_BRANCH },
+		{ "when",   FORM_BRANCH },
+		{ "unless", FORM_BRANCH },
+		{ "and",    FORM_BRANCH },
+		{ "or",     FORM_BRANCH },
+		{ "do",     FORM_BRANCH },
+	};
+
+	const char *name = head.data.as_special_op->name;
+	for (size_t i = 0; name != NULL && i < sizeof(forms) / sizeof(forms[0]); ++i)
+		if (0 == strcmp(name, forms[i].name))
+			return forms[i].kind;
+
+	return FORM_OTHER;
+}
+
+static bool
+is_literal(struct chx_value v)
+{
+	switch (v.type) {
+	case CHEAX_INT:
+	case CHEAX_BOOL:
+	case CHEAX_DOUBLE:
+	case CHEAX_STRING:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool
+is_bool_literal(struct chx_value v, bool b)
+{
+	return v.type == CHEAX_BOOL && (v.data.as_int != 0) == b;
+}
+
+static bool
+is_bound(struct opt_state *st, struct chx_id *id)
+{
+	for (size_t i = 0; i < st->num_bound; ++i)
+		if (st->bound[i] == id)
+			return true;
+	return false;
+}
+
+static void
+add_bound(CHEAX *c, struct opt_state *st, struct chx_id *id)
+{
+	if (is_bound(st, id))
+		return;
+
+	if (st->num_bound == st->cap_bound) {
+		size_t new_cap = (st->cap_bound == 0) ? 16 : st->cap_bound * 2;
+		struct chx_id **new_bound = cheax_realloc(c, st->bound, new_cap * sizeof(*new_bound));
+		cheax_ft(c, pad);
+		st->bound = new_bound;
+		st->cap_bound = new_cap;
+	}
+
+	st->bound[st->num_bound++] = id;
+pad:
+	return;
+}
+
+/* Mark every identifier occurring in v as bound */
+static void
+collect_ids(CHEAX *c, struct opt_state *st, struct chx_value v)
+{
+	switch (v.type) {
+	case CHEAX_ID:
+		add_bound(c, st, v.data.as_id);
+		break;
+	case CHEAX_LIST:
+		for (struct chx_list *lst = v.data.as_list; lst != NULL; lst = lst->next)
+			collect_ids(c, st, lst->value);
+		break;
+	case CHEAX_QUOTE:
+	case CHEAX_BACKQUOTE:
+	case CHEAX_COMMA:
+	case CHEAX_SPLICE:
+		collect_ids(c, st, v.data.as_quote->value);
+		break;
+	}
+}
+
+static void collect_bound(CHEAX *c, struct opt_state *st, struct chx_value v);
+
+static void
+collect_bound_seq(CHEAX *c, struct opt_state *st, struct chx_list *lst)
+{
+	for (; lst != NULL; lst = lst->next)
+		collect_bound(c, st, lst->value);
+}
+
+/* Mark every identifier bound by a binding form in v as bound */
+static void
+collect_bound(CHEAX *c, struct opt_state *st, struct chx_value v)
+{
+	if (v.type == CHEAX_BACKQUOTE) {
+		/* May contain anything at all */
+		collect_ids(c, st, v);
+		return;
+	}
+
+	if (v.type != CHEAX_LIST || v.data.as_list == NULL)
+		return;
+
+	struct chx_list *lst = v.data.as_list, *args = lst->next;
+	switch (form_kind(lst->value)) {
+	case FORM_CALL:
+		collect_bound_seq(c, st, lst);
+		break;
+	case FORM_FN:
+	case FORM_DEF:
+		if (args != NULL) {
+			collect_ids(c, st, args->value);
+			collect_bound_seq(c, st, args->next);
+		}
+		break;
+	case FORM_LET:
+		if (args == NULL)
+			break;
+		for (struct chx_list *p = (args->value.type == CHEAX_LIST) ? args->value.data.as_list : NULL;
+		     p != NULL;
+		     p = p->next)
+		{
+			collect_ids(c, st, p->value);
+		}
+		collect_bound_seq(c, st, args->next);
+		break;
+	case FORM_CASE:
+		if (args == NULL)
+			break;
+		collect_bound(c, st, args->value);
+		for (struct chx_list *cl = args->next; cl != NULL; cl = cl->next) {
+			if (cl->value.type != CHEAX_LIST || cl->value.data.as_list == NULL)
+				continue;
+			collect_ids(c, st, cl->value.data.as_list->value);
+			collect_bound_seq(c, st, cl->value.data.as_list->next);
+		}
+		break;
+	case FORM_COND:
+		for (struct chx_list *cl = args; cl != NULL; cl = cl->next)
+			if (cl->value.type == CHEAX_LIST)
+				collect_bound_seq(c, st, cl->value.data.as_list);
+		break;
+	case FORM_BRANCH:
+		collect_bound_seq(c, st, args);
+		break;
+	default:
+		collect_ids(c, st, v);
+		break;
+	}
+}
+
+/* Look up read-only global that isn't shadowed within the form */
+static bool
+get_global(CHEAX *c, struct opt_state *st, struct chx_value id, struct chx_value *out)
+{
+	return id.type == CHEAX_ID
+	    && !is_bound(st, id.data.as_id)
+	    && cheax_try_get_const_global_(c, id.data.as_id, out);
+}
+
+/*
+ * Copy-on-write helper: return list node with given value and next
+ * pointer, reusing orig if nothing changed.
+ */
+static struct chx_list *
+rebuild(CHEAX *c, struct chx_list *orig, struct chx_value value, struct chx_list *next)
+{
+	if (cheax_equiv(orig->value, value) && orig->next == next)
+		return orig;
+
+	struct chx_list *res = cheax_list(c, value, next).data.as_list;
+	cheax_ft(c, pad);
+
+	res->rtflags |= orig->rtflags & PREPROC_BIT;
+	if (c->gen_debug_info)
+		cheax_set_orig_form_(c, res, orig);
+	return res;
+pad:
+	return orig;
+}
+
+static struct chx_value opt_expr(CHEAX *c, struct opt_state *st, struct chx_value v);
+
+typedef struct chx_value (*opt_func)(CHEAX *c, struct opt_state *st, struct chx_value v);
+
+/* Apply f to every value in lst */
+static struct chx_list *
+opt_seq(CHEAX *c, struct opt_state *st, struct chx_list *lst, opt_func f)
+{
+	if (lst == NULL)
+		return NULL;
+
+	struct chx_value value = f(c, st, lst->value);
+	struct chx_list *next = opt_seq(c, st, lst->next, f);
+	return rebuild(c, lst, value, next);
+}
+
+/* Apply f to every value in lst, but leave the first one as is */
+static struct chx_list *
+opt_tail(CHEAX *c, struct opt_state *st, struct chx_list *lst, opt_func f)
+{
+	return (lst == NULL)
+	     ? NULL
+	     : rebuild(c, lst, lst->value, opt_seq(c, st, lst->next, f));
+}
+
+/* (LIT EXPR...) */
+static struct chx_value
+opt_lit_exprs(CHEAX *c, struct opt_state *st, struct chx_value v)
+{
+	return (v.type == CHEAX_LIST)
+	     ? cheax_list_value(opt_tail(c, st, v.data.as_list, opt_expr))
+	     : v;
+}
+
+/* (EXPR...) */
+static struct chx_value
+opt_exprs(CHEAX *c, struct opt_state *st, struct chx_value v)
+{
+	return (v.type == CHEAX_LIST)
+	     ? cheax_list_value(opt_seq(c, st, v.data.as_list, opt_expr))
+	     : v;
+}
+
+static struct chx_value
+prune_cond(CHEAX *c, struct chx_list *cond)
+{
+	struct chx_list *clauses = cond->next, *out = NULL, **nextp = &out;
+	bool changed = false;
+
+	for (struct chx_list *cl = clauses; cl != NULL; cl = cl->next) {
+		if (cl->value.type != CHEAX_LIST || cl->value.data.as_list == NULL)
+			return cheax_list_value(cond);
+
+		struct chx_value test = cl->value.data.as_list->value;
+		if (is_bool_literal(test, false)) {
+			changed = true;
+			continue;
+		}
+
+		*nextp = cheax_list(c, cl->value, NULL).data.as_list;
+		cheax_ft(c, pad);
+		nextp = &(*nextp)->next;
+
+		if (is_bool_literal(test, true)) {
+			changed = changed || cl->next != NULL;
+			break;
+		}
+	}
+
+	if (out == NULL)
+		return CHEAX_NIL;
+
+	struct chx_list *first = out->value.data.as_list;
+	if (is_bool_literal(first->value, true)) {
+		/* (cond (true)) => () */
+		if (first->next == NULL)
+			return CHEAX_NIL;
+
+		/* (cond (true x)) => x, unless x binds something in the
+		 * environment (cond) would have pushed */
+		if (first->next->next == NULL && !cheax_is_definition_(c, first->next->value))
+			return first->next->value;
+	}
+
+	if (changed)
+		return cheax_list_value(rebuild(c, cond, cond->value, out));
+pad:
+	return cheax_list_value(cond);
+}
+
+/* Expression that (if), (when), (unless), (and) or (or) form reduces
+ * to, given the value of its test */
+static struct chx_value
+branch_taken(const char *name, bool test, struct chx_list *args)
+{
+	struct chx_value x = args->next->value;
+	bool has_else = args->next->next != NULL;
+
+	if (0 == strcmp(name, "if"))
+		return (test || !has_else) ? x : args->next->next->value;
+	if (0 == strcmp(name, "when"))
+		return test ? x : CHEAX_NIL;
+	if (0 == strcmp(name, "unless"))
+		return test ? CHEAX_NIL : x;
+	if (0 == strcmp(name, "and"))
+		return test ? x : cheax_bool(false);
+	if (0 == strcmp(name, "or"))
+		return test ? cheax_bool(true) : x;
+	return CHEAX_NIL;
+}
+
+static struct chx_value
+prune_branch(CHEAX *c, struct chx_list *branch)
+{
+	const char *name = branch->value.data.as_special_op->name;
+	struct chx_list *args = branch->next;
+	if (name == NULL || args == NULL)
+		return cheax_list_value(branch);
+
+	/* (do x) => x */
+	if (0 == strcmp(name, "do"))
+		return (args->next == NULL && !cheax_is_definition_(c, args->value))
+		     ? args->value
+		     : cheax_list_value(branch);
+
+	bool test = is_bool_literal(args->value, true);
+	if ((!test && !is_bool_literal(args->value, false)) || args->next == NULL)
+		return cheax_list_value(branch);
+
+	/* Keep the form if the branch taken binds something in the
+	 * environment it would have pushed */
+	struct chx_value res = branch_taken(name, test, args);
+	return cheax_is_definition_(c, res) ? cheax_list_value(branch) : res;
+}
+
+static struct chx_value
+fold_call(CHEAX *c, struct chx_ext_func *fn, struct chx_list *args)
+{
+	for (struct chx_list *a = args; a != NULL; a = a->next)
+		if (!is_literal(a->value))
+			return CHEAX_NIL;
+
+	struct chx_value res = fn->perform(c, args, fn->info);
+	if (cheax_errno(c) != 0) {
+		/* Leave the error for runtime */
+		cheax_clear_errno(c);
+		return CHEAX_NIL;
+	}
+
+	return (is_literal(res) && res.type != CHEAX_STRING) ? res : CHEAX_NIL;
+}
+
+/*
+ * Inlining
+ */
+
+struct inline_info {
+	struct opt_state *st;
+	int num_params;
+	struct chx_id *params[MAX_INLINE_PARAMS];
+	struct chx_value args[MAX_INLINE_PARAMS];
+	int uses[MAX_INLINE_PARAMS];
+	bool lazy_use[MAX_INLINE_PARAMS]; /* used in non-strict position */
+
+	/* identifiers bound by (fn) forms within the body */
+	struct chx_id *inner[MAX_INLINE_PARAMS];
+	int num_inner;
+
+	bool ok;
+};
+
+static int
+param_index(struct inline_info *ii, struct chx_id *id)
+{
+	for (int i = 0; i < ii->num_params; ++i)
+		if (ii->params[i] == id)
+			return i;
+	return -1;
+}
+
+static bool
+add_inner(struct inline_info *ii, struct chx_value pan)
+{
+	switch (pan.type) {
+	case CHEAX_ID:
+		if (param_index(ii, pan.data.as_id) >= 0 || ii->num_inner >= MAX_INLINE_PARAMS)
+			return false;
+		ii->inner[ii->num_inner++] = pan.data.as_id;
+		return true;
+	case CHEAX_LIST:
+		for (struct chx_list *lst = pan.data.as_list; lst != NULL; lst = lst->next)
+			if (!add_inner(ii, lst->value))
+				return false;
+		return true;
+	default:
+		return true;
+	}
+}
+
+/*
+ * Check whether the function body can be inlined, counting parameter
+ * uses. A use is strict if it is certain to be evaluated before
+ * anything else with side effects in the body.
+ */
+static void
+check_inline(CHEAX *c, struct inline_info *ii, struct chx_value v, bool strict)
+{
+	struct chx_value glbl;
+
+	if (!ii->ok)
+		return;
+
+	switch (v.type) {
+	case CHEAX_ID:
+		for (int i = 0; i < ii->num_inner; ++i)
+			if (ii->inner[i] == v.data.as_id)
+				return;
+
+		int idx = param_index(ii, v.data.as_id);
+		if (idx >= 0) {
+			++ii->uses[idx];
+			ii->lazy_use[idx] = ii->lazy_use[idx] || !strict;
+		} else if (!get_global(c, ii->st, v, &glbl)) {
+			/* free variable */
+			ii->ok = false;
+		}
+		return;
+
+	case CHEAX_BACKQUOTE:
+	case CHEAX_COMMA:
+	case CHEAX_SPLICE:
+		ii->ok = false;
+		return;
+
+	case CHEAX_LIST:
+		break;
+
+	default:
+		return;
+	}
+
+	struct chx_list *lst = v.data.as_list;
+	if (lst == NULL)
+		return;
+
+	switch (form_kind(lst->value)) {
+	case FORM_CALL:
+		check_inline(c, ii, lst->value, false);
+		for (struct chx_list *a = lst->next; a != NULL; a = a->next)
+			check_inline(c, ii, a->value, strict && a == lst->next && lst->value.type == CHEAX_ID);
+		break;
+
+	case FORM_FN:
+		if (lst->next == NULL || !add_inner(ii, lst->next->value)) {
+			ii->ok = false;
+			break;
+		}
+		for (struct chx_list *b = lst->next->next; b != NULL; b = b->next)
+			check_inline(c, ii, b->value, false);
+		break;
+
+	case FORM_COND:
+		for (struct chx_list *cl = lst->next; cl != NULL; cl = cl->next) {
+			if (cl->value.type != CHEAX_LIST) {
+				ii->ok = false;
+				break;
+			}
+
+			for (struct chx_list *e = cl->value.data.as_list; e != NULL; e = e->next) {
+				bool s = strict && cl == lst->next && e == cl->value.data.as_list;
+				check_inline(c, ii, e->value, s);
+			}
+		}
+		break;
+
+	case FORM_BRANCH:
+		for (struct chx_list *e = lst->next; e != NULL; e = e->next)
+			check_inline(c, ii, e->value, strict && e == lst->next);
+		break;
+
+	default:
+		ii->ok = false;
+		break;
+	}
+}
+
+static struct chx_value
+subst(CHEAX *c, struct inline_info *ii, struct chx_value v)
+{
+	if (v.type == CHEAX_ID) {
+		for (int i = 0; i < ii->num_inner; ++i)
+			if (ii->inner[i] == v.data.as_id)
+				return v;
+
+		int idx = param_index(ii, v.data.as_id);
+		return (idx >= 0) ? ii->args[idx] : v;
+	}
+
+	if (v.type != CHEAX_LIST || v.data.as_list == NULL)
+		return v;
+
+	/* Always copy, so that the function body is never shared */
+	struct chx_list *lst = v.data.as_list, *out = NULL, **nextp = &out;
+	bool is_fn = form_kind(lst->value) == FORM_FN;
+	int i = 0;
+	for (struct chx_list *e = lst; e != NULL; e = e->next, ++i) {
+		/* don't substitute in (fn) argument list */
+		struct chx_value val = (is_fn && i == 1) ? e->value : subst(c, ii, e->value);
+		cheax_ft(c, pad);
+
+		*nextp = cheax_list(c, val, NULL).data.as_list;
+		cheax_ft(c, pad);
+		if (c->gen_debug_info)
+			cheax_set_orig_form_(c, *nextp, e);
+		nextp = &(*nextp)->next;
+	}
+
+	out->rtflags |= lst->rtflags & PREPROC_BIT;
+	return cheax_list_value(out);
+pad:
+	return CHEAX_NIL;
+}
+
+static struct chx_value
+try_inline(CHEAX *c, struct opt_state *st, struct chx_func *fn, struct chx_list *args)
+{
+	/* Free identifiers must refer to globals */
+	if (fn->lexenv != NULL || fn->body == NULL || fn->body->next != NULL)
+		return CHEAX_NIL;
+
+	if (fn->args.type != CHEAX_LIST)
+		return CHEAX_NIL;
+
+	struct inline_info ii = { .st = st, .ok = true };
+
+	struct chx_list *p = fn->args.data.as_list, *a = args;
+	for (; p != NULL && a != NULL; p = p->next, a = a->next) {
+		if (p->value.type != CHEAX_ID
+		 || p->value.data.as_id == c->std_ids[COLON_ID]
+		 || ii.num_params >= MAX_INLINE_PARAMS
+		 || param_index(&ii, p->value.data.as_id) >= 0)
+		{
+			return CHEAX_NIL;
+		}
+
+		ii.params[ii.num_params] = p->value.data.as_id;
+		ii.args[ii.num_params] = a->value;
+		++ii.num_params;
+	}
+
+	/* Leave arity errors for runtime */
+	if (p != NULL || a != NULL)
+		return CHEAX_NIL;
+
+	check_inline(c, &ii, fn->body->value, true);
+	cheax_ft(c, pad);
+	if (!ii.ok)
+		return CHEAX_NIL;
+
+	/*
+	 * Arguments with side effects must be evaluated exactly once, and
+	 * in the same order. Allow at most one such argument, used once,
+	 * in strict position.
+	 */
+	int num_complex = 0;
+	for (int i = 0; i < ii.num_params; ++i) {
+		if (is_literal(ii.args[i]) || cheax_is_nil(ii.args[i]))
+			continue;
+
+		if (++num_complex > 1 || ii.uses[i] != 1 || ii.lazy_use[i])
+			return CHEAX_NIL;
+	}
+
+	/* Substituted arguments must not be captured by (fn) forms in
+	 * the body */
+	for (int i = 0; i < ii.num_params; ++i)
+		if (!is_literal(ii.args[i]) && ii.num_inner > 0)
+			return CHEAX_NIL;
+
+	/* Inner binders are now part of the form */
+	for (int i = 0; i < ii.num_inner; ++i) {
+		add_bound(c, st, ii.inner[i]);
+		cheax_ft(c, pad);
+	}
+
+	return subst(c, &ii, fn->body->value);
+pad:
+	return CHEAX_NIL;
+}
+
+static struct chx_value
+opt_call(CHEAX *c, struct opt_state *st, struct chx_list *call)
+{
+	struct chx_value fn;
+	if (!get_global(c, st, call->value, &fn)
+	 || (fn.type != CHEAX_EXT_FUNC && fn.type != CHEAX_FUNC))
+	{
+		return cheax_list_value(call);
+	}
+
+	/* The callee evaluates its arguments in this scope */
+	call = opt_tail(c, st, call, opt_expr);
+	cheax_ft(c, pad);
+
+	if (fn.type == CHEAX_EXT_FUNC) {
+		if (has_flag(fn.data.as_ext_func->rtflags, PURE_BIT)) {
+			struct chx_value res = fold_call(c, fn.data.as_ext_func, call->next);
+			if (!cheax_is_nil(res))
+				return res;
+		}
+		return cheax_list_value(call);
+	}
+
+	if (st->inline_depth >= MAX_INLINE_DEPTH)
+		return cheax_list_value(call);
+
+	struct chx_value inl = try_inline(c, st, fn.data.as_func, call->next);
+	cheax_ft(c, pad);
+	if (inl.type == CHEAX_LIST && inl.data.as_list == NULL)
+		return cheax_list_value(call);
+
+	++st->inline_depth;
+	inl = opt_expr(c, st, inl);
+	--st->inline_depth;
+	return inl;
+pad:
+	return cheax_list_value(call);
+}
+
+static struct chx_value
+opt_expr(CHEAX *c, struct opt_state *st, struct chx_value v)
+{
+	struct chx_value glbl;
+
+	if (cheax_errno(c) != 0)
+		return v;
+
+	if (v.type == CHEAX_ID) {
+		/* Propagate read-only global constants */
+		return (get_global(c, st, v, &glbl)
+		     && (glbl.type == CHEAX_INT || glbl.type == CHEAX_DOUBLE || glbl.type == CHEAX_BOOL))
+		     ? glbl
+		     : v;
+	}
+
+	if (v.type != CHEAX_LIST || v.data.as_list == NULL)
+		return v;
+
+	struct chx_list *lst = v.data.as_list, *args = lst->next;
+	switch (form_kind(lst->value)) {
+	case FORM_CALL:
+		return opt_call(c, st, lst);
+
+	case FORM_FN:
+	case FORM_DEF:
+		if (args == NULL)
+			return v;
+		return cheax_list_value(rebuild(c, lst, lst->value, opt_tail(c, st, args, opt_expr)));
+
+	case FORM_LET:
+		if (args == NULL || args->value.type != CHEAX_LIST)
+			return v;
+		struct chx_list *binds = opt_seq(c, st, args->value.data.as_list, opt_lit_exprs);
+		args = rebuild(c, args, cheax_list_value(binds), opt_seq(c, st, args->next, opt_expr));
+		return cheax_list_value(rebuild(c, lst, lst->value, args));
+
+	case FORM_CASE:
+		if (args == NULL)
+			return v;
+		args = rebuild(c, args, opt_expr(c, st, args->value), opt_seq(c, st, args->next, opt_lit_exprs));
+		return cheax_list_value(rebuild(c, lst, lst->value, args));
+
+	case FORM_COND:
+		lst = rebuild(c, lst, lst->value, opt_seq(c, st, args, opt_exprs));
+		cheax_ft(c, pad);
+		return prune_cond(c, lst);
+
+	case FORM_BRANCH:
+		lst = rebuild(c, lst, lst->value, opt_seq(c, st, args, opt_expr));
+		cheax_ft(c, pad);
+		return prune_branch(c, lst);
+
+	default:
+		return v;
+	}
+pad:
+	return v;
+}
+
+struct chx_value
+cheax_optimize_(CHEAX *c, struct chx_value expr)
+{
+	struct opt_state st = { 0 };
+
+	collect_bound(c, &st, expr);
+	struct chx_value res = opt_expr(c, &st, expr);
+	cheax_free(c, st.bound);
+
+	return (cheax_errno(c) == 0) ? res : CHEAX_NIL;
+}
@@ -17,9 +17,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "btree.h"
 #include "cinfo.h"
 #include "core.h"
 #include "err.h"
+#include "hamt.h"
 #include "print.h"
 #include "strm.h"
 
@@ -35,12 +37,39 @@ show_sym(struct htab_entry *item, void *info)
 		cheax_ostrm_printf_(s, "\n(%s %s)", (sym->set == NULL) ? "def" : "var", fs->name);
 }
 
+struct show_entry_info {
+	CHEAX *c;
+	struct ostrm *s;
+};
+
+static void
+show_hash_entry(struct htab_entry *item, void *info)
+{
+	struct show_entry_info *sei = info;
+	struct hash_entry *ent = container_of(item, struct hash_entry, entry);
+	cheax_ostrm_putc_(sei->s, ' ');
+	cheax_ostrm_show_(sei->c, sei->s, ent->key);
+	cheax_ostrm_putc_(sei->s, ' ');
+	cheax_ostrm_show_(sei->c, sei->s, ent->value);
+}
+
+static void
+show_map_entry(struct chx_value key, struct chx_value value, void *info)
+{
+	struct show_entry_info *sei = info;
+	cheax_ostrm_putc_(sei->s, ' ');
+	cheax_ostrm_show_(sei->c, sei->s, key);
+	cheax_ostrm_putc_(sei->s, ' ');
+	cheax_ostrm_show_(sei->c, sei->s, value);
+}
+
 static void
 cheax_ostrm_show_basic_(CHEAX *c, struct ostrm *s, struct chx_value val)
 {
 	struct chx_env *env;
 	struct chx_ext_func *macro;
 	struct chx_special_op *specop;
+	struct chx_record *rec;
 
 	int ty = cheax_resolve_type(c, val.type);
 	switch (ty) {
@@ -120,6 +149,42 @@ cheax_ostrm_show_basic_(CHEAX *c, struct ostrm *s, struct chx_value val)
 		else
 			cheax_ostrm_printf_(s, "%s", specop->name);
 		break;
+	case CHEAX_GENERATOR:
+		cheax_ostrm_printf_(s, "[generator]");
+		break;
+	case CHEAX_RECORD:
+		rec = val.data.as_record;
+		for (int i = 0; i < rec->num_slots; ++i) {
+			if (i > 0)
+				cheax_ostrm_putc_(s, ' ');
+			cheax_ostrm_show_(c, s, rec->slots[i]);
+		}
+		break;
+	case CHEAX_VECTOR:
+		cheax_ostrm_printf_(s, "(vector");
+		for (size_t i = 0; i < val.data.as_vector->len; ++i) {
+			cheax_ostrm_putc_(s, ' ');
+			cheax_ostrm_show_(c, s, val.data.as_vector->items[i]);
+		}
+		cheax_ostrm_putc_(s, ')');
+		break;
+	case CHEAX_HASHMAP:
+		cheax_ostrm_printf_(s, "(hash-map");
+		cheax_htab_foreach_(&val.data.as_hashmap->table,
+		                    show_hash_entry,
+		                    &(struct show_entry_info){ c, s });
+		cheax_ostrm_putc_(s, ')');
+		break;
+	case CHEAX_MAP:
+		cheax_ostrm_printf_(s, "(map-of");
+		cheax_map_foreach_(val.data.as_map, show_map_entry, &(struct show_entry_info){ c, s });
+		cheax_ostrm_putc_(s, ')');
+		break;
+	case CHEAX_ORDERED_MAP:
+		cheax_ostrm_printf_(s, "(ordered-map");
+		cheax_omap_foreach_(val.data.as_ordered_map, show_map_entry, &(struct show_entry_info){ c, s });
+		cheax_ostrm_putc_(s, ')');
+		break;
 	case CHEAX_USER_PTR:
 		cheax_ostrm_printf_(s, "%p", val.data.user_ptr);
 		break;
@@ -140,7 +205,7 @@ cheax_ostrm_show_basic_(CHEAX *c, struct ostrm *s, struct chx_value val)
 		}
 
 		cheax_ostrm_printf_(s, "((fn ()");
-		cheax_htab_foreach_(&env->value.norm.syms, show_sym, s);
+		cheax_env_foreach_(env, show_sym, s);
 		cheax_ostrm_printf_(s, "\n(env)))");
 		break;
 	}
@@ -152,8 +217,13 @@ cheax_ostrm_show_as_(CHEAX *c, struct ostrm *s, struct chx_value val, int ty)
 	if (cheax_is_basic_type(c, ty)) {
 		cheax_ostrm_show_basic_(c, s, val);
 	} else if (cheax_is_user_type(c, ty)) {
-		cheax_ostrm_printf_(s, "(%s ", c->typestore.array[ty - CHEAX_TYPESTORE_BIAS].name);
-		cheax_ostrm_show_as_(c, s, val, cheax_get_base_type(c, ty));
+		struct type_alias *alias = &c->typestore.array[ty - CHEAX_TYPESTORE_BIAS];
+		cheax_ostrm_printf_(s, "(%s", alias->name);
+		/* records show like lists, (Name slots...) */
+		if (alias->record == NULL || val.data.as_record->num_slots > 0) {
+			cheax_ostrm_putc_(s, ' ');
+			cheax_ostrm_show_as_(c, s, val, cheax_get_base_type(c, ty));
+		}
 		cheax_ostrm_printf_(s, ")");
 	} else {
 		cheax_throwf(c, CHEAX_EEVAL, "cheax_ostrm_show_as_(): unable to resolve type");
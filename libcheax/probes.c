@@ -0,0 +1,76 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "probes.h"
+
+#ifdef HAVE_SYS_SDT_H
+
+#include "attrib.h"
+#include "core.h"
+
+/* Set by the tracer while a probe is attached */
+#define DEFINE_SEMAPHORE(name) \
+	unsigned short PROBE_SEMAPHORE(name) __attribute__((section(".probes"))) = 0
+
+DEFINE_SEMAPHORE(function__entry);
+DEFINE_SEMAPHORE(function__return);
+DEFINE_SEMAPHORE(gc__start);
+DEFINE_SEMAPHORE(gc__mark__done);
+DEFINE_SEMAPHORE(gc__sweep__done);
+DEFINE_SEMAPHORE(gc__alloc);
+DEFINE_SEMAPHORE(error__throw);
+DEFINE_SEMAPHORE(exec__start);
+DEFINE_SEMAPHORE(exec__done);
+
+void
+cheax_probe_site_(CHEAX *c, struct chx_value head, struct chx_list *call, struct probe_site *site)
+{
+	site->func = "?";
+	site->file = "?";
+	site->line = 0;
+
+	switch (head.type) {
+	case CHEAX_EXT_FUNC:
+		if (head.data.as_ext_func->name != NULL)
+			site->func = head.data.as_ext_func->name;
+		break;
+	case CHEAX_SPECIAL_OP:
+		if (head.data.as_special_op->name != NULL)
+			site->func = head.data.as_special_op->name;
+		break;
+	default:
+		if (call != NULL && call->value.type == CHEAX_ID)
+			site->func = call->value.data.as_id->value;
+		else if (head.type == CHEAX_FUNC)
+			site->func = "fn";
+		break;
+	}
+
+	if (call == NULL)
+		return;
+
+	/* report macro expansions at the location of the macro call */
+	struct attrib *orig_form = cheax_attrib_get_(c, call, ATTRIB_ORIG_FORM);
+	if (orig_form != NULL)
+		call = orig_form->orig_form;
+
+	struct attrib *loc = cheax_attrib_get_(c, call, ATTRIB_LOC);
+	if (loc != NULL) {
+		site->file = loc->loc.file;
+		site->line = loc->loc.line;
+	}
+}
+
+#endif
@@ -0,0 +1,103 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <cheax.h>
+
+#include "setup.h"
+
+/*
+ * USDT probes under provider `cheax', for use with bpftrace, perf,
+ * SystemTap et al. Every probe starts with the arguments
+ *
+ *   arg0  name of the function being called (char *)
+ *   arg1  file of the call site (char *)
+ *   arg2  line of the call site (int)
+ *
+ * The call site is the call being entered or exited for the
+ * function__ probes, and the call being evaluated for all others.
+ * Further arguments are:
+ *
+ *   function__entry
+ *   function__return
+ *   gc__start        arg3: number of objects
+ *   gc__mark__done
+ *   gc__sweep__done  arg3: number of objects
+ *   gc__alloc        arg3: type, arg4: size
+ *   error__throw     arg3: error code
+ *   exec__start      arg3: path
+ *   exec__done       arg3: path, arg4: lines read
+ *
+ * Arguments are only computed while a probe is attached, by means of
+ * semaphores. Without <sys/sdt.h>, all probes compile to nothing.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+struct probe_site {
+	const char *func, *file;
+	int line;
+};
+
+void cheax_probe_site_(CHEAX *c, struct chx_value head, struct chx_list *call, struct probe_site *site);
+
+#define PROBE_SEMAPHORE(name) cheax_##name##_semaphore
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name) != 0, 0)
+
+#define PROBE_SITE(c, name, head, call, args)                      \
+	do {                                                       \
+		if (PROBE_ENABLED(name)) {                         \
+			struct probe_site site_;                   \
+			cheax_probe_site_(c, head, call, &site_);  \
+			args;                                      \
+		}                                                  \
+	} while (false)
+
+#define PROBE_CALL(c, name, head, call) \
+	PROBE_SITE(c, name, head, call, STAP_PROBE3(cheax, name, site_.func, site_.file, site_.line))
+#define PROBE(c, name) \
+	PROBE_CALL(c, name, CHEAX_NIL, (c)->bt.last_call)
+#define PROBE1(c, name, a) \
+	PROBE_SITE(c, name, CHEAX_NIL, (c)->bt.last_call, \
+	           STAP_PROBE4(cheax, name, site_.func, site_.file, site_.line, a))
+#define PROBE2(c, name, a, b) \
+	PROBE_SITE(c, name, CHEAX_NIL, (c)->bt.last_call, \
+	           STAP_PROBE5(cheax, name, site_.func, site_.file, site_.line, a, b))
+
+extern unsigned short PROBE_SEMAPHORE(function__entry);
+extern unsigned short PROBE_SEMAPHORE(function__return);
+extern unsigned short PROBE_SEMAPHORE(gc__start);
+extern unsigned short PROBE_SEMAPHORE(gc__mark__done);
+extern unsigned short PROBE_SEMAPHORE(gc__sweep__done);
+extern unsigned short PROBE_SEMAPHORE(gc__alloc);
+extern unsigned short PROBE_SEMAPHORE(error__throw);
+extern unsigned short PROBE_SEMAPHORE(exec__start);
+extern unsigned short PROBE_SEMAPHORE(exec__done);
+
+#else
+
+#define PROBE_CALL(c, name, head, call) ((void)0)
+#define PROBE(c, name)                  ((void)0)
+#define PROBE1(c, name, a)              ((void)0)
+#define PROBE2(c, name, a, b)           ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,803 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "setup.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SETITIMER
+#  include <signal.h>
+#  include <sys/time.h>
+#endif
+
+#include "attrib.h"
+#include "budget.h"
+#include "core.h"
+#include "err.h"
+#include "feat.h"
+#include "htab.h"
+#include "prof.h"
+#include "types.h"
+#include "unpack.h"
+
+/*
+ * Calls to functions, external functions and special operators are
+ * bracketed by cheax_prof_enter_() and cheax_prof_exit_(), which keep
+ * a shadow stack of nodes in a call tree.
+ *
+ * In CHEAX_PROFILE_CALLS mode, every call is timed. Note that a tail
+ * call is not part of its caller: the caller has returned by the time
+ * its tail call is evaluated, so the callee shows up one level higher
+ * in the call tree than one might expect.
+ *
+ * In CHEAX_PROFILE_SAMPLE mode, a SIGPROF handler merely counts timer
+ * ticks, which are attributed to the top of the shadow stack at the
+ * next call boundary. This keeps the signal handler async-signal-safe,
+ * at the cost of some skew towards the ends of long-running calls.
+ *
+ * Functions are keyed on their body, so that all closures created from
+ * the same (fn) form share their statistics. They are named after the
+ * identifier they were first called through, and the location of their
+ * body.
+ */
+
+#define SAMPLE_USEC 1000
+
+struct prof_entry {
+	struct htab_entry entry;
+	const void *key;
+	char *name;
+	size_t calls, depth;
+	uint64_t total, self; /* nanoseconds, or samples */
+	const struct prof_node *stamp;
+};
+
+struct prof_node {
+	struct prof_entry *fn; /* NULL for root */
+	struct prof_node *parent, *child, *sibling;
+	struct prof_node *next_alloc;
+	uint64_t self;
+};
+
+struct prof_frame {
+	struct prof_node *node;
+	uint64_t start, children;
+};
+
+struct prof_info {
+	int mode;
+	unsigned token;
+	uint64_t start, end;
+	struct htab entries;
+	struct prof_node root;
+	struct prof_node *nodes;
+
+	struct {
+		struct prof_frame *array;
+		size_t len, cap;
+	} stack;
+};
+
+#ifdef HAVE_SETITIMER
+static volatile sig_atomic_t pending_ticks;
+static CHEAX *sampler;
+static struct sigaction prev_action;
+
+static void
+on_sigprof(int sig)
+{
+	(void)sig;
+	++pending_ticks;
+}
+
+static int
+start_timer(CHEAX *c)
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_sigprof;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, &prev_action) < 0)
+		return -1;
+
+	pending_ticks = 0;
+	struct itimerval it = { { 0, SAMPLE_USEC }, { 0, SAMPLE_USEC } };
+	if (setitimer(ITIMER_PROF, &it, NULL) < 0) {
+		sigaction(SIGPROF, &prev_action, NULL);
+		return -1;
+	}
+
+	sampler = c;
+	return 0;
+}
+
+static void
+stop_timer(void)
+{
+	struct itimerval it = { { 0, 0 }, { 0, 0 } };
+	setitimer(ITIMER_PROF, &it, NULL);
+	sigaction(SIGPROF, &prev_action, NULL);
+	sampler = NULL;
+}
+#endif
+
+static uint32_t
+entry_hash(const struct htab_entry *item)
+{
+	const struct prof_entry *ent = container_of(item, struct prof_entry, entry);
+	return cheax_good_hash_(&ent->key, sizeof(void *));
+}
+
+static bool
+entry_eq(const struct htab_entry *ent_a, const struct htab_entry *ent_b)
+{
+	const struct prof_entry *a, *b;
+	a = container_of(ent_a, struct prof_entry, entry);
+	b = container_of(ent_b, struct prof_entry, entry);
+	return a->key == b->key;
+}
+
+static const struct attrib_loc *
+body_loc(CHEAX *c, struct chx_list *body)
+{
+	for (; body != NULL; body = body->next) {
+		if (body->value.type != CHEAX_LIST)
+			continue;
+
+		struct chx_list *lst = body->value.data.as_list;
+		struct attrib *attr = cheax_attrib_get_(c, lst, ATTRIB_LOC);
+		if (attr == NULL) {
+			struct attrib *orig = cheax_attrib_get_(c, lst, ATTRIB_ORIG_FORM);
+			if (orig != NULL)
+				attr = cheax_attrib_get_(c, orig->orig_form, ATTRIB_LOC);
+		}
+
+		if (attr != NULL)
+			return &attr->loc;
+	}
+
+	return NULL;
+}
+
+static char *
+entry_name(CHEAX *c, struct chx_value head, struct chx_list *call)
+{
+	const char *name = NULL;
+	const struct attrib_loc *loc = NULL;
+
+	switch (head.type) {
+	case CHEAX_EXT_FUNC:
+		name = head.data.as_ext_func->name;
+		break;
+	case CHEAX_SPECIAL_OP:
+		name = head.data.as_special_op->name;
+		break;
+	case CHEAX_FUNC:
+		if (call != NULL && call->value.type == CHEAX_ID)
+			name = call->value.data.as_id->value;
+		else
+			name = "fn";
+		loc = body_loc(c, head.data.as_func->body);
+		break;
+	}
+
+	if (name == NULL)
+		name = "?";
+
+	int len = (loc == NULL)
+	        ? snprintf(NULL, 0, "%s", name)
+	        : snprintf(NULL, 0, "%s (%s:%d)", name, loc->file, loc->line);
+
+	char *res = cheax_malloc(c, len + 1);
+	if (res == NULL)
+		return NULL;
+
+	if (loc == NULL)
+		snprintf(res, len + 1, "%s", name);
+	else
+		snprintf(res, len + 1, "%s (%s:%d)", name, loc->file, loc->line);
+	return res;
+}
+
+static struct prof_entry *
+get_entry(CHEAX *c, struct prof_info *p, const void *key, struct chx_value head, struct chx_list *call)
+{
+	struct prof_entry dummy = { .key = key };
+	struct htab_search search = cheax_htab_get_(&p->entries, &dummy.entry);
+	if (search.item != NULL)
+		return container_of(search.item, struct prof_entry, entry);
+
+	struct prof_entry *ent = cheax_malloc(c, sizeof(struct prof_entry));
+	if (ent == NULL)
+		return NULL;
+
+	memset(ent, 0, sizeof(struct prof_entry));
+	ent->key = key;
+	ent->name = entry_name(c, head, call);
+	cheax_ft(c, pad);
+
+	cheax_htab_set_(&p->entries, search, &ent->entry);
+	cheax_ft(c, pad);
+	return ent;
+pad:
+	cheax_free(c, ent->name);
+	cheax_free(c, ent);
+	return NULL;
+}
+
+static struct prof_node *
+get_child(CHEAX *c, struct prof_info *p, struct prof_node *parent, struct prof_entry *fn)
+{
+	struct prof_node *node;
+	for (node = parent->child; node != NULL; node = node->sibling)
+		if (node->fn == fn)
+			return node;
+
+	node = cheax_malloc(c, sizeof(struct prof_node));
+	if (node == NULL)
+		return NULL;
+
+	node->fn = fn;
+	node->parent = parent;
+	node->child = NULL;
+	node->sibling = parent->child;
+	node->self = 0;
+	parent->child = node;
+
+	node->next_alloc = p->nodes;
+	p->nodes = node;
+	return node;
+}
+
+static struct prof_node *
+top_node(struct prof_info *p)
+{
+	return (p->stack.len == 0)
+	     ? &p->root
+	     : p->stack.array[p->stack.len - 1].node;
+}
+
+static void
+take_samples(struct prof_info *p)
+{
+#ifdef HAVE_SETITIMER
+	if (p->mode != CHEAX_PROFILE_SAMPLE || pending_ticks == 0)
+		return;
+
+	uint64_t ticks = pending_ticks;
+	pending_ticks = 0;
+
+	struct prof_node *node = top_node(p);
+	node->self += ticks;
+	if (node->fn != NULL)
+		node->fn->self += ticks;
+#else
+	(void)p;
+#endif
+}
+
+static bool
+push_frame(CHEAX *c, struct prof_info *p, struct prof_node *node)
+{
+	if (p->stack.len == p->stack.cap) {
+		size_t new_cap = (p->stack.cap == 0) ? 64 : p->stack.cap * 2;
+		struct prof_frame *new_array;
+		new_array = cheax_realloc(c, p->stack.array, new_cap * sizeof(struct prof_frame));
+		if (new_array == NULL)
+			return false;
+
+		p->stack.array = new_array;
+		p->stack.cap = new_cap;
+	}
+
+	struct prof_frame *fr = &p->stack.array[p->stack.len++];
+	fr->node = node;
+	fr->children = 0;
+	fr->start = (p->mode == CHEAX_PROFILE_CALLS) ? cheax_now_ns_() : 0;
+	return true;
+}
+
+/* Account for frame popped off the shadow stack at time t */
+static void
+finish_frame(struct prof_info *p, struct prof_frame *fr, uint64_t t)
+{
+	struct prof_entry *fn = fr->node->fn;
+	--fn->depth;
+
+	if (p->mode != CHEAX_PROFILE_CALLS)
+		return;
+
+	uint64_t elapsed = t - fr->start;
+	uint64_t self = elapsed - ((fr->children < elapsed) ? fr->children : elapsed);
+	fr->node->self += self;
+	fn->self += self;
+
+	/* don't count recursive calls twice */
+	if (fn->depth == 0)
+		fn->total += elapsed;
+
+	if (p->stack.len > 0)
+		p->stack.array[p->stack.len - 1].children += elapsed;
+}
+
+unsigned
+cheax_prof_enter_(CHEAX *c, struct chx_value head, struct chx_list *call)
+{
+	struct prof_info *p = c->prof;
+	if (p == NULL)
+		return 0;
+
+	const void *key;
+	switch (head.type) {
+	case CHEAX_FUNC:
+		key = head.data.as_func->body;
+		break;
+	case CHEAX_EXT_FUNC:
+		key = head.data.as_ext_func;
+		break;
+	case CHEAX_SPECIAL_OP:
+		key = head.data.as_special_op;
+		break;
+	default:
+		return 0;
+	}
+
+	take_samples(p);
+
+	struct prof_entry *fn = get_entry(c, p, key, head, call);
+	struct prof_node *node = (fn == NULL) ? NULL : get_child(c, p, top_node(p), fn);
+	if (node == NULL || !push_frame(c, p, node)) {
+		/* not worth failing the call over */
+		cheax_clear_errno(c);
+		return 0;
+	}
+
+	++fn->calls;
+	++fn->depth;
+	return p->token;
+}
+
+void
+cheax_prof_exit_(CHEAX *c, unsigned token)
+{
+	struct prof_info *p = c->prof;
+	if (p == NULL || p->token != token || p->stack.len == 0)
+		return;
+
+	take_samples(p);
+
+	uint64_t t = (p->mode == CHEAX_PROFILE_CALLS) ? cheax_now_ns_() : 0;
+	struct prof_frame fr = p->stack.array[--p->stack.len];
+	finish_frame(p, &fr, t);
+}
+
+size_t
+cheax_prof_depth_(CHEAX *c)
+{
+	return (c->prof == NULL) ? 0 : c->prof->stack.len;
+}
+
+/* Move frames above base off the shadow stack, into st */
+void
+cheax_prof_suspend_(CHEAX *c, size_t base, struct prof_stack *st)
+{
+	struct prof_info *p = c->prof;
+	st->len = 0;
+	if (p == NULL || p->stack.len <= base)
+		return;
+
+	take_samples(p);
+
+	size_t n = p->stack.len - base;
+	if (n > st->cap) {
+		struct prof_frame *new_array = cheax_realloc(c, st->array, n * sizeof(struct prof_frame));
+		if (new_array == NULL) {
+			/* lose the frames rather than fail the switch */
+			cheax_clear_errno(c);
+			p->stack.len = base;
+			return;
+		}
+
+		st->array = new_array;
+		st->cap = n;
+	}
+
+	memcpy(st->array, p->stack.array + base, n * sizeof(struct prof_frame));
+	st->len = n;
+	st->token = p->token;
+	st->suspended = (p->mode == CHEAX_PROFILE_CALLS) ? cheax_now_ns_() : 0;
+	p->stack.len = base;
+}
+
+/* Move frames of st back on top of the shadow stack */
+void
+cheax_prof_resume_(CHEAX *c, struct prof_stack *st)
+{
+	struct prof_info *p = c->prof;
+	size_t n = st->len;
+	st->len = 0;
+	/* frames of an earlier profiling run are of no use */
+	if (p == NULL || n == 0 || st->token != p->token)
+		return;
+
+	take_samples(p);
+
+	/* don't count time spent suspended */
+	uint64_t shift = (p->mode == CHEAX_PROFILE_CALLS) ? cheax_now_ns_() - st->suspended : 0;
+	for (size_t i = 0; i < n; ++i) {
+		struct prof_frame *fr = &st->array[i];
+		fr->start += shift;
+		if (!push_frame(c, p, fr->node)) {
+			cheax_clear_errno(c);
+			return;
+		}
+
+		struct prof_frame *top = &p->stack.array[p->stack.len - 1];
+		top->start = fr->start;
+		top->children = fr->children;
+	}
+}
+
+void
+cheax_prof_stack_cleanup_(CHEAX *c, struct prof_stack *st)
+{
+	cheax_free(c, st->array);
+	memset(st, 0, sizeof(*st));
+}
+
+static void
+free_entry(struct htab_entry *item, void *data)
+{
+	CHEAX *c = data;
+	struct prof_entry *ent = container_of(item, struct prof_entry, entry);
+	cheax_free(c, ent->name);
+	cheax_free(c, ent);
+}
+
+static void
+free_prof(CHEAX *c, struct prof_info *p)
+{
+	struct prof_node *node, *next;
+	for (node = p->nodes; node != NULL; node = next) {
+		next = node->next_alloc;
+		cheax_free(c, node);
+	}
+
+	cheax_htab_cleanup_(&p->entries, free_entry, c);
+	cheax_free(c, p->stack.array);
+	cheax_free(c, p);
+}
+
+static int
+start_prof(CHEAX *c, int mode, int code)
+{
+	if (c->prof != NULL) {
+		cheax_throwf(c, code, "profiler already running");
+		return -1;
+	}
+
+	if (mode != CHEAX_PROFILE_CALLS && mode != CHEAX_PROFILE_SAMPLE) {
+		cheax_throwf(c, code, "invalid profiling mode");
+		return -1;
+	}
+
+#ifdef HAVE_SETITIMER
+	if (mode == CHEAX_PROFILE_SAMPLE && sampler != NULL) {
+		cheax_throwf(c, code, "another instance is already sampling");
+		return -1;
+	}
+#else
+	if (mode == CHEAX_PROFILE_SAMPLE) {
+		cheax_throwf(c, code, "sampling not supported on this platform");
+		return -1;
+	}
+#endif
+
+	struct prof_info *p = cheax_malloc(c, sizeof(struct prof_info));
+	if (p == NULL)
+		return -1;
+
+	p->mode = mode;
+	if (++c->prof_runs == 0)
+		++c->prof_runs;
+	p->token = c->prof_runs;
+	cheax_htab_init_(c, &p->entries, entry_hash, entry_eq);
+	memset(&p->root, 0, sizeof(p->root));
+	p->nodes = NULL;
+	p->stack.array = NULL;
+	p->stack.len = p->stack.cap = 0;
+
+#ifdef HAVE_SETITIMER
+	if (mode == CHEAX_PROFILE_SAMPLE && start_timer(c) < 0) {
+		cheax_free(c, p);
+		cheax_throwf(c, code, "failed to start profiling timer");
+		return -1;
+	}
+#endif
+
+	p->start = cheax_now_ns_();
+	c->prof = p;
+	cheax_update_trace_calls_(c);
+	return 0;
+}
+
+int
+cheax_profile_start(CHEAX *c, int mode)
+{
+	return start_prof(c, mode, CHEAX_EAPI);
+}
+
+/* Pre-order successor of node in call tree */
+static struct prof_node *
+next_node(struct prof_node *node)
+{
+	if (node->child != NULL)
+		return node->child;
+
+	while (node != NULL && node->sibling == NULL)
+		node = node->parent;
+
+	return (node == NULL) ? NULL : node->sibling;
+}
+
+static void
+fill_sample_totals(struct prof_info *p)
+{
+	for (struct prof_node *node = next_node(&p->root); node != NULL; node = next_node(node)) {
+		if (node->self == 0)
+			continue;
+
+		for (struct prof_node *n = node; n->fn != NULL; n = n->parent) {
+			if (n->fn->stamp != node) {
+				n->fn->stamp = node;
+				n->fn->total += node->self;
+			}
+		}
+	}
+}
+
+struct entry_array {
+	struct prof_entry **array;
+	size_t len;
+};
+
+static void
+collect_entry(struct htab_entry *item, void *data)
+{
+	struct entry_array *ea = data;
+	ea->array[ea->len++] = container_of(item, struct prof_entry, entry);
+}
+
+static int
+entry_compar(const void *a, const void *b)
+{
+	const struct prof_entry *ea = *(struct prof_entry *const *)a;
+	const struct prof_entry *eb = *(struct prof_entry *const *)b;
+	if (ea->self != eb->self)
+		return (ea->self < eb->self) ? 1 : -1;
+	if (ea->total != eb->total)
+		return (ea->total < eb->total) ? 1 : -1;
+	return strcmp(ea->name, eb->name);
+}
+
+static double
+percent(uint64_t part, uint64_t whole)
+{
+	return (whole == 0) ? 0.0 : 100.0 * (double)part / (double)whole;
+}
+
+static int
+write_report(CHEAX *c, struct prof_info *p, FILE *f)
+{
+	struct entry_array ea = { NULL, 0 };
+	if (p->entries.size > 0) {
+		ea.array = cheax_malloc(c, p->entries.size * sizeof(struct prof_entry *));
+		if (ea.array == NULL)
+			return -1;
+		cheax_htab_foreach_(&p->entries, collect_entry, &ea);
+		qsort(ea.array, ea.len, sizeof(struct prof_entry *), entry_compar);
+	}
+
+	if (p->mode == CHEAX_PROFILE_CALLS) {
+		uint64_t whole = p->end - p->start;
+		fprintf(f, "Profile: %.3f ms\n\n", (double)whole / 1e6);
+		fprintf(f, "%10s %12s %12s %7s  %s\n", "calls", "total ms", "self ms", "self %", "function");
+		for (size_t i = 0; i < ea.len; ++i) {
+			struct prof_entry *ent = ea.array[i];
+			fprintf(f, "%10zu %12.3f %12.3f %6.1f%%  %s\n",
+			        ent->calls, (double)ent->total / 1e6, (double)ent->self / 1e6,
+			        percent(ent->self, whole), ent->name);
+		}
+	} else {
+		uint64_t whole = p->root.self;
+		for (size_t i = 0; i < ea.len; ++i)
+			whole += ea.array[i]->self;
+
+		fprintf(f, "Profile: %" PRIu64 " samples of %d us\n\n", whole, SAMPLE_USEC);
+		fprintf(f, "%10s %8s %8s  %s\n", "samples", "total %", "self %", "function");
+		for (size_t i = 0; i < ea.len; ++i) {
+			struct prof_entry *ent = ea.array[i];
+			if (ent->total == 0)
+				continue;
+			fprintf(f, "%10" PRIu64 " %7.1f%% %7.1f%%  %s\n",
+			        ent->self, percent(ent->total, whole), percent(ent->self, whole), ent->name);
+		}
+	}
+
+	cheax_free(c, ea.array);
+	return 0;
+}
+
+/* Write stacks collapsed to single lines, as read by flamegraph.pl */
+static int
+write_stacks(CHEAX *c, struct prof_info *p, FILE *f)
+{
+	struct prof_node **path = NULL;
+	size_t path_cap = 0;
+
+	for (struct prof_node *node = next_node(&p->root); node != NULL; node = next_node(node)) {
+		/* microseconds, or samples */
+		uint64_t weight = (p->mode == CHEAX_PROFILE_CALLS) ? node->self / 1000 : node->self;
+		if (weight == 0)
+			continue;
+
+		size_t depth = 0;
+		for (struct prof_node *n = node; n->fn != NULL; n = n->parent)
+			++depth;
+
+		if (depth > path_cap) {
+			struct prof_node **new_path = cheax_realloc(c, path, depth * sizeof(struct prof_node *));
+			if (new_path == NULL) {
+				cheax_free(c, path);
+				return -1;
+			}
+			path = new_path;
+			path_cap = depth;
+		}
+
+		size_t i = depth;
+		for (struct prof_node *n = node; n->fn != NULL; n = n->parent)
+			path[--i] = n;
+
+		for (i = 0; i < depth; ++i) {
+			if (i > 0)
+				fputc(';', f);
+			for (const char *s = path[i]->fn->name; *s != '\0'; ++s)
+				fputc((*s == ';') ? ':' : *s, f);
+		}
+		fprintf(f, " %" PRIu64 "\n", weight);
+	}
+
+	cheax_free(c, path);
+	return 0;
+}
+
+int
+cheax_profile_stop(CHEAX *c, FILE *report, FILE *stacks)
+{
+	struct prof_info *p = c->prof;
+	if (p == NULL) {
+		cheax_throwf(c, CHEAX_EAPI, "profile_stop(): profiler not running");
+		return -1;
+	}
+
+	c->prof = NULL;
+	cheax_update_trace_calls_(c);
+
+#ifdef HAVE_SETITIMER
+	if (p->mode == CHEAX_PROFILE_SAMPLE) {
+		take_samples(p);
+		stop_timer();
+	}
+#endif
+
+	/* calls still in progress end here */
+	p->end = cheax_now_ns_();
+	while (p->stack.len > 0) {
+		struct prof_frame fr = p->stack.array[--p->stack.len];
+		finish_frame(p, &fr, p->end);
+	}
+
+	if (p->mode == CHEAX_PROFILE_SAMPLE)
+		fill_sample_totals(p);
+
+	int res = 0;
+	if (report != NULL)
+		res = write_report(c, p, report);
+	if (stacks != NULL && res == 0)
+		res = write_stacks(c, p, stacks);
+
+	free_prof(c, p);
+	return res;
+}
+
+void
+cheax_prof_cleanup_(CHEAX *c)
+{
+	struct prof_info *p = c->prof;
+	if (p == NULL)
+		return;
+
+#ifdef HAVE_SETITIMER
+	if (p->mode == CHEAX_PROFILE_SAMPLE)
+		stop_timer();
+#endif
+
+	c->prof = NULL;
+	cheax_update_trace_calls_(c);
+	free_prof(c, p);
+}
+
+/*
+ *  _           _ _ _   _
+ * | |__  _   _(_) | |_(_)_ __  ___
+ * | '_ \| | | | | | __| | '_ \/ __|
+ * | |_) | |_| | | | |_| | | | \__ \
+ * |_.__/ \__,_|_|_|\__|_|_| |_|___/
+ *
+ */
+
+static struct chx_value
+bltn_profile_start(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_value mode_val;
+	if (cheax_unpack_(c, args, "N?", &mode_val) < 0)
+		return CHEAX_NIL;
+
+	int mode = CHEAX_PROFILE_CALLS;
+	if (!cheax_is_nil(mode_val)) {
+		const char *name = mode_val.data.as_id->value;
+		if (0 == strcmp(name, "sample")) {
+			mode = CHEAX_PROFILE_SAMPLE;
+		} else if (0 != strcmp(name, "calls")) {
+			cheax_throwf(c, CHEAX_EVALUE, "unknown profiling mode `%s'", name);
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+		}
+	}
+
+	start_prof(c, mode, CHEAX_EVALUE);
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_profile_stop(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_value report, stacks;
+	if (cheax_unpack_(c, args, "F?F?", &report, &stacks) < 0)
+		return CHEAX_NIL;
+
+	if (c->prof == NULL) {
+		cheax_throwf(c, CHEAX_EVALUE, "profiler not running");
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	cheax_profile_stop(c,
+	                   cheax_is_nil(report) ? stdout : report.data.user_ptr,
+	                   cheax_is_nil(stacks) ? NULL : stacks.data.user_ptr);
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+void
+cheax_load_prof_feature_(CHEAX *c, int bits)
+{
+	if (has_flag(bits, PROFILE_BUILTIN)) {
+		cheax_defun(c, "profile-start", bltn_profile_start, NULL);
+		cheax_defun(c, "profile-stop", bltn_profile_stop, NULL);
+	}
+}
@@ -0,0 +1,56 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <cheax.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct prof_info;
+
+/*
+ * Bracket a call to head from call site `call'. The token returned by
+ * cheax_prof_enter_() must be passed to the matching
+ * cheax_prof_exit_(). It is 0 if the call isn't being profiled, in
+ * which case cheax_prof_exit_() does nothing.
+ */
+unsigned cheax_prof_enter_(CHEAX *c, struct chx_value head, struct chx_list *call);
+void cheax_prof_exit_(CHEAX *c, unsigned token);
+
+/*
+ * Shadow stack frames of a suspended coroutine. Switching to and from
+ * a generator, its frames are moved onto and off the top of the shadow
+ * stack, see gen.c.
+ */
+struct prof_stack {
+	struct prof_frame *array;
+	size_t len, cap;
+	unsigned token;     /* of the profiling run they belong to */
+	uint64_t suspended; /* time they were moved off */
+};
+
+size_t cheax_prof_depth_(CHEAX *c);
+void cheax_prof_suspend_(CHEAX *c, size_t base, struct prof_stack *st);
+void cheax_prof_resume_(CHEAX *c, struct prof_stack *st);
+void cheax_prof_stack_cleanup_(CHEAX *c, struct prof_stack *st);
+
+void cheax_prof_cleanup_(CHEAX *c);
+
+void cheax_load_prof_feature_(CHEAX *c, int bits);
+
+#endif
@@ -0,0 +1,238 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Records
+ *
+ * (defrecord Name (slot...)) makes a new type Name, an alias of
+ * CHEAX_RECORD. Its instances are single GC objects holding a vector
+ * of slots. The constructor, predicate and accessors defined along
+ * with it are external functions that carry the type code, or the
+ * type code and slot index, so that a slot is read without looking
+ * anything up by name.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "err.h"
+#include "gc.h"
+#include "record.h"
+#include "types.h"
+#include "unpack.h"
+
+struct record_slot {
+	struct record_info *rec;
+	int index;
+	char *getter_name;
+};
+
+struct record_info {
+	int type;
+	const char *name;
+	char *make_name, *pred_name;
+	int num_slots;
+	struct record_slot slots[];
+};
+
+void
+cheax_record_info_free_(CHEAX *c, struct record_info *info)
+{
+	if (info == NULL)
+		return;
+
+	for (int i = 0; i < info->num_slots; ++i)
+		cheax_free(c, info->slots[i].getter_name);
+	cheax_free(c, info->make_name);
+	cheax_free(c, info->pred_name);
+	cheax_free(c, info);
+}
+
+static struct chx_value
+bltn_make_record(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct record_info *ri = info;
+
+	int num_args = 0;
+	for (struct chx_list *a = args; a != NULL; a = a->next)
+		++num_args;
+
+	if (num_args != ri->num_slots) {
+		cheax_throwf(c, CHEAX_EMATCH, "expected %d argument(s)", ri->num_slots);
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	size_t size = offsetof(struct chx_record, slots) + ri->num_slots * sizeof(struct chx_value);
+	struct chx_record *rec = cheax_gc_alloc_(c, size, ri->type);
+	if (rec == NULL)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+
+	rec->num_slots = ri->num_slots;
+	for (int i = 0; args != NULL; args = args->next, ++i)
+		rec->slots[i] = args->value;
+
+	return (struct chx_value){ .type = ri->type, .data.as_record = rec };
+}
+
+static struct chx_value
+bltn_record_p(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct record_info *ri = info;
+	struct chx_value v;
+	return (0 == cheax_unpack_(c, args, "_", &v))
+	     ? cheax_bool(v.type == ri->type)
+	     : CHEAX_NIL;
+}
+
+static struct chx_value
+bltn_record_get(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct record_slot *slot = info;
+	struct chx_value v;
+	if (cheax_unpack_(c, args, "_", &v) < 0)
+		return CHEAX_NIL;
+
+	if (v.type != slot->rec->type || slot->index >= v.data.as_record->num_slots) {
+		cheax_throwf(c, CHEAX_ETYPE, "expected record of type %s", slot->rec->name);
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	return v.data.as_record->slots[slot->index];
+}
+
+/* malloc'd copy of fmt, formatted with one or two strings */
+static char *
+name_fmt(CHEAX *c, const char *fmt, const char *a, const char *b)
+{
+	size_t size = strlen(fmt) + strlen(a) + strlen(b) + 1;
+	char *res = cheax_malloc(c, size);
+	if (res != NULL)
+		snprintf(res, size, fmt, a, b);
+	return res;
+}
+
+static struct record_info *
+new_record_info(CHEAX *c, struct chx_id *name, struct chx_list *slots)
+{
+	int num_slots = 0;
+	for (struct chx_list *s = slots; s != NULL; s = s->next, ++num_slots) {
+		if (s->value.type != CHEAX_ID) {
+			cheax_throwf(c, CHEAX_ETYPE, "expected slot name");
+			return NULL;
+		}
+
+		for (struct chx_list *t = slots; t != s; t = t->next) {
+			if (t->value.data.as_id == s->value.data.as_id) {
+				cheax_throwf(c, CHEAX_EVALUE, "duplicate slot `%s'", s->value.data.as_id->value);
+				return NULL;
+			}
+		}
+	}
+
+	size_t size = offsetof(struct record_info, slots) + num_slots * sizeof(struct record_slot);
+	struct record_info *ri = cheax_calloc(c, 1, size);
+	if (ri == NULL)
+		return NULL;
+
+	ri->type = -1;
+	ri->num_slots = num_slots;
+	ri->make_name = name_fmt(c, "make-%s%s", name->value, "");
+	cheax_ft(c, pad);
+	ri->pred_name = name_fmt(c, "%s?%s", name->value, "");
+	cheax_ft(c, pad);
+
+	for (int i = 0; slots != NULL; slots = slots->next, ++i) {
+		struct record_slot *slot = &ri->slots[i];
+		slot->rec = ri;
+		slot->index = i;
+		slot->getter_name = name_fmt(c, "%s-%s", name->value, slots->value.data.as_id->value);
+		cheax_ft(c, pad);
+	}
+
+	return ri;
+pad:
+	cheax_record_info_free_(c, ri);
+	return NULL;
+}
+
+static int
+sf_defrecord(CHEAX *c, struct chx_list *args, void *info, struct chx_env *ps, union chx_eval_out *out)
+{
+	out->value = CHEAX_NIL;
+
+	struct chx_id *name;
+	struct chx_list *slots;
+	if (cheax_unpack_(c, args, "NC", &name, &slots) < 0)
+		return CHEAX_VALUE_OUT;
+
+	if (cheax_find_type(c, name->value) != -1) {
+		cheax_throwf(c, CHEAX_EEXIST, "type `%s' already exists", name->value);
+		goto pad;
+	}
+
+	struct record_info *ri = new_record_info(c, name, slots);
+	cheax_ft(c, pad);
+
+	int type = cheax_new_type(c, name->value, CHEAX_RECORD);
+	if (type < 0) {
+		cheax_record_info_free_(c, ri);
+		goto pad;
+	}
+
+	/* from here on, the type store owns ri */
+	struct type_alias *alias = &c->typestore.array[type - CHEAX_TYPESTORE_BIAS];
+	alias->record = ri;
+	ri->type = type;
+	ri->name = alias->name;
+
+	cheax_defun(c, ri->make_name, bltn_make_record, ri);
+	cheax_ft(c, pad);
+	cheax_defun(c, ri->pred_name, bltn_record_p, ri);
+	cheax_ft(c, pad);
+	for (int i = 0; i < ri->num_slots; ++i) {
+		cheax_defun(c, ri->slots[i].getter_name, bltn_record_get, &ri->slots[i]);
+		cheax_ft(c, pad);
+	}
+
+	return CHEAX_VALUE_OUT;
+pad:
+	cheax_add_bt(c);
+	return CHEAX_VALUE_OUT;
+}
+
+static struct chx_value
+pp_sf_defrecord(CHEAX *c, struct chx_list *args, void *info)
+{
+	/* (node LIT (node LIT NIL)) */
+	static const uint8_t ops[] = {
+		PP_NODE | PP_ERR(0), PP_LIT, PP_NODE | PP_ERR(1), PP_LIT, PP_NIL | PP_ERR(2),
+	};
+
+	static const char *errors[] = {
+		"expected record name",
+		"expected slot list",
+		"unexpected values after slot list",
+	};
+
+	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
+}
+
+void
+cheax_export_record_bltns_(CHEAX *c)
+{
+	cheax_defsyntax(c, "defrecord", sf_defrecord, pp_sf_defrecord, NULL);
+}
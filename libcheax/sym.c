@@ -54,63 +54,193 @@ norm_env(struct chx_env *env)
 	return env;
 }
 
-static struct htab_search
+/*
+ * Small environments keep their symbols inline, and are searched by
+ * comparing identifier pointers. Only when more than ENV_SMALL_SYMS
+ * symbols are defined, all of them move to the hash table.
+ */
+static struct full_sym *
 find_sym_in(struct chx_env *env, struct chx_id *name)
 {
+	if ((env = norm_env(env)) == NULL)
+		return NULL;
+
+	int n = env->value.norm.num_small;
+	if (n >= 0) {
+		for (int i = 0; i < n; ++i) {
+			if (env->value.norm.small_ids[i] == name)
+				return env->value.norm.small_syms[i];
+		}
+		return NULL;
+	}
+
 	struct full_sym dummy = { .name = name };
-	return ((env = norm_env(env)) == NULL)
-	     ? (struct htab_search){ 0 }
-	     : cheax_htab_get_(&env->value.norm.syms, &dummy.entry);
+	struct htab_search search = cheax_htab_get_(&env->value.norm.syms, &dummy.entry);
+	return (search.item == NULL)
+	     ? NULL
+	     : container_of(search.item, struct full_sym, entry);
 }
 
-static struct htab_search
+static struct full_sym *
 find_sym_in_or_below(struct chx_env *env, struct chx_id *name)
 {
-	struct htab_search res = { 0 };
+	struct full_sym *res;
 	if (env == NULL)
-		return res;
+		return NULL;
 
 	if (!env->is_bif) {
 		res = find_sym_in(env, name);
-		return (res.item != NULL)
+		return (res != NULL)
 		     ? res
 		     : find_sym_in_or_below(env->value.norm.below, name);
 	}
 
 	for (int i = 0; i < 2; ++i) {
 		res = find_sym_in_or_below(env->value.bif[i], name);
-		if (res.item != NULL)
+		if (res != NULL)
 			return res;
 	}
 
-	return (struct htab_search){ 0 };
+	return NULL;
 }
 
-static struct htab_search
+static struct full_sym *
 find_sym(CHEAX *c, struct chx_id *name)
 {
-	struct htab_search res = find_sym_in_or_below(c->env, name);
-	return (res.item != NULL)
+	struct full_sym *res = find_sym_in_or_below(c->env, name);
+	return (res != NULL)
 	     ? res
 	     : find_sym_in(c->global_env, name);
 }
 
+/* Move inline symbols of a small environment to its hash table. */
+static void
+spill_syms(CHEAX *c, struct chx_env *env)
+{
+	struct htab *syms = &env->value.norm.syms;
+	for (int i = 0; i < env->value.norm.num_small; ++i) {
+		struct full_sym *fs = env->value.norm.small_syms[i];
+		cheax_htab_set_(syms, cheax_htab_get_(syms, &fs->entry), &fs->entry);
+		if (cheax_errno(c) != 0) {
+			/* inline symbols stay authoritative */
+			cheax_htab_clear_(syms, NULL, NULL);
+			return;
+		}
+	}
+
+	env->value.norm.num_small = -1;
+}
+
+/*
+ * Add symbol to normal environment env, returning the symbol it
+ * replaces, if any.
+ */
+static struct full_sym *
+put_sym(CHEAX *c, struct chx_env *env, struct full_sym *fs)
+{
+	int n = env->value.norm.num_small;
+	if (n >= 0) {
+		for (int i = 0; i < n; ++i) {
+			if (env->value.norm.small_ids[i] == fs->name) {
+				struct full_sym *prev = env->value.norm.small_syms[i];
+				env->value.norm.small_syms[i] = fs;
+				return prev;
+			}
+		}
+
+		if (n < ENV_SMALL_SYMS) {
+			env->value.norm.small_ids[n] = fs->name;
+			env->value.norm.small_syms[n] = fs;
+			env->value.norm.num_small = n + 1;
+			return NULL;
+		}
+
+		spill_syms(c, env);
+		cheax_ft(c, pad);
+	}
+
+	struct htab_search search = cheax_htab_get_(&env->value.norm.syms, &fs->entry);
+	cheax_htab_set_(&env->value.norm.syms, search, &fs->entry);
+	if (search.item != NULL)
+		return container_of(search.item, struct full_sym, entry);
+pad:
+	return NULL;
+}
+
+void
+cheax_env_foreach_(struct chx_env *env, htab_item_func f, void *data)
+{
+	int n = env->value.norm.num_small;
+	if (n < 0) {
+		cheax_htab_foreach_(&env->value.norm.syms, f, data);
+		return;
+	}
+
+	for (int i = 0; i < n; ++i)
+		f(&env->value.norm.small_syms[i]->entry, data);
+}
+
 struct chx_env *
 cheax_norm_env_init_(CHEAX *c, struct chx_env *env, struct chx_env *below)
 {
 	cheax_htab_init_(c, &env->value.norm.syms, full_sym_hash, full_sym_eq);
 	env->is_bif = false;
+	env->value.norm.num_small = 0;
 	env->value.norm.below = below;
+	env->value.norm.params = NULL;
+	env->value.norm.num_params = env->value.norm.params_cap = 0;
 	return env;
 }
 
+/*
+ * Environment frames that never escaped are recycled by
+ * cheax_pop_env() rather than freed, keeping their bucket array and
+ * parameter block. Together with recycling of symbols, this means a
+ * function call in steady state does not have to allocate anything.
+ */
+#define POOL_MAX_FRAMES  64
+#define POOL_MAX_SYMS    256
+#define POOL_MAX_BUCKETS 17 /* don't hold on to grown bucket arrays */
+#define POOL_MAX_PARAMS  16
+
+static struct full_sym *
+alloc_sym(CHEAX *c)
+{
+	struct full_sym *fs = c->env_pool.syms;
+	if (fs == NULL) {
+		++c->env_pool.sym_misses;
+		return cheax_malloc(c, sizeof(struct full_sym));
+	}
+
+	++c->env_pool.sym_hits;
+	--c->env_pool.num_syms;
+	c->env_pool.syms = (fs->entry.next == NULL)
+	                 ? NULL
+	                 : container_of(fs->entry.next, struct full_sym, entry);
+	return fs;
+}
+
+static void
+free_sym(CHEAX *c, struct full_sym *fs)
+{
+	if (c->env_pool.num_syms >= POOL_MAX_SYMS) {
+		cheax_free(c, fs);
+		return;
+	}
+
+	fs->entry.next = (c->env_pool.syms == NULL) ? NULL : &c->env_pool.syms->entry;
+	c->env_pool.syms = fs;
+	++c->env_pool.num_syms;
+}
+
 static void
 sym_destroy(CHEAX *c, struct full_sym *fs)
 {
 	struct chx_sym *sym = &fs->sym;
 	if (sym->fin != NULL)
 		sym->fin(c, sym);
-	cheax_free(c, fs);
+	if (!fs->in_block)
+		free_sym(c, fs);
 }
 
 static void
@@ -134,10 +264,26 @@ get_def_doc(CHEAX *c)
 	return (doc_attr != NULL) ? doc_attr->doc : NULL;
 }
 
+/* Destroy all symbols, but keep hash table buckets. */
+static void
+clear_syms(CHEAX *c, struct chx_env *env)
+{
+	if (env->value.norm.num_small < 0)
+		cheax_htab_clear_(&env->value.norm.syms, sym_destroy_in_htab, c);
+	else
+		cheax_env_foreach_(env, sym_destroy_in_htab, c);
+
+	env->value.norm.num_small = 0;
+}
+
 void
 cheax_norm_env_cleanup_(CHEAX *c, struct chx_env *env)
 {
-	cheax_htab_cleanup_(&env->value.norm.syms, sym_destroy_in_htab, c);
+	clear_syms(c, env);
+	cheax_htab_cleanup_(&env->value.norm.syms, NULL, NULL);
+	cheax_free(c, env->value.norm.params);
+	env->value.norm.params = NULL;
+	env->value.norm.num_params = env->value.norm.params_cap = 0;
 }
 
 void
@@ -149,6 +295,28 @@ cheax_env_fin_(CHEAX *c, void *obj)
 		cheax_norm_env_cleanup_(c, env);
 }
 
+void
+cheax_env_pool_cleanup_(CHEAX *c)
+{
+	struct chx_env *env, *next_env;
+	for (env = c->env_pool.frames; env != NULL; env = next_env) {
+		next_env = env->value.norm.below;
+		cheax_gc_attach_(c, env);
+		cheax_gc_free_(c, env);
+	}
+
+	struct full_sym *fs = c->env_pool.syms;
+	while (fs != NULL) {
+		struct htab_entry *next_ent = fs->entry.next;
+		cheax_free(c, fs);
+		fs = (next_ent == NULL) ? NULL : container_of(next_ent, struct full_sym, entry);
+	}
+
+	c->env_pool.frames = NULL;
+	c->env_pool.syms = NULL;
+	c->env_pool.num_frames = c->env_pool.num_syms = 0;
+}
+
 static void
 escape(struct chx_env *env)
 {
@@ -165,6 +333,62 @@ escape(struct chx_env *env)
 	}
 }
 
+/* Whether (normal) env binds any of the given identifiers */
+static bool
+binds_any(struct chx_env *env, struct chx_id *const *ids, int n)
+{
+	for (int i = 0; i < n; ++i)
+		if (find_sym_in(env, ids[i]) != NULL)
+			return true;
+	return false;
+}
+
+static struct chx_value bltn_env(CHEAX *c, struct chx_list *args, void *info);
+
+/* Whether value may look up identifiers chosen at run time */
+static bool
+reads_env(struct chx_value value)
+{
+	return value.type == CHEAX_EXT_FUNC
+	    && (value.data.as_ext_func->perform == bltn_env
+	     || cheax_is_eval_(value.data.as_ext_func));
+}
+
+struct chx_env *
+cheax_capture_env_(CHEAX *c, struct chx_id *const *ids, int num_ids, bool dyn_calls)
+{
+	if (dyn_calls) {
+		escape(c->env);
+		return c->env;
+	}
+
+	for (int i = 0; i < num_ids; ++i) {
+		/* Unbound identifiers could still be defined anywhere, and
+		 * (eval) or (env) may look up anything */
+		struct full_sym *fs = find_sym(c, ids[i]);
+		if (fs == NULL || reads_env(fs->sym.protect)) {
+			escape(c->env);
+			return c->env;
+		}
+	}
+
+	/* Frames that may still gain bindings can't be skipped, since
+	 * they could come to shadow what the body looks up */
+	struct chx_env *env = c->env;
+	while (env != NULL && has_flag(env->rtflags, SEALED_BIT) && !binds_any(env, ids, num_ids))
+		env = env->value.norm.below;
+
+	escape(env);
+	return env;
+}
+
+void
+cheax_seal_env_(CHEAX *c)
+{
+	if (c->env != NULL)
+		c->env->rtflags |= SEALED_BIT;
+}
+
 struct chx_value
 cheax_env(CHEAX *c)
 {
@@ -177,7 +401,21 @@ cheax_env(CHEAX *c)
 void
 cheax_push_env(CHEAX *c)
 {
-	struct chx_env *env = cheax_gc_alloc_(c, sizeof(struct chx_env), CHEAX_ENV);
+	struct chx_env *env = c->env_pool.frames;
+	if (env != NULL) {
+		++c->env_pool.frame_hits;
+		--c->env_pool.num_frames;
+		c->env_pool.frames = env->value.norm.below;
+
+		cheax_gc_attach_(c, env);
+		env->rtflags = (env->rtflags | NO_ESC_BIT) & ~SEALED_BIT;
+		env->value.norm.below = c->env;
+		c->env = env;
+		return;
+	}
+
+	++c->env_pool.frame_misses;
+	env = cheax_gc_alloc_(c, sizeof(struct chx_env), CHEAX_ENV);
 	if (env != NULL) {
 		env->rtflags |= NO_ESC_BIT;
 		c->env = cheax_norm_env_init_(c, env, c->env);
@@ -197,6 +435,27 @@ cheax_enter_env(CHEAX *c, struct chx_env *main)
 	}
 }
 
+static void
+recycle_env(CHEAX *c, struct chx_env *env)
+{
+	if (env->is_bif
+	 || c->env_pool.num_frames >= POOL_MAX_FRAMES
+	 || env->value.norm.syms.cap > POOL_MAX_BUCKETS
+	 || env->value.norm.params_cap > POOL_MAX_PARAMS)
+	{
+		cheax_gc_free_(c, env);
+		return;
+	}
+
+	clear_syms(c, env);
+	env->value.norm.num_params = 0;
+
+	cheax_gc_detach_(c, env);
+	env->value.norm.below = c->env_pool.frames;
+	c->env_pool.frames = env;
+	++c->env_pool.num_frames;
+}
+
 void
 cheax_pop_env(CHEAX *c)
 {
@@ -213,7 +472,7 @@ cheax_pop_env(CHEAX *c)
 
 	/* dangerous, but worth it! */
 	if (has_flag(env->rtflags, NO_ESC_BIT))
-		cheax_gc_free_(c, env);
+		recycle_env(c, env);
 }
 
 struct chx_sym *
@@ -232,22 +491,21 @@ cheax_defsym_id_(CHEAX *c, struct chx_id *id,
 	if (env == NULL)
 		env = c->global_env;
 
-	struct htab_search search = find_sym_in(env, id);
-	struct full_sym *prev_fs = NULL;
-	if (search.item != NULL) {
-		prev_fs = container_of(search.item, struct full_sym, entry);
+	struct full_sym *prev_fs = find_sym_in(env, id);
+	if (prev_fs != NULL) {
 		if (!prev_fs->allow_redef) {
 			cheax_throwf(c, CHEAX_EEXIST, "symbol `%s' already exists", id->value);
 			return NULL;
 		}
 	}
 
-	struct full_sym *fs = cheax_malloc(c, sizeof(struct full_sym));
+	struct full_sym *fs = alloc_sym(c);
 	if (fs == NULL)
 		return NULL;
 
 	fs->name = id;
 	fs->allow_redef = c->allow_redef && (env == c->global_env);
+	fs->in_block = false;
 	fs->sym.get = get;
 	fs->sym.set = set;
 	fs->sym.fin = fin;
@@ -255,7 +513,11 @@ cheax_defsym_id_(CHEAX *c, struct chx_id *id,
 	fs->sym.protect = CHEAX_NIL;
 	fs->sym.doc = NULL;
 
-	cheax_htab_set_(&env->value.norm.syms, search, &fs->entry);
+	put_sym(c, env, fs);
+	if (cheax_errno(c) != 0) {
+		free_sym(c, fs);
+		return NULL;
+	}
 
 	if (prev_fs != NULL)
 		sym_destroy(c, prev_fs);
@@ -300,6 +562,50 @@ cheax_def_id_(CHEAX *c, struct chx_id *id, struct chx_value value, int flags)
 	return sym;
 }
 
+void
+cheax_def_params_(CHEAX *c, struct chx_id *const *ids, const struct chx_value *values, int n)
+{
+	struct chx_env *env = norm_env(c->env);
+	if (n == 0)
+		return;
+
+	if (env == NULL || env->value.norm.num_params != 0) {
+		cheax_throwf(c, CHEAX_EAPI, "def_params(): expected fresh environment");
+		return;
+	}
+
+	/* Recycled environments may come with a block already */
+	struct full_sym *params = env->value.norm.params;
+	if (n > env->value.norm.params_cap) {
+		params = cheax_malloc(c, n * sizeof(struct full_sym));
+		cheax_ft(c, pad);
+
+		/* Owned by env from here on, even if we fail halfway */
+		cheax_free(c, env->value.norm.params);
+		env->value.norm.params = params;
+		env->value.norm.params_cap = n;
+	}
+	env->value.norm.num_params = n;
+
+	for (int i = 0; i < n; ++i) {
+		struct full_sym *fs = &params[i];
+		fs->name = ids[i];
+		fs->allow_redef = false;
+		fs->in_block = true;
+		fs->sym.get = var_get;
+		fs->sym.set = NULL;
+		fs->sym.fin = NULL;
+		fs->sym.user_info = NULL;
+		fs->sym.protect = values[i];
+		fs->sym.doc = NULL;
+
+		put_sym(c, env, fs);
+		cheax_ft(c, pad);
+	}
+pad:
+	return;
+}
+
 void
 cheax_def(CHEAX *c, const char *name, struct chx_value value, int flags)
 {
@@ -316,6 +622,21 @@ cheax_defun(CHEAX *c, const char *id, chx_func_ptr perform, void *info)
 	cheax_def(c, id, cheax_ext_func(c, id, perform, info), CHEAX_READONLY);
 }
 void
+cheax_defun_tail(CHEAX *c, const char *id, chx_tail_func_ptr perform, void *info)
+{
+	cheax_def(c, id, cheax_tail_ext_func(c, id, perform, info), CHEAX_READONLY);
+}
+void
+cheax_defun_pure_(CHEAX *c, const char *id, chx_func_ptr perform, void *info)
+{
+	struct chx_value fn = cheax_ext_func(c, id, perform, info);
+	if (fn.type != CHEAX_EXT_FUNC)
+		return;
+
+	fn.data.as_ext_func->rtflags |= PURE_BIT;
+	cheax_def(c, id, fn, CHEAX_READONLY);
+}
+void
 cheax_defsyntax(CHEAX *c,
                 const char *id,
                 chx_tail_func_ptr perform,
@@ -345,13 +666,24 @@ cheax_set(CHEAX *c, const char *name, struct chx_value value)
 	ASSERT_NOT_NULL_VOID("set", name);
 
 	struct chx_id *id = cheax_find_id_(c, name);
-	struct htab_search search;
-	if (id == NULL || (search = find_sym(c, id)).item == NULL) {
+	if (id == NULL) {
 		cheax_throwf(c, CHEAX_ENOSYM, "no such symbol `%s'", name);
 		return;
 	}
 
-	struct chx_sym *sym = &container_of(search.item, struct full_sym, entry)->sym;
+	cheax_set_id_(c, id, value);
+}
+
+void
+cheax_set_id_(CHEAX *c, struct chx_id *id, struct chx_value value)
+{
+	struct full_sym *fs = find_sym(c, id);
+	if (fs == NULL) {
+		cheax_throwf(c, CHEAX_ENOSYM, "no such symbol `%s'", id->value);
+		return;
+	}
+
+	struct chx_sym *sym = &fs->sym;
 	if (sym->set == NULL)
 		cheax_throwf(c, CHEAX_EREADONLY, "cannot write to read-only symbol");
 	else
@@ -390,11 +722,11 @@ cheax_try_get_id_(CHEAX *c, struct chx_id *id, struct chx_value *out)
 {
 	ASSERT_NOT_NULL("get", id, false);
 
-	struct htab_search search = find_sym(c, id);
-	if (search.item == NULL)
+	struct full_sym *fs = find_sym(c, id);
+	if (fs == NULL)
 		return false;
 
-	struct chx_sym *sym = &container_of(search.item, struct full_sym, entry)->sym;
+	struct chx_sym *sym = &fs->sym;
 	if (sym->get == NULL) {
 		cheax_throwf(c, CHEAX_EWRITEONLY, "cannot read from write-only symbol");
 		return false;
@@ -404,6 +736,23 @@ cheax_try_get_id_(CHEAX *c, struct chx_id *id, struct chx_value *out)
 	return cheax_errno(c) == 0;
 }
 
+bool
+cheax_try_get_const_global_(CHEAX *c, struct chx_id *id, struct chx_value *out)
+{
+	if (c->global_env == NULL || find_sym_in_or_below(c->env, id) != NULL)
+		return false;
+
+	struct full_sym *fs = find_sym_in(c->global_env, id);
+	if (fs == NULL)
+		return false;
+
+	if (fs->allow_redef || fs->sym.get != var_get || fs->sym.set != NULL)
+		return false;
+
+	*out = fs->sym.protect;
+	return true;
+}
+
 bool
 cheax_try_get(CHEAX *c, const char *name, struct chx_value *out)
 {
@@ -433,11 +782,12 @@ cheax_try_get_from(CHEAX *c, struct chx_env *env, const char *name, struct chx_v
 	if (id == NULL)
 		return false;
 
-	struct htab_search search = find_sym_in(env, id);
-	if (search.item == NULL)
+	/* NULL is the global scope, as returned by cheax_env() */
+	struct full_sym *fs = find_sym_in((env != NULL) ? env : c->global_env, id);
+	if (fs == NULL)
 		return false;
 
-	struct chx_sym *sym = &container_of(search.item, struct full_sym, entry)->sym;
+	struct chx_sym *sym = &fs->sym;
 	if (sym->get == NULL) {
 		cheax_throwf(c, CHEAX_EWRITEONLY, "cannot read from write-only symbol");
 		return false;
@@ -643,6 +993,7 @@ defgetset(CHEAX *c, const char *name,
 		res->args = getset_args;
 		res->body = args;
 		res->lexenv = cheax_env(c).data.as_env;
+		cheax_init_params_(c, res);
 		*ref_out = cheax_ref_ptr(c, res);
 	}
 	*out = res;
@@ -894,17 +1245,47 @@ pp_sf_var(CHEAX *c, struct chx_list *args, void *info)
 	return cheax_preproc_pattern_(c, cheax_list_value(args), ops, errors);
 }
 
+bool
+cheax_is_definition_(CHEAX *c, struct chx_value expr)
+{
+	if (expr.type != CHEAX_LIST || expr.data.as_list == NULL)
+		return false;
+
+	struct chx_value head = expr.data.as_list->value;
+	switch (head.type) {
+	case CHEAX_SPECIAL_OP:
+		return head.data.as_special_op->perform == sf_def
+		    || head.data.as_special_op->perform == sf_defsym;
+	case CHEAX_ID:
+		return head.data.as_id == c->std_ids[DEF_ID]
+		    || head.data.as_id == c->std_ids[VAR_ID]
+		    || head.data.as_id == c->std_ids[DEFSYM_ID];
+	default:
+		return false;
+	}
+}
+
+bool
+cheax_body_defines_(CHEAX *c, struct chx_list *body)
+{
+	for (; body != NULL; body = body->next)
+		if (cheax_is_definition_(c, body->value))
+			return true;
+	return false;
+}
+
 static int
 sf_set(CHEAX *c, struct chx_list *args, void *info, struct chx_env *ps, union chx_eval_out *out)
 {
-	const char *id;
+	struct chx_id *id;
 	struct chx_value setto;
-	if (cheax_unpack_(c, args, "N!.", &id, &setto) < 0) {
+	if (cheax_unpack_(c, args, "N.", &id, &setto) < 0) {
 		out->value = CHEAX_NIL;
 		return CHEAX_VALUE_OUT;
 	}
 
-	cheax_set(c, id, setto);
+	/* skip cheax_set()'s lookup of the name, we have the id already */
+	cheax_set_id_(c, id, setto);
 	out->value = cheax_bt_wrap_(c, CHEAX_NIL);
 	return CHEAX_VALUE_OUT;
 }
@@ -960,6 +1341,9 @@ sf_let(CHEAX *c,
 		cheax_ft(c, pad);
 	}
 
+	if (!cheax_body_defines_(c, body))
+		cheax_seal_env_(c);
+
 	if (body != NULL) {
 		for (; body->next != NULL; body = body->next) {
 			cheax_eval(c, body->value);
@@ -1010,14 +1394,14 @@ sf_documentation(CHEAX *c, struct chx_list *args, void *info, struct chx_env *ps
 		return CHEAX_VALUE_OUT;
 	}
 
-	struct htab_search search = find_sym(c, id);
-	if (search.item == NULL) {
+	struct full_sym *fs = find_sym(c, id);
+	if (fs == NULL) {
 		cheax_throwf(c, CHEAX_ENOSYM, "no such symbol `%s'", id->value);
 		out->value = CHEAX_NIL;
 		return CHEAX_VALUE_OUT;
 	}
 
-	struct chx_string *doc = container_of(search.item, struct full_sym, entry)->sym.doc;
+	struct chx_string *doc = fs->sym.doc;
 	out->value = (doc == NULL) ? CHEAX_NIL : cheax_string_value(doc);
 	return CHEAX_VALUE_OUT;
 }
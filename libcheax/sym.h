@@ -25,19 +25,64 @@ struct full_sym {
 	struct chx_id *name;
 	struct chx_sym sym;
 	bool allow_redef;
+	bool in_block; /* part of chx_env params block */
 };
 
 struct chx_env *cheax_norm_env_init_(CHEAX *c, struct chx_env *env, struct chx_env *below);
 void cheax_norm_env_cleanup_(CHEAX *c, struct chx_env *env);
 void cheax_env_fin_(CHEAX *c, void *obj);
+void cheax_env_pool_cleanup_(CHEAX *c);
+
+/* Perform action for each symbol in normal environment env. */
+void cheax_env_foreach_(struct chx_env *env, htab_item_func f, void *data);
 
 void cheax_export_sym_bltns_(CHEAX *c);
 
+/*
+ * Define n read-only symbols in the current environment, which must
+ * be freshly pushed, with a single allocation. Identifiers must be
+ * distinct.
+ */
+void cheax_def_params_(CHEAX *c, struct chx_id *const *ids, const struct chx_value *values, int n);
 struct chx_sym *cheax_def_id_(CHEAX *c, struct chx_id *id, struct chx_value value, int flags);
 struct chx_sym *cheax_defsym_id_(CHEAX *c, struct chx_id *id,
                                  chx_getter get, chx_setter set,
                                  chx_finalizer fin, void *user_info);
 struct chx_value cheax_get_id_(CHEAX *c, struct chx_id *id);
 bool cheax_try_get_id_(CHEAX *c, struct chx_id *id, struct chx_value *out);
+void cheax_set_id_(CHEAX *c, struct chx_id *id, struct chx_value value);
+
+/*
+ * Escape and return the innermost part of the current environment
+ * chain binding any of the given identifiers, i.e. the environment a
+ * function looking up these identifiers should capture. Only sealed
+ * frames are left out. The identifiers must all be bound already, and
+ * not to (eval) or (env), or else the whole chain is captured. The same
+ * goes if dyn_calls is set, for a function calling something it isn't
+ * statically known not to be (eval) or (env).
+ */
+struct chx_env *cheax_capture_env_(CHEAX *c, struct chx_id *const *ids, int num_ids, bool dyn_calls);
+
+/*
+ * Mark the current frame as one that gains no more bindings, i.e. as
+ * one whose remaining body defines nothing. Functions created from then
+ * on need not capture it unless they refer to its bindings.
+ */
+void cheax_seal_env_(CHEAX *c);
+
+/* Whether expr is a (def), (var) or (defsym) form, i.e. whether it
+ * binds something in the environment it is evaluated in */
+bool cheax_is_definition_(CHEAX *c, struct chx_value expr);
+
+/* Whether any form in body is a definition */
+bool cheax_body_defines_(CHEAX *c, struct chx_list *body);
+
+/* defun for functions without side effects, whose calls may be folded
+ * by the optimizer if all arguments are constant */
+void cheax_defun_pure_(CHEAX *c, const char *id, chx_func_ptr perform, void *info);
+
+/* Get value of read-only, non-redefinable global, unless shadowed by
+ * the current environment */
+bool cheax_try_get_const_global_(CHEAX *c, struct chx_id *id, struct chx_value *out);
 
 #endif
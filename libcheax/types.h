@@ -36,6 +36,13 @@ struct id_entry {
 	char value[1];
 };
 
+/* external function created through cheax_tail_ext_func() */
+struct tail_ext_func {
+	struct chx_ext_func base;
+	chx_tail_func_ptr perform;
+	void *info;
+};
+
 struct chx_special_op {
 	unsigned rtflags;
 	const char *name;
@@ -51,6 +58,11 @@ struct chx_string {
 	struct chx_string *orig;
 };
 
+struct full_sym;
+
+/* symbols a chx_env holds inline before spilling to a hash table */
+#define ENV_SMALL_SYMS 4
+
 struct chx_env {
 	unsigned rtflags;
 	bool is_bif;
@@ -58,12 +70,71 @@ struct chx_env {
 		struct chx_env *bif[2];
 
 		struct {
+			/* number of inline symbols, or -1 once spilled to syms */
+			int num_small;
+			struct chx_id *small_ids[ENV_SMALL_SYMS];
+			struct full_sym *small_syms[ENV_SMALL_SYMS];
+
 			struct htab syms;
 			struct chx_env *below;
+			struct full_sym *params; /* see cheax_def_params_() */
+			int num_params, params_cap;
 		} norm;
 	} value;
 };
 
+/* instance of a type made by (defrecord), see record.c */
+struct chx_record {
+	unsigned rtflags;
+	int num_slots;
+	struct chx_value slots[];
+};
+
+/* items is owned by the vector, and grows as needed; see vector.c */
+struct chx_vector {
+	unsigned rtflags;
+	size_t len, cap;
+	struct chx_value *items;
+};
+
+/* see hashmap.c */
+struct hash_entry {
+	struct htab_entry entry;
+	uint32_t hash; /* of key, computed on insertion */
+	struct chx_value key, value;
+};
+
+struct chx_hashmap {
+	unsigned rtflags;
+	struct htab table;
+};
+
+/* see hamt.c */
+struct map_slot {
+	struct chx_value key, value;
+};
+
+/* node of a Map, and the root node of a Map value */
+struct chx_map {
+	unsigned rtflags;
+	uint32_t bitmap;   /* hash fragments present in slots */
+	uint32_t subnodes; /* those of them leading to a subnode */
+	int len;           /* number of slots */
+	size_t count;      /* number of entries in this node and below */
+	struct map_slot slots[];
+};
+
+/* nodes are owned by the map; see btree.c */
+struct bt_node;
+
+struct chx_ordered_map {
+	unsigned rtflags;
+	struct bt_node *root;
+	size_t count;
+	struct chx_value cmp; /* comparison function, or nil */
+	int busy;             /* comparisons in progress */
+};
+
 union chx_any {
 	struct chx_list list;
 	struct chx_id id;
@@ -33,33 +33,43 @@ enum {
 };
 
 static const struct unpack_field unpack_fields[] = {
-	[' '] = { NIL_TYPE,        true  },
-	['#'] = { NUM_TYPE,        false },
-	['-'] = { NIL_TYPE,        false },
-	['.'] = { ANY_TYPE,        true  },
-	['B'] = { CHEAX_BOOL,      false },
-	['C'] = { CHEAX_LIST,      false }, /* C: Cons */
-	['D'] = { CHEAX_DOUBLE,    false },
-	['E'] = { CHEAX_ENV,       false },
-	['F'] = { FILE_TYPE,       false },
-	['I'] = { CHEAX_INT,       false },
-	['L'] = { CHEAX_FUNC,      false }, /* L: Lambda */
-	['N'] = { CHEAX_ID,        false }, /* N: Name */
-	['P'] = { CHEAX_EXT_FUNC,  false }, /* P: Procedure */
-	['S'] = { CHEAX_STRING,    false },
-	['X'] = { CHEAX_ERRORCODE, false },
-	['_'] = { ANY_TYPE,        false },
-	['b'] = { CHEAX_BOOL,      true  },
-	['c'] = { CHEAX_LIST,      true  },
-	['d'] = { CHEAX_DOUBLE,    true  },
-	['e'] = { CHEAX_ENV,       true  },
-	['f'] = { FILE_TYPE,       true  },
-	['i'] = { CHEAX_INT,       true  },
-	['l'] = { CHEAX_FUNC,      true  },
-	['n'] = { CHEAX_ID,        true  },
-	['p'] = { CHEAX_EXT_FUNC,  true  },
-	['s'] = { CHEAX_STRING,    true  },
-	['x'] = { CHEAX_ERRORCODE, true  },
+	[' '] = { NIL_TYPE,          true  },
+	['#'] = { NUM_TYPE,          false },
+	['-'] = { NIL_TYPE,          false },
+	['.'] = { ANY_TYPE,          true  },
+	['B'] = { CHEAX_BOOL,        false },
+	['C'] = { CHEAX_LIST,        false }, /* C: Cons */
+	['D'] = { CHEAX_DOUBLE,      false },
+	['E'] = { CHEAX_ENV,         false },
+	['F'] = { FILE_TYPE,         false },
+	['G'] = { CHEAX_GENERATOR,   false },
+	['H'] = { CHEAX_HASHMAP,     false },
+	['I'] = { CHEAX_INT,         false },
+	['L'] = { CHEAX_FUNC,        false }, /* L: Lambda */
+	['M'] = { CHEAX_MAP,         false },
+	['N'] = { CHEAX_ID,          false }, /* N: Name */
+	['O'] = { CHEAX_ORDERED_MAP, false },
+	['P'] = { CHEAX_EXT_FUNC,    false }, /* P: Procedure */
+	['S'] = { CHEAX_STRING,      false },
+	['V'] = { CHEAX_VECTOR,      false },
+	['X'] = { CHEAX_ERRORCODE,   false },
+	['_'] = { ANY_TYPE,          false },
+	['b'] = { CHEAX_BOOL,        true  },
+	['c'] = { CHEAX_LIST,        true  },
+	['d'] = { CHEAX_DOUBLE,      true  },
+	['e'] = { CHEAX_ENV,         true  },
+	['f'] = { FILE_TYPE,         true  },
+	['g'] = { CHEAX_GENERATOR,   true  },
+	['h'] = { CHEAX_HASHMAP,     true  },
+	['i'] = { CHEAX_INT,         true  },
+	['l'] = { CHEAX_FUNC,        true  },
+	['m'] = { CHEAX_MAP,         true  },
+	['n'] = { CHEAX_ID,          true  },
+	['o'] = { CHEAX_ORDERED_MAP, true  },
+	['p'] = { CHEAX_EXT_FUNC,    true  },
+	['s'] = { CHEAX_STRING,      true  },
+	['v'] = { CHEAX_VECTOR,      true  },
+	['x'] = { CHEAX_ERRORCODE,   true  },
 };
 
 /* storage options */
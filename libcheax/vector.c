@@ -0,0 +1,372 @@
+/* Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Vectors
+ *
+ * A vector is a GC object pointing to an array of values that it owns
+ * and grows as needed. The array is not a GC object itself, since it
+ * must be able to move when it grows; the vector's finalizer frees it.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "err.h"
+#include "gc.h"
+#include "types.h"
+#include "unpack.h"
+#include "vector.h"
+
+void
+cheax_vector_fin_(CHEAX *c, void *obj)
+{
+	struct chx_vector *vec = obj;
+	cheax_free(c, vec->items);
+}
+
+/* make room for at least cap items, growing geometrically */
+static bool
+reserve(CHEAX *c, struct chx_vector *vec, size_t cap)
+{
+	if (cap <= vec->cap)
+		return true;
+
+	size_t new_cap = vec->cap + vec->cap / 2;
+	if (new_cap < cap)
+		new_cap = cap;
+	if (new_cap < 4)
+		new_cap = 4;
+
+	if (new_cap > SIZE_MAX / sizeof(struct chx_value)) {
+		cheax_throwf(c, CHEAX_ENOMEM, "vector too large");
+		return false;
+	}
+
+	struct chx_value *items = cheax_realloc(c, vec->items, new_cap * sizeof(struct chx_value));
+	if (items == NULL)
+		return false;
+
+	vec->items = items;
+	vec->cap = new_cap;
+	return true;
+}
+
+static struct chx_vector *
+new_vector(CHEAX *c, size_t cap)
+{
+	struct chx_vector *vec = cheax_gc_alloc_(c, sizeof(struct chx_vector), CHEAX_VECTOR);
+	if (vec == NULL)
+		return NULL;
+
+	vec->len = vec->cap = 0;
+	vec->items = NULL;
+
+	/* on failure, the finalizer cleans up after us */
+	return (cap == 0 || reserve(c, vec, cap)) ? vec : NULL;
+}
+
+struct chx_value
+cheax_vector(CHEAX *c, struct chx_value *items, size_t len)
+{
+	if (len > 0)
+		ASSERT_NOT_NULL("vector", items, CHEAX_NIL);
+
+	struct chx_vector *vec = new_vector(c, len);
+	if (vec == NULL)
+		return CHEAX_NIL;
+
+	if (len > 0)
+		memcpy(vec->items, items, len * sizeof(struct chx_value));
+	vec->len = len;
+	return cheax_vector_value(vec);
+}
+
+struct chx_value
+cheax_vector_value_proc(struct chx_vector *vec)
+{
+	return cheax_vector_value(vec);
+}
+
+size_t
+cheax_vector_len(CHEAX *c, struct chx_vector *vec)
+{
+	return (vec == NULL) ? 0 : vec->len;
+}
+
+struct chx_value
+cheax_vector_ref(CHEAX *c, struct chx_vector *vec, size_t pos)
+{
+	ASSERT_NOT_NULL("vector_ref", vec, CHEAX_NIL);
+
+	if (pos >= vec->len) {
+		cheax_throwf(c, CHEAX_EINDEX, "vector_ref(): index out of bounds");
+		return CHEAX_NIL;
+	}
+
+	return vec->items[pos];
+}
+
+void
+cheax_vector_set(CHEAX *c, struct chx_vector *vec, size_t pos, struct chx_value value)
+{
+	ASSERT_NOT_NULL_VOID("vector_set", vec);
+
+	if (pos >= vec->len) {
+		cheax_throwf(c, CHEAX_EINDEX, "vector_set(): index out of bounds");
+		return;
+	}
+
+	vec->items[pos] = value;
+}
+
+int
+cheax_vector_push(CHEAX *c, struct chx_vector *vec, struct chx_value value)
+{
+	ASSERT_NOT_NULL("vector_push", vec, -1);
+
+	if (!reserve(c, vec, vec->len + 1))
+		return -1;
+
+	vec->items[vec->len++] = value;
+	return 0;
+}
+
+/*
+ *  _           _ _ _   _
+ * | |__  _   _(_) | |_(_)_ __  ___
+ * | '_ \| | | | | | __| | '_ \/ __|
+ * | |_) | |_| | | | |_| | | | \__ \
+ * |_.__/ \__,_|_|_|\__|_|_| |_|___/
+ *
+ */
+
+static bool
+check_index(CHEAX *c, chx_int pos)
+{
+	if (pos < 0) {
+		cheax_throwf(c, CHEAX_EINDEX, "index out of bounds");
+		return false;
+	}
+	return true;
+}
+
+static struct chx_value
+bltn_vector(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_vector *vec = new_vector(c, 0);
+	if (vec == NULL)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+
+	for (; args != NULL; args = args->next) {
+		if (cheax_vector_push(c, vec, args->value) < 0)
+			return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	return cheax_vector_value(vec);
+}
+
+static struct chx_value
+bltn_list_to_vector(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_list *list;
+	if (cheax_unpack_(c, args, "C", &list) < 0)
+		return CHEAX_NIL;
+
+	struct chx_vector *vec = new_vector(c, 0);
+	if (vec == NULL)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+
+	/* adopt the array that cheax_list_to_array() allocates */
+	if (cheax_list_to_array(c, list, &vec->items, &vec->len) < 0)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	vec->cap = vec->len;
+
+	return cheax_vector_value(vec);
+}
+
+static struct chx_value
+bltn_vector_to_list(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_vector *vec;
+	if (cheax_unpack_(c, args, "V", &vec) < 0)
+		return CHEAX_NIL;
+
+	return (vec->len == 0)
+	     ? CHEAX_NIL
+	     : cheax_bt_wrap_(c, cheax_array_to_list(c, vec->items, vec->len));
+}
+
+static struct chx_value
+bltn_vector_length(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_vector *vec;
+	return (0 == cheax_unpack_(c, args, "V", &vec))
+	     ? cheax_int((chx_int)vec->len)
+	     : CHEAX_NIL;
+}
+
+static struct chx_value
+bltn_vector_ref(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_vector *vec;
+	chx_int pos;
+	if (cheax_unpack_(c, args, "VI", &vec, &pos) < 0)
+		return CHEAX_NIL;
+
+	if (!check_index(c, pos))
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+
+	return cheax_bt_wrap_(c, cheax_vector_ref(c, vec, pos));
+}
+
+static struct chx_value
+bltn_vector_set(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_vector *vec;
+	chx_int pos;
+	struct chx_value value;
+	if (cheax_unpack_(c, args, "VI_", &vec, &pos, &value) < 0)
+		return CHEAX_NIL;
+
+	if (check_index(c, pos))
+		cheax_vector_set(c, vec, pos, value);
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_vector_push(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_vector *vec;
+	struct chx_value value;
+	if (cheax_unpack_(c, args, "V_", &vec, &value) < 0)
+		return CHEAX_NIL;
+
+	cheax_vector_push(c, vec, value);
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_vector_pop(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_vector *vec;
+	if (cheax_unpack_(c, args, "V", &vec) < 0)
+		return CHEAX_NIL;
+
+	if (vec->len == 0) {
+		cheax_throwf(c, CHEAX_EINDEX, "vector is empty");
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	return vec->items[--vec->len];
+}
+
+static struct chx_value
+bltn_vector_slice(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_vector *vec;
+	chx_int pos, len = 0;
+	struct chx_value len_or_nil;
+	if (cheax_unpack_(c, args, "VII?", &vec, &pos, &len_or_nil) < 0)
+		return CHEAX_NIL;
+
+	if (!cheax_is_nil(len_or_nil))
+		len = len_or_nil.data.as_int;
+	else if (pos >= 0 && (size_t)pos <= vec->len)
+		len = vec->len - (size_t)pos;
+
+	if (pos < 0 || len < 0) {
+		cheax_throwf(c, CHEAX_EVALUE, "expected positive integer");
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	if ((size_t)pos > vec->len || (size_t)len > vec->len - (size_t)pos) {
+		cheax_throwf(c, CHEAX_EINDEX, "slice out of bounds");
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+	}
+
+	return cheax_bt_wrap_(c, cheax_vector(c, vec->items + pos, len));
+}
+
+static struct chx_value
+bltn_vector_map(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_value func;
+	struct chx_vector *vec;
+	if (cheax_unpack_(c, args, "[LP]V", &func, &vec) < 0)
+		return CHEAX_NIL;
+
+	struct chx_vector *res = new_vector(c, vec->len);
+	if (res == NULL)
+		return cheax_bt_wrap_(c, CHEAX_NIL);
+
+	chx_ref res_ref = cheax_ref_ptr(c, res);
+
+	/* func may change vec, so check the length every time around */
+	for (size_t i = 0; i < vec->len; ++i) {
+		struct chx_value arg = cheax_list(c, vec->items[i], NULL);
+		cheax_ft(c, pad);
+		struct chx_value value = cheax_apply(c, func, arg.data.as_list);
+		cheax_ft(c, pad);
+		if (cheax_vector_push(c, res, value) < 0)
+			goto pad;
+	}
+
+	cheax_unref_ptr(c, res, res_ref);
+	return cheax_vector_value(res);
+pad:
+	cheax_unref_ptr(c, res, res_ref);
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+static struct chx_value
+bltn_vector_fold(CHEAX *c, struct chx_list *args, void *info)
+{
+	struct chx_value func, acc;
+	struct chx_vector *vec;
+	if (cheax_unpack_(c, args, "[LP]_V", &func, &acc, &vec) < 0)
+		return CHEAX_NIL;
+
+	for (size_t i = 0; i < vec->len; ++i) {
+		struct chx_value arg = cheax_list(c, vec->items[i], NULL);
+		cheax_ft(c, pad);
+		arg = cheax_list(c, acc, arg.data.as_list);
+		cheax_ft(c, pad);
+		acc = cheax_apply(c, func, arg.data.as_list);
+		cheax_ft(c, pad);
+	}
+
+	return acc;
+pad:
+	return cheax_bt_wrap_(c, CHEAX_NIL);
+}
+
+void
+cheax_export_vector_bltns_(CHEAX *c)
+{
+	cheax_defun(c, "vector",        bltn_vector,         NULL);
+	cheax_defun(c, "list->vector",  bltn_list_to_vector, NULL);
+	cheax_defun(c, "vector->list",  bltn_vector_to_list, NULL);
+	cheax_defun(c, "vector-length", bltn_vector_length,  NULL);
+	cheax_defun(c, "vector-ref",    bltn_vector_ref,     NULL);
+	cheax_defun(c, "vector-set!",   bltn_vector_set,     NULL);
+	cheax_defun(c, "vector-push!",  bltn_vector_push,    NULL);
+	cheax_defun(c, "vector-pop!",   bltn_vector_pop,     NULL);
+	cheax_defun(c, "vector-slice",  bltn_vector_slice,   NULL);
+	cheax_defun(c, "vector-map",    bltn_vector_map,     NULL);
+	cheax_defun(c, "vector-fold",   bltn_vector_fold,    NULL);
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2024, Antonie Blom
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Tests of parts of the C API that cheax code can't reach. Run as
+ * `api_test NAME' to run test NAME on a fresh cheax instance, once
+ * with each evaluator; see CMakeLists.txt.
+ */
+
+#include <cheax.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static CHEAX *c;
+static int failures = 0;
+/* "recursive" or "heap-stack" */
+static const char *evaluator;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void
+check(bool ok, const char *what, int line)
+{
+	if (!ok) {
+		fprintf(stderr, "api_test.c:%d (%s): check failed: %s\n", line, evaluator, what);
+		++failures;
+	}
+}
+
+/* Read, preprocess and evaluate a single form */
+static struct chx_value
+run(const char *src)
+{
+	struct chx_value v = cheax_readstr(c, src);
+	cheax_ft(c, pad);
+	v = cheax_preproc(c, v);
+	cheax_ft(c, pad);
+	return cheax_eval(c, v);
+pad:
+	return CHEAX_NIL;
+}
+
+/* Like run(), but the form must evaluate without error */
+static struct chx_value
+run_ok(const char *src)
+{
+	struct chx_value v = run(src);
+	if (cheax_errno(c) != 0) {
+		fprintf(stderr, "api_test.c (%s): evaluating %s\n", evaluator, src);
+		cheax_perror(c, "api_test.c");
+		cheax_clear_errno(c);
+		++failures;
+	}
+	return v;
+}
+
+static void
+test_profile_generators(void)
+{
+	run_ok("(def spin (fn (n) (if (= n 0) 0 (spin (- n 1)))))");
+	run_ok("(def work (fn (n) (if (= n 0) 0 (work (- n 1)))))");
+	run_ok("(def g (generator (fn () (work 1000) (yield 1) (work 1000) (yield 2))))");
+
+	CHECK(cheax_profile_start(c, CHEAX_PROFILE_CALLS) == 0);
+	for (int i = 0; i < 3; ++i) {
+		run_ok("(next g)");
+		run_ok("(spin 1000)");
+	}
+
+	FILE *stacks = tmpfile();
+	CHECK(stacks != NULL);
+	if (stacks == NULL)
+		return;
+
+	CHECK(cheax_profile_stop(c, NULL, stacks) == 0);
+	rewind(stacks);
+
+	/* what the generator calls is called by (next), but what the
+	 * resumer does in between isn't */
+	bool work_seen = false, spin_seen = false;
+	char line[256];
+	while (fgets(line, sizeof(line), stacks) != NULL) {
+		CHECK(0 != strncmp(line, "next;spin", 9));
+		work_seen = work_seen || 0 == strncmp(line, "next;work", 9);
+		spin_seen = spin_seen || 0 == strncmp(line, "spin", 4);
+	}
+	CHECK(work_seen);
+	CHECK(spin_seen);
+
+	fclose(stacks);
+}
+
+#define MAX_TRACE_DEPTH 256
+
+struct hook_log {
+	/* calls entered but not exited */
+	struct chx_list *calls[MAX_TRACE_DEPTH];
+	int depth;
+	int enters, mismatches;
+
+	int gc_starts, gc_ends;
+	bool in_gc;
+
+	int errors, last_error;
+	int expansions;
+};
+
+static void
+on_call_enter(CHEAX *c, struct chx_list *call, void *data)
+{
+	struct hook_log *log = data;
+	++log->enters;
+	if (log->depth < MAX_TRACE_DEPTH)
+		log->calls[log->depth] = call;
+	++log->depth;
+}
+
+static void
+on_call_exit(CHEAX *c, struct chx_list *call, void *data)
+{
+	struct hook_log *log = data;
+	if (log->depth == 0) {
+		++log->mismatches;
+		return;
+	}
+
+	--log->depth;
+	if (log->depth < MAX_TRACE_DEPTH && log->calls[log->depth] != call)
+		++log->mismatches;
+}
+
+static void
+on_gc_start(CHEAX *c, void *data)
+{
+	struct hook_log *log = data;
+	if (log->in_gc)
+		++log->mismatches;
+	log->in_gc = true;
+	++log->gc_starts;
+}
+
+static void
+on_gc_end(CHEAX *c, void *data)
+{
+	struct hook_log *log = data;
+	if (!log->in_gc)
+		++log->mismatches;
+	log->in_gc = false;
+	++log->gc_ends;
+}
+
+static void
+on_error(CHEAX *c, int code, struct chx_string *msg, void *data)
+{
+	struct hook_log *log = data;
+	++log->errors;
+	log->last_error = code;
+}
+
+static void
+on_macroexpand(CHEAX *c, struct chx_value form, struct chx_value expansion, void *data)
+{
+	struct hook_log *log = data;
+	++log->expansions;
+}
+
+static void
+test_hooks(void)
+{
+	struct hook_log log = { 0 };
+	struct chx_hooks hooks = {
+		.enter       = on_call_enter,
+		.exit        = on_call_exit,
+		.gc_start    = on_gc_start,
+		.gc_end      = on_gc_end,
+		.error       = on_error,
+		.macroexpand = on_macroexpand,
+		.data        = &log,
+	};
+
+	run_ok("(def depth (fn (n) (if (= n 0) 0 (+ 1 (depth (- n 1))))))");
+	run_ok("(def fail-at (fn (n) (if (= n 0) (throw EVALUE \"bottom\") (+ 1 (fail-at (- n 1))))))");
+	cheax_set_hooks(c, &hooks);
+
+	/* every call entered is exited, innermost first */
+	struct chx_value v = run_ok("(depth 20)");
+	CHECK(v.type == CHEAX_INT && v.data.as_int == 20);
+	CHECK(log.enters > 20);
+	CHECK(log.depth == 0);
+	CHECK(log.mismatches == 0);
+	CHECK(log.errors == 0);
+
+	/* ...also when an error unwinds them */
+	run("(fail-at 20)");
+	CHECK(cheax_errno(c) == CHEAX_EVALUE);
+	cheax_clear_errno(c);
+	CHECK(log.errors == 1);
+	CHECK(log.last_error == CHEAX_EVALUE);
+	CHECK(log.depth == 0);
+	CHECK(log.mismatches == 0);
+
+	/* errors caught within cheax are reported too */
+	v = run_ok("(try (fail-at 5) (catch EVALUE 'caught))");
+	CHECK(log.errors == 2);
+	CHECK(log.depth == 0);
+	CHECK(log.mismatches == 0);
+
+	run_ok("(gc)");
+	CHECK(log.gc_starts >= 1);
+	CHECK(log.gc_ends == log.gc_starts);
+	CHECK(!log.in_gc);
+
+	run_ok("(defmacro twice (x) (: '+ (: x (: x ()))))");
+	v = run_ok("(twice 21)");
+	CHECK(v.type == CHEAX_INT && v.data.as_int == 42);
+	CHECK(log.expansions >= 1);
+	CHECK(log.mismatches == 0);
+
+	/* nothing is reported once the hooks are removed */
+	cheax_set_hooks(c, NULL);
+	int enters = log.enters;
+	run_ok("(depth 5)");
+	run("(fail-at 5)");
+	cheax_clear_errno(c);
+	CHECK(log.enters == enters);
+	CHECK(log.errors == 2);
+}
+
+/* Evaluate within budget, returning the error code thrown, if any */
+static int
+run_budgeted(const char *src, struct chx_budget budget, struct chx_value *out)
+{
+	if (out != NULL)
+		*out = CHEAX_NIL;
+
+	struct chx_value v = cheax_readstr(c, src);
+	cheax_ft(c, pad);
+	v = cheax_preproc(c, v);
+	cheax_ft(c, pad);
+	v = cheax_eval_with_budget(c, v, &budget);
+	if (out != NULL)
+		*out = v;
+pad:;
+	int code = cheax_errno(c);
+	cheax_clear_errno(c);
+	return code;
+}
+
+/* (with-steps n 'expr): evaluate expr within a budget of its own */
+static struct chx_value
+with_steps(CHEAX *c, struct chx_list *args, void *info)
+{
+	if (args == NULL || args->next == NULL || args->value.type != CHEAX_INT) {
+		cheax_throwf(c, CHEAX_EMATCH, "expected step count and expression");
+		return CHEAX_NIL;
+	}
+
+	struct chx_budget budget = { .steps = (size_t)args->value.data.as_int };
+	struct chx_value expr = cheax_preproc(c, args->next->value);
+	cheax_ft(c, pad);
+	return cheax_eval_with_budget(c, expr, &budget);
+pad:
+	return CHEAX_NIL;
+}
+
+static void
+test_budget(void)
+{
+	struct chx_value v;
+	const struct chx_budget no_limit = { 0 };
+	const struct chx_budget few_steps = { .steps = 10000 };
+	const struct chx_budget few_bytes = { .bytes = 1u << 20 };
+	const struct chx_budget little_time = { .time_ms = 50 };
+
+	/* within its limits, it's just cheax_eval() */
+	CHECK(0 == run_budgeted("(+ 1 2)", few_steps, &v));
+	CHECK(v.type == CHEAX_INT && v.data.as_int == 3);
+	CHECK(0 == run_budgeted("(+ 1 2)", no_limit, &v));
+	CHECK(v.type == CHEAX_INT && v.data.as_int == 3);
+
+	/* every kind of loop runs out */
+	CHECK(CHEAX_EBUDGET == run_budgeted("(while true 1)", few_steps, NULL));
+	CHECK(CHEAX_EBUDGET == run_budgeted("(dotimes (i 100000000000) 1)", few_steps, NULL));
+	CHECK(CHEAX_EBUDGET == run_budgeted("(loop ((i 0)) (recur (+ i 1)))", few_steps, NULL));
+	run_ok("(def spin (fn (i) (spin (+ i 1))))");
+	CHECK(CHEAX_EBUDGET == run_budgeted("(spin 0)", few_steps, NULL));
+
+	/* allocation, while allocating without bound */
+	CHECK(CHEAX_EBUDGET == run_budgeted("(loop ((acc ())) (recur (: 1 acc)))", few_bytes, NULL));
+	/* ...but not by taking many steps without allocating */
+	CHECK(0 == run_budgeted("(dotimes (i 100000) 1)", few_bytes, NULL));
+
+	/* deadline, in about the time given */
+	time_t start = time(NULL);
+	CHECK(CHEAX_ETIMEOUT == run_budgeted("(while true 1)", little_time, NULL));
+	CHECK(time(NULL) - start < 5);
+
+	/* cheax code can't catch its way out */
+	CHECK(CHEAX_EBUDGET == run_budgeted("(while true (try (while true 1) (catch EBUDGET 0)))", few_steps, NULL));
+	CHECK(CHEAX_EBUDGET == run_budgeted("(loop ((i 0)) (recur (try (spin 0) (catch errno i))))", few_steps, NULL));
+
+	/* an inner budget running out can be caught outside it */
+	cheax_defun(c, "with-steps", with_steps, NULL);
+	CHECK(0 == run_budgeted("(try (with-steps 1000 '(while true 1)) (catch EBUDGET 42))", few_steps, &v));
+	CHECK(v.type == CHEAX_INT && v.data.as_int == 42);
+	/* ...but the outer one still applies within */
+	CHECK(CHEAX_EBUDGET == run_budgeted("(do (try (with-steps 100000000 '(while true 1)) (catch EBUDGET 0)) (while true 1))", few_steps, NULL));
+	CHECK(CHEAX_ETIMEOUT == run_budgeted("(with-steps 100000000 '(while true 1))", little_time, NULL));
+
+	/* limits don't outlive the call */
+	CHECK(0 == run_budgeted("(dotimes (i 100000) 1)", no_limit, NULL));
+	run_ok("(dotimes (i 100000) 1)");
+}
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} tests[] = {
+	{ "profile-generators", test_profile_generators },
+	{ "hooks",              test_hooks },
+	{ "budget",             test_budget },
+};
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s TEST\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	size_t num_tests = sizeof(tests) / sizeof(tests[0]);
+	for (size_t i = 0; i < num_tests; ++i) {
+		if (0 != strcmp(argv[1], tests[i].name))
+			continue;
+
+		for (int heap_stack = 0; heap_stack <= 1; ++heap_stack) {
+			evaluator = heap_stack ? "heap-stack" : "recursive";
+			c = cheax_init();
+			cheax_load_feature(c, "all");
+			cheax_config_bool(c, "heap-stack", heap_stack);
+			tests[i].run();
+			cheax_destroy(c);
+		}
+
+		return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "%s: no such test `%s'\n", argv[0], argv[1]);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+#
+# Time two call-heavy programs, a non-tail recursive Fibonacci and a
+# self tail call with a few special forms in its body, three runs each.
+# Use it to compare builds before and after a change to the call path,
+# e.g. to check that event hooks cost nothing measurable while none are
+# installed (see cheax_set_hooks()).
+#
+# Usage: bench-calls.sh [/path/to/cheax...]
+
+[ $# -eq 0 ] && set -- cheax
+PROG=$(mktemp) || exit 1
+trap 'rm -f "$PROG"' EXIT
+
+bench()
+{
+	local TIMEFORMAT="$(printf '%-10s' "$2") %Rs"
+	printf '%s\n' "$3" >"$PROG"
+	for run in 1 2 3; do
+		time "$1" -p "$PROG" >/dev/null
+	done
+}
+
+for CHEAX in "$@"; do
+	echo "$CHEAX"
+
+	bench "$CHEAX" fib "
+(def fib (fn (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 27)"
+
+	bench "$CHEAX" call "
+(def cnt (fn (n acc) (if (and (> n 0) (or false true)) (cnt (- n 1) (do (+ acc 1))) acc)))
+(cnt 3000000 0)"
+done
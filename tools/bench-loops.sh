@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+#
+# Time a summing loop written as a self-recursive function against the
+# same loop written with (loop), (while) and (dotimes). Expect the first
+# three to take about as long: the arithmetic in the body dominates, and
+# (while) has two (set)s to evaluate per iteration rather than a call.
+#
+# Usage: bench-loops.sh [/path/to/cheax] [ITERATIONS]
+
+CHEAX=${1:-cheax}
+N=${2:-3000000}
+PROG=$(mktemp) || exit 1
+trap 'rm -f "$PROG"' EXIT
+
+bench()
+{
+	local TIMEFORMAT="$(printf '%-10s' "$1") %Rs"
+	printf '%s\n' "$2" >"$PROG"
+	time "$CHEAX" -p "$PROG" >/dev/null
+}
+
+bench recursive "
+(def sum-to (fn (i acc) (if (= i 0) acc (sum-to (- i 1) (+ acc i)))))
+(sum-to $N 0)"
+
+bench loop "
+(loop ((i $N) (acc 0)) (if (= i 0) acc (recur (- i 1) (+ acc i))))"
+
+bench while "
+(var i $N) (var acc 0)
+(while (!= i 0) (set acc (+ acc i)) (set i (- i 1)))"
+
+bench dotimes "
+(var acc 0)
+(dotimes (i $N) (set acc (+ acc i)))"